@@ -11,10 +11,14 @@
 #define ABSTRACT_KMEANS_HPP
 
 #include "measurement/measurement.hpp"
+#include "measurement/hardware_counters.hpp"
 
 #include <functional>
 #include <cstdint>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <boost/compute/core.hpp>
 #include <boost/compute/container/vector.hpp>
@@ -49,6 +53,8 @@ public:
         host_centroids(nullptr),
         host_masses(nullptr),
         host_labels(nullptr),
+        decay(1.0),
+        event_capacity(0),
         measurement(new Measurement::Measurement)
     {}
 
@@ -68,13 +74,23 @@ public:
 
     virtual void set_features(size_t f) {
         this->num_features = f;
-        this->num_points = this->host_points->size() / f;
+
+        if (this->host_points) {
+            this->num_points = this->host_points->size() / f;
+        }
     }
 
     virtual void set_clusters(size_t c) {
         this->num_clusters = c;
     }
 
+    // Weight of the accumulated cluster masses that is retained when
+    // ingesting the next batch. 1.0 keeps all history, values below 1.0
+    // let the centroids follow drifting data.
+    virtual void set_decay(double d) {
+        this->decay = d;
+    }
+
     virtual void set_initializer(InitCentroidsFunction f) {
         this->centroids_initializer = f;
     }
@@ -97,12 +113,85 @@ public:
         return *this->host_masses;
     }
 
+    // Sum of squared distances of the points to their centroid, per
+    // cluster. Computed in the last labeling pass, i.e. against the
+    // centroids before the last update. Empty unless cluster_sse is set
+    // for the labeling or fused stage.
+    virtual HostVector<PointT> const& get_cluster_sse() const {
+        return this->host_cluster_sse;
+    }
+
+    // Sum of all cluster SSE, the k-means objective
+    virtual double get_inertia() const {
+        HostVector<PointT> const& cluster_sse = this->get_cluster_sse();
+        if (cluster_sse.empty()) {
+            throw std::invalid_argument("cluster_sse is not enabled");
+        }
+
+        double inertia = 0.0;
+        for (PointT sse : cluster_sse) {
+            inertia += sse;
+        }
+
+        return inertia;
+    }
+
+    // Collect profiling info into capacity preallocated records per run
+    // instead of retaining every OpenCL event. Zero retains all events.
+    virtual void set_event_capacity(size_t capacity) {
+        this->event_capacity = capacity;
+        this->measurement->set_event_capacity(capacity);
+    }
+
+    // Sample host-side hardware counters (cycles, instructions, LLC misses)
+    // around the iterations. Attached to the TotalTime datapoint.
+    virtual void set_hardware_counters(bool enable) {
+        if (enable) {
+            this->hardware_counters.reset(
+                    new Measurement::HardwareCounters);
+        }
+        else {
+            this->hardware_counters.reset();
+        }
+    }
+
     virtual Measurement::Measurement const& get_measurement() const {
         return *this->measurement;
     }
 
     virtual void run() = 0;
 
+    // Name of the pipeline as in the [kmeans] configuration section
+    virtual char const* pipeline_name() const = 0;
+
+    // Streaming interface
+    //
+    // Assigns a column-major batch of num_batch_points points to the
+    // current centroids and folds the batch into the centroids using the
+    // decayed cluster masses. Centroids are initialized from the first
+    // batch if none were set.
+    virtual void ingest(
+            PointT const *batch,
+            size_t num_batch_points
+            ) {
+        (void) batch;
+        (void) num_batch_points;
+        throw std::invalid_argument(
+                std::string("ingest is not supported by the ")
+                + this->pipeline_name()
+                + " pipeline, use single_stage");
+    }
+
+    // Returns a copy of the centroids as of the last ingested batch.
+    // Empty before the first batch or run.
+    virtual HostVector<PointT> snapshot_centroids() const {
+        if (not this->host_centroids) {
+            return HostVector<PointT>();
+        }
+
+        return *this->host_centroids;
+    }
+
     virtual MeasurementPtr operator() (
             size_t max_iterations,
             size_t num_features,
@@ -125,6 +214,7 @@ public:
 
         auto current_measurement = this->measurement;
         this->measurement.reset(new Measurement::Measurement);
+        this->measurement->set_event_capacity(this->event_capacity);
 
         return current_measurement;
     }
@@ -138,6 +228,10 @@ protected:
     HostVectorPtr<PointT> host_centroids;
     HostVectorPtr<MassT> host_masses;
     HostVectorPtr<LabelT> host_labels;
+    HostVector<PointT> host_cluster_sse;
+    double decay;
+    size_t event_capacity;
+    std::shared_ptr<Measurement::HardwareCounters> hardware_counters;
 
     InitCentroidsFunction centroids_initializer;
     std::shared_ptr<Measurement::Measurement> measurement;
@@ -0,0 +1,860 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+#include "binary_format.hpp"
+
+#include "configuration_parser.hpp"
+#include "matrix.hpp"
+
+#include "pipeline_factory.hpp"
+#include "point_format.hpp"
+
+#include "SystemConfig.h"
+
+#include <boost/program_options.hpp>
+#include <boost/compute/core.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Suppress editor errors about AUTOTUNE_NAME not defined
+#ifndef AUTOTUNE_NAME
+#define AUTOTUNE_NAME ""
+#endif
+
+namespace po = boost::program_options;
+namespace bc = boost::compute;
+
+class CmdOptions {
+public:
+    int parse(int argc, char **argv) {
+        char help_msg[] =
+            "Usage: " AUTOTUNE_NAME " [OPTION] [FILE]\n"
+            "Searches the kernel configuration of each pipeline stage\n"
+            "and writes the fastest one to a configuration file\n"
+            "Options"
+            ;
+
+        po::options_description cmdline(help_msg);
+        cmdline.add_options()
+            ("help", "Produce help message")
+            ("verbose", "Show timings of all candidates")
+            ("config",
+             po::value<std::string>(),
+             "Base configuration file")
+            ("output",
+             po::value<std::string>(),
+             "Tuned configuration file")
+            ("cache",
+             po::value<std::string>(&cache_file_),
+             "Tuning cache file")
+            ("eta",
+             po::value<uint32_t>(&eta_),
+             "Fraction of candidates kept per round is 1/eta")
+            ("iterations",
+             po::value<uint32_t>(&iterations_),
+             "K-means iterations of the first round")
+            ;
+
+        po::options_description hidden("Hidden options");
+        hidden.add_options()
+            ("input-file", po::value<std::string>(), "Input file")
+            ;
+
+        po::options_description visible;
+        visible.add(cmdline).add(hidden);
+
+        po::positional_options_description pos;
+        pos.add("input-file", 1);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(visible)
+                .positional(pos).run(), vm);
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            std::cout << cmdline << std::endl;
+            return -1;
+        }
+
+        if (vm.count("verbose")) {
+            verbose_ = true;
+        }
+
+        if (vm.count("input-file")) {
+            input_file_ = vm["input-file"].as<std::string>();
+        }
+
+        if (vm.count("config")) {
+            config_file_ = vm["config"].as<std::string>();
+        }
+
+        if (vm.count("output")) {
+            output_file_ = vm["output"].as<std::string>();
+        }
+
+        // Ensure we have required options
+        if (input_file_.empty()) {
+            std::cout << "No input file specified." << std::endl;
+            return -1;
+        }
+
+        if (config_file_.empty()) {
+            std::cout << "No config file specified." << std::endl;
+            return -1;
+        }
+
+        if (output_file_.empty()) {
+            std::cout << "No output file specified." << std::endl;
+            return -1;
+        }
+
+        if (eta_ < 2) {
+            std::cout << "Eta must be at least 2." << std::endl;
+            return -1;
+        }
+
+        if (iterations_ == 0) {
+            std::cout << "Iterations must be at least 1." << std::endl;
+            return -1;
+        }
+
+        return 1;
+    }
+
+    bool verbose() const {
+        return verbose_;
+    }
+
+    std::string input_file() const {
+        return input_file_;
+    }
+
+    std::string config_file() const {
+        return config_file_;
+    }
+
+    std::string output_file() const {
+        return output_file_;
+    }
+
+    std::string cache_file() const {
+        return cache_file_;
+    }
+
+    uint32_t eta() const {
+        return eta_;
+    }
+
+    uint32_t iterations() const {
+        return iterations_;
+    }
+
+private:
+    bool verbose_ = false;
+    std::string input_file_;
+    std::string config_file_;
+    std::string output_file_;
+    std::string cache_file_;
+    uint32_t eta_ = 3;
+    uint32_t iterations_ = 2;
+};
+
+/*
+ * Point in the search space of one pipeline stage
+ *
+ * Parameters that are not searched (e.g. local_features and
+ * thread_features of feature_sum_pardim) are kept from the base
+ * configuration.
+ */
+struct Candidate {
+    std::string strategy;
+    size_t global_size;
+    size_t local_size;
+    size_t vector_length;
+    double time;
+};
+
+/*
+ * Tuning results keyed by device, data shape, pipeline and stage
+ *
+ * The cache is a whitespace separated text file with one line per entry:
+ * device features clusters points pipeline point_type stage strategy
+ * global_size local_size vector_length time_ns
+ *
+ * Spaces in the device name are replaced by underscores.
+ */
+class TuningCache {
+public:
+    int read(std::string const& file) {
+        file_ = file;
+
+        if (file_.empty()) {
+            return 0;
+        }
+
+        std::ifstream handle(file_);
+        if (not handle.is_open()) {
+            // Nothing tuned yet
+            return 0;
+        }
+
+        std::string line;
+        while (std::getline(handle, line)) {
+            std::istringstream fields(line);
+            std::string key, part;
+            Candidate c;
+
+            for (int i = 0; i < 7; ++i) {
+                fields >> part;
+                key += part + " ";
+            }
+            fields
+                >> c.strategy
+                >> c.global_size
+                >> c.local_size
+                >> c.vector_length
+                >> c.time;
+
+            if (fields.fail()) {
+                std::cerr
+                    << "Skipping malformed tuning cache line: "
+                    << line
+                    << std::endl;
+                continue;
+            }
+
+            keys_.push_back(key);
+            entries_.push_back(c);
+        }
+
+        return 1;
+    }
+
+    bool find(std::string const& key, Candidate& c) const {
+        for (size_t i = 0; i < keys_.size(); ++i) {
+            if (keys_[i] == key) {
+                c = entries_[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int insert(std::string const& key, Candidate const& c) {
+        keys_.push_back(key);
+        entries_.push_back(c);
+
+        if (file_.empty()) {
+            return 0;
+        }
+
+        std::ofstream handle(file_, std::ios::app);
+        if (not handle.is_open()) {
+            std::cerr
+                << "Could not open tuning cache " << file_
+                << std::endl;
+            return -1;
+        }
+
+        handle
+            << key
+            << c.strategy << " "
+            << c.global_size << " "
+            << c.local_size << " "
+            << c.vector_length << " "
+            << (uint64_t) c.time
+            << std::endl;
+
+        return 1;
+    }
+
+    static std::string key(
+            std::string device,
+            size_t num_features,
+            size_t num_clusters,
+            size_t num_points,
+            std::string const& pipeline,
+            std::string const& point_type,
+            std::string const& stage)
+    {
+        std::replace(device.begin(), device.end(), ' ', '_');
+
+        return device + " "
+            + std::to_string(num_features) + " "
+            + std::to_string(num_clusters) + " "
+            + std::to_string(num_points) + " "
+            + pipeline + " "
+            + point_type + " "
+            + stage + " ";
+    }
+
+private:
+    std::string file_;
+    std::vector<std::string> keys_;
+    std::vector<Candidate> entries_;
+};
+
+template <typename PointT, typename LabelT, typename MassT, bool ColMajor = true>
+class Autotune {
+public:
+    using Factory = Clustering::PipelineFactory<
+        PointT,
+        LabelT,
+        MassT,
+        ColMajor>;
+    using MeasurementPtr = std::shared_ptr<Measurement::Measurement>;
+
+    int run(CmdOptions options, Clustering::ConfigurationParser config) {
+        cle::Matrix<PointT, std::allocator<PointT>, size_t, true> points;
+
+        Clustering::BinaryFormat binformat;
+        binformat.read(options.input_file().c_str(), points);
+
+        pipeline_config =
+            Factory::configure(config, options.input_file(), points);
+        auto const& km_config = pipeline_config.kmeans;
+
+        num_points = points.rows();
+        num_features = points.cols();
+        num_clusters = km_config.clusters;
+
+        host_points = std::make_shared<std::vector<PointT>>(
+                points.get_data());
+        host_centroids = std::make_shared<std::vector<PointT>>(
+                num_clusters * num_features);
+        host_masses = std::make_shared<std::vector<MassT>>(num_clusters);
+        host_labels = std::make_shared<std::vector<LabelT>>(num_points);
+
+        // Tuning tables would override the candidates
+        pipeline_config.labeling.tuning = Clustering::TuningTable();
+        pipeline_config.centroid_update.tuning = Clustering::TuningTable();
+        pipeline_config.fused.tuning = Clustering::TuningTable();
+
+        TuningCache cache;
+        cache.read(options.cache_file());
+
+        eta = options.eta();
+        min_iterations = options.iterations();
+        verbose = options.verbose();
+
+        if (
+                km_config.pipeline == "three_stage"
+                or km_config.pipeline == "three_stage_buffered"
+           )
+        {
+            // Stages are tuned one after another with the remaining stages
+            // fixed. Reductions are timed as part of their stage; their
+            // name is shared between stages, which only adds a constant.
+            tune_stage(
+                    cache,
+                    "labeling",
+                    "Labeling.*",
+                    pipeline_config.labeling);
+            tune_stage(
+                    cache,
+                    "mass_update",
+                    "MassUpdate.*|ReduceVectorParcol",
+                    pipeline_config.mass_update);
+            tune_stage(
+                    cache,
+                    "centroid_update",
+                    "CentroidUpdate.*|ReduceVectorParcol",
+                    pipeline_config.centroid_update);
+        }
+        else if (
+                km_config.pipeline == "single_stage"
+                or km_config.pipeline == "single_stage_buffered"
+                )
+        {
+            tune_stage(
+                    cache,
+                    "fused",
+                    "Fused.*|ReduceVectorParcol",
+                    pipeline_config.fused);
+        }
+        else {
+            throw std::invalid_argument(km_config.pipeline);
+        }
+
+        return write_config(options.config_file(), options.output_file());
+    }
+
+private:
+    /*
+     * Strategies of a stage that the factories can build
+     */
+    template <typename Config>
+    std::vector<std::string> strategies(
+            std::string const& stage,
+            Config const& base)
+    {
+        if (stage == "labeling") {
+            return {"unroll_vector"};
+        }
+        else if (stage == "mass_update") {
+            return {"global_atomic", "part_global", "part_local",
+                "part_private"};
+        }
+        else if (stage == "centroid_update") {
+            std::vector<std::string> s = {"feature_sum", "cluster_merge",
+                "cluster_spill", "sorted_segment"};
+            // Tiling parameters are not searched
+            if (base.strategy == "feature_sum_pardim") {
+                s.push_back("feature_sum_pardim");
+            }
+            return s;
+        }
+        else {
+            return {"cluster_merge", "feature_sum"};
+        }
+    }
+
+    /*
+     * Power-of-two grid of work sizes and vector lengths
+     *
+     * Local sizes range from the warp size (one on CPUs) to the maximum
+     * work group size. Global sizes range from one work group per compute
+     * unit to one work item per point.
+     */
+    template <typename Config>
+    std::vector<Candidate> candidates(
+            std::string const& stage,
+            bc::device const& device,
+            Config const& base)
+    {
+        std::vector<Candidate> grid;
+
+        size_t const max_local = device.max_work_group_size();
+        size_t const compute_units = device.compute_units();
+        size_t const min_local =
+            (device.type() & bc::device::cpu) ? 1 : 32;
+
+        size_t max_global = 1;
+        while (max_global < num_points) {
+            max_global *= 2;
+        }
+
+        std::vector<size_t> vector_lengths = {1, 2, 4, 8};
+        if (
+                Clustering::PointFormatHelper::parse(
+                    pipeline_config.kmeans.point_type)
+                == Clustering::PointFormat::Int8
+           )
+        {
+            vector_lengths = {1};
+        }
+
+        for (auto const& strategy : strategies(stage, base)) {
+            for (
+                    size_t local = min_local;
+                    local <= max_local;
+                    local *= 2)
+            {
+                size_t min_global = 1;
+                while (min_global < local * compute_units) {
+                    min_global *= 2;
+                }
+
+                for (
+                        size_t global = min_global;
+                        global <= std::max(max_global, min_global);
+                        global *= 2)
+                {
+                    for (auto vector_length : vector_lengths) {
+                        grid.push_back(
+                                {strategy, global, local, vector_length, 0.0});
+                    }
+                }
+            }
+        }
+
+        return grid;
+    }
+
+    /*
+     * Successive halving over the candidate grid
+     *
+     * Each round measures all remaining candidates with twice the
+     * iterations of the previous round and keeps the fastest 1/eta.
+     * Candidates that fail to build or launch are dropped.
+     */
+    template <typename Config>
+    void tune_stage(
+            TuningCache& cache,
+            std::string const& stage,
+            std::string const& event_name,
+            Config& config)
+    {
+        bc::device device =
+            queues.queue(config.platform, config.device).get_device();
+
+        std::string key = TuningCache::key(
+                device.name(),
+                num_features,
+                num_clusters,
+                num_points,
+                pipeline_config.kmeans.pipeline,
+                pipeline_config.kmeans.point_type,
+                stage);
+
+        Candidate best;
+        if (cache.find(key, best)) {
+            std::cout
+                << "Using cached " << stage << " configuration"
+                << std::endl;
+            apply(best, config);
+            tuned_stages.push_back(stage);
+            return;
+        }
+
+        std::vector<Candidate> remaining = candidates(stage, device, config);
+        std::regex expression(event_name);
+        size_t iterations = min_iterations;
+
+        std::cout
+            << "Tuning " << stage
+            << " on " << device.name()
+            << " with " << remaining.size() << " candidates"
+            << std::endl;
+
+        while (remaining.size() > 1) {
+            std::vector<Candidate> measured;
+
+            for (auto c : remaining) {
+                Config candidate_config = config;
+                apply(c, candidate_config);
+
+                try {
+                    c.time = measure(
+                            candidate_config,
+                            expression,
+                            iterations);
+                }
+                catch (std::exception const& e) {
+                    if (verbose) {
+                        std::cout
+                            << "  " << format(c)
+                            << " failed: " << e.what()
+                            << std::endl;
+                    }
+                    continue;
+                }
+
+                if (verbose) {
+                    std::cout
+                        << "  " << format(c)
+                        << " " << c.time << " ns"
+                        << std::endl;
+                }
+
+                measured.push_back(c);
+            }
+
+            if (measured.empty()) {
+                throw std::runtime_error(
+                        "No " + stage + " configuration runs on "
+                        + device.name());
+            }
+
+            std::sort(
+                    measured.begin(),
+                    measured.end(),
+                    [](Candidate const& a, Candidate const& b) {
+                        return a.time < b.time;
+                    });
+
+            size_t keep = (measured.size() + eta - 1) / eta;
+            measured.resize(std::max(keep, (size_t) 1));
+            remaining = std::move(measured);
+            iterations *= 2;
+        }
+
+        best = remaining.front();
+        if (best.time == 0.0) {
+            // Single candidate was never measured
+            Config candidate_config = config;
+            apply(best, candidate_config);
+            best.time = measure(
+                    candidate_config,
+                    expression,
+                    iterations);
+        }
+
+        std::cout
+            << "Best " << stage << ": " << format(best)
+            << " " << best.time << " ns"
+            << std::endl;
+
+        apply(best, config);
+        tuned_stages.push_back(stage);
+        cache.insert(key, best);
+    }
+
+    template <typename Config>
+    static void apply(Candidate const& c, Config& config) {
+        config.strategy = c.strategy;
+        config.global_size[0] = c.global_size;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = c.local_size;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = c.vector_length;
+    }
+
+    static std::string format(Candidate const& c) {
+        return c.strategy
+            + " global_size=" + std::to_string(c.global_size)
+            + " local_size=" + std::to_string(c.local_size)
+            + " vector_length=" + std::to_string(c.vector_length);
+    }
+
+    /*
+     * Mean stage time per iteration in nanoseconds
+     *
+     * Runs the whole pipeline with the candidate configuration in place of
+     * the base configuration of its stage.
+     */
+    template <typename Config>
+    double measure(
+            Config const& candidate,
+            std::regex const& expression,
+            size_t iterations)
+    {
+        Clustering::PipelineConfiguration config = pipeline_config;
+        stage_configuration(config, candidate) = candidate;
+
+        std::unique_ptr<typename Factory::Kmeans> kmeans =
+            Factory::create(config, queues);
+
+        // Same initialization as bench
+        for (size_t d = 0; d < num_features; ++d) {
+            for (size_t c = 0; c < num_clusters; ++c) {
+                (*host_centroids)[d * num_clusters + c] =
+                    (*host_points)[d * num_points + c % num_points];
+            }
+        }
+
+        MeasurementPtr measurement = (*kmeans)(
+                iterations,
+                num_features,
+                host_points,
+                host_centroids,
+                host_masses,
+                host_labels);
+
+        auto times =
+            measurement->template get_execution_times_by_name<
+            std::chrono::nanoseconds>(expression);
+
+        uint64_t total = 0;
+        for (auto const& t : times) {
+            total += std::get<1>(t);
+        }
+
+        return (double) total / iterations;
+    }
+
+    static Clustering::LabelingConfiguration& stage_configuration(
+            Clustering::PipelineConfiguration& config,
+            Clustering::LabelingConfiguration const&)
+    {
+        return config.labeling;
+    }
+
+    static Clustering::MassUpdateConfiguration& stage_configuration(
+            Clustering::PipelineConfiguration& config,
+            Clustering::MassUpdateConfiguration const&)
+    {
+        return config.mass_update;
+    }
+
+    static Clustering::CentroidUpdateConfiguration& stage_configuration(
+            Clustering::PipelineConfiguration& config,
+            Clustering::CentroidUpdateConfiguration const&)
+    {
+        return config.centroid_update;
+    }
+
+    static Clustering::FusedConfiguration& stage_configuration(
+            Clustering::PipelineConfiguration& config,
+            Clustering::FusedConfiguration const&)
+    {
+        return config.fused;
+    }
+
+    /*
+     * Searched keys of the tuned stages, by their full option name
+     */
+    std::map<std::string, std::string> tuned_options() const {
+        std::map<std::string, std::string> options;
+
+        for (auto const& stage : tuned_stages) {
+            if (stage == "labeling") {
+                add_options(options, stage, pipeline_config.labeling);
+            }
+            else if (stage == "mass_update") {
+                add_options(options, stage, pipeline_config.mass_update);
+            }
+            else if (stage == "centroid_update") {
+                add_options(options, stage, pipeline_config.centroid_update);
+            }
+            else {
+                add_options(options, stage, pipeline_config.fused);
+            }
+        }
+
+        return options;
+    }
+
+    template <typename Config>
+    static void add_options(
+            std::map<std::string, std::string>& options,
+            std::string const& stage,
+            Config const& config)
+    {
+        std::string const prefix = "kmeans." + stage + ".";
+
+        options[prefix + "strategy"] = config.strategy;
+        options[prefix + "global_size"] =
+            std::to_string(config.global_size[0]);
+        options[prefix + "local_size"] =
+            std::to_string(config.local_size[0]);
+        options[prefix + "vector_length"] =
+            std::to_string(config.vector_length);
+    }
+
+    static std::string trim(std::string const& s) {
+        size_t const begin = s.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) {
+            return std::string();
+        }
+        size_t const end = s.find_last_not_of(" \t\r");
+        return s.substr(begin, end - begin + 1);
+    }
+
+    /*
+     * Write the base configuration with the searched keys of the tuned
+     * stages replaced
+     *
+     * All other keys, comments and tuning rules of the base configuration
+     * are kept as they are. Searched keys that the base configuration does
+     * not set are appended in a section of their stage. Note that tuning
+     * rules that match the data shape still take precedence over the tuned
+     * strategy when the configuration is run.
+     */
+    int write_config(std::string const& base_file, std::string const& file) {
+        std::ifstream in(base_file);
+        if (not in.is_open()) {
+            std::cerr << "Could not open " << base_file << std::endl;
+            return -1;
+        }
+
+        std::ofstream out(file);
+        if (not out.is_open()) {
+            std::cerr << "Could not open " << file << std::endl;
+            return -1;
+        }
+
+        std::map<std::string, std::string> options = tuned_options();
+
+        std::string line;
+        std::string section;
+        while (std::getline(in, line)) {
+            std::string const content = trim(line.substr(0, line.find('#')));
+
+            if (
+                    not content.empty()
+                    && content.front() == '['
+                    && content.back() == ']'
+               )
+            {
+                section = trim(content.substr(1, content.size() - 2));
+                out << line << "\n";
+                continue;
+            }
+
+            size_t const assign = content.find('=');
+            if (assign != std::string::npos) {
+                std::string const key = trim(content.substr(0, assign));
+                std::string const name =
+                    section.empty() ? key : section + "." + key;
+
+                auto option = options.find(name);
+                if (option != options.end()) {
+                    out << key << " = " << option->second << "\n";
+                    options.erase(option);
+                    continue;
+                }
+            }
+
+            out << line << "\n";
+        }
+
+        for (auto const& option : options) {
+            size_t const dot = option.first.rfind('.');
+            out
+                << "\n"
+                << "[" << option.first.substr(0, dot) << "]\n"
+                << option.first.substr(dot + 1)
+                << " = " << option.second << "\n";
+        }
+
+        std::cout << "Wrote " << file << std::endl;
+
+        return 1;
+    }
+
+    Clustering::PipelineConfiguration pipeline_config;
+    Clustering::QueueCache queues;
+    std::vector<std::string> tuned_stages;
+
+    size_t num_points = 0;
+    size_t num_features = 0;
+    size_t num_clusters = 0;
+    std::shared_ptr<std::vector<PointT>> host_points;
+    std::shared_ptr<std::vector<PointT>> host_centroids;
+    std::shared_ptr<std::vector<MassT>> host_masses;
+    std::shared_ptr<std::vector<LabelT>> host_labels;
+
+    size_t eta = 3;
+    size_t min_iterations = 2;
+    bool verbose = false;
+};
+
+int main(int argc, char **argv) {
+    int ret = 0;
+
+    CmdOptions options;
+
+    ret = options.parse(argc, argv);
+    if (ret < 0) {
+        return -1;
+    }
+
+    Clustering::ConfigurationParser config;
+    config.parse_file(options.config_file());
+
+    ret = Clustering::dispatch_pipeline_types<Autotune>(
+            config.get_kmeans_configuration(),
+            options,
+            config);
+
+    return ret < 0 ? ret : 0;
+}
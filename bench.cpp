@@ -6,18 +6,17 @@
  * 
  * Copyright (c) 2016-2018, Lutz, Clemens <lutzcle@cml.li>
  */
+#include "benchmark_harness.hpp"
 #include "binary_format.hpp"
 
 #include "clustering_benchmark.hpp"
 #include "configuration_parser.hpp"
 #include "matrix.hpp"
 
-#include "kmeans_three_stage.hpp"
-#include "kmeans_three_stage_buffered.hpp"
-#include "kmeans_single_stage.hpp"
-#include "kmeans_single_stage_buffered.hpp"
 #include "kmeans_naive.hpp"
 #include "kmeans_initializer.hpp"
+#include "pipeline_factory.hpp"
+#include "sweep_configuration.hpp"
 
 #include "SystemConfig.h"
 
@@ -27,9 +26,12 @@
 #include <iostream>
 #include <cstdint>
 #include <string>
+#include <functional>
 #include <set>
 #include <memory>
 #include <stdexcept>
+#include <tuple>
+#include <vector>
 
 #ifdef CUDA_FOUND
 #include <cuda_runtime.h>
@@ -41,13 +43,13 @@
 #endif
 
 namespace po = boost::program_options;
-namespace bc = boost::compute;
 
 class CmdOptions {
 public:
     int parse(int argc, char **argv) {
         char help_msg[] =
             "Usage: " BENCH_NAME " [OPTION] [FILE]\n"
+            "       " BENCH_NAME " [OPTION] --sweep SWEEP [FILE]\n"
             "Options"
             ;
 
@@ -66,9 +68,18 @@ public:
             ("csv",
              po::value<std::string>(),
              "Output measurements to CSV file")
+            ("trace",
+             po::value<std::string>(),
+             "Output Chrome JSON trace of OpenCL events and IO threads")
+            ("columnar",
+             po::value<std::string>(),
+             "Append measurements to binary columnar file")
             ("config",
              po::value<std::string>(),
              "Configuration file")
+            ("sweep",
+             po::value<std::string>(),
+             "Run all configurations of a sweep file")
             ;
 
         po::options_description hidden("Hidden options");
@@ -121,11 +132,29 @@ public:
             csv_file_ = vm["csv"].as<std::string>();
         }
 
+        if (vm.count("trace")) {
+            trace_ = true;
+            trace_file_ = vm["trace"].as<std::string>();
+        }
+
+        if (vm.count("columnar")) {
+            columnar_ = true;
+            columnar_file_ = vm["columnar"].as<std::string>();
+        }
+
         if (vm.count("config")) {
             config_ = true;
             config_file_ = vm["config"].as<std::string>();
         }
 
+        if (vm.count("sweep")) {
+            sweep_ = true;
+            sweep_file_ = vm["sweep"].as<std::string>();
+
+            // Data and configuration are in the sweep file
+            return 1;
+        }
+
         // Ensure we have required options
         if (input_file_.empty()) {
             std::cout << "No input file specified." << std::endl;
@@ -161,6 +190,10 @@ public:
         return input_file_;
     }
 
+    void set_input_file(std::string file) {
+        input_file_ = file;
+    }
+
     bool verify() const {
         return verify_;
     }
@@ -173,6 +206,22 @@ public:
         return csv_file_;
     }
 
+    bool trace() const {
+        return trace_;
+    }
+
+    std::string trace_file() const {
+        return trace_file_;
+    }
+
+    bool columnar() const {
+        return columnar_;
+    }
+
+    std::string columnar_file() const {
+        return columnar_file_;
+    }
+
     bool config() const {
         return config_;
     }
@@ -181,6 +230,14 @@ public:
         return config_file_;
     }
 
+    bool sweep() const {
+        return sweep_;
+    }
+
+    std::string sweep_file() const {
+        return sweep_file_;
+    }
+
 private:
     bool verbose_ = false;
     uint32_t k_ = 0;
@@ -190,27 +247,119 @@ private:
     bool verify_ = false;
     bool csv_ = false;
     std::string csv_file_;
+    bool trace_ = false;
+    std::string trace_file_;
+    bool columnar_ = false;
+    std::string columnar_file_;
     bool config_ = false;
     std::string config_file_;
+    bool sweep_ = false;
+    std::string sweep_file_;
+};
+
+/*
+ * Resources that outlive a single benchmark
+ *
+ * In a sweep, the points of the current data file and the command queues
+ * are reused by all configurations. Otherwise, points are handed over
+ * without a copy.
+ */
+class BenchCache {
+public:
+    template <typename PointT>
+    using Points = cle::Matrix<PointT, std::allocator<PointT>, size_t, true>;
+
+    BenchCache(bool keep_points)
+        :
+            keep_points_(keep_points)
+    {}
+
+    template <typename PointT>
+    Points<PointT> points(std::string const& file) {
+        if (file != points_file_) {
+            std::get<Points<float>>(points_) = Points<float>();
+            std::get<Points<double>>(points_) = Points<double>();
+            points_file_ = file;
+        }
+
+        Points<PointT>& cached = std::get<Points<PointT>>(points_);
+        if (cached.rows() == 0) {
+            Clustering::BinaryFormat binformat;
+            binformat.read(file.c_str(), cached);
+        }
+
+        if (not keep_points_) {
+            points_file_.clear();
+            return std::move(cached);
+        }
+
+        return cached;
+    }
+
+    // Ground truth labels of generated data, empty if the file has none
+    std::vector<uint32_t> const& ground_truth(std::string const& file) {
+        if (file != ground_truth_file_) {
+            cle::Matrix<float, std::allocator<float>, size_t> centroids;
+            Clustering::BinaryFormat binformat;
+            if (
+                    binformat.read_ground_truth(
+                        file.c_str(),
+                        centroids,
+                        ground_truth_) != 1
+               )
+            {
+                ground_truth_.clear();
+            }
+            ground_truth_file_ = file;
+        }
+
+        return ground_truth_;
+    }
+
+    // Stages on the same device share a queue and context
+    Clustering::QueueCache& queues() {
+        return queues_;
+    }
+
+private:
+    bool keep_points_;
+    std::string points_file_;
+    std::tuple<Points<float>, Points<double>> points_;
+    std::string ground_truth_file_;
+    std::vector<uint32_t> ground_truth_;
+    Clustering::QueueCache queues_;
 };
 
 template <typename PointT, typename LabelT, typename MassT, bool ColMajor = true>
 class Bench {
 public:
-    int run(CmdOptions options, Clustering::ConfigurationParser config) {
-        auto bm_config = config.get_benchmark_configuration();
-        auto km_config = config.get_kmeans_configuration();
+    int run(
+            CmdOptions options,
+            Clustering::ConfigurationParser config,
+            BenchCache& cache,
+            Clustering::SweepPoint const& point
+           )
+    {
+        using Factory = Clustering::PipelineFactory<
+            PointT,
+            LabelT,
+            MassT,
+            ColMajor>;
 
-        cle::Matrix<PointT, std::allocator<PointT>, size_t, true> points;
+        cle::Matrix<PointT, std::allocator<PointT>, size_t, true> points =
+            cache.points<PointT>(options.input_file());
 
-        Clustering::BinaryFormat binformat;
-        binformat.read(options.input_file().c_str(), points);
+        Clustering::PipelineConfiguration pipeline_config =
+            Factory::configure(config, options.input_file(), points);
+        auto const& bm_config = pipeline_config.benchmark;
+        auto const& km_config = pipeline_config.kmeans;
 
         Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor> bm(
                 bm_config.runs,
                 points.rows(),
                 km_config.iterations,
                 std::move(points));
+        bm.set_harness(Clustering::BenchmarkHarness(bm_config));
 
         bm.initialize(
                 km_config.clusters,
@@ -227,190 +376,45 @@ public:
         Clustering::ClusteringBenchmarkStats bs(bm_config.runs);
         uint64_t verify_res = 0;
         typename decltype(bm)::ClClusteringFunction kmeans;
+        std::unique_ptr<typename Factory::Kmeans> pipeline;
 
-        if (
-                km_config.pipeline == "three_stage"
-                or km_config.pipeline == "three_stage_buffered"
-           )
-        {
-            auto ll_config =
-                config.get_labeling_configuration();
-            auto mu_config =
-                config.get_mass_update_configuration();
-            auto cu_config =
-                config.get_centroid_update_configuration();
-
-            bc::command_queue ll_queue, mu_queue, cu_queue;
-            bc::context ll_context, mu_context, cu_context;
-
-            {
-                bc::device ll_dev =
-                    bc::system::platforms()[ll_config.platform]
-                    .devices()[ll_config.device];
-                ll_context = bc::context(ll_dev);
-
-                ll_queue = bc::command_queue(
-                        ll_context,
-                        ll_dev,
-                        bc::command_queue::enable_profiling
-                        );
-            }
-
-            if (
-                    mu_config.platform == ll_config.platform
-                    && mu_config.device == ll_config.device
-                    ) {
-                mu_queue = ll_queue;
-                mu_context = ll_context;
-            }
-            else {
-                bc::device mu_dev =
-                    bc::system::platforms()[mu_config.platform]
-                    .devices()[mu_config.device];
-                mu_context = bc::context(mu_dev);
-
-                mu_queue = bc::command_queue(
-                        mu_context,
-                        mu_dev,
-                        bc::command_queue::enable_profiling
-                        );
-            }
-
-            if (
-                    cu_config.platform == ll_config.platform
-                    && cu_config.device == ll_config.device
-                    ) {
-                cu_queue = ll_queue;
-                cu_context = ll_context;
-            }
-            else if (
-                    cu_config.platform == mu_config.platform
-                    && cu_config.device == mu_config.device
-                    ) {
-                cu_queue = mu_queue;
-                cu_context = mu_context;
-            }
-            else {
-                bc::device cu_dev =
-                    bc::system::platforms()[cu_config.platform]
-                    .devices()[cu_config.device];
-                cu_context = bc::context(cu_dev);
-
-                cu_queue = bc::command_queue(
-                        cu_context,
-                        cu_dev,
-                        bc::command_queue::enable_profiling
-                        );
-            }
-
-            if (options.verbose()) {
-                std::cout
-                    << "Labeling device: "
-                    << ll_queue.get_device().name()
-                    << std::endl
-                    << "Mass update device: "
-                    << mu_queue.get_device().name()
-                    << std::endl
-                    << "Centroid update device: "
-                    << cu_queue.get_device().name()
-                    << std::endl;
-            }
-
-            if (km_config.pipeline == "three_stage") {
-                Clustering::KmeansThreeStage<
-                    PointT,
-                    LabelT,
-                    MassT,
-                    ColMajor> threestage;
-
-                threestage.set_labeling_queue(ll_queue);
-                threestage.set_mass_update_queue(mu_queue);
-                threestage.set_centroid_update_queue(cu_queue);
-                threestage.set_labeling_context(ll_context);
-                threestage.set_mass_update_context(mu_context);
-                threestage.set_centroid_update_context(cu_context);
-                threestage.set_labeler(ll_config);
-                threestage.set_mass_updater(mu_config);
-                threestage.set_centroid_updater(cu_config);
-                kmeans = threestage;
-            }
-            else if (km_config.pipeline == "three_stage_buffered") {
-                Clustering::KmeansThreeStageBuffered<
-                    PointT,
-                    LabelT,
-                    MassT,
-                    ColMajor> threestagebuffered;
-
-                threestagebuffered.set_labeling_queue(ll_queue);
-                threestagebuffered.set_mass_update_queue(mu_queue);
-                threestagebuffered.set_centroid_update_queue(cu_queue);
-                threestagebuffered.set_labeling_context(ll_context);
-                threestagebuffered.set_mass_update_context(mu_context);
-                threestagebuffered.set_centroid_update_context(cu_context);
-                threestagebuffered.set_labeler(ll_config);
-                threestagebuffered.set_mass_updater(mu_config);
-                threestagebuffered.set_centroid_updater(cu_config);
-                kmeans = threestagebuffered;
-            }
+        // Native CPU engine, e.g. to compare hardware counters against the
+        // CPU OpenCL runtime
+        bool const native = (km_config.pipeline == "naive");
+        if (native) {
+            kmeans_naive.set_hardware_counters(bm_config.hardware_counters);
         }
-        else if (
-                km_config.pipeline == "single_stage"
-                or km_config.pipeline == "single_stage_buffered"
-                )
-        {
-            auto fu_config =
-                config.get_fused_configuration();
-
-            bc::device device =
-                bc::system::platforms()[fu_config.platform]
-                .devices()[fu_config.device];
-            bc::context context = bc::context(device);
-
-            bc::command_queue queue(
-                    context,
-                    device,
-                    bc::command_queue::enable_profiling);
+        else {
+            pipeline = Factory::create(pipeline_config, cache.queues());
+            kmeans = std::ref(*pipeline);
 
             if (options.verbose()) {
-                std::cout
-                    << "Fused device: "
-                    << queue.get_device().name()
-                    << std::endl;
-            }
-
-            if (km_config.pipeline == "single_stage") {
-                Clustering::KmeansSingleStage<
-                    PointT,
-                    LabelT,
-                    MassT,
-                    ColMajor> singlestage;
-
-                singlestage.set_queue(queue);
-                singlestage.set_context(context);
-                singlestage.set_fused(fu_config);
-                kmeans = singlestage;
-            }
-            else if (km_config.pipeline == "single_stage_buffered") {
-                Clustering::KmeansSingleStageBuffered<
-                    PointT,
-                    LabelT,
-                    MassT,
-                    ColMajor> singlestagebuffered;
-
-                singlestagebuffered.set_queue(queue);
-                singlestagebuffered.set_context(context);
-                singlestagebuffered.set_fused(fu_config);
-                kmeans = singlestagebuffered;
+                print_devices(pipeline_config, cache.queues());
             }
         }
 
         if (options.verify() || bm_config.verify) {
-            verify_res = bm.verify(kmeans);
+            verify_res = native
+                ? bm.verify(kmeans_naive)
+                : bm.verify(kmeans);
         }
         else {
-            bs = bm.run(kmeans);
+            bs = native
+                ? bm.run(kmeans_naive)
+                : bm.run(kmeans);
+            if (bm_config.peak_bandwidth > 0.0
+                    || bm_config.peak_performance > 0.0) {
+                bs.set_peak(
+                        bm_config.peak_bandwidth,
+                        bm_config.peak_performance);
+            }
         }
 
+        // Result of the last run against the ground truth of generated data
+        Clustering::ClusteringQuality quality =
+            bm.quality(cache.ground_truth(options.input_file()));
+        bs.set_quality(quality);
+
         if (options.verbose()) {
             std::cout << "Pipeline: " << km_config.pipeline << " ";
             std::cout << "Types: "
@@ -436,6 +440,57 @@ public:
                 bs.print_times();
 
             }
+
+            std::cout << "SSE: " << quality.sse;
+            if (quality.has_ground_truth()) {
+                std::cout
+                    << " Adjusted Rand index: "
+                    << quality.adjusted_rand_index
+                    << " NMI: "
+                    << quality.normalized_mutual_information;
+            }
+            std::cout << std::endl;
+        }
+
+        // One line per sweep point, in the order of the header
+        if (options.sweep()) {
+            std::cout << options.input_file();
+            for (auto const& option : point) {
+                std::cout << ',' << option.second;
+            }
+            if (options.verify() || bm_config.verify) {
+                std::cout << ',' << verify_res;
+            }
+            else {
+                auto stats =
+                    Clustering::BenchmarkHarness::statistics(
+                            bs.microseconds);
+                std::cout
+                    << ',' << stats.count
+                    << ',' << stats.median
+                    << ',' << stats.median_ci_low
+                    << ',' << stats.median_ci_high
+                    << ',' << stats.p95
+                    << ',' << stats.outliers;
+            }
+            std::cout << ',' << quality.sse << ',';
+            if (quality.has_ground_truth()) {
+                std::cout
+                    << quality.adjusted_rand_index
+                    << ','
+                    << quality.normalized_mutual_information;
+            }
+            else {
+                std::cout << ',';
+            }
+            std::cout << std::endl;
+        }
+
+        // Tell the runs of a sweep apart in the output files
+        for (auto& m : bs.measurements) {
+            for (auto const& option : point) {
+                m->set_parameter(option.first, option.second);
+            }
         }
 
         if (options.csv() && not (options.verify() || bm_config.verify)) {
@@ -445,13 +500,144 @@ public:
                     );
         }
 
+        if (options.trace() && not (options.verify() || bm_config.verify)) {
+            bs.to_trace(options.trace_file().c_str());
+        }
+
+        if (options.columnar() && not (options.verify() || bm_config.verify)) {
+            bs.to_columnar(
+                    options.columnar_file().c_str(),
+                    options.input_file().c_str()
+                    );
+        }
+
         kmeans_naive.finalize();
         bm.finalize();
 
         return 1;
     }
+
+private:
+    static void print_devices(
+            Clustering::PipelineConfiguration const& config,
+            Clustering::QueueCache& queues)
+    {
+        if (
+                config.kmeans.pipeline == "single_stage"
+                or config.kmeans.pipeline == "single_stage_buffered"
+           )
+        {
+            std::cout
+                << "Fused device: "
+                << queues.queue(
+                        config.fused.platform,
+                        config.fused.device).get_device().name()
+                << std::endl;
+        }
+        else {
+            std::cout
+                << "Labeling device: "
+                << queues.queue(
+                        config.labeling.platform,
+                        config.labeling.device).get_device().name()
+                << std::endl
+                << "Mass update device: "
+                << queues.queue(
+                        config.mass_update.platform,
+                        config.mass_update.device).get_device().name()
+                << std::endl
+                << "Centroid update device: "
+                << queues.queue(
+                        config.centroid_update.platform,
+                        config.centroid_update.device).get_device().name()
+                << std::endl;
+        }
+    }
 };
 
+int run_bench(
+        CmdOptions const& options,
+        Clustering::ConfigurationParser config,
+        BenchCache& cache,
+        Clustering::SweepPoint const& point
+        )
+{
+    return Clustering::dispatch_pipeline_types<Bench>(
+            config.get_kmeans_configuration(),
+            options,
+            config,
+            cache,
+            point);
+}
+
+/*
+ * Runs the configuration of each sweep point on each data file
+ *
+ * Data files are loaded once, and command queues and built programs are
+ * reused across all points. Prints one CSV line per point. Points with
+ * invalid configurations are reported and skipped.
+ */
+int run_sweep(CmdOptions options) {
+    Clustering::ConfigurationParser base;
+    base.parse_file(options.sweep_file());
+    auto sweep = base.get_sweep_configuration();
+
+    std::vector<std::string> data_files = sweep.data_files();
+    if (not options.input_file().empty()) {
+        data_files.push_back(options.input_file());
+    }
+
+    if (data_files.empty()) {
+        std::cout << "No input file specified." << std::endl;
+        return -1;
+    }
+
+    auto bm_config = base.get_benchmark_configuration();
+    std::cout << "Data";
+    for (auto const& axis : sweep.axes()) {
+        std::cout << ',' << axis.option;
+    }
+    if (options.verify() || bm_config.verify) {
+        std::cout << ",IncorrectLabels";
+    }
+    else {
+        std::cout << ",Runs,Median,MedianCILow,MedianCIHigh,P95,Outliers";
+    }
+    std::cout << ",SSE,ARI,NMI";
+    std::cout << std::endl;
+
+    BenchCache cache(true);
+
+    for (auto const& file : data_files) {
+        options.set_input_file(file);
+
+        for (size_t p = 0; p < sweep.size(); ++p) {
+            Clustering::SweepPoint point = sweep.point(p);
+
+            Clustering::ConfigurationParser config(base);
+            for (auto const& option : point) {
+                config.set_option(option.first, option.second);
+            }
+
+            try {
+                int ret = run_bench(options, config, cache, point);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+            catch (std::invalid_argument const& e) {
+                std::cerr
+                    << "Skipping sweep point " << p
+                    << " of " << file
+                    << ": " << e.what()
+                    << std::endl;
+            }
+        }
+    }
+
+    return 1;
+}
+
 int main(int argc, char **argv) {
     int ret = 0;
 
@@ -462,44 +648,19 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-    Clustering::ConfigurationParser config;
-    config.parse_file(options.config_file());
-    auto km_config = config.get_kmeans_configuration();
-
-    if (
-            km_config.point_type == "double" &&
-            km_config.label_type == "uint64" &&
-            km_config.mass_type == "uint64"
-            ) {
-        Bench<
-            double,
-            uint64_t,
-            uint64_t,
-            true
-                > bench;
-        ret = bench.run(options, config);
-        if (ret < 0) {
-            return ret;
-        }
-    }
-    else if (
-            km_config.point_type == "float" &&
-            km_config.label_type == "uint32" &&
-            km_config.mass_type == "uint32"
-            ) {
-        Bench<
-            float,
-            uint32_t,
-            uint32_t,
-            true
-                > bench;
-        ret = bench.run(options, config);
-        if (ret < 0) {
-            return ret;
-        }
+    if (options.sweep()) {
+        ret = run_sweep(options);
     }
     else {
-        throw std::invalid_argument("Invalid type");
+        Clustering::ConfigurationParser config;
+        config.parse_file(options.config_file());
+
+        BenchCache cache(false);
+        ret = run_bench(options, config, cache, Clustering::SweepPoint());
+    }
+
+    if (ret < 0) {
+        return ret;
     }
 
 #ifdef CUDA_FOUND
@@ -17,6 +17,13 @@ namespace Clustering {
 struct BenchmarkConfiguration {
     size_t runs;
     bool verify;
+    size_t event_capacity = 0;
+    size_t warmup_runs = 0;
+    size_t max_runs = 0;
+    double ci_width = 0.0;
+    double peak_bandwidth = 0.0;
+    double peak_performance = 0.0;
+    bool hardware_counters = false;
 };
 
 }
@@ -0,0 +1,141 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include "benchmark_harness.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// z-score of the 95% confidence level
+double const z_95 = 1.96;
+
+// Nearest rank percentile of sorted samples, ceil(p / 100 * count)
+uint64_t percentile(std::vector<uint64_t> const& sorted, size_t p) {
+    size_t rank = (p * sorted.size() + 99) / 100;
+    return sorted[std::max(rank, (size_t) 1) - 1];
+}
+
+}
+
+Clustering::BenchmarkHarness::BenchmarkHarness(
+        size_t min_runs,
+        size_t warmup_runs,
+        size_t max_runs,
+        double ci_width)
+    :
+        min_runs_(std::max(min_runs, (size_t) 1)),
+        warmup_runs_(warmup_runs),
+        max_runs_(std::max(max_runs, min_runs_)),
+        ci_width_(ci_width)
+{}
+
+Clustering::BenchmarkHarness::BenchmarkHarness(
+        BenchmarkConfiguration const& config)
+    :
+        BenchmarkHarness(
+                config.runs,
+                config.warmup_runs,
+                config.max_runs,
+                config.ci_width)
+{}
+
+void Clustering::BenchmarkHarness::run(SampleFunction sample) {
+    samples_.clear();
+
+    for (size_t r = 0; r < warmup_runs_; ++r) {
+        sample(true);
+    }
+
+    while (samples_.size() < min_runs_) {
+        samples_.push_back(sample(false));
+    }
+
+    while (samples_.size() < max_runs_ && not converged()) {
+        samples_.push_back(sample(false));
+    }
+}
+
+std::vector<uint64_t> const& Clustering::BenchmarkHarness::samples() const {
+    return samples_;
+}
+
+Clustering::SampleStatistics Clustering::BenchmarkHarness::statistics() const {
+    return statistics(samples_);
+}
+
+Clustering::SampleStatistics Clustering::BenchmarkHarness::statistics(
+        std::vector<uint64_t> samples) {
+
+    SampleStatistics stats = {0, 0, 0.0, 0.0, 0.0, 0.0};
+    if (samples.empty()) {
+        return stats;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t const n = samples.size();
+
+    stats.count = n;
+    stats.median = (n % 2 == 1)
+        ? samples[n / 2]
+        : (samples[n / 2 - 1] + samples[n / 2]) / 2.0;
+    stats.p95 = percentile(samples, 95);
+
+    // Ranks j and k of the order statistics that enclose the median with
+    // 95% probability (normal approximation of the binomial distribution)
+    double const spread = z_95 * std::sqrt((double) n) / 2.0;
+    double const low_rank = std::floor(n / 2.0 - spread);
+    double const high_rank = std::ceil(1.0 + n / 2.0 + spread);
+    size_t j = (low_rank < 1.0) ? 1 : (size_t) low_rank;
+    size_t k = (high_rank > n) ? n : (size_t) high_rank;
+    stats.median_ci_low = samples[j - 1];
+    stats.median_ci_high = samples[k - 1];
+
+    double const q1 = percentile(samples, 25);
+    double const q3 = percentile(samples, 75);
+    double const fence = 1.5 * (q3 - q1);
+    stats.outliers = std::count_if(
+            samples.begin(),
+            samples.end(),
+            [q1, q3, fence](uint64_t s) {
+                return s < q1 - fence || s > q3 + fence;
+            });
+
+    return stats;
+}
+
+void Clustering::BenchmarkHarness::print(
+        std::ostream& os,
+        SampleStatistics const& stats,
+        char const* unit) {
+
+    os
+        << "median " << stats.median << " " << unit
+        << ", 95% CI [" << stats.median_ci_low
+        << ", " << stats.median_ci_high << "]"
+        << ", p95 " << stats.p95 << " " << unit
+        << ", " << stats.count << " runs"
+        << ", " << stats.outliers << " outliers";
+}
+
+bool Clustering::BenchmarkHarness::converged() const {
+    if (ci_width_ <= 0.0) {
+        return true;
+    }
+
+    SampleStatistics stats = statistics(samples_);
+    if (stats.median <= 0.0) {
+        return true;
+    }
+
+    double width =
+        (stats.median_ci_high - stats.median_ci_low) / stats.median;
+    return width <= ci_width_;
+}
@@ -0,0 +1,82 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef BENCHMARK_HARNESS_HPP
+#define BENCHMARK_HARNESS_HPP
+
+#include "benchmark_configuration.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+namespace Clustering {
+
+struct SampleStatistics {
+    size_t count;
+    // Samples outside 1.5 times the interquartile range
+    size_t outliers;
+    double median;
+    double p95;
+    // 95% confidence interval of the median
+    double median_ci_low;
+    double median_ci_high;
+};
+
+/*
+ * Runs a benchmark with warmup and an adaptive number of runs
+ *
+ * Warmup runs are discarded. After min_runs, runs are repeated until the
+ * width of the median's confidence interval relative to the median is at
+ * most ci_width, or max_runs is reached. A ci_width of zero runs exactly
+ * min_runs times.
+ *
+ * The confidence interval is distribution-free, i.e. given by the order
+ * statistics around the median, so a few outliers do not widen it.
+ */
+class BenchmarkHarness {
+public:
+    // Called once per run, returns the time of the run
+    using SampleFunction = std::function<uint64_t(bool warmup)>;
+
+    BenchmarkHarness(
+            size_t min_runs,
+            size_t warmup_runs = 0,
+            size_t max_runs = 0,
+            double ci_width = 0.0);
+
+    BenchmarkHarness(BenchmarkConfiguration const& config);
+
+    void run(SampleFunction sample);
+
+    std::vector<uint64_t> const& samples() const;
+    SampleStatistics statistics() const;
+
+    static SampleStatistics statistics(std::vector<uint64_t> samples);
+
+    static void print(
+            std::ostream& os,
+            SampleStatistics const& stats,
+            char const* unit);
+
+private:
+    bool converged() const;
+
+    size_t min_runs_;
+    size_t warmup_runs_;
+    size_t max_runs_;
+    double ci_width_;
+    std::vector<uint64_t> samples_;
+};
+
+}
+
+#endif /* BENCHMARK_HARNESS_HPP */
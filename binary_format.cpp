@@ -14,34 +14,170 @@
 #include <cstdint>
 #include <fstream>
 #include <memory>
-#include <cassert>
+#include <iostream>
+#include <vector>
 
-template <typename FP, typename AllocFP, typename INT>
-int Clustering::BinaryFormat::read(char const* file_name, cle::Matrix<FP, AllocFP, INT>& matrix) {
-
-    std::ifstream fh(file_name, std::fstream::binary);
+namespace {
 
+struct Header {
+    bool v2;
     uint64_t num_features;
     uint64_t num_clusters;
     uint64_t num_points;
+    uint64_t point_format;
+    Clustering::PointQuantization quant;
+};
+
+// Leaves fh positioned at the first point
+int read_header(std::ifstream& fh, Header& header) {
+
+    uint64_t first;
+    fh.read((char*)&first, sizeof(first));
+
+    header.v2 = (first == Clustering::BinaryFormat::MAGIC_V2);
+    if (header.v2) {
+        fh.read((char*)&header.num_features, sizeof(header.num_features));
+        fh.read((char*)&header.num_clusters, sizeof(header.num_clusters));
+        fh.read((char*)&header.num_points, sizeof(header.num_points));
+        fh.read((char*)&header.point_format, sizeof(header.point_format));
+
+        if (header.point_format == Clustering::BinaryFormat::FORMAT_INT8) {
+            header.quant.min.resize(header.num_features);
+            header.quant.scale.resize(header.num_features);
+            fh.read(
+                    (char*)header.quant.min.data(),
+                    header.num_features * sizeof(float));
+            fh.read(
+                    (char*)header.quant.scale.data(),
+                    header.num_features * sizeof(float));
+        }
+        else if (
+                header.point_format
+                != Clustering::BinaryFormat::FORMAT_FLOAT
+                ) {
+            std::cerr
+                << "BinaryFormat: unknown point format "
+                << header.point_format
+                << std::endl;
+            return -1;
+        }
+    }
+    else {
+        header.num_features = first;
+        fh.read((char*)&header.num_clusters, sizeof(header.num_clusters));
+        fh.read((char*)&header.num_points, sizeof(header.num_points));
+        header.point_format = Clustering::BinaryFormat::FORMAT_FLOAT;
+    }
+
+    if (not fh.good()) {
+        std::cerr << "BinaryFormat: truncated header" << std::endl;
+        return -1;
+    }
 
-    fh.read((char*)&num_features, sizeof(num_features));
-    fh.read((char*)&num_clusters, sizeof(num_clusters));
-    fh.read((char*)&num_points, sizeof(num_points));
+    return 1;
+}
+
+}
+
+template <typename FP, typename AllocFP, typename INT>
+int Clustering::BinaryFormat::read(char const* file_name, cle::Matrix<FP, AllocFP, INT>& matrix) {
 
-    // Importing ground-truth centroids not supported yet
-    assert(num_clusters == 0);
+    std::ifstream fh(file_name, std::fstream::binary);
+
+    Header header;
+    if (read_header(fh, header) < 0) {
+        return -1;
+    }
+
+    uint64_t num_features = header.num_features;
+    uint64_t num_points = header.num_points;
 
     matrix.resize(num_points, num_features);
 
+    if (header.point_format == FORMAT_INT8) {
+        std::vector<uint8_t> column(num_points);
+        for (uint64_t f = 0; f < num_features; ++f) {
+            fh.read((char*)column.data(), num_points);
+            for (uint64_t p = 0; p < num_points; ++p) {
+                matrix(p, f) =
+                    header.quant.min[f]
+                    + header.quant.scale[f] * (float) column[p];
+            }
+        }
+    }
+    else {
+        for (uint64_t f = 0; f < num_features; ++f) {
+            for (uint64_t p = 0; p < num_points; ++p) {
+                float point;
+                fh.read((char*)&point, sizeof(point));
+                matrix(p, f) = point;
+            }
+        }
+    }
+
+    return 1;
+}
+
+int Clustering::BinaryFormat::read_quantization(char const* file_name, PointQuantization& quant) {
+
+    std::ifstream fh(file_name, std::fstream::binary);
+
+    Header header;
+    if (read_header(fh, header) < 0) {
+        return -1;
+    }
+
+    if (header.point_format != FORMAT_INT8) {
+        return 0;
+    }
+
+    quant = std::move(header.quant);
+    return 1;
+}
+
+int Clustering::BinaryFormat::read_ground_truth(
+        char const* file_name,
+        cle::Matrix<float, std::allocator<float>, size_t>& centroids,
+        std::vector<uint32_t>& labels) {
+
+    std::ifstream fh(file_name, std::fstream::binary);
+
+    Header header;
+    if (read_header(fh, header) < 0) {
+        return -1;
+    }
+
+    // Version 1 files have no ground truth section
+    if (not header.v2 || header.num_clusters == 0) {
+        return 0;
+    }
+
+    uint64_t num_features = header.num_features;
+    uint64_t num_clusters = header.num_clusters;
+    uint64_t num_points = header.num_points;
+    uint64_t point_size = (header.point_format == FORMAT_INT8)
+        ? sizeof(uint8_t)
+        : sizeof(float);
+
+    fh.seekg(num_features * num_points * point_size, std::ios_base::cur);
+
+    centroids.resize(num_clusters, num_features);
     for (uint64_t f = 0; f < num_features; ++f) {
-        for (uint64_t p = 0; p < num_points; ++p) {
-            float point;
-            fh.read((char*)&point, sizeof(point));
-            matrix(p, f) = point;
+        for (uint64_t c = 0; c < num_clusters; ++c) {
+            float centroid;
+            fh.read((char*)&centroid, sizeof(centroid));
+            centroids(c, f) = centroid;
         }
     }
 
+    labels.resize(num_points);
+    fh.read((char*)labels.data(), num_points * sizeof(uint32_t));
+
+    if (not fh.good()) {
+        std::cerr << "BinaryFormat: truncated ground truth" << std::endl;
+        return -1;
+    }
+
     return 1;
 }
 
@@ -11,13 +11,63 @@
 #define BINARY_FORMAT_HPP
 
 #include "matrix.hpp"
+#include "point_format.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 namespace Clustering {
 
+/*
+ * Version 1 layout:
+ *  uint64 num_features, uint64 num_clusters, uint64 num_points,
+ *  float points[num_features][num_points]
+ *
+ * Version 2 layout:
+ *  uint64 magic, uint64 num_features, uint64 num_clusters,
+ *  uint64 num_points, uint64 point_format,
+ *  if point_format is Int8:
+ *      float min[num_features], float scale[num_features]
+ *  points[num_features][num_points] in point_format
+ *  if num_clusters > 0, ground truth of generated data:
+ *      float centroids[num_features][num_clusters],
+ *      uint32 labels[num_points]
+ *
+ * Version 1 files never start with the magic, as num_features would be
+ * implausibly large.
+ */
 class BinaryFormat {
 public:
+    static constexpr uint64_t MAGIC_V2 = 0x000032764d4b4c43ull; // "CLKMv2"
+    static constexpr uint64_t FORMAT_FLOAT = 0;
+    static constexpr uint64_t FORMAT_INT8 = 1;
+
+    /*
+     * Read points as floating point values
+     *
+     * Int8 points are dequantized.
+     */
     template <typename FP, typename AllocFP, typename INT>
     int read(char const* file_name, cle::Matrix<FP, AllocFP, INT>& matrix);
+
+    /*
+     * Read per-feature quantization of an Int8 file
+     *
+     * Returns 1 if the file is Int8 quantized, 0 if not and -1 on error.
+     */
+    int read_quantization(char const* file_name, PointQuantization& quant);
+
+    /*
+     * Read ground truth centroids and labels of a version 2 file
+     *
+     * Returns 1 if the file has ground truth, 0 if not and -1 on error.
+     */
+    int read_ground_truth(
+            char const* file_name,
+            cle::Matrix<float, std::allocator<float>, size_t>& centroids,
+            std::vector<uint32_t>& labels);
 };
 
 }
@@ -31,6 +31,8 @@ namespace Clustering {
  * Transient: Instantiated on access and dropped on eviction.
  *
  * Note: Transient mode useful for e.g. pipelines while object is locked in cache.
+ * Transient objects need no host data. Without host data, ranges can only
+ * be given as byte offsets into the object.
  */
 enum class ObjectMode {
     ReadWrite,
@@ -45,6 +47,7 @@ public:
 
     using Buffer = boost::compute::buffer;
     using BufferList = std::vector<BufferDesc>;
+    using DirtyBitmap = std::vector<bool>;
     using Context = boost::compute::context;
     using Device = boost::compute::device;
     using Event = boost::compute::event;
@@ -90,9 +93,9 @@ public:
     /*
      * Add data object for buffer cache to manage.
      * Note that BufferCache captures the object, but does not manage
-     * its life-cycle.
+     * its life-cycle. data_object may be nullptr in ObjectMode::Transient.
      *
-     * Returns new object id (oid).
+     * Returns new object id (oid), or 0 on error.
      */
     virtual uint32_t add_object(void *data_object, size_t length, ObjectMode mode = ObjectMode::ReadOnly) = 0;
 
@@ -117,6 +120,12 @@ public:
      */
     virtual int get(Queue queue, uint32_t object_id, void *begin, void *end, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
 
+    /*
+     * Get locked device buffer of object at the byte offsets [begin, end).
+     * Same as above, but also for objects without host data.
+     */
+    virtual int get(Queue queue, uint32_t object_id, size_t begin, size_t end, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
+
     /*
      * Asynchronously write buffer at offset from host to device and get locked buffer at location of pointer.
      * User shall unlock buffer after use.
@@ -124,6 +133,17 @@ public:
      * Returns 1 if successful, negative value if unsucessful.
      */
     virtual int write_and_get(Queue queue, uint32_t object_id, void *begin, void *end, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
+    virtual int write_and_get(Queue queue, uint32_t object_id, size_t begin, size_t end, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
+
+    /*
+     * Get locked buffer at location of pointer without writing its content
+     * from host to device. The user must overwrite the whole range, which is
+     * written back on eviction.
+     *
+     * Returns 1 if successful, negative value if unsucessful.
+     */
+    virtual int overwrite_and_get(Queue queue, uint32_t object_id, void *begin, void *end, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
+    virtual int overwrite_and_get(Queue queue, uint32_t object_id, size_t begin, size_t end, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
 
     /*
      * Asynchronously read buffer at location of pointer from device to host.
@@ -142,9 +162,24 @@ public:
 
     /*
      * Locking prevents eviction of buffer at location of pointer on device. Necessary during kernel execution.
+     * Presumes that the user modified the buffers.
      */
     virtual int unlock(Queue queue, uint32_t object_id, BufferList const& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
 
+    /*
+     * Unlock and report whether the user modified the buffers.
+     * Unmodified buffers are not written back on eviction.
+     */
+    virtual int unlock(Queue queue, uint32_t object_id, BufferList const& buffers, bool modified, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
+
+    /*
+     * Unlock and report the modified ranges with one DirtyBitmap per buffer.
+     * Bit i covers the i-th of bitmap.size() equal parts of the buffer
+     * content, e.g. as reported by a kernel. Only modified ranges are
+     * written back on eviction.
+     */
+    virtual int unlock(Queue queue, uint32_t object_id, BufferList const& buffers, std::vector<DirtyBitmap> const& dirty, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint) = 0;
+
 protected:
 
     size_t buffer_size_i;
@@ -10,6 +10,8 @@
 #ifndef CENTROID_UPDATE_CONFIGURATION_HPP
 #define CENTROID_UPDATE_CONFIGURATION_HPP
 
+#include "tuning_table.hpp"
+
 #include <cstddef>
 #include <string>
 
@@ -24,6 +26,12 @@ struct CentroidUpdateConfiguration {
     size_t local_features;
     size_t thread_features;
     size_t vector_length;
+    size_t scratch_budget = 0;
+    // Kahan summation of the private centroids
+    bool compensated_sum = false;
+    // Fixed point steps of 2^-fixed_point_exponent for fixed_point
+    int fixed_point_exponent = 0;
+    TuningTable tuning;
 };
 
 }
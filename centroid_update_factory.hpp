@@ -13,10 +13,14 @@
 #include "centroid_update_configuration.hpp"
 
 #include "measurement/measurement.hpp"
+#include "tuned_strategy.hpp"
 
 #include "cl_kernels/centroid_update_feature_sum.hpp"
 #include "cl_kernels/centroid_update_feature_sum_pardim.hpp"
 #include "cl_kernels/centroid_update_cluster_merge.hpp"
+#include "cl_kernels/centroid_update_cluster_spill.hpp"
+#include "cl_kernels/centroid_update_sorted_segment.hpp"
+#include "cl_kernels/centroid_update_fixed_point.hpp"
 
 #include <functional>
 #include <string>
@@ -59,6 +63,27 @@ public:
             Measurement::Measurement& measurement
             )
     {
+        check(config);
+
+        // Select the strategy when the data shape is known
+        if (not config.tuning.empty()) {
+            measurement.set_parameter(
+                    "CentroidUpdateTuningRules",
+                    std::to_string(config.tuning.size())
+                    );
+
+            TuningTable tuning = config.tuning;
+            config.tuning = TuningTable();
+            return TunedStrategy<
+                CentroidUpdateFunction,
+                CentroidUpdateConfiguration>(
+                        config,
+                        tuning,
+                        [context](CentroidUpdateConfiguration c) {
+                            return create_strategy(context, c);
+                        });
+        }
+
         measurement.set_parameter(
                 "CentroidUpdateGlobalSize",
                 std::to_string(config.global_size[0])
@@ -79,6 +104,120 @@ public:
                     );
         }
 
+        if (config.strategy == "feature_sum_pardim") {
+            measurement.set_parameter(
+                    "CentroidUpdateLocalFeatures",
+                    std::to_string(config.local_features)
+                    );
+            measurement.set_parameter(
+                    "CentroidUpdateThreadFeatures",
+                    std::to_string(config.thread_features)
+                    );
+        }
+
+        if (config.strategy == "cluster_spill") {
+            measurement.set_parameter(
+                    "CentroidUpdateScratchBudget",
+                    std::to_string(config.scratch_budget)
+                    );
+        }
+
+        if (config.strategy == "fixed_point") {
+            measurement.set_parameter(
+                    "CentroidUpdateFixedPointExponent",
+                    std::to_string(config.fixed_point_exponent)
+                    );
+        }
+
+        measurement.set_parameter(
+                "CentroidUpdateCompensatedSum",
+                (config.compensated_sum) ? "true" : "false"
+                );
+
+        return create_strategy(context, config);
+    }
+
+    /*
+     * Build the strategy that the tuning table selects for the data shape
+     *
+     * Pipelines call this before they start timing.
+     */
+    static void prepare(
+            CentroidUpdateFunction& f,
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_clusters
+            )
+    {
+        TunedStrategy<
+            CentroidUpdateFunction,
+            CentroidUpdateConfiguration>::prepare(
+                    f,
+                    queue,
+                    num_features,
+                    num_clusters);
+    }
+
+    /*
+     * Restart the fixed_point sums of centroids
+     *
+     * Pipelines call this when they zero the centroids at the start of an
+     * iteration. Other strategies don't keep state between calls.
+     */
+    static void reset(
+            CentroidUpdateFunction& f,
+            boost::compute::buffer const& centroids
+            )
+    {
+        using FixedPoint = CentroidUpdateFixedPoint<
+            PointT,
+            LabelT,
+            MassT,
+            ColMajor>;
+
+        TunedStrategy<
+            CentroidUpdateFunction,
+            CentroidUpdateConfiguration>::for_each(
+                    f,
+                    [&centroids](CentroidUpdateFunction& strategy) {
+                        FixedPoint* fixed_point =
+                            strategy.template target<FixedPoint>();
+                        if (fixed_point) {
+                            fixed_point->reset(centroids);
+                        }
+                    });
+    }
+
+private:
+    static bool supports_compensated_sum(std::string const& strategy) {
+        return strategy == "feature_sum" or strategy == "cluster_merge";
+    }
+
+    /*
+     * Reject options that the base strategy or a tuned strategy cannot
+     * run, before any strategy is built
+     */
+    static void check(CentroidUpdateConfiguration const& config) {
+        if (not config.compensated_sum) {
+            return;
+        }
+
+        bool supported = supports_compensated_sum(config.strategy);
+        for (auto const& rule : config.tuning.rules()) {
+            supported = supported && supports_compensated_sum(rule.strategy);
+        }
+
+        if (not supported) {
+            throw std::invalid_argument(
+                    "compensated_sum requires feature_sum or cluster_merge");
+        }
+    }
+
+    static CentroidUpdateFunction create_strategy(
+            boost::compute::context context,
+            CentroidUpdateConfiguration config
+            )
+    {
         if (config.strategy == "feature_sum") {
             CentroidUpdateFeatureSum<
                 PointT,
@@ -90,15 +229,6 @@ public:
             return strategy;
         }
         else if (config.strategy == "feature_sum_pardim") {
-            measurement.set_parameter(
-                    "CentroidUpdateLocalFeatures",
-                    std::to_string(config.local_features)
-                    );
-            measurement.set_parameter(
-                    "CentroidUpdateThreadFeatures",
-                    std::to_string(config.thread_features)
-                    );
-
             CentroidUpdateFeatureSumPardim<
                 PointT,
                 LabelT,
@@ -118,6 +248,36 @@ public:
             strategy.prepare(context, config);
             return strategy;
         }
+        else if (config.strategy == "cluster_spill") {
+            CentroidUpdateClusterSpill<
+                PointT,
+                LabelT,
+                MassT,
+                ColMajor>
+                    strategy;
+            strategy.prepare(context, config);
+            return strategy;
+        }
+        else if (config.strategy == "sorted_segment") {
+            CentroidUpdateSortedSegment<
+                PointT,
+                LabelT,
+                MassT,
+                ColMajor>
+                    strategy;
+            strategy.prepare(context, config);
+            return strategy;
+        }
+        else if (config.strategy == "fixed_point") {
+            CentroidUpdateFixedPoint<
+                PointT,
+                LabelT,
+                MassT,
+                ColMajor>
+                    strategy;
+            strategy.prepare(context, config);
+            return strategy;
+        }
         else {
             throw std::invalid_argument(config.strategy);
         }
@@ -11,6 +11,8 @@
 #define CENTROID_UPDATE_CLUSTER_MERGE_HPP
 
 #include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
 
 #include "reduce_vector_parcol.hpp"
 #include "matrix_binary_op.hpp"
@@ -48,7 +50,8 @@ public:
     using LocalBuffer = boost::compute::local_buffer<T>;
 
     CentroidUpdateClusterMerge() :
-        local_centroids(1)
+        local_centroids(1),
+        local_compensation(1)
     {}
 
     void prepare(
@@ -70,6 +73,9 @@ public:
         defines += boost::compute::type_name<LabelT>();
         defines += " -DVEC_LEN=";
         defines += std::to_string(this->config.vector_length);
+        if (this->config.compensated_sum) {
+            defines += " -DKAHAN_SUM";
+        }
 
         std::string l_stride_defines = " -DLOCAL_STRIDE";
         std::string g_mem_defines = " -DGLOBAL_MEM";
@@ -78,7 +84,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-            g_stride_g_mem_program.build(defines + g_mem_defines);
+            ProgramCache::build(g_stride_g_mem_program, defines + g_mem_defines);
         }
         catch (std::exception e) {
             std::cerr << g_stride_g_mem_program.build_log() << std::endl;
@@ -89,7 +95,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-            g_stride_l_mem_program.build(defines);
+            ProgramCache::build(g_stride_l_mem_program, defines);
         }
         catch (std::exception e) {
             std::cerr << g_stride_l_mem_program.build_log() << std::endl;
@@ -100,7 +106,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-        l_stride_g_mem_program.build(defines + l_stride_defines + g_mem_defines);
+        ProgramCache::build(l_stride_g_mem_program, defines + l_stride_defines + g_mem_defines);
         }
         catch (std::exception e) {
             std::cerr << l_stride_g_mem_program.build_log() << std::endl;
@@ -169,6 +175,11 @@ public:
         assert(masses_begin.get_index() == 0u);
 
         datapoint.set_name("CentroidUpdateClusterMerge");
+        KernelWork::centroid_update<PointT, LabelT>(
+                datapoint,
+                num_features,
+                num_points,
+                num_clusters);
 
         size_t min_centroids_size =
             this->config.global_size[0]
@@ -194,6 +205,9 @@ public:
                         ));
         }
 
+        // Compensation doubles the private centroids
+        size_t const copies = (this->config.compensated_sum) ? 2 : 1;
+
         boost::compute::device device = queue.get_device();
         bool use_local_stride =
             device.type() == device.cpu ||
@@ -202,7 +216,7 @@ public:
         bool use_local_memory =
             device.type() == device.gpu &&
             device.local_memory_size() >
-            local_centroids_size * sizeof(PointT)
+            copies * local_centroids_size * sizeof(PointT)
             ;
         Kernel& kernel = (use_local_stride)
             ? l_stride_g_mem_kernel
@@ -231,6 +245,15 @@ public:
                     (cl_uint)num_clusters);
         }
 
+        if (this->config.compensated_sum) {
+            set_compensation_arg(
+                    queue,
+                    kernel,
+                    use_local_memory,
+                    min_centroids_size,
+                    local_centroids_size);
+        }
+
         Event event;
         event = queue.enqueue_1d_range_kernel(
                 kernel,
@@ -273,6 +296,35 @@ public:
 
 
 private:
+    // Compensation buffer is appended to the kernel arguments
+    void set_compensation_arg(
+            boost::compute::command_queue queue,
+            Kernel& kernel,
+            bool use_local_memory,
+            size_t min_centroids_size,
+            size_t local_centroids_size)
+    {
+        if (use_local_memory) {
+            if (this->local_compensation.size() != local_centroids_size) {
+                this->local_compensation = std::move(
+                        LocalBuffer<PointT>(
+                            local_centroids_size
+                            ));
+            }
+            kernel.set_arg(kernel.arity() - 1, this->local_compensation);
+        }
+        else {
+            if (this->tmp_compensation.size() < min_centroids_size) {
+                this->tmp_compensation = std::move(
+                        Vector<PointT>(
+                            min_centroids_size,
+                            queue.get_context()
+                            ));
+            }
+            kernel.set_arg(kernel.arity() - 1, this->tmp_compensation);
+        }
+    }
+
     static constexpr const char* PROGRAM_FILE = CL_KERNEL_FILE_PATH("lloyd_cluster_merge.cl");
     static constexpr const char* KERNEL_NAME = "lloyd_cluster_merge";
 
@@ -281,6 +333,8 @@ private:
     Kernel l_stride_g_mem_kernel;
     Vector<PointT> tmp_centroids;
     LocalBuffer<PointT> local_centroids;
+    Vector<PointT> tmp_compensation;
+    LocalBuffer<PointT> local_compensation;
     CentroidUpdateConfiguration config;
     ReduceVectorParcol<PointT> reduce;
     MatrixBinaryOp<PointT, PointT> matrix_add;
@@ -0,0 +1,441 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef CENTROID_UPDATE_CLUSTER_SPILL_HPP
+#define CENTROID_UPDATE_CLUSTER_SPILL_HPP
+
+#include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
+
+#include "reduce_vector_parcol.hpp"
+
+#include "../centroid_update_configuration.hpp"
+#include "../measurement/measurement.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility> // std::move
+#include <vector>
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/algorithm/copy.hpp>
+#include <boost/compute/memory/local_buffer.hpp>
+
+namespace Clustering {
+
+/*
+ * Centroid update that keeps private copies of hot clusters only
+ *
+ * cluster_merge allocates global_size * num_clusters * num_features
+ * scratch space, which does not fit into device memory for large
+ * num_clusters. Instead, the clusters with the largest masses get private
+ * copies in local or global memory, and the remaining clusters are added
+ * with atomics. The number of hot clusters is chosen such that the scratch
+ * space stays within config.scratch_budget bytes.
+ *
+ * Hot clusters are found by a bitonic sort of the cluster indices by mass
+ * on the device, in O(k log^2 k) work for k clusters. The sort is skipped
+ * if all or none of the clusters are hot.
+ */
+template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
+class CentroidUpdateClusterSpill {
+public:
+    using Event = boost::compute::event;
+    using Context = boost::compute::context;
+    using Kernel = boost::compute::kernel;
+    using Program = boost::compute::program;
+    template <typename T>
+    using Vector = boost::compute::vector<T>;
+    template <typename T>
+    using LocalBuffer = boost::compute::local_buffer<T>;
+
+    // Scratch space if none is configured
+    static constexpr size_t DEFAULT_SCRATCH_BUDGET = 64 * 1024 * 1024;
+
+    CentroidUpdateClusterSpill() :
+        local_hot_centroids(1)
+    {}
+
+    void prepare(
+            Context context,
+            CentroidUpdateConfiguration config
+            )
+    {
+        static_assert(boost::compute::is_fundamental<PointT>(),
+                "PointT must be a boost compute fundamental type");
+        static_assert(boost::compute::is_fundamental<LabelT>(),
+                "LabelT must be a boost compute fundamental type");
+        static_assert(boost::compute::is_fundamental<MassT>(),
+                "MassT must be a boost compute fundamental type");
+        static_assert(std::is_same<float, PointT>::value
+                or std::is_same<double, PointT>::value,
+                "PointT must be float or double");
+
+        this->config = config;
+
+        if (this->config.vector_length != 1) {
+            throw std::invalid_argument(
+                    "cluster_spill requires vector_length 1");
+        }
+
+        if (this->config.scratch_budget == 0) {
+            this->config.scratch_budget = DEFAULT_SCRATCH_BUDGET;
+        }
+
+        std::string defines;
+        defines += " -DCL_INT=uint";
+        defines += " -DCL_POINT=";
+        defines += boost::compute::type_name<PointT>();
+        defines += " -DCL_LABEL=";
+        defines += boost::compute::type_name<LabelT>();
+        defines += " -DCL_MASS=";
+        defines += boost::compute::type_name<MassT>();
+        if (std::is_same<double, PointT>::value) {
+            defines += " -DCL_POINT_UINT=ulong -DPOINT_DOUBLE";
+        }
+        else {
+            defines += " -DCL_POINT_UINT=uint";
+        }
+
+        // Native float atomics are only visible to OpenCL C 3.0 programs
+        if (supports_float_atomics(context.get_device())) {
+            defines += " -cl-std=CL3.0";
+        }
+
+        std::string l_stride_defines = " -DLOCAL_STRIDE";
+        std::string g_mem_defines = " -DGLOBAL_MEM";
+
+        Program g_stride_g_mem_program = build(
+                context, defines + g_mem_defines);
+        g_stride_g_mem_kernel = g_stride_g_mem_program.create_kernel(KERNEL_NAME);
+        sort_kernel = g_stride_g_mem_program.create_kernel(SORT_KERNEL_NAME);
+        slots_kernel = g_stride_g_mem_program.create_kernel(SLOTS_KERNEL_NAME);
+        merge_kernel = g_stride_g_mem_program.create_kernel(MERGE_KERNEL_NAME);
+
+        Program g_stride_l_mem_program = build(context, defines);
+        g_stride_l_mem_kernel = g_stride_l_mem_program.create_kernel(KERNEL_NAME);
+
+        Program l_stride_g_mem_program = build(
+                context, defines + l_stride_defines + g_mem_defines);
+        l_stride_g_mem_kernel = l_stride_g_mem_program.create_kernel(KERNEL_NAME);
+
+        reduce.prepare(context);
+    }
+
+    /*
+     * Number of clusters with private copies
+     */
+    size_t num_hot_clusters(size_t num_features, size_t num_clusters) const {
+        size_t copy_size =
+            this->config.global_size[0] * num_features * sizeof(PointT);
+
+        return std::min(
+                num_clusters,
+                this->config.scratch_budget / copy_size);
+    }
+
+    /*
+     * Clusters with private copies in the last call, by slot
+     *
+     * Slots are assigned by descending mass if only some clusters are hot.
+     */
+    std::vector<cl_uint> hot_clusters(
+            boost::compute::command_queue queue) const
+    {
+        std::vector<cl_uint> hot(this->last_num_hot);
+        boost::compute::copy(
+                this->order.begin(),
+                this->order.begin() + this->last_num_hot,
+                hot.begin(),
+                queue);
+
+        return hot;
+    }
+
+    Event operator() (
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters,
+            boost::compute::buffer_iterator<PointT> points_begin,
+            boost::compute::buffer_iterator<PointT> points_end,
+            boost::compute::buffer_iterator<PointT> centroids_begin,
+            boost::compute::buffer_iterator<PointT> centroids_end,
+            boost::compute::buffer_iterator<LabelT> labels_begin,
+            boost::compute::buffer_iterator<LabelT> labels_end,
+            boost::compute::buffer_iterator<MassT> masses_begin,
+            boost::compute::buffer_iterator<MassT> masses_end,
+            Measurement::DataPoint& datapoint,
+            boost::compute::wait_list const& events
+            )
+    {
+        assert(points_end - points_begin == (long) (num_points * num_features));
+        assert(centroids_end - centroids_begin == (long) (num_clusters * num_features));
+        assert(labels_end - labels_begin == (long) num_points);
+        assert(masses_end - masses_begin == (long) num_clusters);
+        assert(points_begin.get_index() == 0u);
+        assert(centroids_begin.get_index() == 0u);
+        assert(labels_begin.get_index() == 0u);
+        assert(masses_begin.get_index() == 0u);
+
+        datapoint.set_name("CentroidUpdateClusterSpill");
+        KernelWork::centroid_update<PointT, LabelT>(
+                datapoint,
+                num_features,
+                num_points,
+                num_clusters);
+
+        size_t const num_hot = num_hot_clusters(num_features, num_clusters);
+        this->last_num_hot = num_hot;
+
+        size_t min_hot_size =
+            this->config.global_size[0]
+            * num_hot
+            * num_features;
+        // Buffers must not be empty
+        if (this->tmp_hot_centroids.size() < std::max(min_hot_size, (size_t) 1)) {
+            this->tmp_hot_centroids = std::move(
+                    Vector<PointT>(
+                        std::max(min_hot_size, (size_t) 1),
+                        queue.get_context()
+                        ));
+        }
+        if (this->slots.size() < num_clusters) {
+            this->slots = std::move(
+                    Vector<cl_int>(num_clusters, queue.get_context()));
+        }
+
+        // Cluster indices padded to a power of two for the sort. Any
+        // permutation is a valid input, thus the order of the previous
+        // call is kept. It has its padding last as long as num_clusters
+        // stays the same.
+        size_t order_size = 1;
+        while (order_size < num_clusters) {
+            order_size *= 2;
+        }
+        if (
+                this->order.size() != order_size
+                || this->order_clusters != num_clusters
+           )
+        {
+            std::vector<cl_uint> identity(order_size);
+            for (size_t i = 0; i < order_size; ++i) {
+                identity[i] = i;
+            }
+
+            this->order = std::move(
+                    Vector<cl_uint>(order_size, queue.get_context()));
+            boost::compute::copy(
+                    identity.begin(),
+                    identity.end(),
+                    this->order.begin(),
+                    queue);
+            this->order_clusters = num_clusters;
+        }
+
+        size_t const local_hot_size =
+            this->config.local_size[0]
+            * num_features
+            * num_hot
+            ;
+        if (this->local_hot_centroids.size() != std::max(local_hot_size, (size_t) 1)) {
+            this->local_hot_centroids = std::move(
+                    LocalBuffer<PointT>(
+                        std::max(local_hot_size, (size_t) 1)
+                        ));
+        }
+
+        Event event;
+        boost::compute::wait_list wait_list = events;
+
+        // Order clusters by mass if only some of them are hot
+        if (num_hot > 0 && num_hot < num_clusters) {
+            for (size_t block = 2; block <= order_size; block *= 2) {
+                for (size_t stride = block / 2; stride > 0; stride /= 2) {
+                    this->sort_kernel.set_args(
+                            masses_begin.get_buffer(),
+                            this->order,
+                            (cl_uint) num_clusters,
+                            (cl_uint) block,
+                            (cl_uint) stride);
+
+                    event = queue.enqueue_1d_range_kernel(
+                            this->sort_kernel,
+                            0,
+                            order_size / 2,
+                            0,
+                            wait_list);
+                    datapoint.add_event() = event;
+                    wait_list = boost::compute::wait_list(event);
+                }
+            }
+        }
+
+        // Assign hot slots in cluster order
+        this->slots_kernel.set_args(
+                this->order,
+                this->slots,
+                (cl_uint) num_clusters,
+                (cl_uint) num_hot);
+
+        event = queue.enqueue_1d_range_kernel(
+                this->slots_kernel,
+                0,
+                num_clusters,
+                0,
+                wait_list);
+        datapoint.add_event() = event;
+        wait_list.insert(event);
+
+        boost::compute::device device = queue.get_device();
+        bool use_local_stride =
+            device.type() == device.cpu ||
+            device.type() == device.accelerator
+            ;
+        bool use_local_memory =
+            device.type() == device.gpu &&
+            device.local_memory_size() >
+            local_hot_size * sizeof(PointT)
+            ;
+        Kernel& kernel = (use_local_stride)
+            ? l_stride_g_mem_kernel
+            : (use_local_memory)
+            ? g_stride_l_mem_kernel
+            : g_stride_g_mem_kernel
+            ;
+
+        if (use_local_memory) {
+            kernel.set_args(
+                    points_begin.get_buffer(),
+                    centroids_begin.get_buffer(),
+                    this->tmp_hot_centroids,
+                    labels_begin.get_buffer(),
+                    this->slots,
+                    this->local_hot_centroids,
+                    (cl_uint)num_features,
+                    (cl_uint)num_points,
+                    (cl_uint)num_clusters,
+                    (cl_uint)num_hot);
+        }
+        else {
+            kernel.set_args(
+                    points_begin.get_buffer(),
+                    centroids_begin.get_buffer(),
+                    this->tmp_hot_centroids,
+                    labels_begin.get_buffer(),
+                    this->slots,
+                    (cl_uint)num_features,
+                    (cl_uint)num_points,
+                    (cl_uint)num_clusters,
+                    (cl_uint)num_hot);
+        }
+
+        event = queue.enqueue_1d_range_kernel(
+                kernel,
+                0,
+                this->config.global_size[0],
+                this->config.local_size[0],
+                wait_list);
+        datapoint.add_event() = event;
+
+        if (num_hot == 0) {
+            return event;
+        }
+
+        wait_list.insert(event);
+
+        event = reduce(
+                queue,
+                this->config.global_size[0],
+                num_hot * num_features,
+                this->tmp_hot_centroids.begin(),
+                this->tmp_hot_centroids.begin() + min_hot_size,
+                datapoint.create_child(),
+                wait_list
+                );
+        wait_list.insert(event);
+
+        this->merge_kernel.set_args(
+                centroids_begin.get_buffer(),
+                this->tmp_hot_centroids,
+                this->order,
+                (cl_uint) num_clusters,
+                (cl_uint) num_hot);
+
+        event = queue.enqueue_1d_range_kernel(
+                this->merge_kernel,
+                0,
+                num_hot * num_features,
+                0,
+                wait_list);
+        datapoint.add_event() = event;
+
+        return event;
+    }
+
+private:
+    /*
+     * Whether the device builds OpenCL C 3.0 with float atomics
+     */
+    static bool supports_float_atomics(boost::compute::device const& device) {
+        std::string const prefix = "OpenCL C ";
+        std::string const version =
+            device.get_info<std::string>(CL_DEVICE_OPENCL_C_VERSION);
+
+        return device.supports_extension("cl_ext_float_atomics")
+            && version.compare(0, prefix.size(), prefix) == 0
+            && version.size() > prefix.size()
+            && version[prefix.size()] >= '3';
+    }
+
+    static Program build(Context context, std::string const& defines) {
+        Program program = Program::create_with_source_file(
+                PROGRAM_FILE,
+                context);
+        try {
+            ProgramCache::build(program, defines);
+        }
+        catch (std::exception e) {
+            std::cerr << program.build_log() << std::endl;
+            throw e;
+        }
+
+        return program;
+    }
+
+    static constexpr const char* PROGRAM_FILE = CL_KERNEL_FILE_PATH("lloyd_cluster_spill.cl");
+    static constexpr const char* KERNEL_NAME = "cluster_spill";
+    static constexpr const char* SORT_KERNEL_NAME = "cluster_spill_sort";
+    static constexpr const char* SLOTS_KERNEL_NAME = "cluster_spill_slots";
+    static constexpr const char* MERGE_KERNEL_NAME = "cluster_spill_merge";
+
+    Kernel g_stride_g_mem_kernel;
+    Kernel g_stride_l_mem_kernel;
+    Kernel l_stride_g_mem_kernel;
+    Kernel sort_kernel;
+    Kernel slots_kernel;
+    Kernel merge_kernel;
+    Vector<PointT> tmp_hot_centroids;
+    Vector<cl_int> slots;
+    Vector<cl_uint> order;
+    size_t order_clusters = 0;
+    size_t last_num_hot = 0;
+    LocalBuffer<PointT> local_hot_centroids;
+    CentroidUpdateConfiguration config;
+    ReduceVectorParcol<PointT> reduce;
+};
+
+}
+
+#endif /* CENTROID_UPDATE_CLUSTER_SPILL_HPP */
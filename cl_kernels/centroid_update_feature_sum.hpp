@@ -11,6 +11,8 @@
 #define CENTROID_UPDATE_FEATURE_SUM_HPP
 
 #include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
 
 #include "reduce_vector_parcol.hpp"
 #include "matrix_binary_op.hpp"
@@ -69,12 +71,15 @@ public:
         defines += boost::compute::type_name<LabelT>();
         defines += " -DCL_MASS=";
         defines += boost::compute::type_name<MassT>();
+        if (this->config.compensated_sum) {
+            defines += " -DKAHAN_SUM";
+        }
 
         Program program = Program::create_with_source_file(
                 PROGRAM_FILE,
                 context);
 
-        program.build(defines);
+        ProgramCache::build(program, defines);
 
         this->kernel = program.create_kernel(KERNEL_NAME);
 
@@ -142,6 +147,11 @@ public:
         assert(masses_begin.get_index() == 0u);
 
         datapoint.set_name("CentroidUpdateFeatureSum");
+        KernelWork::centroid_update<PointT, LabelT>(
+                datapoint,
+                num_features,
+                num_points,
+                num_clusters);
 
         size_t min_centroids_size =
             num_clusters * this->config.global_size[0];
@@ -161,6 +171,20 @@ public:
                 (cl_uint)num_points,
                 (cl_uint)num_clusters);
 
+        // Compensation buffer is appended to the kernel arguments
+        if (this->config.compensated_sum) {
+            if (this->tmp_compensation.size() < min_centroids_size) {
+                this->tmp_compensation = std::move(
+                        Vector<PointT>(
+                            min_centroids_size,
+                            queue.get_context()
+                            ));
+            }
+            this->kernel.set_arg(
+                    this->kernel.arity() - 1,
+                    this->tmp_compensation);
+        }
+
         size_t work_offset = 0;
 
         Event event;
@@ -212,6 +236,7 @@ private:
 
     Kernel kernel;
     Vector<PointT> tmp_centroids;
+    Vector<PointT> tmp_compensation;
     CentroidUpdateConfiguration config;
     ReduceVectorParcol<PointT> reduce_centroids;
     MatrixBinaryOp<PointT, PointT> matrix_add;
@@ -11,6 +11,8 @@
 #define CENTROID_UPDATE_FEATURE_SUM_PARDIM_HPP
 
 #include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
 
 #include "reduce_vector_parcol.hpp"
 #include "matrix_binary_op.hpp"
@@ -82,7 +84,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-            g_stride_g_mem_program.build(defines + g_mem_defines);
+            ProgramCache::build(g_stride_g_mem_program, defines + g_mem_defines);
         }
         catch (std::exception e) {
             std::cerr << g_stride_g_mem_program.build_log() << std::endl;
@@ -93,7 +95,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-            g_stride_l_mem_program.build(defines);
+            ProgramCache::build(g_stride_l_mem_program, defines);
         }
         catch (std::exception e) {
             std::cerr << g_stride_l_mem_program.build_log() << std::endl;
@@ -104,7 +106,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-        l_stride_g_mem_program.build(defines + l_stride_defines + g_mem_defines);
+        ProgramCache::build(l_stride_g_mem_program, defines + l_stride_defines + g_mem_defines);
         }
         catch (std::exception e) {
             std::cerr << l_stride_g_mem_program.build_log() << std::endl;
@@ -183,6 +185,11 @@ public:
         assert(masses_begin.get_index() == 0u);
 
         datapoint.set_name("CentroidUpdateFeatureSumPardim");
+        KernelWork::centroid_update<PointT, LabelT>(
+                datapoint,
+                num_features,
+                num_points,
+                num_clusters);
 
         size_t global_size[3] = {
             this->config.global_size[0] / num_feature_tiles,
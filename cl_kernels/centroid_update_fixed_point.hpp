@@ -0,0 +1,293 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef CENTROID_UPDATE_FIXED_POINT_HPP
+#define CENTROID_UPDATE_FIXED_POINT_HPP
+
+#include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
+
+#include "reduce_vector_parcol.hpp"
+
+#include "../centroid_update_configuration.hpp"
+#include "../measurement/measurement.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility> // std::move
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+
+namespace Clustering {
+
+/*
+ * Deterministic centroid update
+ *
+ * Sums the points in 64-bit fixed point with 2^fixed_point_exponent steps.
+ * The integer sums are exact, so the result is bitwise identical for any
+ * global size, local size and number of buffer chunks. Each work item sums
+ * into a private copy in global memory, and the copies are reduced with
+ * ReduceVectorParcol<cl_long>.
+ *
+ * The buffered pipelines call the centroid update once per chunk and add
+ * the chunk sums to the centroids. To keep these additions exact, the
+ * integer sums of each centroid buffer are kept between calls. Pipelines
+ * call reset when they zero the centroids at the start of an iteration, and
+ * the next call restarts the sums from the centroids.
+ */
+template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
+class CentroidUpdateFixedPoint {
+public:
+    using Event = boost::compute::event;
+    using Context = boost::compute::context;
+    using Kernel = boost::compute::kernel;
+    using Program = boost::compute::program;
+    template <typename T>
+    using Vector = boost::compute::vector<T>;
+
+    CentroidUpdateFixedPoint() :
+        accumulators(std::make_shared<AccumulatorMap>())
+    {}
+
+    /*
+     * Largest exponent at which the sum of all points cannot overflow
+     */
+    static int fixed_point_exponent(
+            PointT const *points,
+            size_t num_values,
+            size_t num_points)
+    {
+        PointT max_abs = 0;
+        for (size_t i = 0; i < num_values; ++i) {
+            max_abs = std::max(max_abs, std::abs(points[i]));
+        }
+
+        int value_bits = 0;
+        std::frexp(max_abs, &value_bits);
+
+        int count_bits = 0;
+        while (((size_t) 1 << count_bits) < num_points) {
+            ++count_bits;
+        }
+
+        int exponent = 62 - value_bits - count_bits;
+        return std::max(
+                std::numeric_limits<PointT>::min_exponent,
+                std::min(
+                    exponent,
+                    std::numeric_limits<PointT>::max_exponent - 2));
+    }
+
+    void prepare(
+            Context context,
+            CentroidUpdateConfiguration config
+            )
+    {
+        static_assert(boost::compute::is_fundamental<PointT>(),
+                "PointT must be a boost compute fundamental type");
+        static_assert(boost::compute::is_fundamental<LabelT>(),
+                "LabelT must be a boost compute fundamental type");
+        static_assert(boost::compute::is_fundamental<MassT>(),
+                "MassT must be a boost compute fundamental type");
+        static_assert(std::is_same<float, PointT>::value
+                or std::is_same<double, PointT>::value,
+                "PointT must be float or double");
+
+        this->config = config;
+
+        if (this->config.vector_length != 1) {
+            throw std::invalid_argument(
+                    "fixed_point requires vector_length 1");
+        }
+
+        std::string defines;
+        defines += " -DCL_INT=uint";
+        defines += " -DCL_POINT=";
+        defines += boost::compute::type_name<PointT>();
+        defines += " -DCL_LABEL=";
+        defines += boost::compute::type_name<LabelT>();
+        if (std::is_same<double, PointT>::value) {
+            defines += " -DPOINT_DOUBLE";
+        }
+
+        Program program = Program::create_with_source_file(
+                PROGRAM_FILE,
+                context);
+        try {
+            ProgramCache::build(program, defines);
+        }
+        catch (std::exception e) {
+            std::cerr << program.build_log() << std::endl;
+            throw e;
+        }
+
+        partial_kernel = program.create_kernel(PARTIAL_KERNEL_NAME);
+        commit_kernel = program.create_kernel(COMMIT_KERNEL_NAME);
+
+        reduce.prepare(context);
+    }
+
+    Event operator() (
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters,
+            boost::compute::buffer_iterator<PointT> points_begin,
+            boost::compute::buffer_iterator<PointT> points_end,
+            boost::compute::buffer_iterator<PointT> centroids_begin,
+            boost::compute::buffer_iterator<PointT> centroids_end,
+            boost::compute::buffer_iterator<LabelT> labels_begin,
+            boost::compute::buffer_iterator<LabelT> labels_end,
+            boost::compute::buffer_iterator<MassT> masses_begin,
+            boost::compute::buffer_iterator<MassT> masses_end,
+            Measurement::DataPoint& datapoint,
+            boost::compute::wait_list const& events
+            )
+    {
+        assert(points_end - points_begin == (long) (num_points * num_features));
+        assert(centroids_end - centroids_begin == (long) (num_clusters * num_features));
+        assert(labels_end - labels_begin == (long) num_points);
+        assert(masses_end - masses_begin == (long) num_clusters);
+        assert(points_begin.get_index() == 0u);
+        assert(centroids_begin.get_index() == 0u);
+        assert(labels_begin.get_index() == 0u);
+        (void) masses_begin;
+        (void) masses_end;
+
+        datapoint.set_name("CentroidUpdateFixedPoint");
+        KernelWork::centroid_update<PointT, LabelT>(
+                datapoint,
+                num_features,
+                num_points,
+                num_clusters);
+
+        size_t const num_values = num_clusters * num_features;
+        size_t const min_partial_size =
+            this->config.global_size[0] * num_values;
+        if (this->tmp_partial.size() < min_partial_size) {
+            this->tmp_partial = std::move(
+                    Vector<cl_long>(
+                        min_partial_size,
+                        queue.get_context()
+                        ));
+        }
+
+        // A new or resized centroid buffer starts from its current values
+        Accumulator& acc =
+            (*this->accumulators)[centroids_begin.get_buffer().get()];
+        if (acc.sums.size() != num_values) {
+            acc.sums = std::move(
+                    Vector<cl_long>(num_values, queue.get_context()));
+            acc.reset = true;
+        }
+        bool const reset = acc.reset;
+        acc.reset = false;
+
+        PointT const scale = std::ldexp(
+                (PointT) 1,
+                this->config.fixed_point_exponent);
+        PointT const inv_scale = std::ldexp(
+                (PointT) 1,
+                -this->config.fixed_point_exponent);
+
+        Event event;
+        boost::compute::wait_list wait_list = events;
+
+        this->partial_kernel.set_args(
+                points_begin.get_buffer(),
+                this->tmp_partial,
+                labels_begin.get_buffer(),
+                (cl_uint) num_features,
+                (cl_uint) num_points,
+                (cl_uint) num_clusters,
+                scale);
+
+        event = queue.enqueue_1d_range_kernel(
+                this->partial_kernel,
+                0,
+                this->config.global_size[0],
+                this->config.local_size[0],
+                wait_list);
+        datapoint.add_event() = event;
+        wait_list.insert(event);
+
+        event = reduce(
+                queue,
+                this->config.global_size[0],
+                num_values,
+                this->tmp_partial.begin(),
+                this->tmp_partial.begin() + min_partial_size,
+                datapoint.create_child(),
+                wait_list
+                );
+        wait_list.insert(event);
+
+        this->commit_kernel.set_args(
+                centroids_begin.get_buffer(),
+                acc.sums,
+                this->tmp_partial,
+                (cl_uint) num_values,
+                (cl_uint) reset,
+                scale,
+                inv_scale);
+
+        event = queue.enqueue_1d_range_kernel(
+                this->commit_kernel,
+                0,
+                num_values,
+                0,
+                wait_list);
+        datapoint.add_event() = event;
+
+        return event;
+    }
+
+    /*
+     * Restart the sums of centroids from their values on the next call
+     */
+    void reset(boost::compute::buffer const& centroids) {
+        (*this->accumulators)[centroids.get()].reset = true;
+    }
+
+private:
+    struct Accumulator {
+        Vector<cl_long> sums;
+        bool reset = true;
+    };
+
+    // Shared by all copies of the strategy, because the pipelines copy the
+    // strategy function for each iteration
+    using AccumulatorMap = std::map<cl_mem, Accumulator>;
+
+    static constexpr const char* PROGRAM_FILE = CL_KERNEL_FILE_PATH("lloyd_fixed_point.cl");
+    static constexpr const char* PARTIAL_KERNEL_NAME = "fixed_point_partial";
+    static constexpr const char* COMMIT_KERNEL_NAME = "fixed_point_commit";
+
+    Kernel partial_kernel;
+    Kernel commit_kernel;
+    Vector<cl_long> tmp_partial;
+    std::shared_ptr<AccumulatorMap> accumulators;
+    CentroidUpdateConfiguration config;
+    ReduceVectorParcol<cl_long> reduce;
+};
+
+}
+
+#endif /* CENTROID_UPDATE_FIXED_POINT_HPP */
@@ -0,0 +1,280 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef CENTROID_UPDATE_SORTED_SEGMENT_HPP
+#define CENTROID_UPDATE_SORTED_SEGMENT_HPP
+
+#include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
+
+#include "mass_update_global_atomic.hpp"
+
+#include "../centroid_update_configuration.hpp"
+#include "../mass_update_configuration.hpp"
+#include "../measurement/measurement.hpp"
+#include "../utility.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility> // std::move
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/memory/local_buffer.hpp>
+#include <boost/compute/algorithm/fill.hpp>
+
+namespace Clustering {
+
+/*
+ * Centroid update by sorting point indices by label
+ *
+ * Counts the labels with the histogram_global mass update kernel, turns
+ * the counts into bucket offsets and scatters the point indices into their
+ * buckets. Each cluster is then summed up by one work group without
+ * atomics or per-work item copies, so the scratch space is independent of
+ * num_clusters.
+ *
+ * Masses are not read, because the three stage buffered pipeline passes
+ * the masses of all buffers but the labels of a single buffer.
+ */
+template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
+class CentroidUpdateSortedSegment {
+public:
+    using Event = boost::compute::event;
+    using Context = boost::compute::context;
+    using Kernel = boost::compute::kernel;
+    using Program = boost::compute::program;
+    template <typename T>
+    using Vector = boost::compute::vector<T>;
+    template <typename T>
+    using LocalBuffer = boost::compute::local_buffer<T>;
+    // Bucket sizes must hold up to num_points, also for compact labels
+    using CountT = typename std::conditional<
+        std::is_same<uint64_t, LabelT>::value,
+        uint64_t,
+        uint32_t>::type;
+
+    CentroidUpdateSortedSegment() :
+        local_scan(1),
+        local_sums(1)
+    {}
+
+    void prepare(
+            Context context,
+            CentroidUpdateConfiguration config
+            )
+    {
+        static_assert(boost::compute::is_fundamental<PointT>(),
+                "PointT must be a boost compute fundamental type");
+        static_assert(boost::compute::is_fundamental<LabelT>(),
+                "LabelT must be a boost compute fundamental type");
+
+        this->config = config;
+
+        if (not Utility::is_power_of_two(this->config.local_size[0])) {
+            throw std::invalid_argument(
+                    "sorted_segment requires a power of two local_size");
+        }
+
+        std::string defines;
+        defines += " -DCL_INT=uint";
+        defines += " -DCL_POINT=";
+        defines += boost::compute::type_name<PointT>();
+        defines += " -DCL_LABEL=";
+        defines += boost::compute::type_name<LabelT>();
+        defines += " -DCL_COUNT=";
+        defines += boost::compute::type_name<CountT>();
+        if (std::is_same<uint64_t, CountT>::value) {
+            defines += " -DCOUNT64";
+        }
+
+        Program program = Program::create_with_source_file(
+                PROGRAM_FILE,
+                context);
+        try {
+            ProgramCache::build(program, defines);
+        }
+        catch (std::exception e) {
+            std::cerr << program.build_log() << std::endl;
+            throw e;
+        }
+
+        scan_kernel = program.create_kernel(SCAN_KERNEL_NAME);
+        scatter_kernel = program.create_kernel(SCATTER_KERNEL_NAME);
+        sum_kernel = program.create_kernel(SUM_KERNEL_NAME);
+
+        MassUpdateConfiguration histogram_config;
+        histogram_config.platform = config.platform;
+        histogram_config.device = config.device;
+        histogram_config.strategy = "global_atomic";
+        histogram_config.vector_length = 1;
+        for (size_t i = 0; i < 3; ++i) {
+            histogram_config.global_size[i] = config.global_size[i];
+            histogram_config.local_size[i] = config.local_size[i];
+        }
+        histogram.prepare(context, histogram_config);
+    }
+
+    Event operator() (
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters,
+            boost::compute::buffer_iterator<PointT> points_begin,
+            boost::compute::buffer_iterator<PointT> points_end,
+            boost::compute::buffer_iterator<PointT> centroids_begin,
+            boost::compute::buffer_iterator<PointT> centroids_end,
+            boost::compute::buffer_iterator<LabelT> labels_begin,
+            boost::compute::buffer_iterator<LabelT> labels_end,
+            boost::compute::buffer_iterator<MassT> masses_begin,
+            boost::compute::buffer_iterator<MassT> masses_end,
+            Measurement::DataPoint& datapoint,
+            boost::compute::wait_list const& events
+            )
+    {
+        assert(points_end - points_begin == (long) (num_points * num_features));
+        assert(centroids_end - centroids_begin == (long) (num_clusters * num_features));
+        assert(labels_end - labels_begin == (long) num_points);
+        assert(masses_end - masses_begin == (long) num_clusters);
+        assert(points_begin.get_index() == 0u);
+        assert(centroids_begin.get_index() == 0u);
+        assert(labels_begin.get_index() == 0u);
+        (void) masses_begin;
+        (void) masses_end;
+
+        datapoint.set_name("CentroidUpdateSortedSegment");
+        KernelWork::centroid_update<PointT, LabelT>(
+                datapoint,
+                num_features,
+                num_points,
+                num_clusters);
+
+        if (this->counts.size() < num_clusters) {
+            this->counts = std::move(
+                    Vector<CountT>(num_clusters, queue.get_context()));
+            this->offsets = std::move(
+                    Vector<CountT>(num_clusters, queue.get_context()));
+            this->cursors = std::move(
+                    Vector<CountT>(num_clusters, queue.get_context()));
+        }
+        if (this->indices.size() < num_points) {
+            this->indices = std::move(
+                    Vector<cl_uint>(num_points, queue.get_context()));
+        }
+
+        size_t const local_size = this->config.local_size[0];
+        if (this->local_scan.size() != local_size) {
+            this->local_scan = std::move(LocalBuffer<CountT>(local_size));
+            this->local_sums = std::move(LocalBuffer<PointT>(local_size));
+        }
+
+        Event event;
+        boost::compute::wait_list wait_list = events;
+
+        // Bucket sizes
+        event = boost::compute::fill_async(
+                this->counts.begin(),
+                this->counts.begin() + num_clusters,
+                0,
+                queue)
+            .get_event();
+        wait_list.insert(event);
+
+        event = histogram(
+                queue,
+                num_points,
+                num_clusters,
+                labels_begin,
+                labels_end,
+                this->counts.begin(),
+                this->counts.begin() + num_clusters,
+                datapoint.create_child(),
+                wait_list);
+        wait_list.insert(event);
+
+        // Bucket offsets
+        this->scan_kernel.set_args(
+                this->counts,
+                this->offsets,
+                this->cursors,
+                this->local_scan,
+                (cl_uint) num_clusters);
+        event = queue.enqueue_1d_range_kernel(
+                this->scan_kernel,
+                0,
+                local_size,
+                local_size,
+                wait_list);
+        datapoint.add_event() = event;
+        wait_list.insert(event);
+
+        // Sort point indices into buckets
+        this->scatter_kernel.set_args(
+                labels_begin.get_buffer(),
+                this->cursors,
+                this->indices,
+                (cl_uint) num_points);
+        event = queue.enqueue_1d_range_kernel(
+                this->scatter_kernel,
+                0,
+                this->config.global_size[0],
+                local_size,
+                wait_list);
+        datapoint.add_event() = event;
+        wait_list.insert(event);
+
+        // Segmented sums
+        this->sum_kernel.set_args(
+                points_begin.get_buffer(),
+                centroids_begin.get_buffer(),
+                this->indices,
+                this->offsets,
+                this->counts,
+                this->local_sums,
+                (cl_uint) num_features,
+                (cl_uint) num_points,
+                (cl_uint) num_clusters);
+        event = queue.enqueue_1d_range_kernel(
+                this->sum_kernel,
+                0,
+                this->config.global_size[0],
+                local_size,
+                wait_list);
+        datapoint.add_event() = event;
+
+        return event;
+    }
+
+private:
+    static constexpr const char* PROGRAM_FILE = CL_KERNEL_FILE_PATH("lloyd_sorted_segment.cl");
+    static constexpr const char* SCAN_KERNEL_NAME = "sorted_segment_scan";
+    static constexpr const char* SCATTER_KERNEL_NAME = "sorted_segment_scatter";
+    static constexpr const char* SUM_KERNEL_NAME = "sorted_segment_sum";
+
+    Kernel scan_kernel;
+    Kernel scatter_kernel;
+    Kernel sum_kernel;
+    Vector<CountT> counts;
+    Vector<CountT> offsets;
+    Vector<CountT> cursors;
+    Vector<cl_uint> indices;
+    LocalBuffer<CountT> local_scan;
+    LocalBuffer<PointT> local_sums;
+    CentroidUpdateConfiguration config;
+    MassUpdateGlobalAtomic<LabelT, CountT> histogram;
+};
+
+}
+
+#endif /* CENTROID_UPDATE_SORTED_SEGMENT_HPP */
@@ -0,0 +1,139 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+// Cluster SSE helpers, included by the labeling and fused kernels
+//
+// Requires CL_POINT, CL_INT and ccoord2ind() of the including kernel.
+// SSE64 is required for double points.
+//
+// Labels below NUM_SSE_BINS are summed in l_cluster_sse, which holds one
+// column of NUM_SSE_BINS bins per work item. Work items add to their own
+// column without atomics. At the end of the kernel, the columns are
+// reduced with a tree in local memory, and each work group adds one sum
+// per cluster to g_cluster_sse.
+//
+// Larger labels are summed privately while consecutive points of a work
+// item share the label, and added to g_cluster_sse when it changes.
+
+#ifdef SSE64
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#define CL_SSE_BITS ulong
+#define AS_SSE_BITS(X) as_ulong(X)
+#define AS_SSE_POINT(X) as_double(X)
+#define ATOMIC_SSE_CMPXCHG(P, C, V) atom_cmpxchg(P, C, V)
+#else
+#define CL_SSE_BITS uint
+#define AS_SSE_BITS(X) as_uint(X)
+#define AS_SSE_POINT(X) as_float(X)
+#define ATOMIC_SSE_CMPXCHG(P, C, V) atomic_cmpxchg(P, C, V)
+#endif
+
+// Floating point atomic add with compare-and-exchange
+void atomic_add_sse_global(__global CL_POINT *const sum, CL_POINT const value) {
+    volatile __global CL_SSE_BITS *const bits =
+        (volatile __global CL_SSE_BITS *) sum;
+    CL_SSE_BITS current = *bits;
+    CL_SSE_BITS expected;
+
+    do {
+        expected = current;
+        current = ATOMIC_SSE_CMPXCHG(
+                bits,
+                expected,
+                AS_SSE_BITS(AS_SSE_POINT(expected) + value));
+    } while (current != expected);
+}
+
+// Zero the column of this work item. Needs no barrier, as only this work
+// item accesses its column before cluster_sse_reduce.
+void cluster_sse_zero(
+        __local CL_POINT *const restrict l_cluster_sse,
+        CL_INT const NUM_SSE_BINS
+        )
+{
+    for (CL_INT c = 0; c < NUM_SSE_BINS; ++c) {
+        l_cluster_sse[
+            ccoord2ind(get_local_size(0), get_local_id(0), c)
+        ] = 0;
+    }
+}
+
+// Add the squared distance of a point with label
+void cluster_sse_add(
+        __global CL_POINT *const restrict g_cluster_sse,
+        __local CL_POINT *const restrict l_cluster_sse,
+        CL_INT const NUM_SSE_BINS,
+        CL_INT const label,
+        CL_POINT const dist,
+        CL_INT *const restrict run_label,
+        CL_POINT *const restrict run_sse
+        )
+{
+    if (label < NUM_SSE_BINS) {
+        l_cluster_sse[
+            ccoord2ind(get_local_size(0), get_local_id(0), label)
+        ] += dist;
+    }
+    else if (label == *run_label) {
+        *run_sse += dist;
+    }
+    else {
+        if (*run_sse != 0) {
+            atomic_add_sse_global(&g_cluster_sse[*run_label], *run_sse);
+        }
+        *run_label = label;
+        *run_sse = dist;
+    }
+}
+
+// Add the sums of the work group to g_cluster_sse
+//
+// All work items of the work group must call this.
+void cluster_sse_reduce(
+        __global CL_POINT *const restrict g_cluster_sse,
+        __local CL_POINT *const restrict l_cluster_sse,
+        CL_INT const NUM_SSE_BINS,
+        CL_INT const run_label,
+        CL_POINT const run_sse
+        )
+{
+    if (run_sse != 0) {
+        atomic_add_sse_global(&g_cluster_sse[run_label], run_sse);
+    }
+
+    CL_INT const lid = get_local_id(0);
+    CL_INT const num_items = get_local_size(0);
+
+    // Half of the smallest power of two not below num_items
+    CL_INT stride = 1;
+    while (stride < num_items) {
+        stride <<= 1;
+    }
+    stride >>= 1;
+
+    for (; stride > 0; stride >>= 1) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (lid < stride && lid + stride < num_items) {
+            for (CL_INT c = 0; c < NUM_SSE_BINS; ++c) {
+                l_cluster_sse[ccoord2ind(num_items, lid, c)] +=
+                    l_cluster_sse[ccoord2ind(num_items, lid + stride, c)];
+            }
+        }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (CL_INT c = lid; c < NUM_SSE_BINS; c += num_items) {
+        CL_POINT const sse = l_cluster_sse[ccoord2ind(num_items, 0, c)];
+        if (sse != 0) {
+            atomic_add_sse_global(&g_cluster_sse[c], sse);
+        }
+    }
+}
@@ -10,7 +10,10 @@
 #ifndef FUSED_CLUSTER_MERGE_HPP
 #define FUSED_CLUSTER_MERGE_HPP
 
+#include "kernel_args.hpp"
 #include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
 
 #include "reduce_vector_parcol.hpp"
 #include "matrix_binary_op.hpp"
@@ -19,7 +22,9 @@
 #include "../measurement/measurement.hpp"
 #include "../allocator/readonly_allocator.hpp"
 #include "../utility.hpp"
+#include "../point_format.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <string>
 #include <type_traits>
@@ -53,9 +58,11 @@ public:
         g_stride_g_mem_kernel(Utility::log2(MAX_FEATURES)),
         g_stride_l_mem_kernel(Utility::log2(MAX_FEATURES)),
         l_stride_g_mem_kernel(Utility::log2(MAX_FEATURES)),
+        quantize_kernel(Utility::log2(MAX_FEATURES)),
         local_points(1),
         local_new_centroids(1),
-        local_masses(1)
+        local_masses(1),
+        local_compensation(1)
     {}
 
     void prepare(
@@ -74,6 +81,13 @@ public:
                 "PointT must be float or double");
 
         this->config = config;
+        this->point_format = PointFormatHelper::parse(config.point_format);
+
+        if (this->point_format == PointFormat::Int8
+                && this->config.vector_length != 1) {
+            throw std::invalid_argument(
+                    "Int8 points require vector_length 1");
+        }
 
         std::string defines;
         defines += " -DCL_INT=uint";
@@ -81,10 +95,12 @@ public:
         defines += boost::compute::type_name<PointT>();
         if (std::is_same<float, PointT>::value) {
             defines += " -DCL_SINT=int";
+            defines += " -DCL_LABEL_SEL=uint";
             defines += " -DCL_POINT_MAX=FLT_MAX";
         }
         else if (std::is_same<double, PointT>::value) {
             defines += " -DCL_SINT=long";
+            defines += " -DCL_LABEL_SEL=ulong";
             defines += " -DCL_POINT_MAX=DBL_MAX";
         }
         else {
@@ -96,6 +112,20 @@ public:
         defines += boost::compute::type_name<MassT>();
         defines += " -DVEC_LEN=";
         defines += std::to_string(this->config.vector_length);
+        defines += PointFormatHelper::defines<PointT>(
+                this->point_format);
+        if (this->point_format == PointFormat::Int8) {
+            defines += QuantizationArgs<PointT>::defines();
+        }
+        if (this->config.compensated_sum) {
+            defines += " -DKAHAN_SUM";
+        }
+        if (this->config.cluster_sse) {
+            defines += ClusterSseArgs<PointT>::defines();
+        }
+        if (this->config.label_changes) {
+            defines += LabelChangeArgs::defines();
+        }
 
         std::string l_stride_defines = " -DLOCAL_STRIDE";
         std::string g_mem_defines = " -DGLOBAL_MEM";
@@ -121,9 +151,14 @@ public:
             size_t kernel_index = Utility::log2(d) - 1;
 
             try {
-                g_stride_g_mem_program.build(defines + features + g_mem_defines);
+                ProgramCache::build(g_stride_g_mem_program, defines + features + g_mem_defines);
                 g_stride_g_mem_kernel[kernel_index] =
                     g_stride_g_mem_program.create_kernel(KERNEL_NAME);
+                if (this->point_format == PointFormat::Int8) {
+                    quantize_kernel[kernel_index] =
+                        g_stride_g_mem_program.create_kernel(
+                                QuantizationArgs<PointT>::KERNEL_NAME);
+                }
             }
             catch (std::exception e) {
                 std::cerr << g_stride_g_mem_program.build_log() << std::endl;
@@ -131,7 +166,7 @@ public:
             }
 
             try {
-                g_stride_l_mem_program.build(defines + features);
+                ProgramCache::build(g_stride_l_mem_program, defines + features);
                 g_stride_l_mem_kernel[kernel_index] =
                     g_stride_l_mem_program.create_kernel(KERNEL_NAME);
             }
@@ -141,7 +176,7 @@ public:
             }
 
             try {
-                l_stride_g_mem_program.build(defines + features + l_stride_defines + g_mem_defines);
+                ProgramCache::build(l_stride_g_mem_program, defines + features + l_stride_defines + g_mem_defines);
                 l_stride_g_mem_kernel[kernel_index] =
                     l_stride_g_mem_program.create_kernel(KERNEL_NAME);
             }
@@ -185,6 +220,8 @@ public:
                 labels.end(),
                 masses.begin(),
                 masses.end(),
+                boost::compute::buffer_iterator<PointT>(),
+                boost::compute::buffer_iterator<PointT>(),
                 datapoint,
                 events
                 );
@@ -205,12 +242,17 @@ public:
             boost::compute::buffer_iterator<LabelT> labels_end,
             boost::compute::buffer_iterator<MassT> masses_begin,
             boost::compute::buffer_iterator<MassT> masses_end,
+            boost::compute::buffer_iterator<PointT> cluster_sse_begin,
+            boost::compute::buffer_iterator<PointT> cluster_sse_end,
             Measurement::DataPoint& datapoint,
             boost::compute::wait_list const& events
             )
     {
         assert(num_features <= MAX_FEATURES);
-        assert(points_end - points_begin == (long) (num_points * num_features));
+        assert(points_end - points_begin == (long)
+                PointFormatHelper::storage_length<PointT>(
+                    this->point_format,
+                    num_points * num_features));
         assert(old_centroids_end - old_centroids_begin == (long) (num_clusters * num_features));
         assert(new_centroids_end - new_centroids_begin == (long) (num_clusters * num_features));
         assert(labels_end - labels_begin == (long) num_points);
@@ -222,6 +264,12 @@ public:
         assert(masses_begin.get_index() == 0u);
 
         datapoint.set_name("FusedClusterMerge");
+        KernelWork::fused<PointT, LabelT, MassT>(
+                datapoint,
+                points_end - points_begin,
+                num_features,
+                num_points,
+                num_clusters);
 
         size_t const min_centroids_size =
             this->config.global_size[0]
@@ -246,10 +294,16 @@ public:
                         ));
         }
 
+        // Int8 points are cached both as fp32 and, behind them, quantized
         size_t const local_points_size =
             this->config.local_size[0]
             * this->config.vector_length
             * num_features
+            + ((this->point_format == PointFormat::Int8)
+                    ? (this->config.local_size[0] * num_features
+                        + sizeof(PointT) - 1)
+                    / sizeof(PointT)
+                    : 0)
             ;
         if (this->local_points.size() != local_points_size) {
             this->local_points = std::move(
@@ -302,14 +356,16 @@ public:
             device.type() == device.cpu ||
             device.type() == device.accelerator
             ;
-        bool use_local_memory =
-            device.type() == device.gpu &&
-            device.local_memory_size() >
-            (
+        // Compensation doubles the private centroids
+        size_t const centroid_copies = (this->config.compensated_sum) ? 2 : 1;
+        size_t const local_memory_size =
              local_points.size() * sizeof(PointT) +
-             local_new_centroids.size() * sizeof(PointT) +
+             centroid_copies * local_new_centroids.size() * sizeof(PointT) +
              local_masses.size() * sizeof(MassT)
-            )
+             ;
+        bool use_local_memory =
+            device.type() == device.gpu &&
+            device.local_memory_size() > local_memory_size
             ;
         auto& kernel = (use_local_stride)
             ? l_stride_g_mem_kernel[kernel_index]
@@ -344,6 +400,69 @@ public:
                     (cl_uint)num_clusters);
         }
 
+        boost::compute::wait_list kernel_events = events;
+
+        // Label change arguments directly follow NUM_CLUSTERS
+        if (this->config.label_changes) {
+            kernel_events.insert(
+                    this->label_change_args(
+                        queue,
+                        kernel,
+                        kernel.arity()
+                        - LabelChangeArgs::NUM_ARGS
+                        - ((this->config.cluster_sse)
+                            ? ClusterSseArgs<PointT>::NUM_ARGS
+                            : 0)
+                        - ((this->config.compensated_sum) ? 1 : 0)
+                        - ((this->point_format == PointFormat::Int8)
+                            ? QuantizationArgs<PointT>::NUM_ARGS
+                            : 0),
+                        labels_begin.get_buffer()));
+        }
+
+        if (this->point_format == PointFormat::Int8) {
+            kernel_events.insert(
+                    quantization_args(
+                        queue,
+                        kernel,
+                        quantize_kernel[kernel_index],
+                        this->config.point_quantization,
+                        num_features,
+                        num_clusters,
+                        this->ro_centroids.get_buffer(),
+                        events));
+        }
+
+        if (this->config.cluster_sse) {
+            assert(cluster_sse_end - cluster_sse_begin == (long) num_clusters);
+            assert(cluster_sse_begin.get_index() == 0u);
+            // Cluster SSE arguments precede the compensation and Int8
+            // arguments
+            this->cluster_sse_args(
+                    kernel,
+                    kernel.arity()
+                    - ClusterSseArgs<PointT>::NUM_ARGS
+                    - ((this->config.compensated_sum) ? 1 : 0)
+                    - ((this->point_format == PointFormat::Int8)
+                        ? QuantizationArgs<PointT>::NUM_ARGS
+                        : 0),
+                    cluster_sse_begin,
+                    num_clusters,
+                    this->config.local_size[0],
+                    device.local_memory_size(),
+                    device.local_memory_size()
+                    - ((use_local_memory) ? local_memory_size : 0));
+        }
+
+        if (this->config.compensated_sum) {
+            set_compensation_arg(
+                    queue,
+                    kernel,
+                    use_local_memory,
+                    min_centroids_size,
+                    local_new_centroids_size);
+        }
+
         size_t work_offset[3] = {0, 0, 0};
 
         Event event;
@@ -353,7 +472,7 @@ public:
                 work_offset,
                 this->config.global_size,
                 this->config.local_size,
-                events);
+                kernel_events);
 
         datapoint.add_event() = event;
 
@@ -413,8 +532,62 @@ public:
         return event;
     }
 
+    /*
+     * Read which blocks of labels the last kernel on labels changed
+     *
+     * Returns false if label_changes is not set or no kernel ran on labels.
+     */
+    bool changed_blocks(
+            boost::compute::command_queue queue,
+            boost::compute::buffer const& labels,
+            boost::compute::wait_list const& events,
+            std::vector<bool>& blocks) const
+    {
+        return this->config.label_changes
+            and this->label_change_args.changed_blocks(
+                    queue,
+                    labels,
+                    events,
+                    blocks);
+    }
 
 private:
+    // Compensation buffer follows the cluster SSE arguments, before the
+    // Int8 arguments
+    void set_compensation_arg(
+            boost::compute::command_queue queue,
+            Kernel& kernel,
+            bool use_local_memory,
+            size_t min_centroids_size,
+            size_t local_centroids_size)
+    {
+        size_t const index =
+            kernel.arity() - 1
+            - ((this->point_format == PointFormat::Int8)
+                    ? QuantizationArgs<PointT>::NUM_ARGS
+                    : 0);
+
+        if (use_local_memory) {
+            if (this->local_compensation.size() != local_centroids_size) {
+                this->local_compensation = std::move(
+                        LocalBuffer<PointT>(
+                            local_centroids_size
+                            ));
+            }
+            kernel.set_arg(index, this->local_compensation);
+        }
+        else {
+            if (this->tmp_compensation.size() < min_centroids_size) {
+                this->tmp_compensation = std::move(
+                        Vector<PointT>(
+                            min_centroids_size,
+                            queue.get_context()
+                            ));
+            }
+            kernel.set_arg(index, this->tmp_compensation);
+        }
+    }
+
     static constexpr const char* PROGRAM_FILE = CL_KERNEL_FILE_PATH("lloyd_fused_cluster_merge.cl");
     static constexpr const char* KERNEL_NAME = "lloyd_fused_cluster_merge";
     static constexpr const size_t MAX_FEATURES = 1024;
@@ -422,13 +595,20 @@ private:
     std::vector<Kernel> g_stride_g_mem_kernel;
     std::vector<Kernel> g_stride_l_mem_kernel;
     std::vector<Kernel> l_stride_g_mem_kernel;
+    std::vector<Kernel> quantize_kernel;
     Vector<PointT> tmp_new_centroids;
     Vector<MassT> new_masses;
     ReadonlyVector<PointT> ro_centroids;
     LocalBuffer<PointT> local_points;
     LocalBuffer<PointT> local_new_centroids;
     LocalBuffer<MassT> local_masses;
+    Vector<PointT> tmp_compensation;
+    LocalBuffer<PointT> local_compensation;
     FusedConfiguration config;
+    PointFormat point_format;
+    QuantizationArgs<PointT> quantization_args;
+    ClusterSseArgs<PointT> cluster_sse_args;
+    LabelChangeArgs label_change_args;
     ReduceVectorParcol<PointT> reduce_centroids;
     ReduceVectorParcol<MassT> reduce_masses;
     MatrixBinaryOp<PointT, PointT> matrix_add_centroids;
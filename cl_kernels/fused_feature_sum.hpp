@@ -10,7 +10,10 @@
 #ifndef FUSED_FEATURE_SUM_HPP
 #define FUSED_FEATURE_SUM_HPP
 
+#include "kernel_args.hpp"
 #include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
 
 #include "reduce_vector_parcol.hpp"
 #include "matrix_binary_op.hpp"
@@ -19,7 +22,9 @@
 #include "../measurement/measurement.hpp"
 #include "../allocator/readonly_allocator.hpp"
 #include "../utility.hpp"
+#include "../point_format.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <string>
 #include <type_traits>
@@ -53,6 +58,7 @@ public:
         g_stride_g_mem_kernel(Utility::log2(MAX_FEATURES)),
         g_stride_l_mem_kernel(Utility::log2(MAX_FEATURES)),
         l_stride_g_mem_kernel(Utility::log2(MAX_FEATURES)),
+        quantize_kernel(Utility::log2(MAX_FEATURES)),
         local_points(1),
         local_new_centroids(1),
         local_masses(1),
@@ -75,6 +81,13 @@ public:
                 "PointT must be float or double");
 
         this->config = config;
+        this->point_format = PointFormatHelper::parse(config.point_format);
+
+        if (this->point_format == PointFormat::Int8
+                && this->config.vector_length != 1) {
+            throw std::invalid_argument(
+                    "Int8 points require vector_length 1");
+        }
 
         std::string defines;
         defines += " -DCL_INT=uint";
@@ -82,10 +95,12 @@ public:
         defines += boost::compute::type_name<PointT>();
         if (std::is_same<float, PointT>::value) {
             defines += " -DCL_SINT=int";
+            defines += " -DCL_LABEL_SEL=uint";
             defines += " -DCL_POINT_MAX=FLT_MAX";
         }
         else if (std::is_same<double, PointT>::value) {
             defines += " -DCL_SINT=long";
+            defines += " -DCL_LABEL_SEL=ulong";
             defines += " -DCL_POINT_MAX=DBL_MAX";
         }
         defines += " -DCL_LABEL=";
@@ -94,6 +109,17 @@ public:
         defines += boost::compute::type_name<MassT>();
         defines += " -DVEC_LEN=";
         defines += std::to_string(this->config.vector_length);
+        defines += PointFormatHelper::defines<PointT>(
+                this->point_format);
+        if (this->point_format == PointFormat::Int8) {
+            defines += QuantizationArgs<PointT>::defines();
+        }
+        if (this->config.cluster_sse) {
+            defines += ClusterSseArgs<PointT>::defines();
+        }
+        if (this->config.label_changes) {
+            defines += LabelChangeArgs::defines();
+        }
 
         std::string l_stride_defines = " -DLOCAL_STRIDE";
         std::string g_mem_defines = " -DGLOBAL_MEM";
@@ -119,9 +145,14 @@ public:
             size_t kernel_index = Utility::log2(d) - 1;
 
             try {
-                g_stride_g_mem_program.build(defines + features + g_mem_defines);
+                ProgramCache::build(g_stride_g_mem_program, defines + features + g_mem_defines);
                 g_stride_g_mem_kernel[kernel_index] =
                     g_stride_g_mem_program.create_kernel(KERNEL_NAME);
+                if (this->point_format == PointFormat::Int8) {
+                    quantize_kernel[kernel_index] =
+                        g_stride_g_mem_program.create_kernel(
+                                QuantizationArgs<PointT>::KERNEL_NAME);
+                }
             }
             catch (std::exception e) {
                 std::cerr << g_stride_g_mem_program.build_log() << std::endl;
@@ -129,7 +160,7 @@ public:
             }
 
             try {
-                g_stride_l_mem_program.build(defines + features);
+                ProgramCache::build(g_stride_l_mem_program, defines + features);
                 g_stride_l_mem_kernel[kernel_index] =
                     g_stride_l_mem_program.create_kernel(KERNEL_NAME);
             }
@@ -139,7 +170,7 @@ public:
             }
 
             try {
-                l_stride_g_mem_program.build(defines + features + l_stride_defines + g_mem_defines);
+                ProgramCache::build(l_stride_g_mem_program, defines + features + l_stride_defines + g_mem_defines);
                 l_stride_g_mem_kernel[kernel_index] =
                     l_stride_g_mem_program.create_kernel(KERNEL_NAME);
             }
@@ -183,6 +214,8 @@ public:
                 labels.end(),
                 masses.begin(),
                 masses.end(),
+                boost::compute::buffer_iterator<PointT>(),
+                boost::compute::buffer_iterator<PointT>(),
                 datapoint,
                 events
                 );
@@ -203,12 +236,17 @@ public:
             boost::compute::buffer_iterator<LabelT> labels_end,
             boost::compute::buffer_iterator<MassT> masses_begin,
             boost::compute::buffer_iterator<MassT> masses_end,
+            boost::compute::buffer_iterator<PointT> cluster_sse_begin,
+            boost::compute::buffer_iterator<PointT> cluster_sse_end,
             Measurement::DataPoint& datapoint,
             boost::compute::wait_list const& events
             )
     {
         assert(num_features <= MAX_FEATURES);
-        assert(points_end - points_begin == (long) (num_points * num_features));
+        assert(points_end - points_begin == (long)
+                PointFormatHelper::storage_length<PointT>(
+                    this->point_format,
+                    num_points * num_features));
         assert(old_centroids_end - old_centroids_begin == (long) (num_clusters * num_features));
         assert(new_centroids_end - new_centroids_begin == (long) (num_clusters * num_features));
         assert(labels_end - labels_begin == (long) num_points);
@@ -220,6 +258,12 @@ public:
         assert(masses_begin.get_index() == 0u);
 
         datapoint.set_name("FusedFeatureSum");
+        KernelWork::fused<PointT, LabelT, MassT>(
+                datapoint,
+                points_end - points_begin,
+                num_features,
+                num_points,
+                num_clusters);
 
         uint32_t const num_thread_features =
           (this->config.local_size[0] >= num_features)
@@ -251,10 +295,16 @@ public:
                         ));
         }
 
+        // Int8 points are cached both as fp32 and, behind them, quantized
         size_t const local_points_size =
             this->config.local_size[0]
             * this->config.vector_length
             * num_features
+            + ((this->point_format == PointFormat::Int8)
+                    ? (this->config.local_size[0] * num_features
+                        + sizeof(PointT) - 1)
+                    / sizeof(PointT)
+                    : 0)
             ;
         if (this->local_points.size() != local_points_size) {
             this->local_points = std::move(
@@ -318,14 +368,14 @@ public:
             device.type() == device.cpu ||
             device.type() == device.accelerator
             ;
-        bool use_local_memory =
-            device.type() == device.gpu &&
-            device.local_memory_size() >
-            (
+        size_t const local_memory_size =
              local_points_size * sizeof(PointT) +
              local_new_centroids_size * sizeof(PointT) +
              local_masses_size * sizeof(MassT)
-            )
+             ;
+        bool use_local_memory =
+            device.type() == device.gpu &&
+            device.local_memory_size() > local_memory_size
             ;
         auto& kernel = (use_local_stride)
             ? l_stride_g_mem_kernel[kernel_index]
@@ -366,6 +416,58 @@ public:
                 );
         }
 
+        if (this->config.cluster_sse) {
+            assert(cluster_sse_end - cluster_sse_begin == (long) num_clusters);
+            assert(cluster_sse_begin.get_index() == 0u);
+            // Cluster SSE arguments precede the Int8 arguments
+            this->cluster_sse_args(
+                    kernel,
+                    kernel.arity()
+                    - ClusterSseArgs<PointT>::NUM_ARGS
+                    - ((this->point_format == PointFormat::Int8)
+                        ? QuantizationArgs<PointT>::NUM_ARGS
+                        : 0),
+                    cluster_sse_begin,
+                    num_clusters,
+                    this->config.local_size[0],
+                    device.local_memory_size(),
+                    device.local_memory_size()
+                    - local_labels_size * sizeof(LabelT)
+                    - ((use_local_memory) ? local_memory_size : 0));
+        }
+
+        boost::compute::wait_list kernel_events = events;
+
+        // Label change arguments directly follow NUM_THREAD_FEATURES
+        if (this->config.label_changes) {
+            kernel_events.insert(
+                    this->label_change_args(
+                        queue,
+                        kernel,
+                        kernel.arity()
+                        - LabelChangeArgs::NUM_ARGS
+                        - ((this->config.cluster_sse)
+                            ? ClusterSseArgs<PointT>::NUM_ARGS
+                            : 0)
+                        - ((this->point_format == PointFormat::Int8)
+                            ? QuantizationArgs<PointT>::NUM_ARGS
+                            : 0),
+                        labels_begin.get_buffer()));
+        }
+
+        if (this->point_format == PointFormat::Int8) {
+            kernel_events.insert(
+                    quantization_args(
+                        queue,
+                        kernel,
+                        quantize_kernel[kernel_index],
+                        this->config.point_quantization,
+                        num_features,
+                        num_clusters,
+                        this->ro_centroids.get_buffer(),
+                        events));
+        }
+
         size_t work_offset[3] = {0, 0, 0};
 
         Event event;
@@ -375,7 +477,7 @@ public:
                 work_offset,
                 this->config.global_size,
                 this->config.local_size,
-                events);
+                kernel_events);
 
         datapoint.add_event() = event;
 
@@ -443,6 +545,24 @@ public:
         return event;
     }
 
+    /*
+     * Read which blocks of labels the last kernel on labels changed
+     *
+     * Returns false if label_changes is not set or no kernel ran on labels.
+     */
+    bool changed_blocks(
+            boost::compute::command_queue queue,
+            boost::compute::buffer const& labels,
+            boost::compute::wait_list const& events,
+            std::vector<bool>& blocks) const
+    {
+        return this->config.label_changes
+            and this->label_change_args.changed_blocks(
+                    queue,
+                    labels,
+                    events,
+                    blocks);
+    }
 
 private:
     static constexpr const char* PROGRAM_FILE = CL_KERNEL_FILE_PATH("lloyd_fused_feature_sum.cl");
@@ -452,6 +572,7 @@ private:
     std::vector<Kernel> g_stride_g_mem_kernel;
     std::vector<Kernel> g_stride_l_mem_kernel;
     std::vector<Kernel> l_stride_g_mem_kernel;
+    std::vector<Kernel> quantize_kernel;
     Vector<PointT> tmp_new_centroids;
     Vector<MassT> new_masses;
     ReadonlyVector<PointT> ro_centroids;
@@ -460,6 +581,10 @@ private:
     LocalBuffer<MassT> local_masses;
     LocalBuffer<LabelT> local_labels;
     FusedConfiguration config;
+    PointFormat point_format;
+    QuantizationArgs<PointT> quantization_args;
+    ClusterSseArgs<PointT> cluster_sse_args;
+    LabelChangeArgs label_change_args;
     ReduceVectorParcol<PointT> reduce_centroids;
     ReduceVectorParcol<MassT> reduce_masses;
     MatrixBinaryOp<PointT, PointT> matrix_add_centroids;
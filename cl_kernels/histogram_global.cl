@@ -21,9 +21,14 @@
 #endif
 #endif
 
+// Labels may be narrower than the bins
+#ifndef CL_LABEL
+#define CL_LABEL CL_INT
+#endif
+
 __kernel
 void histogram_global(
-            __global CL_INT const *const restrict g_in,
+            __global CL_LABEL const *const restrict g_in,
             __global CL_INT *const restrict g_out,
             const CL_INT NUM_ITEMS,
             const CL_INT NUM_BINS
@@ -19,6 +19,11 @@
 #endif
 #endif
 
+// Labels may be narrower than the bins
+#ifndef CL_LABEL
+#define CL_LABEL CL_INT
+#endif
+
 /*
  * Calculate histogram in paritions per work group
  * 
@@ -28,7 +33,7 @@
  */
 __kernel
 void histogram_part_global(
-            __global CL_INT const *const restrict g_in,
+            __global CL_LABEL const *const restrict g_in,
             __global CL_INT *const restrict g_out,
             const CL_INT NUM_ITEMS,
             const CL_INT NUM_BINS
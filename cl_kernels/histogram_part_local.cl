@@ -19,6 +19,11 @@
 #endif
 #endif
 
+// Labels may be narrower than the bins
+#ifndef CL_LABEL
+#define CL_LABEL CL_INT
+#endif
+
 /*
  * Calculate histogram in paritions per work group
  * 
@@ -28,7 +33,7 @@
  */
 __kernel
 void histogram_part_local(
-            __global CL_INT const *const restrict g_in,
+            __global CL_LABEL const *const restrict g_in,
             __global CL_INT *const restrict g_out,
             __local CL_INT *const restrict l_bins,
             const CL_INT NUM_ITEMS,
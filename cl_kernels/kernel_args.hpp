@@ -0,0 +1,317 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef KERNEL_ARGS_HPP
+#define KERNEL_ARGS_HPP
+
+#include "kernel_path.hpp"
+
+#include "../point_format.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility> // std::move
+#include <vector>
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/algorithm/copy.hpp>
+#include <boost/compute/algorithm/fill.hpp>
+#include <boost/compute/iterator/buffer_iterator.hpp>
+#include <boost/compute/memory/local_buffer.hpp>
+
+namespace Clustering {
+
+/*
+ * Optional kernel arguments shared by the labeling and fused strategies
+ */
+
+/*
+ * Int8 point arguments: per-feature min and scale, and the centroids
+ * rounded to the quantization grid followed by a saturation flag per
+ * cluster. They are the last arguments of the kernels that include
+ * point_int8.cl.
+ */
+template <typename PointT>
+class QuantizationArgs {
+public:
+    using Event = boost::compute::event;
+    using Kernel = boost::compute::kernel;
+    template <typename T>
+    using Vector = boost::compute::vector<T>;
+
+    static constexpr size_t NUM_ARGS = 3;
+    static constexpr const char* KERNEL_NAME = "quantize_centroids_int8";
+
+    /*
+     * Build options for programs that include point_int8.cl
+     */
+    static std::string defines() {
+        return std::string(" -I ") + CL_KERNELS_PATH;
+    }
+
+    /*
+     * Set the Int8 arguments of kernel and quantize the centroids
+     *
+     * quantize_kernel is the quantize_centroids_int8 kernel of the same
+     * NUM_FEATURES. Returns its event, which kernel must wait for.
+     */
+    Event operator() (
+            boost::compute::command_queue queue,
+            Kernel& kernel,
+            Kernel& quantize_kernel,
+            PointQuantization const& quant,
+            size_t num_features,
+            size_t num_clusters,
+            boost::compute::buffer const& centroids,
+            boost::compute::wait_list const& events)
+    {
+        assert(quant.min.size() == num_features);
+        assert(quant.scale.size() == num_features);
+
+        if (this->point_min.size() != num_features
+                || this->quant.min != quant.min
+                || this->quant.scale != quant.scale) {
+            this->point_min = std::move(
+                    Vector<PointT>(
+                        num_features,
+                        queue.get_context()
+                        ));
+            this->point_scale = std::move(
+                    Vector<PointT>(
+                        num_features,
+                        queue.get_context()
+                        ));
+            boost::compute::copy(
+                    quant.min.begin(),
+                    quant.min.end(),
+                    this->point_min.begin(),
+                    queue);
+            boost::compute::copy(
+                    quant.scale.begin(),
+                    quant.scale.end(),
+                    this->point_scale.begin(),
+                    queue);
+            this->quant = quant;
+        }
+
+        size_t const centroids_size = num_clusters * (num_features + 1);
+        if (this->centroids_q.size() < centroids_size) {
+            this->centroids_q = std::move(
+                    Vector<cl_uchar>(
+                        centroids_size,
+                        queue.get_context()
+                        ));
+        }
+
+        quantize_kernel.set_args(
+                centroids,
+                this->centroids_q,
+                this->point_min,
+                this->point_scale,
+                (cl_uint) num_clusters);
+        Event event = queue.enqueue_1d_range_kernel(
+                quantize_kernel,
+                0,
+                num_clusters,
+                0,
+                events);
+
+        size_t const index = kernel.arity() - NUM_ARGS;
+        kernel.set_arg(index, this->point_min);
+        kernel.set_arg(index + 1, this->point_scale);
+        kernel.set_arg(index + 2, this->centroids_q);
+
+        return event;
+    }
+
+private:
+    PointQuantization quant;
+    Vector<PointT> point_min;
+    Vector<PointT> point_scale;
+    Vector<cl_uchar> centroids_q;
+};
+
+/*
+ * Cluster SSE arguments: the SSE per cluster, the local bins and their
+ * number, for kernels that include cluster_sse.cl. Each work item has its
+ * own bins, which are reduced per work group at the end of the kernel.
+ */
+template <typename PointT>
+class ClusterSseArgs {
+public:
+    using Kernel = boost::compute::kernel;
+    template <typename T>
+    using LocalBuffer = boost::compute::local_buffer<T>;
+
+    static constexpr size_t NUM_ARGS = 3;
+
+    ClusterSseArgs() :
+        local_cluster_sse(1)
+    {}
+
+    /*
+     * Build options for programs that include cluster_sse.cl
+     */
+    static std::string defines() {
+        std::string defines = " -DCLUSTER_SSE";
+        if (std::is_same<double, PointT>::value) {
+            defines += " -DSSE64";
+        }
+        defines += std::string(" -I ") + CL_KERNELS_PATH;
+        return defines;
+    }
+
+    /*
+     * Set the cluster SSE arguments of kernel, starting at index
+     *
+     * The bins take at most a quarter of the local memory, such that large
+     * k doesn't limit the number of resident work groups. Clusters beyond
+     * the bins are summed privately and added with global atomics. Returns
+     * the local memory taken by the bins.
+     */
+    size_t operator() (
+            Kernel& kernel,
+            size_t index,
+            boost::compute::buffer_iterator<PointT> cluster_sse_begin,
+            size_t num_clusters,
+            size_t local_size,
+            size_t local_memory_size,
+            size_t free_local_memory)
+    {
+        assert(cluster_sse_begin.get_index() == 0u);
+
+        size_t const bins_memory = std::min(
+                free_local_memory,
+                local_memory_size / LOCAL_MEMORY_FRACTION);
+        size_t const num_sse_bins = std::min(
+                num_clusters,
+                bins_memory / (local_size * sizeof(PointT)));
+        size_t const local_sse_size =
+            std::max(num_sse_bins * local_size, (size_t) 1);
+        if (this->local_cluster_sse.size() != local_sse_size) {
+            this->local_cluster_sse = std::move(
+                    LocalBuffer<PointT>(local_sse_size));
+        }
+
+        kernel.set_arg(index, cluster_sse_begin.get_buffer());
+        kernel.set_arg(index + 1, this->local_cluster_sse);
+        kernel.set_arg(index + 2, (cl_uint) num_sse_bins);
+
+        return num_sse_bins * local_size * sizeof(PointT);
+    }
+
+private:
+    static constexpr size_t LOCAL_MEMORY_FRACTION = 4;
+
+    LocalBuffer<PointT> local_cluster_sse;
+};
+
+/*
+ * Label change arguments: one flag per block of the labels buffer, for
+ * kernels that include label_changes.cl. They directly follow the
+ * mandatory arguments.
+ *
+ * The flags of each labels buffer are kept until they are read with
+ * changed_blocks, which returns them in the format of BufferCache::unlock.
+ * Copies share the flags.
+ */
+class LabelChangeArgs {
+public:
+    using Event = boost::compute::event;
+    using Kernel = boost::compute::kernel;
+    template <typename T>
+    using Vector = boost::compute::vector<T>;
+
+    static constexpr size_t NUM_ARGS = 1;
+    static constexpr size_t NUM_BLOCKS = 64;
+
+    LabelChangeArgs() :
+        flags(std::make_shared<FlagMap>())
+    {}
+
+    /*
+     * Build options for programs that include label_changes.cl
+     */
+    static std::string defines() {
+        return std::string(" -DLABEL_CHANGES -DNUM_CHANGED_BLOCKS=")
+            + std::to_string(NUM_BLOCKS)
+            + " -I " + CL_KERNELS_PATH;
+    }
+
+    /*
+     * Zero the flags of labels and set them as argument index of kernel
+     *
+     * Returns the event of zeroing, which kernel must wait for.
+     */
+    Event operator() (
+            boost::compute::command_queue queue,
+            Kernel& kernel,
+            size_t index,
+            boost::compute::buffer const& labels)
+    {
+        Vector<cl_uchar>& changes = (*this->flags)[labels.get()];
+        if (changes.size() != NUM_BLOCKS) {
+            changes = std::move(
+                    Vector<cl_uchar>(NUM_BLOCKS, queue.get_context()));
+        }
+
+        Event event = boost::compute::fill_async(
+                changes.begin(),
+                changes.end(),
+                (cl_uchar) 0,
+                queue)
+            .get_event();
+
+        kernel.set_arg(index, changes);
+
+        return event;
+    }
+
+    /*
+     * Read the flags of labels after events
+     *
+     * Returns false if no kernel flagged changes of labels.
+     */
+    bool changed_blocks(
+            boost::compute::command_queue queue,
+            boost::compute::buffer const& labels,
+            boost::compute::wait_list const& events,
+            std::vector<bool>& blocks) const
+    {
+        auto it = this->flags->find(labels.get());
+        if (it == this->flags->end()) {
+            return false;
+        }
+
+        std::vector<cl_uchar> changes(NUM_BLOCKS);
+        queue.enqueue_read_buffer(
+                it->second.get_buffer(),
+                0,
+                NUM_BLOCKS,
+                changes.data(),
+                events);
+
+        blocks.assign(changes.begin(), changes.end());
+        return true;
+    }
+
+private:
+    using FlagMap = std::map<cl_mem, Vector<cl_uchar>>;
+
+    std::shared_ptr<FlagMap> flags;
+};
+
+}
+
+#endif /* KERNEL_ARGS_HPP */
@@ -0,0 +1,125 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef KERNEL_WORK_HPP
+#define KERNEL_WORK_HPP
+
+#include "../measurement/measurement.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Clustering {
+
+/*
+ * Analytical work of the k-means stages for the roofline
+ *
+ * Counts the compulsory traffic of a launch, i.e. every input read once and
+ * every output written once, and its floating point operations. Partial
+ * results in scratch buffers are not counted, so strategies that spend
+ * their time on them show up below the roof. The counts are the same for
+ * all vector lengths and unroll factors, which only change how the work is
+ * scheduled.
+ *
+ * point_storage is the length of the point buffer in PointT, which is
+ * smaller than num_points * num_features for quantized points.
+ */
+class KernelWork {
+public:
+    // Distance to each centroid: subtract, multiply and add per feature
+    template <typename PointT, typename LabelT>
+    static void labeling(
+            Measurement::DataPoint& datapoint,
+            size_t point_storage,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters)
+    {
+        datapoint.add_work(
+                point_storage * sizeof(PointT)
+                + num_clusters * num_features * sizeof(PointT),
+                num_points * sizeof(LabelT),
+                3 * (uint64_t) num_points * num_clusters * num_features);
+    }
+
+    // Labeling that also counts the masses
+    template <typename PointT, typename LabelT, typename MassT>
+    static void labeling_mass(
+            Measurement::DataPoint& datapoint,
+            size_t point_storage,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters)
+    {
+        labeling<PointT, LabelT>(
+                datapoint,
+                point_storage,
+                num_features,
+                num_points,
+                num_clusters);
+        datapoint.add_work(0, num_clusters * sizeof(MassT), 0);
+    }
+
+    // Integer counting only
+    template <typename LabelT, typename MassT>
+    static void mass_update(
+            Measurement::DataPoint& datapoint,
+            size_t num_points,
+            size_t num_clusters)
+    {
+        datapoint.add_work(
+                num_points * sizeof(LabelT),
+                num_clusters * sizeof(MassT),
+                0);
+    }
+
+    // One addition per feature, into the current centroids
+    template <typename PointT, typename LabelT>
+    static void centroid_update(
+            Measurement::DataPoint& datapoint,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters)
+    {
+        datapoint.add_work(
+                num_points * num_features * sizeof(PointT)
+                + num_points * sizeof(LabelT)
+                + num_clusters * num_features * sizeof(PointT),
+                num_clusters * num_features * sizeof(PointT),
+                (uint64_t) num_points * num_features);
+    }
+
+    // Labeling, mass update and centroid update in one pass over the points
+    template <typename PointT, typename LabelT, typename MassT>
+    static void fused(
+            Measurement::DataPoint& datapoint,
+            size_t point_storage,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters)
+    {
+        size_t const centroids_size =
+            num_clusters * num_features * sizeof(PointT);
+        size_t const masses_size = num_clusters * sizeof(MassT);
+
+        datapoint.add_work(
+                point_storage * sizeof(PointT)
+                + 2 * centroids_size
+                + masses_size,
+                num_points * sizeof(LabelT)
+                + centroids_size
+                + masses_size,
+                3 * (uint64_t) num_points * num_clusters * num_features
+                + (uint64_t) num_points * num_features);
+    }
+};
+
+}
+
+#endif /* KERNEL_WORK_HPP */
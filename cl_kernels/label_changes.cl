@@ -0,0 +1,46 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+// Label change helpers, included by the labeling and fused kernels
+//
+// Requires CL_INT, CL_LABEL and NUM_CHANGED_BLOCKS.
+//
+// g_label_changes holds one flag per block of the labels buffer. Block i
+// covers the bytes that BufferCache::unlock assigns to the i-th of
+// NUM_CHANGED_BLOCKS equal parts of the buffer content. A flag is set if a
+// label in its block differs from the label it overwrites. The host zeroes
+// the flags before each launch.
+
+// Block of byte b of a labels buffer of length bytes
+ulong label_changes_block(ulong const b, ulong const length) {
+    return ((b + 1) * NUM_CHANGED_BLOCKS - 1) / length;
+}
+
+// Store the label of point r and flag its blocks if it changed
+void label_changes_store(
+        __global CL_LABEL *const restrict g_labels,
+        __global uchar *const restrict g_label_changes,
+        CL_INT const NUM_POINTS,
+        CL_INT const r,
+        CL_LABEL const label
+        )
+{
+    if (g_labels[r] != label) {
+        ulong const length = (ulong) NUM_POINTS * sizeof(CL_LABEL);
+        ulong const first = (ulong) r * sizeof(CL_LABEL);
+        ulong const last = first + sizeof(CL_LABEL) - 1;
+
+        g_label_changes[label_changes_block(first, length)] = 1;
+        g_label_changes[label_changes_block(last, length)] = 1;
+    }
+
+    // Labels are always stored, because the buffer may not hold the labels
+    // of the last iteration, e.g. if it was not copied to the device
+    g_labels[r] = label;
+}
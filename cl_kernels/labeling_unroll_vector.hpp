@@ -10,16 +10,21 @@
 #ifndef LABELING_UNROLL_VECTOR_HPP
 #define LABELING_UNROLL_VECTOR_HPP
 
+#include "kernel_args.hpp"
 #include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
 
 #include "../utility.hpp"
 #include "../labeling_configuration.hpp"
 #include "../measurement/measurement.hpp"
 #include "../allocator/readonly_allocator.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <cassert>
+#include <cstdint>
 #include <string>
 #include <type_traits>
 #include <vector>
@@ -32,7 +37,17 @@
 
 namespace Clustering {
 
-template <typename PointT, typename LabelT, bool ColMajor>
+/*
+ * Labeling with the unroll_vector kernel
+ *
+ * With mass_histogram set, each work group also counts its labels and adds
+ * the counts to the masses, which replaces the separate mass update pass.
+ * The masses must be zeroed before the call. MassT is unused otherwise.
+ *
+ * With label_changes set, the kernel flags the blocks of labels that it
+ * changed, which changed_blocks reports after the kernel has finished.
+ */
+template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
 class LabelingUnrollVector {
 public:
     using Event = boost::compute::event;
@@ -54,10 +69,15 @@ public:
         g_stride_g_mem_kernel(Utility::log2(MAX_FEATURES)),
         g_stride_l_mem_kernel(Utility::log2(MAX_FEATURES)),
         l_stride_g_mem_kernel(Utility::log2(MAX_FEATURES)),
-        local_points(1)
+        local_points(1),
+        local_masses(1)
     {}
 
     void prepare(Context context, LabelingConfiguration config) {
+        static_assert(std::is_same<uint32_t, MassT>::value
+                or std::is_same<uint64_t, MassT>::value,
+                "MassT must be uint32_t or uint64_t");
+
         this->config = config;
 
         std::string defines;
@@ -68,10 +88,12 @@ public:
         defines += boost::compute::type_name<LabelT>();
         if (std::is_same<float, PointT>::value) {
             defines += " -DCL_SINT=int";
+            defines += " -DCL_LABEL_SEL=uint";
             defines += " -DCL_POINT_MAX=FLT_MAX";
         }
         else if (std::is_same<double, PointT>::value) {
             defines += " -DCL_SINT=long";
+            defines += " -DCL_LABEL_SEL=ulong";
             defines += " -DCL_POINT_MAX=DBL_MAX";
         }
         else {
@@ -80,6 +102,20 @@ public:
 
         defines += " -DVEC_LEN="
             + std::to_string(this->config.vector_length);
+        if (this->config.mass_histogram) {
+            defines += " -DCL_MASS=";
+            defines += boost::compute::type_name<MassT>();
+            defines += " -DMASS_HISTOGRAM";
+            if (std::is_same<uint64_t, MassT>::value) {
+                defines += " -DMASS64";
+            }
+        }
+        if (this->config.cluster_sse) {
+            defines += ClusterSseArgs<PointT>::defines();
+        }
+        if (this->config.label_changes) {
+            defines += LabelChangeArgs::defines();
+        }
 
         std::string l_stride_defines = " -DLOCAL_STRIDE";
         std::string g_mem_defines = " -DGLOBAL_MEM";
@@ -103,7 +139,7 @@ public:
             size_t kernel_index = Utility::log2(d) - 1;
 
             try {
-                g_stride_g_mem_program.build(defines + features + g_mem_defines);
+                ProgramCache::build(g_stride_g_mem_program, defines + features + g_mem_defines);
                 g_stride_g_mem_kernel[kernel_index] =
                     g_stride_g_mem_program.create_kernel(KERNEL_NAME);
             }
@@ -113,7 +149,7 @@ public:
             }
 
             try {
-                g_stride_l_mem_program.build(defines + features);
+                ProgramCache::build(g_stride_l_mem_program, defines + features);
                 g_stride_l_mem_kernel[kernel_index] =
                     g_stride_l_mem_program.create_kernel(KERNEL_NAME);
             }
@@ -123,7 +159,8 @@ public:
             }
 
             try {
-                l_stride_g_mem_program.build(
+                ProgramCache::build(
+                        l_stride_g_mem_program,
                         defines + features + l_stride_defines + g_mem_defines
                         );
                 l_stride_g_mem_kernel[kernel_index] =
@@ -160,6 +197,8 @@ public:
                 centroids.end(),
                 labels.begin(),
                 labels.end(),
+                boost::compute::buffer_iterator<PointT>(),
+                boost::compute::buffer_iterator<PointT>(),
                 datapoint,
                 events
                 );
@@ -176,6 +215,49 @@ public:
             boost::compute::buffer_iterator<PointT> centroids_end,
             boost::compute::buffer_iterator<LabelT> labels_begin,
             boost::compute::buffer_iterator<LabelT> labels_end,
+            boost::compute::buffer_iterator<PointT> cluster_sse_begin,
+            boost::compute::buffer_iterator<PointT> cluster_sse_end,
+            Measurement::DataPoint& datapoint,
+            boost::compute::wait_list const& events
+            )
+    {
+        assert(not this->config.mass_histogram);
+
+        return (*this)(
+                queue,
+                num_features,
+                num_points,
+                num_clusters,
+                points_begin,
+                points_end,
+                centroids_begin,
+                centroids_end,
+                labels_begin,
+                labels_end,
+                boost::compute::buffer_iterator<MassT>(),
+                boost::compute::buffer_iterator<MassT>(),
+                cluster_sse_begin,
+                cluster_sse_end,
+                datapoint,
+                events
+                );
+    }
+
+    Event operator() (
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters,
+            boost::compute::buffer_iterator<PointT> points_begin,
+            boost::compute::buffer_iterator<PointT> points_end,
+            boost::compute::buffer_iterator<PointT> centroids_begin,
+            boost::compute::buffer_iterator<PointT> centroids_end,
+            boost::compute::buffer_iterator<LabelT> labels_begin,
+            boost::compute::buffer_iterator<LabelT> labels_end,
+            boost::compute::buffer_iterator<MassT> masses_begin,
+            boost::compute::buffer_iterator<MassT> masses_end,
+            boost::compute::buffer_iterator<PointT> cluster_sse_begin,
+            boost::compute::buffer_iterator<PointT> cluster_sse_end,
             Measurement::DataPoint& datapoint,
             boost::compute::wait_list const& events
             )
@@ -190,6 +272,22 @@ public:
         assert(labels_begin.get_index() == 0u);
 
         datapoint.set_name("LabelingUnrollVector");
+        if (this->config.mass_histogram) {
+            KernelWork::labeling_mass<PointT, LabelT, MassT>(
+                    datapoint,
+                    points_end - points_begin,
+                    num_features,
+                    num_points,
+                    num_clusters);
+        }
+        else {
+            KernelWork::labeling<PointT, LabelT>(
+                    datapoint,
+                    points_end - points_begin,
+                    num_features,
+                    num_points,
+                    num_clusters);
+        }
 
         size_t const local_points_size =
             this->config.local_size[0]
@@ -238,6 +336,10 @@ public:
             ;
         size_t kernel_index = Utility::log2(num_features) - 1;
 
+        size_t free_local_memory =
+            device.local_memory_size()
+            - ((use_local_memory) ? local_points_size * sizeof(PointT) : 0);
+
         if (use_local_memory) {
             kernel[kernel_index].set_args(
                     points_begin.get_buffer(),
@@ -256,6 +358,48 @@ public:
                     (cl_uint) num_clusters);
         }
 
+        if (this->config.mass_histogram) {
+            assert(masses_end - masses_begin == (long) num_clusters);
+            assert(masses_begin.get_index() == 0u);
+            free_local_memory -= set_mass_args(
+                    kernel[kernel_index],
+                    masses_begin,
+                    num_clusters,
+                    device.local_memory_size(),
+                    free_local_memory);
+        }
+
+        // Cluster SSE arguments are the last arguments
+        if (this->config.cluster_sse) {
+            assert(cluster_sse_end - cluster_sse_begin == (long) num_clusters);
+            this->cluster_sse_args(
+                    kernel[kernel_index],
+                    kernel[kernel_index].arity()
+                    - ClusterSseArgs<PointT>::NUM_ARGS,
+                    cluster_sse_begin,
+                    num_clusters,
+                    this->config.local_size[0],
+                    device.local_memory_size(),
+                    free_local_memory);
+        }
+
+        boost::compute::wait_list kernel_events = events;
+
+        // Label change arguments directly follow NUM_CLUSTERS
+        if (this->config.label_changes) {
+            kernel_events.insert(
+                    this->label_change_args(
+                        queue,
+                        kernel[kernel_index],
+                        kernel[kernel_index].arity()
+                        - LabelChangeArgs::NUM_ARGS
+                        - ((this->config.mass_histogram) ? 3 : 0)
+                        - ((this->config.cluster_sse)
+                            ? ClusterSseArgs<PointT>::NUM_ARGS
+                            : 0),
+                        labels_begin.get_buffer()));
+        }
+
         size_t work_offset[3] = {0, 0, 0};
 
         Event event;
@@ -265,23 +409,85 @@ public:
                 work_offset,
                 this->config.global_size,
                 this->config.local_size,
-                events);
+                kernel_events);
 
         datapoint.add_event() = event;
         return event;
     }
 
+    /*
+     * Read which blocks of labels the last kernel on labels changed
+     *
+     * Returns false if label_changes is not set or no kernel ran on labels.
+     */
+    bool changed_blocks(
+            boost::compute::command_queue queue,
+            boost::compute::buffer const& labels,
+            boost::compute::wait_list const& events,
+            std::vector<bool>& blocks) const
+    {
+        return this->config.label_changes
+            and this->label_change_args.changed_blocks(
+                    queue,
+                    labels,
+                    events,
+                    blocks);
+    }
+
 private:
+    // Mass buffer, local bins and number of local bins follow
+    // NUM_CLUSTERS. The bins take at most a quarter of the local memory,
+    // such that large k doesn't limit the number of resident work groups.
+    // Clusters beyond the bins are counted with global atomics. Returns the
+    // local memory taken by the bins.
+    size_t set_mass_args(
+            Kernel& kernel,
+            boost::compute::buffer_iterator<MassT> masses_begin,
+            size_t num_clusters,
+            size_t local_memory_size,
+            size_t free_local_memory)
+    {
+        size_t const index =
+            kernel.arity() - 3
+            - ((this->config.cluster_sse)
+                    ? ClusterSseArgs<PointT>::NUM_ARGS
+                    : 0);
+
+        size_t const bins_memory = std::min(
+                free_local_memory,
+                local_memory_size / LOCAL_BINS_FRACTION);
+        size_t const num_mass_bins = std::min(
+                num_clusters,
+                bins_memory / sizeof(MassT));
+        if (this->local_masses.size()
+                != std::max(num_mass_bins, (size_t) 1)) {
+            this->local_masses = std::move(
+                    LocalBuffer<MassT>(
+                        std::max(num_mass_bins, (size_t) 1)
+                        ));
+        }
+
+        kernel.set_arg(index, masses_begin.get_buffer());
+        kernel.set_arg(index + 1, this->local_masses);
+        kernel.set_arg(index + 2, (cl_uint) num_mass_bins);
+
+        return num_mass_bins * sizeof(MassT);
+    }
+
     static constexpr const char* PROGRAM_FILE = CL_KERNEL_FILE_PATH("lloyd_labeling_vp_clcp.cl");
     static constexpr const char* KERNEL_NAME = "lloyd_labeling_vp_clcp";
     static constexpr const size_t MAX_FEATURES = 1024;
+    static constexpr const size_t LOCAL_BINS_FRACTION = 4;
 
     std::vector<Kernel> g_stride_g_mem_kernel;
     std::vector<Kernel> g_stride_l_mem_kernel;
     std::vector<Kernel> l_stride_g_mem_kernel;
     ReadonlyVector<PointT> ro_centroids;
     LocalBuffer<PointT> local_points;
+    LocalBuffer<MassT> local_masses;
     LabelingConfiguration config;
+    ClusterSseArgs<PointT> cluster_sse_args;
+    LabelChangeArgs label_change_args;
 
 };
 
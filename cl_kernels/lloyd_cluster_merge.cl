@@ -12,6 +12,11 @@
 //
 // #define GLOBAL_MEM
 // Default: local memory cache
+//
+// #define KAHAN_SUM
+// Compensated summation of the private centroids. The compensation of
+// each sum is kept in a buffer of the same layout, passed as the last
+// kernel argument.
 
 #ifndef CL_INT
 #define CL_INT ulong
@@ -48,6 +53,18 @@
 #define VSTORE(DATA, P) VSTORE_JUMP_2(DATA, P, VEC_LEN)
 #endif
 
+#ifdef KAHAN_SUM
+#define ADD_POINT(SUM, COMP, X)                                         \
+    do {                                                                \
+        CL_POINT const y_ = (X) - (COMP);                               \
+        CL_POINT const t_ = (SUM) + y_;                                 \
+        (COMP) = (t_ - (SUM)) - y_;                                     \
+        (SUM) = t_;                                                     \
+    } while (false)
+#else
+#define ADD_POINT(SUM, COMP, X) (SUM) += (X)
+#endif
+
 CL_INT ccoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
     return dim * col + row;
 }
@@ -69,6 +86,13 @@ void lloyd_cluster_merge(
         CL_INT const NUM_FEATURES,
         CL_INT const NUM_POINTS,
         CL_INT const NUM_CLUSTERS
+#if defined(KAHAN_SUM) && defined(GLOBAL_MEM)
+        ,
+        __global CL_POINT *const restrict g_compensation
+#elif defined(KAHAN_SUM)
+        ,
+        __local CL_POINT *const restrict l_compensation
+#endif
         )
 {
     CL_INT const g_cluster_offset =
@@ -83,12 +107,20 @@ void lloyd_cluster_merge(
             g_centroids[
                 g_cluster_offset + ccoord2ind(NUM_CLUSTERS, c, f)
             ] = 0;
+#ifdef KAHAN_SUM
+            g_compensation[
+                g_cluster_offset + ccoord2ind(NUM_CLUSTERS, c, f)
+            ] = 0;
+#endif
         }
     }
 #else
     for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
         for (CL_INT c = 0; c < NUM_CLUSTERS; ++c) {
             l_centroids[ccoord2abc(NUM_CLUSTERS, c, f)] = 0;
+#ifdef KAHAN_SUM
+            l_compensation[ccoord2abc(NUM_CLUSTERS, c, f)] = 0;
+#endif
         }
     }
 
@@ -131,17 +163,26 @@ void lloyd_cluster_merge(
 #if VEC_LEN > 1
 #ifdef GLOBAL_MEM
 #define BASE_STEP(NUM)                                                  \
-            g_centroids[                                                \
-                g_cluster_offset +                                      \
-                ccoord2ind(NUM_CLUSTERS, label.s ## NUM, f)             \
-            ] += point.s ## NUM;
+            ADD_POINT(                                                  \
+                    g_centroids[                                        \
+                        g_cluster_offset +                              \
+                        ccoord2ind(NUM_CLUSTERS, label.s ## NUM, f)     \
+                    ],                                                  \
+                    g_compensation[                                     \
+                        g_cluster_offset +                              \
+                        ccoord2ind(NUM_CLUSTERS, label.s ## NUM, f)     \
+                    ],                                                  \
+                    point.s ## NUM);
 #else
 #define BASE_STEP(NUM)                                                  \
-            l_centroids[                                                \
-                ccoord2abc(                          \
-                        NUM_CLUSTERS, label.s ## NUM, f                 \
-                        )                                               \
-            ] += point.s ## NUM;
+            ADD_POINT(                                                  \
+                    l_centroids[                                        \
+                        ccoord2abc(NUM_CLUSTERS, label.s ## NUM, f)     \
+                    ],                                                  \
+                    l_compensation[                                     \
+                        ccoord2abc(NUM_CLUSTERS, label.s ## NUM, f)     \
+                    ],                                                  \
+                    point.s ## NUM);
 #endif
 
 #define REP_STEP_2 BASE_STEP(0) BASE_STEP(1)
@@ -157,13 +198,19 @@ void lloyd_cluster_merge(
             REP_STEP(VEC_LEN);
 #else
 #ifdef GLOBAL_MEM
-            g_centroids[
-                g_cluster_offset + ccoord2ind(NUM_CLUSTERS, label, f)
-            ] += point;
+            ADD_POINT(
+                    g_centroids[
+                        g_cluster_offset + ccoord2ind(NUM_CLUSTERS, label, f)
+                    ],
+                    g_compensation[
+                        g_cluster_offset + ccoord2ind(NUM_CLUSTERS, label, f)
+                    ],
+                    point);
 #else
-            l_centroids[
-                ccoord2abc(NUM_CLUSTERS, label, f)
-            ] += point;
+            ADD_POINT(
+                    l_centroids[ccoord2abc(NUM_CLUSTERS, label, f)],
+                    l_compensation[ccoord2abc(NUM_CLUSTERS, label, f)],
+                    point);
 #endif
 #endif
 
@@ -171,6 +218,16 @@ void lloyd_cluster_merge(
 
     }
 
+#if defined(KAHAN_SUM) && defined(GLOBAL_MEM)
+    // Apply compensation
+    for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+        for (CL_INT c = 0; c < NUM_CLUSTERS; ++c) {
+            CL_INT const i = g_cluster_offset + ccoord2ind(NUM_CLUSTERS, c, f);
+            g_centroids[i] -= g_compensation[i];
+        }
+    }
+#endif
+
 #ifndef GLOBAL_MEM
     barrier(CLK_LOCAL_MEM_FENCE);
 
@@ -179,6 +236,9 @@ void lloyd_cluster_merge(
             CL_POINT centroid = l_centroids[
                 ccoord2abc(NUM_CLUSTERS, c, f)
             ];
+#ifdef KAHAN_SUM
+            centroid -= l_compensation[ccoord2abc(NUM_CLUSTERS, c, f)];
+#endif
             g_centroids[
                 g_cluster_offset + ccoord2ind(NUM_CLUSTERS, c, f)
             ] = centroid;
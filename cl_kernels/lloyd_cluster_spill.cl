@@ -0,0 +1,301 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+// #define LOCAL_STRIDE
+// Default: global stride access
+//
+// #define GLOBAL_MEM
+// Default: local memory cache
+//
+// Centroid update with private copies of hot clusters only
+//
+// The NUM_HOT clusters with the largest masses are summed up in private
+// copies, as in lloyd_cluster_merge. All other clusters are added to the
+// centroids with atomics. cluster_spill_sort orders the clusters by mass,
+// cluster_spill_slots assigns the hot slots, and cluster_spill_merge adds
+// the reduced hot copies to the centroids.
+//
+// Native float atomics are used if the program is built as OpenCL C 3.0
+// on a device with cl_ext_float_atomics. Otherwise, atomics fall back to
+// compare and exchange loops.
+
+#ifndef CL_INT
+#define CL_INT uint
+#endif
+
+// Unsigned integer of the same size as CL_POINT
+// float -> uint ; double -> ulong
+#ifndef CL_POINT_UINT
+#define CL_POINT_UINT uint
+#endif
+
+#ifndef CL_POINT
+#define CL_POINT float
+#endif
+
+#ifndef CL_LABEL
+#define CL_LABEL uint
+#endif
+
+#ifndef CL_MASS
+#define CL_MASS uint
+#endif
+
+#ifdef POINT_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#define ATOMIC_CMPXCHG(P, CMP, VAL) atom_cmpxchg(P, CMP, VAL)
+#define AS_POINT(X) as_double(X)
+#define AS_POINT_UINT(X) as_ulong(X)
+#if defined(cl_ext_float_atomics) \
+    && defined(__opencl_c_ext_fp64_global_atomic_add) \
+    && defined(__opencl_c_atomic_scope_device)
+#define NATIVE_ATOMIC_ADD
+#define ATOMIC_POINT atomic_double
+#endif
+#else
+#define ATOMIC_CMPXCHG(P, CMP, VAL) atomic_cmpxchg(P, CMP, VAL)
+#define AS_POINT(X) as_float(X)
+#define AS_POINT_UINT(X) as_uint(X)
+#if defined(cl_ext_float_atomics) \
+    && defined(__opencl_c_ext_fp32_global_atomic_add) \
+    && defined(__opencl_c_atomic_scope_device)
+#define NATIVE_ATOMIC_ADD
+#define ATOMIC_POINT atomic_float
+#endif
+#endif
+
+CL_INT ccoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
+    return dim * col + row;
+}
+
+// Anti-bank conflict column major indexing
+// Warning: Use only for local memory buffers
+CL_INT ccoord2abc(CL_INT dim, CL_INT row, CL_INT col) {
+    return get_local_size(0) * (dim * col + row) + get_local_id(0);
+}
+
+void atomic_add_point(
+        volatile __global CL_POINT *const p,
+        CL_POINT const value
+        )
+{
+#ifdef NATIVE_ATOMIC_ADD
+    atomic_fetch_add_explicit(
+            (volatile __global ATOMIC_POINT *) p,
+            value,
+            memory_order_relaxed,
+            memory_scope_device);
+#else
+    volatile __global CL_POINT_UINT *const ip =
+        (volatile __global CL_POINT_UINT *) p;
+    CL_POINT_UINT old = *ip;
+    CL_POINT_UINT assumed;
+
+    do {
+        assumed = old;
+        old = ATOMIC_CMPXCHG(
+                ip,
+                assumed,
+                AS_POINT_UINT(AS_POINT(assumed) + value));
+    } while (old != assumed);
+#endif
+}
+
+// Order of clusters by descending mass, ties are broken by cluster index
+//
+// Indices of at least NUM_CLUSTERS are padding and order last.
+bool cluster_spill_before(
+        __global CL_MASS const *const restrict g_masses,
+        CL_INT const a,
+        CL_INT const b,
+        CL_INT const NUM_CLUSTERS
+        )
+{
+    CL_MASS const mass_a = (a < NUM_CLUSTERS) ? g_masses[a] : 0;
+    CL_MASS const mass_b = (b < NUM_CLUSTERS) ? g_masses[b] : 0;
+
+    return mass_a > mass_b || (mass_a == mass_b && a < b);
+}
+
+// Step of a bitonic sort of the cluster indices in g_order
+//
+// g_order holds the indices 0 to n - 1, for n the number of clusters
+// rounded up to a power of two. The host launches the steps for BLOCK = 2,
+// 4, ..., n and STRIDE = BLOCK / 2, ..., 1. Global size is n / 2.
+__kernel
+void cluster_spill_sort(
+        __global CL_MASS const *const restrict g_masses,
+        __global CL_INT *const restrict g_order,
+        CL_INT const NUM_CLUSTERS,
+        CL_INT const BLOCK,
+        CL_INT const STRIDE
+        )
+{
+    CL_INT const t = get_global_id(0);
+    CL_INT const i = 2 * STRIDE * (t / STRIDE) + t % STRIDE;
+    CL_INT const j = i + STRIDE;
+
+    CL_INT const a = g_order[i];
+    CL_INT const b = g_order[j];
+
+    bool const forward = (i & BLOCK) == 0;
+    bool const swap = (forward)
+        ? cluster_spill_before(g_masses, b, a, NUM_CLUSTERS)
+        : cluster_spill_before(g_masses, a, b, NUM_CLUSTERS)
+        ;
+
+    if (swap) {
+        g_order[i] = b;
+        g_order[j] = a;
+    }
+}
+
+// Assign the first NUM_HOT clusters of g_order to the hot slots
+//
+// Global size must be at least NUM_CLUSTERS.
+__kernel
+void cluster_spill_slots(
+        __global CL_INT const *const restrict g_order,
+        __global int *const restrict g_slots,
+        CL_INT const NUM_CLUSTERS,
+        CL_INT const NUM_HOT
+        )
+{
+    CL_INT const rank = get_global_id(0);
+
+    if (rank >= NUM_CLUSTERS) {
+        return;
+    }
+
+    g_slots[g_order[rank]] = (rank < NUM_HOT) ? (int) rank : -1;
+}
+
+__kernel
+void cluster_spill(
+        __global CL_POINT const *const restrict g_points,
+        __global CL_POINT *const restrict g_centroids,
+        __global CL_POINT *const restrict g_hot_centroids,
+        __global CL_LABEL const *const restrict g_labels,
+        __global int const *const restrict g_slots,
+#ifndef GLOBAL_MEM
+        __local CL_POINT *const restrict l_hot_centroids,
+#endif
+        CL_INT const NUM_FEATURES,
+        CL_INT const NUM_POINTS,
+        CL_INT const NUM_CLUSTERS,
+        CL_INT const NUM_HOT
+        )
+{
+    CL_INT const g_hot_offset =
+        get_global_id(0)
+        * NUM_FEATURES
+        * NUM_HOT;
+
+    // Zero hot centroids
+#ifdef GLOBAL_MEM
+    for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+        for (CL_INT h = 0; h < NUM_HOT; ++h) {
+            g_hot_centroids[
+                g_hot_offset + ccoord2ind(NUM_HOT, h, f)
+            ] = 0;
+        }
+    }
+#else
+    for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+        for (CL_INT h = 0; h < NUM_HOT; ++h) {
+            l_hot_centroids[ccoord2abc(NUM_HOT, h, f)] = 0;
+        }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+#endif
+
+    CL_INT r;
+#ifdef LOCAL_STRIDE
+    CL_INT stride = get_local_size(0);
+    CL_INT block_size =
+        (NUM_POINTS + get_num_groups(0) - 1) / get_num_groups(0);
+    CL_INT group_start_offset = get_group_id(0) * block_size;
+    CL_INT start_offset = group_start_offset + get_local_id(0);
+    CL_INT real_block_size =
+        (group_start_offset + block_size > NUM_POINTS)
+        ? sub_sat(NUM_POINTS, group_start_offset)
+        : block_size
+        ;
+
+    for (
+            r = start_offset;
+            r < group_start_offset + real_block_size;
+            r += stride
+        )
+#else
+    for (
+            r = get_global_id(0);
+            r < NUM_POINTS;
+            r += get_global_size(0)
+        )
+#endif
+    {
+        CL_LABEL const label = g_labels[r];
+        int const slot = g_slots[label];
+
+        if (slot >= 0) {
+            for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+                CL_POINT point = g_points[ccoord2ind(NUM_POINTS, r, f)];
+#ifdef GLOBAL_MEM
+                g_hot_centroids[
+                    g_hot_offset + ccoord2ind(NUM_HOT, slot, f)
+                ] += point;
+#else
+                l_hot_centroids[ccoord2abc(NUM_HOT, slot, f)] += point;
+#endif
+            }
+        }
+        else {
+            for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+                CL_POINT point = g_points[ccoord2ind(NUM_POINTS, r, f)];
+                atomic_add_point(
+                        &g_centroids[ccoord2ind(NUM_CLUSTERS, label, f)],
+                        point);
+            }
+        }
+    }
+
+#ifndef GLOBAL_MEM
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+        for (CL_INT h = 0; h < NUM_HOT; ++h) {
+            g_hot_centroids[
+                g_hot_offset + ccoord2ind(NUM_HOT, h, f)
+            ] = l_hot_centroids[ccoord2abc(NUM_HOT, h, f)];
+        }
+    }
+#endif
+}
+
+// Add the reduced hot centroids to their clusters
+//
+// Global size is NUM_HOT * NUM_FEATURES.
+__kernel
+void cluster_spill_merge(
+        __global CL_POINT *const restrict g_centroids,
+        __global CL_POINT const *const restrict g_hot_centroids,
+        __global CL_INT const *const restrict g_hot_clusters,
+        CL_INT const NUM_CLUSTERS,
+        CL_INT const NUM_HOT
+        )
+{
+    CL_INT const i = get_global_id(0);
+    CL_INT const h = i % NUM_HOT;
+    CL_INT const f = i / NUM_HOT;
+    CL_INT const c = g_hot_clusters[h];
+
+    g_centroids[ccoord2ind(NUM_CLUSTERS, c, f)] += g_hot_centroids[i];
+}
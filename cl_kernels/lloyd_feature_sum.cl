@@ -23,6 +23,22 @@
 #define VEC_LEN 4
 #endif
 
+// #define KAHAN_SUM
+// Compensated summation in lloyd_feature_sum_sequential. The compensation
+// of each sum is kept in a buffer of the same layout, passed as the last
+// kernel argument.
+#ifdef KAHAN_SUM
+#define ADD_POINT(SUM, COMP, X)                                         \
+    do {                                                                \
+        CL_POINT const y_ = (X) - (COMP);                               \
+        CL_POINT const t_ = (SUM) + y_;                                 \
+        (COMP) = (t_ - (SUM)) - y_;                                     \
+        (SUM) = t_;                                                     \
+    } while (false)
+#else
+#define ADD_POINT(SUM, COMP, X) (SUM) += (X)
+#endif
+
 #define CONCAT_EXPANDED(NAME, LEN) NAME##LEN
 #define CONCAT(NAME, LEN) CONCAT_EXPANDED(NAME, LEN)
 
@@ -41,6 +57,10 @@ void lloyd_feature_sum_sequential(
         const CL_INT NUM_FEATURES,
         const CL_INT NUM_POINTS,
         const CL_INT NUM_CLUSTERS
+#ifdef KAHAN_SUM
+        ,
+        __global CL_POINT *const restrict g_compensation
+#endif
         )
 {
     CL_INT const feature = get_global_id(0) % NUM_FEATURES;
@@ -66,6 +86,9 @@ void lloyd_feature_sum_sequential(
         )
     {
         g_centroids[i] = 0;
+#ifdef KAHAN_SUM
+        g_compensation[i] = 0;
+#endif
     }
 
     for (
@@ -78,10 +101,21 @@ void lloyd_feature_sum_sequential(
         CL_LABEL label = g_labels[p];
         CL_POINT point = g_points[ccoord2ind(NUM_POINTS, p, feature)];
 
-        g_centroids[
-            centroid_offset + ccoord2ind(NUM_CLUSTERS, label, feature)
-        ] += point;
+        CL_INT const i =
+            centroid_offset + ccoord2ind(NUM_CLUSTERS, label, feature);
+        ADD_POINT(g_centroids[i], g_compensation[i], point);
     }
+
+#ifdef KAHAN_SUM
+    for (
+            CL_INT i = feature_offset;
+            i < feature_offset + NUM_CLUSTERS;
+            ++i
+        )
+    {
+        g_centroids[i] -= g_compensation[i];
+    }
+#endif
 }
 
 __kernel
@@ -0,0 +1,111 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+// Deterministic centroid update in 64-bit fixed point
+//
+// Points are rounded to multiples of 1 / SCALE and summed as integers.
+// Integer addition is associative, so the sums do not depend on the order
+// in which work items, work groups or buffer chunks are added up.
+//
+// fixed_point_partial sums each work item's points into a private copy of
+// the centroids in global memory. The copies are reduced with
+// reduce_vector_parcol. fixed_point_commit adds the reduced sums to an
+// accumulator that persists across calls and writes the accumulator back
+// as CL_POINT. The host restarts the accumulator with RESET at the start of
+// each iteration.
+
+#ifndef CL_INT
+#define CL_INT uint
+#endif
+
+#ifndef CL_POINT
+#define CL_POINT float
+#endif
+
+#ifndef CL_LABEL
+#define CL_LABEL uint
+#endif
+
+#ifdef POINT_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#define CONVERT_POINT(X) convert_double_rte(X)
+#else
+#define CONVERT_POINT(X) convert_float_rte(X)
+#endif
+
+CL_INT ccoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
+    return dim * col + row;
+}
+
+__kernel
+void fixed_point_partial(
+        __global CL_POINT const *const restrict g_points,
+        __global long *const restrict g_partial,
+        __global CL_LABEL const *const restrict g_labels,
+        CL_INT const NUM_FEATURES,
+        CL_INT const NUM_POINTS,
+        CL_INT const NUM_CLUSTERS,
+        CL_POINT const SCALE
+        )
+{
+    CL_INT const g_cluster_offset =
+        get_global_id(0)
+        * NUM_FEATURES
+        * NUM_CLUSTERS;
+
+    for (CL_INT i = 0; i < NUM_FEATURES * NUM_CLUSTERS; ++i) {
+        g_partial[g_cluster_offset + i] = 0;
+    }
+
+    for (
+            CL_INT r = get_global_id(0);
+            r < NUM_POINTS;
+            r += get_global_size(0)
+        )
+    {
+        CL_LABEL const label = g_labels[r];
+        for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+            CL_POINT const point = g_points[ccoord2ind(NUM_POINTS, r, f)];
+            g_partial[
+                g_cluster_offset + ccoord2ind(NUM_CLUSTERS, label, f)
+            ] += convert_long_sat_rte(point * SCALE);
+        }
+    }
+}
+
+// Add the reduced sums to the accumulator
+//
+// With RESET, the accumulator restarts from the current centroids, which
+// the pipeline zeroed at the start of the iteration.
+__kernel
+void fixed_point_commit(
+        __global CL_POINT *const restrict g_centroids,
+        __global long *const restrict g_accumulator,
+        __global long const *const restrict g_sums,
+        CL_INT const NUM_VALUES,
+        CL_INT const RESET,
+        CL_POINT const SCALE,
+        CL_POINT const INV_SCALE
+        )
+{
+    for (
+            CL_INT i = get_global_id(0);
+            i < NUM_VALUES;
+            i += get_global_size(0)
+        )
+    {
+        long accumulator = (RESET == 0)
+            ? g_accumulator[i]
+            : convert_long_sat_rte(g_centroids[i] * SCALE);
+        accumulator += g_sums[i];
+
+        g_accumulator[i] = accumulator;
+        g_centroids[i] = CONVERT_POINT(accumulator) * INV_SCALE;
+    }
+}
@@ -12,6 +12,20 @@
 //
 // #define GLOBAL_MEM
 // Default: local memory cache
+//
+// #define KAHAN_SUM
+// Compensated summation of the private centroids. The compensation of
+// each sum is kept in a buffer of the same layout, passed after
+// NUM_CLUSTERS, the label change and the cluster SSE arguments.
+//
+// #define CLUSTER_SSE
+// Also sum the squared distance of each point to its centroid per cluster.
+// The sums of the first NUM_SSE_BINS clusters are reduced per work group in
+// local memory, see cluster_sse.cl. SSE64 is required for double points.
+//
+// #define LABEL_CHANGES
+// Also flag the blocks of labels that changed, see label_changes.cl. The
+// flags are passed after NUM_CLUSTERS.
 
 #ifndef CL_INT
 #define CL_INT uint
@@ -30,6 +44,12 @@
 #define CL_LABEL uint
 #endif
 
+// Labels are selected in CL_LABEL_SEL, which must have the width of
+// CL_POINT, and converted to CL_LABEL when written
+#ifndef CL_LABEL_SEL
+#define CL_LABEL_SEL CL_LABEL
+#endif
+
 #ifndef CL_MASS
 #define CL_MASS uint
 #endif
@@ -61,6 +81,49 @@
 #define VSTORE(DATA, P) VSTORE_JUMP_2(DATA, P, VEC_LEN)
 #endif
 
+// Point storage format
+// Default: points stored as CL_POINT
+//
+// #define POINT_HALF
+// Points stored as IEEE half, requires CL_POINT float
+//
+// #define POINT_BFLOAT16
+// Points stored as upper 16 bits of float, requires CL_POINT float
+//
+// #define POINT_INT8
+// Points stored as uchar with per-feature min and scale, requires
+// CL_POINT float and VEC_LEN 1
+#ifndef CL_POINT_STORE
+#define CL_POINT_STORE CL_POINT
+#endif
+
+#if defined(POINT_INT8) && VEC_LEN != 1
+#error "POINT_INT8 requires VEC_LEN 1"
+#endif
+
+// Load point of feature F and convert to VEC_TYPE(CL_POINT)
+#if defined(POINT_HALF) && VEC_LEN == 1
+#define VLOAD_POINT(P, F) vload_half(0, P)
+#elif defined(POINT_HALF)
+#define VLOAD_HALF_JUMP(P, LEN) vload_half##LEN(0, P)
+#define VLOAD_HALF_JUMP_2(P, LEN) VLOAD_HALF_JUMP(P, LEN)
+#define VLOAD_POINT(P, F) VLOAD_HALF_JUMP_2(P, VEC_LEN)
+#elif defined(POINT_BFLOAT16) && VEC_LEN == 1
+#define VLOAD_POINT(P, F) as_float(convert_uint(*(P)) << 16)
+#elif defined(POINT_BFLOAT16)
+#define AS_FLOAT_JUMP(X, LEN) as_float##LEN(X)
+#define AS_FLOAT_JUMP_2(X, LEN) AS_FLOAT_JUMP(X, LEN)
+#define CONVERT_UINT_JUMP(X, LEN) convert_uint##LEN(X)
+#define CONVERT_UINT_JUMP_2(X, LEN) CONVERT_UINT_JUMP(X, LEN)
+#define VLOAD_POINT(P, F) \
+    AS_FLOAT_JUMP_2(CONVERT_UINT_JUMP_2(VLOAD(P), VEC_LEN) << 16, VEC_LEN)
+#elif defined(POINT_INT8)
+#define VLOAD_POINT(P, F) \
+    fma(convert_float(*(P)), g_point_scale[F], g_point_min[F])
+#else
+#define VLOAD_POINT(P, F) VLOAD(P)
+#endif
+
 #define REP_STEP_2(BASE_STEP) BASE_STEP(0) BASE_STEP(1)
 #define REP_STEP_4(BASE_STEP) REP_STEP_2(BASE_STEP)                 \
     BASE_STEP(2) BASE_STEP(3)
@@ -74,20 +137,52 @@
 #define REP_STEP(BASE_STEP, NUM)                                    \
 do { REP_STEP_JUMP(BASE_STEP, NUM) } while (false)
 
+#ifdef KAHAN_SUM
+#define ADD_POINT(SUM, COMP, X)                                         \
+    do {                                                                \
+        CL_POINT const y_ = (X) - (COMP);                               \
+        CL_POINT const t_ = (SUM) + y_;                                 \
+        (COMP) = (t_ - (SUM)) - y_;                                     \
+        (SUM) = t_;                                                     \
+    } while (false)
+#else
+#define ADD_POINT(SUM, COMP, X) (SUM) += (X)
+#endif
+
+#define CONVERT_LABEL_JUMP(TYPE, X) convert_##TYPE(X)
+#define CONVERT_LABEL_JUMP_2(TYPE, X) CONVERT_LABEL_JUMP(TYPE, X)
+#define CONVERT_LABEL(X) CONVERT_LABEL_JUMP_2(VEC_TYPE(CL_LABEL), X)
+
 CL_INT ccoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
     return dim * col + row;
 }
 
+CL_INT rcoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
+    return dim * row + col;
+}
+
 // Anti-bank conflict column major indexing
 // Warning: Use only for local memory buffers
 CL_INT ccoord2abc(CL_INT dim, CL_INT row, CL_INT col) {
     return get_local_size(0) * (dim * col + row) + get_local_id(0);
 }
 
+#ifdef POINT_INT8
+#include "point_int8.cl"
+#endif
+
+#ifdef CLUSTER_SSE
+#include "cluster_sse.cl"
+#endif
+
+#ifdef LABEL_CHANGES
+#include "label_changes.cl"
+#endif
+
 // Note: Define NUM_FEATURES in preprocessor
 __kernel
 void lloyd_fused_cluster_merge(
-        __global CL_POINT const *const restrict g_points,
+        __global CL_POINT_STORE const *const restrict g_points,
         __constant CL_POINT const *const restrict g_old_centroids,
         __global CL_POINT *const restrict g_new_centroids,
         __global CL_MASS *const restrict g_masses,
@@ -99,8 +194,37 @@ void lloyd_fused_cluster_merge(
 #endif
         CL_INT const NUM_POINTS,
         CL_INT const NUM_CLUSTERS
+#ifdef LABEL_CHANGES
+        ,
+        __global uchar *const restrict g_label_changes
+#endif
+#ifdef CLUSTER_SSE
+        ,
+        __global CL_POINT *const restrict g_cluster_sse,
+        __local CL_POINT *const restrict l_cluster_sse,
+        CL_INT const NUM_SSE_BINS
+#endif
+#if defined(KAHAN_SUM) && defined(GLOBAL_MEM)
+        ,
+        __global CL_POINT *const restrict g_compensation
+#elif defined(KAHAN_SUM)
+        ,
+        __local CL_POINT *const restrict l_compensation
+#endif
+#ifdef POINT_INT8
+        ,
+        __constant CL_POINT const *const restrict g_point_min,
+        __constant CL_POINT const *const restrict g_point_scale,
+        __constant uchar const *const restrict g_centroids_q
+#endif
         )
 {
+#if defined(POINT_INT8) && !defined(GLOBAL_MEM)
+    // Quantized points are cached behind the dequantized points
+    __local uchar *const restrict l_qpoints =
+        (__local uchar *) (l_points + get_local_size(0) * NUM_FEATURES);
+#endif
+
 
     // Calculate centroids offset
     CL_INT const g_cluster_offset =
@@ -119,6 +243,11 @@ void lloyd_fused_cluster_merge(
             g_new_centroids[
                 g_cluster_offset + ccoord2ind(NUM_CLUSTERS, c, f)
             ] = 0;
+#ifdef KAHAN_SUM
+            g_compensation[
+                g_cluster_offset + ccoord2ind(NUM_CLUSTERS, c, f)
+            ] = 0;
+#endif
         }
     }
 
@@ -133,6 +262,9 @@ void lloyd_fused_cluster_merge(
             l_new_centroids[
                 ccoord2abc(NUM_CLUSTERS, c, f)
             ] = 0;
+#ifdef KAHAN_SUM
+            l_compensation[ccoord2abc(NUM_CLUSTERS, c, f)] = 0;
+#endif
         }
     }
 
@@ -144,6 +276,13 @@ void lloyd_fused_cluster_merge(
     barrier(CLK_LOCAL_MEM_FENCE);
 #endif
 
+#ifdef CLUSTER_SSE
+    // Zero cluster SSE in local memory
+    cluster_sse_zero(l_cluster_sse, NUM_SSE_BINS);
+    CL_INT sse_run_label = 0;
+    CL_POINT sse_run = 0;
+#endif
+
     CL_INT p;
 #ifdef LOCAL_STRIDE
     CL_INT stride = VEC_LEN * get_local_size(0);
@@ -176,7 +315,7 @@ void lloyd_fused_cluster_merge(
         for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
             // Read point
             VEC_TYPE(CL_POINT) point
-            = VLOAD(&g_points[ccoord2ind(NUM_POINTS, p, f)]);
+            = VLOAD_POINT(&g_points[ccoord2ind(NUM_POINTS, p, f)], f);
 
             // Cache point
             l_points[
@@ -185,11 +324,47 @@ void lloyd_fused_cluster_merge(
         }
 #endif
 
+#if defined(POINT_INT8) && !defined(GLOBAL_MEM)
+        // Cache quantized point, features contiguous
+        for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+            l_qpoints[rcoord2ind(NUM_FEATURES, get_local_id(0), f)] =
+                g_points[ccoord2ind(NUM_POINTS, p, f)];
+        }
+#endif
+
         // Labeling phase
-        VEC_TYPE(CL_LABEL) label;
+        VEC_TYPE(CL_LABEL_SEL) label;
+#ifdef POINT_INT8
+#ifdef GLOBAL_MEM
+        __global uchar const *const q_point = &g_points[p];
+        CL_INT const q_stride = NUM_POINTS;
+#else
+        __local uchar const *const q_point =
+            &l_qpoints[get_local_id(0) * NUM_FEATURES];
+        CL_INT const q_stride = 1;
+#endif
+        label = label_point_int8(
+                q_point,
+                q_stride,
+                g_centroids_q,
+                g_old_centroids,
+                g_point_min,
+                g_point_scale,
+                NUM_CLUSTERS);
+#ifdef CLUSTER_SSE
+        CL_POINT min_dist = point_distance_int8(
+                q_point,
+                q_stride,
+                g_old_centroids,
+                g_point_min,
+                g_point_scale,
+                label,
+                NUM_CLUSTERS);
+#endif
+#else
         VEC_TYPE(CL_POINT) min_dist = CL_POINT_MAX;
 
-        for (CL_LABEL c = 0; c < NUM_CLUSTERS; ++c) {
+        for (CL_LABEL_SEL c = 0; c < NUM_CLUSTERS; ++c) {
 
             VEC_TYPE(CL_POINT) dist = 0;
 
@@ -197,7 +372,7 @@ void lloyd_fused_cluster_merge(
                 // Read point
                 VEC_TYPE(CL_POINT) point =
 #ifdef GLOBAL_MEM
-                    VLOAD(&g_points[ccoord2ind(NUM_POINTS, p, f)]);
+                    VLOAD_POINT(&g_points[ccoord2ind(NUM_POINTS, p, f)], f);
 #else
                     l_points[
                         ccoord2ind(get_local_size(0), get_local_id(0), f)
@@ -216,9 +391,43 @@ void lloyd_fused_cluster_merge(
             min_dist = fmin(dist, min_dist);
             label = select(label, c, is_dist_smaller);
         }
+#endif
 
         // Write back label
-        VSTORE(label, &g_labels[p]);
+#ifdef LABEL_CHANGES
+        CL_LABEL new_labels[VEC_LEN];
+        VSTORE(CONVERT_LABEL(label), new_labels);
+
+        for (CL_INT v = 0; v < VEC_LEN; ++v) {
+            label_changes_store(
+                    g_labels,
+                    g_label_changes,
+                    NUM_POINTS,
+                    p + v,
+                    new_labels[v]);
+        }
+#else
+        VSTORE(CONVERT_LABEL(label), &g_labels[p]);
+#endif
+
+#ifdef CLUSTER_SSE
+        // Cluster SSE update phase
+        CL_LABEL_SEL sse_labels[VEC_LEN];
+        CL_POINT sse_dists[VEC_LEN];
+        VSTORE(label, sse_labels);
+        VSTORE(min_dist, sse_dists);
+
+        for (CL_INT v = 0; v < VEC_LEN; ++v) {
+            cluster_sse_add(
+                    g_cluster_sse,
+                    l_cluster_sse,
+                    NUM_SSE_BINS,
+                    sse_labels[v],
+                    sse_dists[v],
+                    &sse_run_label,
+                    &sse_run);
+        }
+#endif
 
         // Masses update phase
 #if VEC_LEN > 1
@@ -245,7 +454,7 @@ void lloyd_fused_cluster_merge(
         for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
             VEC_TYPE(CL_POINT) point =
 #ifdef GLOBAL_MEM
-                VLOAD(&g_points[ccoord2ind(NUM_POINTS, p, f)]);
+                VLOAD_POINT(&g_points[ccoord2ind(NUM_POINTS, p, f)], f);
 #else
                 l_points[
                     ccoord2ind(get_local_size(0), get_local_id(0), f)
@@ -255,26 +464,44 @@ void lloyd_fused_cluster_merge(
 #if VEC_LEN > 1
 #ifdef GLOBAL_MEM
 #define CENTROID_UPDATE_BASE(NUM)                                              \
-            g_new_centroids[                                                   \
-                g_cluster_offset + ccoord2ind(NUM_CLUSTERS, label.s ## NUM, f) \
-            ] += point.s ## NUM;
+            ADD_POINT(                                                         \
+                    g_new_centroids[                                           \
+                        g_cluster_offset +                                     \
+                        ccoord2ind(NUM_CLUSTERS, label.s ## NUM, f)            \
+                    ],                                                         \
+                    g_compensation[                                            \
+                        g_cluster_offset +                                     \
+                        ccoord2ind(NUM_CLUSTERS, label.s ## NUM, f)            \
+                    ],                                                         \
+                    point.s ## NUM);
 #else
 #define CENTROID_UPDATE_BASE(NUM)                               \
-            l_new_centroids[                                    \
-                ccoord2abc(NUM_CLUSTERS, label.s ## NUM, f)     \
-            ] += point.s ## NUM;
+            ADD_POINT(                                          \
+                    l_new_centroids[                            \
+                        ccoord2abc(NUM_CLUSTERS, label.s ## NUM, f) \
+                    ],                                          \
+                    l_compensation[                             \
+                        ccoord2abc(NUM_CLUSTERS, label.s ## NUM, f) \
+                    ],                                          \
+                    point.s ## NUM);
 #endif
 
             REP_STEP(CENTROID_UPDATE_BASE, VEC_LEN);
 #else
 #ifdef GLOBAL_MEM
-            g_new_centroids[
-                g_cluster_offset + ccoord2ind(NUM_CLUSTERS, label, f)
-            ] += point;
+            ADD_POINT(
+                    g_new_centroids[
+                        g_cluster_offset + ccoord2ind(NUM_CLUSTERS, label, f)
+                    ],
+                    g_compensation[
+                        g_cluster_offset + ccoord2ind(NUM_CLUSTERS, label, f)
+                    ],
+                    point);
 #else
-            l_new_centroids[
-                ccoord2abc(NUM_CLUSTERS, label, f)
-            ] += point;
+            ADD_POINT(
+                    l_new_centroids[ccoord2abc(NUM_CLUSTERS, label, f)],
+                    l_compensation[ccoord2abc(NUM_CLUSTERS, label, f)],
+                    point);
 #endif
 #endif
 
@@ -282,6 +509,16 @@ void lloyd_fused_cluster_merge(
 
     }
 
+#if defined(KAHAN_SUM) && defined(GLOBAL_MEM)
+    // Apply compensation
+    for (CL_INT c = 0; c < NUM_CLUSTERS; ++c) {
+        for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+            CL_INT const i = g_cluster_offset + ccoord2ind(NUM_CLUSTERS, c, f);
+            g_new_centroids[i] -= g_compensation[i];
+        }
+    }
+#endif
+
 #ifndef GLOBAL_MEM
     // No barrier necessary, as only writing back private data
 
@@ -295,10 +532,23 @@ void lloyd_fused_cluster_merge(
             CL_POINT centroid = l_new_centroids[
                 ccoord2abc(NUM_CLUSTERS, c, f)
             ];
+#ifdef KAHAN_SUM
+            centroid -= l_compensation[ccoord2abc(NUM_CLUSTERS, c, f)];
+#endif
             g_new_centroids[
                 g_cluster_offset + ccoord2ind(NUM_CLUSTERS, c, f)
             ] = centroid;
         }
     }
 #endif
+
+#ifdef CLUSTER_SSE
+    // Add cluster SSE of the work group
+    cluster_sse_reduce(
+            g_cluster_sse,
+            l_cluster_sse,
+            NUM_SSE_BINS,
+            sse_run_label,
+            sse_run);
+#endif
 }
@@ -12,6 +12,15 @@
 //
 // #define GLOBAL_MEM
 // Default: local memory cache
+//
+// #define CLUSTER_SSE
+// Also sum the squared distance of each point to its centroid per cluster.
+// The sums of the first NUM_SSE_BINS clusters are reduced per work group in
+// local memory, see cluster_sse.cl. SSE64 is required for double points.
+//
+// #define LABEL_CHANGES
+// Also flag the blocks of labels that changed, see label_changes.cl. The
+// flags are passed after NUM_THREAD_FEATURES.
 
 #ifndef CL_INT
 #define CL_INT uint
@@ -30,6 +39,12 @@
 #define CL_LABEL uint
 #endif
 
+// Labels are selected in CL_LABEL_SEL, which must have the width of
+// CL_POINT, and converted to CL_LABEL when written
+#ifndef CL_LABEL_SEL
+#define CL_LABEL_SEL CL_LABEL
+#endif
+
 #ifndef CL_MASS
 #define CL_MASS uint
 #endif
@@ -61,6 +76,49 @@
 #define VSTORE(DATA, P) VSTORE_JUMP_2(DATA, P, VEC_LEN)
 #endif
 
+// Point storage format
+// Default: points stored as CL_POINT
+//
+// #define POINT_HALF
+// Points stored as IEEE half, requires CL_POINT float
+//
+// #define POINT_BFLOAT16
+// Points stored as upper 16 bits of float, requires CL_POINT float
+//
+// #define POINT_INT8
+// Points stored as uchar with per-feature min and scale, requires
+// CL_POINT float and VEC_LEN 1
+#ifndef CL_POINT_STORE
+#define CL_POINT_STORE CL_POINT
+#endif
+
+#if defined(POINT_INT8) && VEC_LEN != 1
+#error "POINT_INT8 requires VEC_LEN 1"
+#endif
+
+// Load point of feature F and convert to VEC_TYPE(CL_POINT)
+#if defined(POINT_HALF) && VEC_LEN == 1
+#define VLOAD_POINT(P, F) vload_half(0, P)
+#elif defined(POINT_HALF)
+#define VLOAD_HALF_JUMP(P, LEN) vload_half##LEN(0, P)
+#define VLOAD_HALF_JUMP_2(P, LEN) VLOAD_HALF_JUMP(P, LEN)
+#define VLOAD_POINT(P, F) VLOAD_HALF_JUMP_2(P, VEC_LEN)
+#elif defined(POINT_BFLOAT16) && VEC_LEN == 1
+#define VLOAD_POINT(P, F) as_float(convert_uint(*(P)) << 16)
+#elif defined(POINT_BFLOAT16)
+#define AS_FLOAT_JUMP(X, LEN) as_float##LEN(X)
+#define AS_FLOAT_JUMP_2(X, LEN) AS_FLOAT_JUMP(X, LEN)
+#define CONVERT_UINT_JUMP(X, LEN) convert_uint##LEN(X)
+#define CONVERT_UINT_JUMP_2(X, LEN) CONVERT_UINT_JUMP(X, LEN)
+#define VLOAD_POINT(P, F) \
+    AS_FLOAT_JUMP_2(CONVERT_UINT_JUMP_2(VLOAD(P), VEC_LEN) << 16, VEC_LEN)
+#elif defined(POINT_INT8)
+#define VLOAD_POINT(P, F) \
+    fma(convert_float(*(P)), g_point_scale[F], g_point_min[F])
+#else
+#define VLOAD_POINT(P, F) VLOAD(P)
+#endif
+
 #define REP_STEP_2(BASE_STEP) BASE_STEP(0) BASE_STEP(1)
 #define REP_STEP_4(BASE_STEP) REP_STEP_2(BASE_STEP)                 \
     BASE_STEP(2) BASE_STEP(3)
@@ -74,14 +132,34 @@
 #define REP_STEP(BASE_STEP, NUM)                                    \
 do { REP_STEP_JUMP(BASE_STEP, NUM) } while (false)
 
+#define CONVERT_LABEL_JUMP(TYPE, X) convert_##TYPE(X)
+#define CONVERT_LABEL_JUMP_2(TYPE, X) CONVERT_LABEL_JUMP(TYPE, X)
+#define CONVERT_LABEL(X) CONVERT_LABEL_JUMP_2(VEC_TYPE(CL_LABEL), X)
+
 CL_INT ccoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
     return dim * col + row;
 }
 
+CL_INT rcoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
+    return dim * row + col;
+}
+
+#ifdef POINT_INT8
+#include "point_int8.cl"
+#endif
+
+#ifdef CLUSTER_SSE
+#include "cluster_sse.cl"
+#endif
+
+#ifdef LABEL_CHANGES
+#include "label_changes.cl"
+#endif
+
 // Note: Define NUM_FEATURES with preprocessor
 __kernel
 void lloyd_fused_feature_sum(
-        __global CL_POINT const *const restrict g_points,
+        __global CL_POINT_STORE const *const restrict g_points,
         __constant CL_POINT const *const restrict g_old_centroids,
         __global CL_POINT *const restrict g_new_centroids,
         __global CL_MASS *const restrict g_masses,
@@ -95,8 +173,30 @@ void lloyd_fused_feature_sum(
         CL_INT const NUM_POINTS,
         CL_INT const NUM_CLUSTERS,
         CL_INT const NUM_THREAD_FEATURES
+#ifdef LABEL_CHANGES
+        ,
+        __global uchar *const restrict g_label_changes
+#endif
+#ifdef CLUSTER_SSE
+        ,
+        __global CL_POINT *const restrict g_cluster_sse,
+        __local CL_POINT *const restrict l_cluster_sse,
+        CL_INT const NUM_SSE_BINS
+#endif
+#ifdef POINT_INT8
+        ,
+        __constant CL_POINT const *const restrict g_point_min,
+        __constant CL_POINT const *const restrict g_point_scale,
+        __constant uchar const *const restrict g_centroids_q
+#endif
         )
 {
+#if defined(POINT_INT8) && !defined(GLOBAL_MEM)
+    // Quantized points are cached behind the dequantized points
+    __local uchar *const restrict l_qpoints =
+        (__local uchar *) (l_points + get_local_size(0) * NUM_FEATURES);
+#endif
+
 
     // Calculate centroids indices
     CL_INT const block_size = NUM_FEATURES / NUM_THREAD_FEATURES;
@@ -150,6 +250,13 @@ void lloyd_fused_feature_sum(
     }
 #endif
 
+#ifdef CLUSTER_SSE
+    // Zero cluster SSE in local memory
+    cluster_sse_zero(l_cluster_sse, NUM_SSE_BINS);
+    CL_INT sse_run_label = 0;
+    CL_POINT sse_run = 0;
+#endif
+
     // Main loop over points
     //
     // All threads must participate!
@@ -197,7 +304,7 @@ void lloyd_fused_feature_sum(
             for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
                 // Read point
                 VEC_TYPE(CL_POINT) point
-                    = VLOAD(&g_points[ccoord2ind(NUM_POINTS, p, f)]);
+                    = VLOAD_POINT(&g_points[ccoord2ind(NUM_POINTS, p, f)], f);
 
                 // Cache point
                 l_points[
@@ -206,11 +313,47 @@ void lloyd_fused_feature_sum(
             }
 #endif
 
+#if defined(POINT_INT8) && !defined(GLOBAL_MEM)
+            // Cache quantized point, features contiguous
+            for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+                l_qpoints[rcoord2ind(NUM_FEATURES, get_local_id(0), f)] =
+                    g_points[ccoord2ind(NUM_POINTS, p, f)];
+            }
+#endif
+
             // Labeling phase
-            VEC_TYPE(CL_LABEL) label;
+            VEC_TYPE(CL_LABEL_SEL) label;
+#ifdef POINT_INT8
+#ifdef GLOBAL_MEM
+            __global uchar const *const q_point = &g_points[p];
+            CL_INT const q_stride = NUM_POINTS;
+#else
+            __local uchar const *const q_point =
+                &l_qpoints[get_local_id(0) * NUM_FEATURES];
+            CL_INT const q_stride = 1;
+#endif
+            label = label_point_int8(
+                    q_point,
+                    q_stride,
+                    g_centroids_q,
+                    g_old_centroids,
+                    g_point_min,
+                    g_point_scale,
+                    NUM_CLUSTERS);
+#ifdef CLUSTER_SSE
+            CL_POINT min_dist = point_distance_int8(
+                    q_point,
+                    q_stride,
+                    g_old_centroids,
+                    g_point_min,
+                    g_point_scale,
+                    label,
+                    NUM_CLUSTERS);
+#endif
+#else
             VEC_TYPE(CL_POINT) min_dist = CL_POINT_MAX;
 
-            for (CL_LABEL c = 0; c < NUM_CLUSTERS; ++c) {
+            for (CL_LABEL_SEL c = 0; c < NUM_CLUSTERS; ++c) {
 
                 VEC_TYPE(CL_POINT) dist = 0;
 
@@ -218,7 +361,7 @@ void lloyd_fused_feature_sum(
                     // Read point
                     VEC_TYPE(CL_POINT) point =
 #ifdef GLOBAL_MEM
-                        VLOAD(&g_points[ccoord2ind(NUM_POINTS, p, f)]);
+                        VLOAD_POINT(&g_points[ccoord2ind(NUM_POINTS, p, f)], f);
 #else
                         l_points[
                         ccoord2ind(get_local_size(0), get_local_id(0), f)
@@ -237,10 +380,44 @@ void lloyd_fused_feature_sum(
                 min_dist = fmin(dist, min_dist);
                 label = select(label, c, is_dist_smaller);
             }
+#endif
 
             // Write back label
-            l_labels[get_local_id(0)] = label;
-            VSTORE(label, &g_labels[p]);
+            l_labels[get_local_id(0)] = CONVERT_LABEL(label);
+#ifdef LABEL_CHANGES
+            CL_LABEL new_labels[VEC_LEN];
+            VSTORE(CONVERT_LABEL(label), new_labels);
+
+            for (CL_INT v = 0; v < VEC_LEN; ++v) {
+                label_changes_store(
+                        g_labels,
+                        g_label_changes,
+                        NUM_POINTS,
+                        p + v,
+                        new_labels[v]);
+            }
+#else
+            VSTORE(CONVERT_LABEL(label), &g_labels[p]);
+#endif
+
+#ifdef CLUSTER_SSE
+            // Cluster SSE update phase
+            CL_LABEL_SEL sse_labels[VEC_LEN];
+            CL_POINT sse_dists[VEC_LEN];
+            VSTORE(label, sse_labels);
+            VSTORE(min_dist, sse_dists);
+
+            for (CL_INT v = 0; v < VEC_LEN; ++v) {
+                cluster_sse_add(
+                        g_cluster_sse,
+                        l_cluster_sse,
+                        NUM_SSE_BINS,
+                        sse_labels[v],
+                        sse_dists[v],
+                        &sse_run_label,
+                        &sse_run);
+            }
+#endif
 
             // Masses update phase
 #if VEC_LEN > 1
@@ -302,7 +479,7 @@ void lloyd_fused_feature_sum(
             {
                 VEC_TYPE(CL_POINT) point =
 #ifdef GLOBAL_MEM
-                    VLOAD(&g_points[ccoord2ind(NUM_POINTS, group_offset + bp, f)]);
+                    VLOAD_POINT(&g_points[ccoord2ind(NUM_POINTS, group_offset + bp, f)], f);
 #else
                     l_points[
                     ccoord2ind(num_local_points, bp, f)
@@ -371,4 +548,14 @@ void lloyd_fused_feature_sum(
     }
 #endif
 
+#ifdef CLUSTER_SSE
+    // Add cluster SSE of the work group
+    cluster_sse_reduce(
+            g_cluster_sse,
+            l_cluster_sse,
+            NUM_SSE_BINS,
+            sse_run_label,
+            sse_run);
+#endif
+
 }
@@ -12,6 +12,20 @@
 //
 // #define GLOBAL_MEM
 // Default: local memory cache
+//
+// #define MASS_HISTOGRAM
+// Also count the cluster masses. Labels below NUM_LOCAL_BINS are counted
+// in a per-work-group histogram in local memory, which is added to
+// g_masses at the end. Larger labels are counted with global atomics.
+//
+// #define CLUSTER_SSE
+// Also sum the squared distance of each point to its centroid per cluster.
+// The sums of the first NUM_SSE_BINS clusters are reduced per work group in
+// local memory, see cluster_sse.cl. SSE64 is required for double points.
+//
+// #define LABEL_CHANGES
+// Also flag the blocks of labels that changed, see label_changes.cl. The
+// flags are passed after NUM_CLUSTERS.
 
 #ifndef CL_INT
 #define CL_INT uint
@@ -30,6 +44,16 @@
 #define CL_LABEL uint
 #endif
 
+// Labels are selected in CL_LABEL_SEL, which must have the width of
+// CL_POINT, and converted to CL_LABEL when written
+#ifndef CL_LABEL_SEL
+#define CL_LABEL_SEL CL_LABEL
+#endif
+
+#ifndef CL_MASS
+#define CL_MASS uint
+#endif
+
 #ifndef CL_POINT_MAX
 #define CL_POINT_MAX FLT_MAX
 #endif
@@ -57,6 +81,19 @@
 #define VSTORE(DATA, P) VSTORE_JUMP_2(DATA, P, VEC_LEN)
 #endif
 
+#ifdef MASS64
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#define ATOMIC_MASS_INC(P) atom_inc(P)
+#define ATOMIC_MASS_ADD(P, V) atom_add(P, V)
+#else
+#define ATOMIC_MASS_INC(P) atomic_inc(P)
+#define ATOMIC_MASS_ADD(P, V) atomic_add(P, V)
+#endif
+
+#define CONVERT_LABEL_JUMP(TYPE, X) convert_##TYPE(X)
+#define CONVERT_LABEL_JUMP_2(TYPE, X) CONVERT_LABEL_JUMP(TYPE, X)
+#define CONVERT_LABEL(X) CONVERT_LABEL_JUMP_2(VEC_TYPE(CL_LABEL), X)
+
 CL_INT ccoord2ind(CL_INT rdim, CL_INT row, CL_INT col) {
     return rdim * col + row;
 }
@@ -65,6 +102,14 @@ CL_INT rcoord2ind(CL_INT cdim, CL_INT row, CL_INT col) {
     return cdim * row + col;
 }
 
+#ifdef CLUSTER_SSE
+#include "cluster_sse.cl"
+#endif
+
+#ifdef LABEL_CHANGES
+#include "label_changes.cl"
+#endif
+
 // Note: Define NUM_FEATURES with preprocessor
 __kernel
 void lloyd_labeling_vp_clcp(
@@ -76,8 +121,43 @@ void lloyd_labeling_vp_clcp(
 #endif
             const CL_INT NUM_POINTS,
             const CL_INT NUM_CLUSTERS
+#ifdef LABEL_CHANGES
+        ,
+        __global uchar *const restrict g_label_changes
+#endif
+#ifdef MASS_HISTOGRAM
+        ,
+        __global CL_MASS *const restrict g_masses,
+        __local CL_MASS *const restrict l_masses,
+        const CL_INT NUM_LOCAL_BINS
+#endif
+#ifdef CLUSTER_SSE
+        ,
+        __global CL_POINT *const restrict g_cluster_sse,
+        __local CL_POINT *const restrict l_cluster_sse,
+        const CL_INT NUM_SSE_BINS
+#endif
        ) {
 
+#ifdef MASS_HISTOGRAM
+    for (
+            CL_INT c = get_local_id(0);
+            c < NUM_LOCAL_BINS;
+            c += get_local_size(0)
+        )
+    {
+        l_masses[c] = 0;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+#endif
+
+#ifdef CLUSTER_SSE
+    cluster_sse_zero(l_cluster_sse, NUM_SSE_BINS);
+    CL_INT sse_run_label = 0;
+    CL_POINT sse_run = 0;
+#endif
+
     CL_INT p;
 #ifdef LOCAL_STRIDE
     CL_INT stride = VEC_LEN * get_local_size(0);
@@ -120,10 +200,10 @@ void lloyd_labeling_vp_clcp(
         }
 #endif
 
-        VEC_TYPE(CL_LABEL) min_c;
+        VEC_TYPE(CL_LABEL_SEL) min_c;
         VEC_TYPE(CL_POINT) min_dist = CL_POINT_MAX;
 
-        for (CL_LABEL c = 0; c < NUM_CLUSTERS; ++c) {
+        for (CL_LABEL_SEL c = 0; c < NUM_CLUSTERS; ++c) {
             VEC_TYPE(CL_POINT) dist = 0;
 
             for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
@@ -150,6 +230,77 @@ void lloyd_labeling_vp_clcp(
             min_c = select(min_c, c, is_dist_smaller);
         }
 
-        VSTORE(min_c, &g_labels[p]);
+#ifdef LABEL_CHANGES
+        CL_LABEL new_labels[VEC_LEN];
+        VSTORE(CONVERT_LABEL(min_c), new_labels);
+
+        for (CL_INT v = 0; v < VEC_LEN; ++v) {
+            label_changes_store(
+                    g_labels,
+                    g_label_changes,
+                    NUM_POINTS,
+                    p + v,
+                    new_labels[v]);
+        }
+#else
+        VSTORE(CONVERT_LABEL(min_c), &g_labels[p]);
+#endif
+
+#ifdef MASS_HISTOGRAM
+        CL_LABEL_SEL labels[VEC_LEN];
+        VSTORE(min_c, labels);
+
+        for (CL_INT v = 0; v < VEC_LEN; ++v) {
+            if (labels[v] < NUM_LOCAL_BINS) {
+                ATOMIC_MASS_INC(&l_masses[labels[v]]);
+            }
+            else {
+                ATOMIC_MASS_INC(&g_masses[labels[v]]);
+            }
+        }
+#endif
+
+#ifdef CLUSTER_SSE
+        CL_LABEL_SEL sse_labels[VEC_LEN];
+        CL_POINT sse_dists[VEC_LEN];
+        VSTORE(min_c, sse_labels);
+        VSTORE(min_dist, sse_dists);
+
+        for (CL_INT v = 0; v < VEC_LEN; ++v) {
+            cluster_sse_add(
+                    g_cluster_sse,
+                    l_cluster_sse,
+                    NUM_SSE_BINS,
+                    sse_labels[v],
+                    sse_dists[v],
+                    &sse_run_label,
+                    &sse_run);
+        }
+#endif
+    }
+
+#ifdef MASS_HISTOGRAM
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (
+            CL_INT c = get_local_id(0);
+            c < NUM_LOCAL_BINS;
+            c += get_local_size(0)
+        )
+    {
+        CL_MASS mass = l_masses[c];
+        if (mass != 0) {
+            ATOMIC_MASS_ADD(&g_masses[c], mass);
+        }
     }
+#endif
+
+#ifdef CLUSTER_SSE
+    cluster_sse_reduce(
+            g_cluster_sse,
+            l_cluster_sse,
+            NUM_SSE_BINS,
+            sse_run_label,
+            sse_run);
+#endif
 }
@@ -0,0 +1,164 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+// Centroid update by sorting points by label
+//
+// The label histogram of histogram_global gives the bucket sizes.
+// sorted_segment_scan turns them into bucket offsets,
+// sorted_segment_scatter sorts the point indices into their buckets and
+// sorted_segment_sum sums up each bucket with one work group.
+
+#ifndef CL_INT
+#define CL_INT uint
+#endif
+
+#ifndef CL_POINT
+#define CL_POINT float
+#endif
+
+#ifndef CL_LABEL
+#define CL_LABEL uint
+#endif
+
+// Bucket sizes and offsets
+#ifndef CL_COUNT
+#define CL_COUNT uint
+#endif
+
+#ifdef COUNT64
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#define ATOMIC_INC(P) atom_inc(P)
+#else
+#define ATOMIC_INC(P) atomic_inc(P)
+#endif
+
+CL_INT ccoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
+    return dim * col + row;
+}
+
+// Exclusive prefix sum of the bucket sizes
+//
+// Runs as a single work group with a power of two local size.
+__kernel
+void sorted_segment_scan(
+        __global CL_COUNT const *const restrict g_counts,
+        __global CL_COUNT *const restrict g_offsets,
+        __global CL_COUNT *const restrict g_cursors,
+        __local CL_COUNT *const restrict l_scan,
+        CL_INT const NUM_CLUSTERS
+        )
+{
+    CL_INT const lid = get_local_id(0);
+    CL_INT const lsize = get_local_size(0);
+    CL_COUNT carry = 0;
+
+    for (CL_INT base = 0; base < NUM_CLUSTERS; base += lsize) {
+        CL_INT const c = base + lid;
+        CL_COUNT const count = (c < NUM_CLUSTERS) ? g_counts[c] : 0;
+
+        // Inclusive Hillis-Steele scan
+        l_scan[lid] = count;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (CL_INT d = 1; d < lsize; d *= 2) {
+            CL_COUNT const other = (lid >= d) ? l_scan[lid - d] : 0;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            l_scan[lid] += other;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if (c < NUM_CLUSTERS) {
+            CL_COUNT const offset = carry + l_scan[lid] - count;
+            g_offsets[c] = offset;
+            g_cursors[c] = offset;
+        }
+
+        carry += l_scan[lsize - 1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+// Counting sort of point indices by label
+__kernel
+void sorted_segment_scatter(
+        __global CL_LABEL const *const restrict g_labels,
+        __global CL_COUNT *const restrict g_cursors,
+        __global CL_INT *const restrict g_indices,
+        CL_INT const NUM_POINTS
+        )
+{
+    for (
+            CL_INT r = get_global_id(0);
+            r < NUM_POINTS;
+            r += get_global_size(0)
+        )
+    {
+        CL_LABEL const label = g_labels[r];
+        CL_COUNT const pos = ATOMIC_INC(&g_cursors[label]);
+        g_indices[pos] = r;
+    }
+}
+
+// Sum up the points of each cluster
+//
+// Work groups stride over clusters, work items of a group stride over the
+// points of the cluster. Local size must be a power of two.
+__kernel
+void sorted_segment_sum(
+        __global CL_POINT const *const restrict g_points,
+        __global CL_POINT *const restrict g_centroids,
+        __global CL_INT const *const restrict g_indices,
+        __global CL_COUNT const *const restrict g_offsets,
+        __global CL_COUNT const *const restrict g_counts,
+        __local CL_POINT *const restrict l_sums,
+        CL_INT const NUM_FEATURES,
+        CL_INT const NUM_POINTS,
+        CL_INT const NUM_CLUSTERS
+        )
+{
+    CL_INT const lid = get_local_id(0);
+    CL_INT const lsize = get_local_size(0);
+
+    for (
+            CL_INT c = get_group_id(0);
+            c < NUM_CLUSTERS;
+            c += get_num_groups(0)
+        )
+    {
+        CL_INT const begin = g_offsets[c];
+        CL_INT const count = g_counts[c];
+
+        if (count == 0) {
+            continue;
+        }
+
+        for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+            CL_POINT sum = 0;
+            for (CL_INT i = lid; i < count; i += lsize) {
+                CL_INT const r = g_indices[begin + i];
+                sum += g_points[ccoord2ind(NUM_POINTS, r, f)];
+            }
+
+            l_sums[lid] = sum;
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            for (CL_INT s = lsize / 2; s > 0; s /= 2) {
+                if (lid < s) {
+                    l_sums[lid] += l_sums[lid + s];
+                }
+                barrier(CLK_LOCAL_MEM_FENCE);
+            }
+
+            if (lid == 0) {
+                g_centroids[ccoord2ind(NUM_CLUSTERS, c, f)] += l_sums[0];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+    }
+}
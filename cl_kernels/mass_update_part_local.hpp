@@ -11,6 +11,8 @@
 #define MASS_UPDATE_PART_LOCAL_HPP
 
 #include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
 
 #include "../mass_update_configuration.hpp"
 #include "../measurement/measurement.hpp"
@@ -60,21 +62,23 @@ public:
         this->config = config;
 
         std::string defines;
-        if (std::is_same<uint32_t, LabelT>::value) {
+        if (std::is_same<uint32_t, MassT>::value) {
             defines = "-DTYPE32";
         }
-        else if (std::is_same<uint64_t, LabelT>::value) {
+        else if (std::is_same<uint64_t, MassT>::value) {
             defines = "-DTYPE64";
         }
         else {
             assert(false);
         }
+        defines += " -DCL_LABEL=";
+        defines += boost::compute::type_name<LabelT>();
 
         Program gs_program = Program::create_with_source_file(
                 PROGRAM_FILE,
                 context);
         try {
-            gs_program.build(defines);
+            ProgramCache::build(gs_program, defines);
             this->global_stride_kernel = gs_program.create_kernel(KERNEL_NAME);
         }
         catch (std::exception e) {
@@ -87,7 +91,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-            ls_program.build(defines);
+            ProgramCache::build(ls_program, defines);
             this->local_stride_kernel = ls_program.create_kernel(KERNEL_NAME);
         }
         catch (std::exception e) {
@@ -140,6 +144,10 @@ public:
         assert(masses_begin.get_index() == 0u);
 
         datapoint.set_name("MassUpdatePartLocal");
+        KernelWork::mass_update<LabelT, MassT>(
+                datapoint,
+                num_points,
+                num_clusters);
 
         size_t num_work_groups =
             this->config.global_size[0] / this->config.local_size[0];
@@ -174,8 +182,8 @@ public:
                 labels_begin.get_buffer(),
                 this->tmp_masses,
                 this->local_masses,
-                (uint32_t) num_points,
-                (uint32_t) num_clusters);
+                (MassT) num_points,
+                (MassT) num_clusters);
 
         size_t work_offset[3] = {0, 0, 0};
 
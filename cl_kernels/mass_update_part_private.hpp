@@ -11,6 +11,8 @@
 #define MASS_UPDATE_PART_PRIVATE_HPP
 
 #include "kernel_path.hpp"
+#include "kernel_work.hpp"
+#include "program_cache.hpp"
 
 #include "reduce_vector_parcol.hpp"
 #include "matrix_binary_op.hpp"
@@ -73,7 +75,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-            g_stride_g_mem_program.build(defines + g_mem_defines);
+            ProgramCache::build(g_stride_g_mem_program, defines + g_mem_defines);
             g_stride_g_mem_kernel =
                 g_stride_g_mem_program.create_kernel(KERNEL_NAME);
         }
@@ -86,7 +88,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-            g_stride_l_mem_program.build(defines);
+            ProgramCache::build(g_stride_l_mem_program, defines);
             g_stride_l_mem_kernel =
                 g_stride_l_mem_program.create_kernel(KERNEL_NAME);
         }
@@ -99,7 +101,7 @@ public:
                 PROGRAM_FILE,
                 context);
         try {
-            l_stride_g_mem_program.build(defines + l_stride_defines + g_mem_defines);
+            ProgramCache::build(l_stride_g_mem_program, defines + l_stride_defines + g_mem_defines);
             l_stride_g_mem_kernel =
                 l_stride_g_mem_program.create_kernel(KERNEL_NAME);
         }
@@ -153,6 +155,10 @@ public:
         assert(masses_begin.get_index() == 0u);
 
         datapoint.set_name("MassUpdatePartPrivate");
+        KernelWork::mass_update<LabelT, MassT>(
+                datapoint,
+                num_points,
+                num_clusters);
 
         size_t const buffer_size =
             num_clusters * this->config.global_size[0];
@@ -11,6 +11,7 @@
 #define MATRIX_BINARY_OP_HPP
 
 #include "kernel_path.hpp"
+#include "program_cache.hpp"
 
 #include "../measurement/measurement.hpp"
 
@@ -55,7 +56,7 @@ public:
                 PROGRAM_FILE,
                 context);
 
-        program.build(defines);
+        ProgramCache::build(program, defines);
 
         this->scalar_kernel = program.create_kernel(SCALAR_KERNEL_NAME);
         this->row_kernel = program.create_kernel(ROW_KERNEL_NAME);
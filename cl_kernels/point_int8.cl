@@ -0,0 +1,227 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+// Int8 point helpers, included by the fused kernels
+//
+// Requires CL_POINT float, CL_INT, CL_LABEL_SEL, CL_POINT_MAX,
+// NUM_FEATURES, ccoord2ind() and rcoord2ind() of the including kernel.
+//
+// Quantized points are read from q_point[f * q_stride]. The including
+// kernel passes either its local cache of quantized points, with features
+// stored contiguously, or the column-major global points. Quantized
+// centroids are row-major, with NUM_FEATURES values per cluster. They are
+// followed by one saturation flag per cluster.
+
+#ifdef GLOBAL_MEM
+#define INT8_CACHE __global
+#else
+#define INT8_CACHE __local
+#endif
+
+#define INT8_DEQUANTIZE(Q, F) \
+    fma(convert_float(Q), g_point_scale[F], g_point_min[F])
+
+// Round the centroids to the quantization grid, once per launch
+//
+// Centroids that are means of points lie within the quantization range.
+// Initial or streamed centroids need not, and saturating them would move
+// them by more than half a step. Such clusters are flagged, and
+// label_point_int8 computes their fp32 distance instead.
+__kernel
+void quantize_centroids_int8(
+        __global CL_POINT const *const restrict g_centroids,
+        __global uchar *const restrict g_centroids_q,
+        __constant CL_POINT const *const restrict g_point_min,
+        __constant CL_POINT const *const restrict g_point_scale,
+        CL_INT const NUM_CLUSTERS
+        )
+{
+    for (
+            CL_INT c = get_global_id(0);
+            c < NUM_CLUSTERS;
+            c += get_global_size(0)
+        )
+    {
+        uchar saturated = 0;
+
+        for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+            CL_POINT const centroid =
+                g_centroids[ccoord2ind(NUM_CLUSTERS, c, f)];
+            CL_POINT const q =
+                (centroid - g_point_min[f]) / g_point_scale[f];
+
+            // Also flags NaN
+            saturated |= !(q >= -0.5f && q <= 255.5f);
+            g_centroids_q[rcoord2ind(NUM_FEATURES, c, f)] =
+                convert_uchar_sat_rte(q);
+        }
+
+        g_centroids_q[NUM_CLUSTERS * NUM_FEATURES + c] = saturated;
+    }
+}
+
+// Squared distance of an int8 point to the centroid of cluster c
+CL_POINT point_distance_int8(
+        INT8_CACHE uchar const *const restrict q_point,
+        CL_INT const q_stride,
+        __constant CL_POINT const *const restrict g_centroids,
+        __constant CL_POINT const *const restrict g_point_min,
+        __constant CL_POINT const *const restrict g_point_scale,
+        CL_LABEL_SEL const c,
+        CL_INT const NUM_CLUSTERS
+        )
+{
+    CL_POINT dist = 0;
+
+    for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+        CL_POINT difference =
+            INT8_DEQUANTIZE(q_point[f * q_stride], f)
+            - g_centroids[ccoord2ind(NUM_CLUSTERS, c, f)];
+        dist = fma(difference, difference, dist);
+    }
+
+    return dist;
+}
+
+// Label an int8 point
+//
+// The coarse pass computes distances on the quantization grid, with
+// centroids rounded to the grid. Rounding moves each distance by at most
+// sum_f w_f * (|d_f| + 1/4), with w_f = scale_f^2 and d_f = q_f - cq_f.
+// The per-feature terms d^2 +- |d| are integers, only the weighting is
+// done in fp32. If the bounds separate the nearest cluster from all
+// others, the coarse label is exact. Otherwise, the point is near a tie
+// and we refine with fp32 distances. The bounds only hold for centroids
+// that were rounded by at most half a step, so both bounds of saturated
+// centroids are their fp32 distance.
+CL_LABEL_SEL label_point_int8(
+        INT8_CACHE uchar const *const restrict q_point,
+        CL_INT const q_stride,
+        __constant uchar const *const restrict g_centroids_q,
+        __constant CL_POINT const *const restrict g_centroids,
+        __constant CL_POINT const *const restrict g_point_min,
+        __constant CL_POINT const *const restrict g_point_scale,
+        CL_INT const NUM_CLUSTERS
+        )
+{
+    CL_POINT quarter_weight = 0;
+    for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+        CL_POINT scale = g_point_scale[f];
+        quarter_weight = fma(0.25f * scale, scale, quarter_weight);
+    }
+
+    CL_LABEL_SEL label = 0;
+    CL_POINT min_upper = CL_POINT_MAX;
+    CL_LABEL_SEL lower_label = 0;
+    CL_POINT fst_lower = CL_POINT_MAX;
+    CL_POINT snd_lower = CL_POINT_MAX;
+
+    __constant uchar const *const restrict saturated =
+        &g_centroids_q[NUM_CLUSTERS * NUM_FEATURES];
+
+    for (CL_LABEL_SEL c = 0; c < NUM_CLUSTERS; ++c) {
+        __constant uchar const *const restrict centroid_q =
+            &g_centroids_q[c * NUM_FEATURES];
+        CL_POINT upper = quarter_weight;
+        CL_POINT lower = -quarter_weight;
+
+        if (saturated[c]) {
+            upper = point_distance_int8(
+                    q_point,
+                    q_stride,
+                    g_centroids,
+                    g_point_min,
+                    g_point_scale,
+                    c,
+                    NUM_CLUSTERS);
+            lower = upper;
+        }
+        else {
+#if NUM_FEATURES % 4 == 0
+            for (CL_INT f = 0; f < NUM_FEATURES; f += 4) {
+                int4 const q = (int4) (
+                        q_point[f * q_stride],
+                        q_point[(f + 1) * q_stride],
+                        q_point[(f + 2) * q_stride],
+                        q_point[(f + 3) * q_stride]);
+                int4 const difference =
+                    q - convert_int4(vload4(0, &centroid_q[f]));
+                int4 const distance = convert_int4(abs(difference));
+                float4 const scale = vload4(0, &g_point_scale[f]);
+                float4 const weight = scale * scale;
+
+                upper += dot(
+                        weight,
+                        convert_float4(
+                            mad24(difference, difference, distance)));
+                lower += dot(
+                        weight,
+                        convert_float4(
+                            mad24(difference, difference, -distance)));
+            }
+#else
+            for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+                int const difference =
+                    (int) q_point[f * q_stride] - (int) centroid_q[f];
+                int const distance = abs(difference);
+                CL_POINT const scale = g_point_scale[f];
+                CL_POINT const weight = scale * scale;
+
+                upper = fma(
+                        weight,
+                        (CL_POINT) mad24(difference, difference, distance),
+                        upper);
+                lower = fma(
+                        weight,
+                        (CL_POINT) mad24(difference, difference, -distance),
+                        lower);
+            }
+#endif
+        }
+
+        if (upper < min_upper) {
+            min_upper = upper;
+            label = c;
+        }
+
+        if (lower < fst_lower) {
+            snd_lower = fst_lower;
+            fst_lower = lower;
+            lower_label = c;
+        }
+        else if (lower < snd_lower) {
+            snd_lower = lower;
+        }
+    }
+
+    CL_POINT other_lower = (lower_label == label) ? snd_lower : fst_lower;
+    if (other_lower > min_upper) {
+        return label;
+    }
+
+    // Refinement for near-ties
+    CL_POINT min_dist = CL_POINT_MAX;
+    for (CL_LABEL_SEL c = 0; c < NUM_CLUSTERS; ++c) {
+        CL_POINT dist = point_distance_int8(
+                q_point,
+                q_stride,
+                g_centroids,
+                g_point_min,
+                g_point_scale,
+                c,
+                NUM_CLUSTERS);
+
+        if (dist < min_dist) {
+            min_dist = dist;
+            label = c;
+        }
+    }
+
+    return label;
+}
@@ -0,0 +1,74 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef PROGRAM_CACHE_HPP
+#define PROGRAM_CACHE_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include <boost/compute/core.hpp>
+
+namespace Clustering {
+
+/*
+ * Process-wide cache of built programs
+ *
+ * Strategies build their programs in prepare(), which bench --sweep calls
+ * for every configuration. Programs are keyed by context, source and build
+ * options, so that each distinct program is only compiled once. Cached
+ * programs keep their context alive until the process exits.
+ */
+class ProgramCache {
+public:
+    using Program = boost::compute::program;
+
+    /*
+     * Replace program by an earlier build with the same options, or build
+     * it. Throws like Program::build, in which case program holds the
+     * build log.
+     */
+    static void build(Program& program, std::string const& options) {
+        Key key(
+                program.get_context().get(),
+                program.source(),
+                options);
+
+        std::lock_guard<std::mutex> lock(mutex());
+
+        auto& programs = cache();
+        auto cached = programs.find(key);
+        if (cached != programs.end()) {
+            program = cached->second;
+            return;
+        }
+
+        program.build(options);
+        programs.emplace(key, program);
+    }
+
+private:
+    using Key = std::tuple<cl_context, std::string, std::string>;
+
+    static std::map<Key, Program>& cache() {
+        static std::map<Key, Program> programs;
+        return programs;
+    }
+
+    static std::mutex& mutex() {
+        static std::mutex m;
+        return m;
+    }
+};
+
+}
+
+#endif /* PROGRAM_CACHE_HPP */
@@ -16,6 +16,29 @@
 #endif
 #endif
 
+#ifndef VEC_LEN
+#define VEC_LEN 1
+#endif
+
+#if VEC_LEN == 1
+#define VEC_TYPE(TYPE) TYPE
+#define VLOAD(P) (*(P))
+#define VSTORE(DATA, P) do { *(P) = DATA; } while (false)
+
+#else
+#define VEC_TYPE_JUMP(TYPE, LEN) TYPE##LEN
+#define VEC_TYPE_JUMP_2(TYPE, LEN) VEC_TYPE_JUMP(TYPE, LEN)
+#define VEC_TYPE(TYPE) VEC_TYPE_JUMP_2(TYPE, VEC_LEN)
+
+#define VLOAD_JUMP(P, LEN) vload##LEN(0, P)
+#define VLOAD_JUMP_2(P, LEN) VLOAD_JUMP(P, LEN)
+#define VLOAD(P) VLOAD_JUMP_2(P, VEC_LEN)
+
+#define VSTORE_JUMP(DATA, P, LEN) vstore##LEN(DATA, 0, P)
+#define VSTORE_JUMP_2(DATA, P, LEN) VSTORE_JUMP(DATA, P, LEN)
+#define VSTORE(DATA, P) VSTORE_JUMP_2(DATA, P, VEC_LEN)
+#endif
+
 /* Reduce to single vector
  * Assume NUM_COLS * NUM_ROWS < 2 * local_size
  * Assume NUM_ROWS % local_size == 0
@@ -73,3 +96,54 @@ void reduce_vector_parcol_compact(
 
     g_data[get_global_id(0)] = sum;
 }
+
+/*
+ * Reduce blocks of columns with a work group tree
+ * Assume column-major format
+ * Assume NUM_ROWS % VEC_LEN == 0
+ * Assume get_local_size(1) is a power of two
+ *
+ * Dimension 0 spans the rows in vectors of VEC_LEN, dimension 1 the
+ * columns. Work group y reduces columns [y * COLS_PER_GROUP,
+ * (y + 1) * COLS_PER_GROUP) into column y of g_out. g_in and g_out may be
+ * the same buffer if there is a single group in dimension 1.
+ */
+__kernel
+void reduce_vector_parcol_tree(
+        __global CL_TYPE const *const g_in,
+        __global CL_TYPE *const g_out,
+        __local VEC_TYPE(CL_TYPE) *const restrict l_data,
+        CL_INT const NUM_COLS,
+        CL_INT const NUM_ROWS,
+        CL_INT const COLS_PER_GROUP
+        ) {
+
+    CL_INT const lx = get_local_id(0);
+    CL_INT const ly = get_local_id(1);
+    CL_INT const lrows = get_local_size(0);
+    CL_INT const lcols = get_local_size(1);
+    CL_INT const row = get_global_id(0) * VEC_LEN;
+    CL_INT const col_begin = get_group_id(1) * COLS_PER_GROUP;
+    CL_INT const col_end = min(col_begin + COLS_PER_GROUP, NUM_COLS);
+
+    VEC_TYPE(CL_TYPE) sum = 0;
+    if (row < NUM_ROWS) {
+        for (CL_INT c = col_begin + ly; c < col_end; c += lcols) {
+            sum += VLOAD(&g_in[c * NUM_ROWS + row]);
+        }
+    }
+
+    l_data[ly * lrows + lx] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (CL_INT s = lcols / 2; s > 0; s /= 2) {
+        if (ly < s) {
+            l_data[ly * lrows + lx] += l_data[(ly + s) * lrows + lx];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (ly == 0 && row < NUM_ROWS) {
+        VSTORE(l_data[lx], &g_out[get_group_id(1) * NUM_ROWS + row]);
+    }
+}
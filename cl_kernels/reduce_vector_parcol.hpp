@@ -11,6 +11,7 @@
 #define REDUCE_VECTOR_PARCOL_HPP
 
 #include "kernel_path.hpp"
+#include "program_cache.hpp"
 
 #include "../measurement/measurement.hpp"
 
@@ -18,14 +19,30 @@
 #include <string>
 #include <type_traits>
 #include <cstdint>
+#include <utility> // std::move
+#include <vector>
 
 #include <boost/compute/core.hpp>
 #include <boost/compute/types.hpp>
 #include <boost/compute/type_traits.hpp>
 #include <boost/compute/container/vector.hpp>
+#include <boost/compute/memory/local_buffer.hpp>
 
 namespace Clustering {
 
+/*
+ * Reduce num_cols column vectors of result_rows elements to one vector
+ *
+ * Work groups first reduce blocks of columns with a tree in local memory.
+ * Each pass writes one partial column per work group, and passes are
+ * repeated until a single column remains. Each pass reduces the number of
+ * columns by a factor of (columns per work group) * ITEM_COLS. Rows are
+ * loaded as vectors of up to four elements, so fewer rows and wider
+ * vectors leave more work items for the column tree and need fewer
+ * passes. Optionally, the last pass runs on the host.
+ *
+ * The result is stored in the first result_rows elements of the data.
+ */
 template <typename T>
 class ReduceVectorParcol {
 public:
@@ -35,6 +52,8 @@ public:
     using Program = boost::compute::program;
     template <typename Q>
     using Vector = boost::compute::vector<Q>;
+    template <typename Q>
+    using LocalBuffer = boost::compute::local_buffer<Q>;
 
     void prepare(Context context)
     {
@@ -49,16 +68,41 @@ public:
         defines += " -DWORKGROUP_SIZE=";
         defines += std::to_string(WORKGROUP_SIZE);
 
-        Program program = Program::create_with_source_file(
-                PROGRAM_FILE,
-                context);
+        for (size_t i = 0; i < NUM_VECTOR_LENGTHS; ++i) {
+            Program tree_program = Program::create_with_source_file(
+                    PROGRAM_FILE,
+                    context);
+
+            ProgramCache::build(
+                    tree_program,
+                    defines
+                    + " -DVEC_LEN="
+                    + std::to_string((size_t) 1 << i));
+
+            this->kernel_tree[i] = tree_program
+                .create_kernel(TREE_KERNEL_NAME);
+        }
+    }
+
+    // Finish the last pass on the host
+    void set_host_finish(bool host_finish) {
+        this->host_finish = host_finish;
+    }
+
+    /*
+     * Number of passes for a reduction
+     */
+    static size_t num_passes(size_t num_cols, size_t result_rows) {
+        size_t const cols_per_group =
+            local_cols(result_rows) * ITEM_COLS;
+        size_t passes = 0;
 
-        program.build(defines);
+        while (num_cols > 1) {
+            num_cols = (num_cols + cols_per_group - 1) / cols_per_group;
+            ++passes;
+        }
 
-        this->kernel_compact = program
-            .create_kernel(COMPACT_KERNEL_NAME);
-        this->kernel_inner = program
-            .create_kernel(INNER_KERNEL_NAME);
+        return passes;
     }
 
     Event operator() (
@@ -94,76 +138,161 @@ public:
 
         size_t data_size = data_end - data_begin;
         assert(data_size >= num_cols * result_rows);
+        assert(data_begin.get_index() == 0u);
+        (void) data_size;
 
         datapoint.set_name("ReduceVectorParcol");
 
         Event event;
         boost::compute::wait_list wait_list = events;
-        size_t work_offset = 0;
-        uint32_t round = 0;
-        size_t global_size = data_size / 2;
-
-        while (
-                data_size > result_rows
-                && data_size > 2 * WORKGROUP_SIZE
-              )
-        {
-            assert(global_size * 2 == data_size);
-            assert(global_size % result_rows == 0);
-
-            this->kernel_compact.set_args(
-                    data_begin.get_buffer(),
-                    (cl_uint) data_size);
-
-            event = queue.enqueue_1d_range_kernel(
-                    this->kernel_compact,
+
+        size_t const vector_index = vector_length_index(result_rows);
+        size_t const vector_rows = result_rows >> vector_index;
+        size_t const lrows = local_rows(result_rows);
+        size_t const lcols = WORKGROUP_SIZE / lrows;
+        size_t const cols_per_group = lcols * ITEM_COLS;
+        size_t const global_rows =
+            (vector_rows + lrows - 1) / lrows * lrows;
+
+        Kernel& kernel = this->kernel_tree[vector_index];
+        LocalBuffer<T> local_data(WORKGROUP_SIZE << vector_index);
+
+        boost::compute::buffer in = data_begin.get_buffer();
+        Vector<T> *out_tmp = &this->tmp_a;
+        size_t cols = num_cols;
+
+        while (cols > 1) {
+            size_t groups = (cols + cols_per_group - 1) / cols_per_group;
+
+            if (groups == 1 && this->host_finish) {
+                return reduce_on_host(
+                        queue,
+                        in,
+                        data_begin.get_buffer(),
+                        cols,
+                        result_rows,
+                        datapoint,
+                        wait_list);
+            }
+
+            boost::compute::buffer out;
+            if (groups == 1) {
+                out = data_begin.get_buffer();
+            }
+            else {
+                if (out_tmp->size() < groups * result_rows) {
+                    *out_tmp = std::move(Vector<T>(
+                                groups * result_rows,
+                                queue.get_context()));
+                }
+                out = out_tmp->get_buffer();
+            }
+
+            kernel.set_args(
+                    in,
+                    out,
+                    local_data,
+                    (cl_uint) cols,
+                    (cl_uint) result_rows,
+                    (cl_uint) cols_per_group);
+
+            size_t work_offset[2] = {0, 0};
+            size_t global_size[2] = {global_rows, groups * lcols};
+            size_t local_size[2] = {lrows, lcols};
+
+            event = queue.enqueue_nd_range_kernel(
+                    kernel,
+                    2,
                     work_offset,
                     global_size,
-                    0,
+                    local_size,
                     wait_list);
             datapoint.add_event() = event;
 
             wait_list.clear();
             wait_list.insert(event);
 
-            ++round;
-            global_size /= 2;
-            data_size = global_size * 2;
+            in = out;
+            out_tmp = (out_tmp == &this->tmp_a) ? &this->tmp_b : &this->tmp_a;
+            cols = groups;
         }
 
-        if (
-                data_size != result_rows
-                )
-        {
-            assert(WORKGROUP_SIZE % result_rows == 0);
+        return event;
+    }
 
-            this->kernel_inner.set_args(
-                    data_begin.get_buffer(),
-                    (cl_uint) num_cols,
-                    (cl_uint) result_rows);
+private:
+    static size_t vector_length_index(size_t result_rows) {
+        size_t i = NUM_VECTOR_LENGTHS - 1;
+        while (i > 0 && result_rows % ((size_t) 1 << i) != 0) {
+            --i;
+        }
+        return i;
+    }
 
-            event = queue.enqueue_1d_range_kernel(
-                    this->kernel_inner,
-                    work_offset,
-                    (cl_int) data_size / 2,
-                    (cl_int) data_size / 2,
-                    wait_list);
-            datapoint.add_event() = event;
+    static size_t local_rows(size_t result_rows) {
+        size_t const vector_rows =
+            result_rows >> vector_length_index(result_rows);
+        size_t lrows = 1;
+        while (lrows < vector_rows && lrows < WORKGROUP_SIZE) {
+            lrows *= 2;
+        }
+        return lrows;
+    }
+
+    static size_t local_cols(size_t result_rows) {
+        return WORKGROUP_SIZE / local_rows(result_rows);
+    }
+
+    Event reduce_on_host(
+            boost::compute::command_queue queue,
+            boost::compute::buffer in,
+            boost::compute::buffer out,
+            size_t num_cols,
+            size_t result_rows,
+            Measurement::DataPoint& datapoint,
+            boost::compute::wait_list const& wait_list)
+    {
+        std::vector<T> partials(num_cols * result_rows);
+        std::vector<T> result(result_rows, 0);
+
+        Event event = queue.enqueue_read_buffer_async(
+                in,
+                0,
+                partials.size() * sizeof(T),
+                partials.data(),
+                wait_list);
+        datapoint.add_event() = event;
+        event.wait();
+
+        for (size_t c = 0; c < num_cols; ++c) {
+            for (size_t r = 0; r < result_rows; ++r) {
+                result[r] += partials[c * result_rows + r];
+            }
         }
 
+        event = queue.enqueue_write_buffer_async(
+                out,
+                0,
+                result.size() * sizeof(T),
+                result.data());
+        datapoint.add_event() = event;
+        event.wait();
+
         return event;
     }
 
-private:
     static constexpr size_t WORKGROUP_SIZE = 256;
+    static constexpr size_t ITEM_COLS = 16;
+    static constexpr size_t NUM_VECTOR_LENGTHS = 3;
 
     static constexpr const char *PROGRAM_FILE =
         CL_KERNEL_FILE_PATH("reduce_vector_parcol.cl");
-    static constexpr const char *COMPACT_KERNEL_NAME = "reduce_vector_parcol_compact";
-    static constexpr const char *INNER_KERNEL_NAME = "reduce_vector_parcol_inner";
+    static constexpr const char *TREE_KERNEL_NAME = "reduce_vector_parcol_tree";
 
-    Kernel kernel_compact;
-    Kernel kernel_inner;
+    Kernel kernel_tree[NUM_VECTOR_LENGTHS];
+    Vector<T> tmp_a;
+    Vector<T> tmp_b;
+    bool host_finish = false;
 };
 }
 
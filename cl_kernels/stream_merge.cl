@@ -0,0 +1,75 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+// #define WEIGHT_DOUBLE
+// Accumulate the decayed cluster weights in double, requires cl_khr_fp64.
+// Default: float
+
+#ifndef CL_INT
+#define CL_INT uint
+#endif
+
+#ifndef CL_POINT
+#define CL_POINT float
+#endif
+
+#ifndef CL_MASS
+#define CL_MASS uint
+#endif
+
+#ifdef WEIGHT_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#define CL_WEIGHT double
+#else
+#define CL_WEIGHT float
+#endif
+
+CL_INT ccoord2ind(CL_INT dim, CL_INT row, CL_INT col) {
+    return dim * col + row;
+}
+
+// Fold the per-batch sums and masses of a stream into the centroids
+//
+// Each cluster keeps a weight, which decays by DECAY per batch and grows by
+// the batch mass. Centroids are the weighted mean of the old centroid and
+// the batch points. g_masses holds the batch masses on entry and the
+// rounded weights on exit.
+__kernel
+void stream_merge(
+        __global CL_POINT *const restrict g_centroids,
+        __global CL_POINT const *const restrict g_sums,
+        __global CL_MASS *const restrict g_masses,
+        __global CL_WEIGHT *const restrict g_weights,
+        CL_WEIGHT const DECAY,
+        CL_INT const NUM_FEATURES,
+        CL_INT const NUM_CLUSTERS
+        )
+{
+    for (
+            CL_INT c = get_global_id(0);
+            c < NUM_CLUSTERS;
+            c += get_global_size(0)
+        )
+    {
+        CL_WEIGHT const old_weight = DECAY * g_weights[c];
+        CL_WEIGHT const weight = old_weight + (CL_WEIGHT) g_masses[c];
+
+        if (weight > 0) {
+            for (CL_INT f = 0; f < NUM_FEATURES; ++f) {
+                CL_INT const i = ccoord2ind(NUM_CLUSTERS, c, f);
+                g_centroids[i] = (CL_POINT) (
+                        (old_weight * g_centroids[i] + g_sums[i])
+                        / weight);
+            }
+        }
+
+        g_weights[c] = weight;
+        g_masses[c] = (CL_MASS) (weight + (CL_WEIGHT) 0.5);
+    }
+}
@@ -0,0 +1,167 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef STREAM_MERGE_HPP
+#define STREAM_MERGE_HPP
+
+#include "kernel_path.hpp"
+#include "program_cache.hpp"
+
+#include "../measurement/measurement.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/algorithm/fill.hpp>
+#include <boost/compute/container/vector.hpp>
+
+namespace Clustering {
+
+/*
+ * Fold per-batch sums and masses into the centroids of a stream
+ *
+ * The decayed cluster weights stay in device memory, in double if the
+ * device supports it and in float otherwise.
+ */
+template <typename PointT, typename MassT>
+class StreamMerge {
+public:
+    using Event = boost::compute::event;
+    using Context = boost::compute::context;
+    using Kernel = boost::compute::kernel;
+    using Program = boost::compute::program;
+    template <typename T>
+    using Vector = boost::compute::vector<T>;
+
+    void prepare(Context context) {
+        static_assert(std::is_same<uint32_t, MassT>::value
+                or std::is_same<uint64_t, MassT>::value,
+                "MassT must be uint32_t or uint64_t");
+
+        this->weight_double =
+            context.get_device().supports_extension("cl_khr_fp64");
+
+        std::string defines;
+        defines += " -DCL_INT=uint";
+        defines += " -DCL_POINT=";
+        defines += boost::compute::type_name<PointT>();
+        defines += " -DCL_MASS=";
+        defines += boost::compute::type_name<MassT>();
+        if (this->weight_double) {
+            defines += " -DWEIGHT_DOUBLE";
+        }
+
+        Program program = Program::create_with_source_file(
+                PROGRAM_FILE,
+                context);
+
+        ProgramCache::build(program, defines);
+
+        this->kernel = program.create_kernel(KERNEL_NAME);
+    }
+
+    /*
+     * Zero the weights of num_clusters clusters
+     */
+    Event reset(
+            boost::compute::command_queue queue,
+            size_t num_clusters)
+    {
+        size_t const size = num_clusters * this->weight_size();
+        if (this->weights.size() != size) {
+            this->weights = std::move(
+                    Vector<cl_uchar>(
+                        size,
+                        queue.get_context()
+                        ));
+        }
+
+        return boost::compute::fill_async(
+                this->weights.begin(),
+                this->weights.end(),
+                0,
+                queue)
+            .get_event();
+    }
+
+    /*
+     * Merge the batch sums into centroids
+     *
+     * masses holds the batch masses and is overwritten with the decayed
+     * masses, rounded to the nearest integer.
+     */
+    Event operator() (
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_clusters,
+            double decay,
+            boost::compute::buffer_iterator<PointT> centroids_begin,
+            boost::compute::buffer_iterator<PointT> centroids_end,
+            boost::compute::buffer_iterator<PointT> sums_begin,
+            boost::compute::buffer_iterator<PointT> sums_end,
+            boost::compute::buffer_iterator<MassT> masses_begin,
+            boost::compute::buffer_iterator<MassT> masses_end,
+            Measurement::DataPoint& datapoint,
+            boost::compute::wait_list const& events
+            )
+    {
+        assert(centroids_end - centroids_begin == (long) (num_clusters * num_features));
+        assert(sums_end - sums_begin == (long) (num_clusters * num_features));
+        assert(masses_end - masses_begin == (long) num_clusters);
+        assert(centroids_begin.get_index() == 0u);
+        assert(sums_begin.get_index() == 0u);
+        assert(masses_begin.get_index() == 0u);
+        assert(this->weights.size() == num_clusters * this->weight_size());
+
+        datapoint.set_name("StreamMerge");
+
+        this->kernel.set_arg(0, centroids_begin.get_buffer());
+        this->kernel.set_arg(1, sums_begin.get_buffer());
+        this->kernel.set_arg(2, masses_begin.get_buffer());
+        this->kernel.set_arg(3, this->weights);
+        if (this->weight_double) {
+            this->kernel.set_arg(4, (cl_double) decay);
+        }
+        else {
+            this->kernel.set_arg(4, (cl_float) decay);
+        }
+        this->kernel.set_arg(5, (cl_uint) num_features);
+        this->kernel.set_arg(6, (cl_uint) num_clusters);
+
+        Event event;
+        event = queue.enqueue_1d_range_kernel(
+                this->kernel,
+                0,
+                num_clusters,
+                0,
+                events);
+
+        datapoint.add_event() = event;
+
+        return event;
+    }
+
+private:
+    size_t weight_size() const {
+        return (this->weight_double) ? sizeof(cl_double) : sizeof(cl_float);
+    }
+
+    static constexpr const char* PROGRAM_FILE = CL_KERNEL_FILE_PATH("stream_merge.cl");
+    static constexpr const char* KERNEL_NAME = "stream_merge";
+
+    Kernel kernel;
+    Vector<cl_uchar> weights;
+    bool weight_double = false;
+};
+}
+
+#endif /* STREAM_MERGE_HPP */
@@ -2,17 +2,79 @@
  * This Source Code Form is subject to the terms of the Mozilla Public License,
  * v. 2.0. If a copy of the MPL was not distributed with this file, You can
  * obtain one at http://mozilla.org/MPL/2.0/.
- * 
- * 
- * Copyright (c) 2016, Lutz, Clemens <lutzcle@cml.li>
+ *
+ *
+ * Copyright (c) 2016-2018, Lutz, Clemens <lutzcle@cml.li>
  */
 
 #include "cluster_generator.hpp"
+#include "binary_format.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
-#include <random>
 #include <fstream>
-#include <cassert>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Last counter word, so that each quantity has its own random stream
+enum Stream : uint32_t {
+    StreamCentroid = 0,
+    StreamDeviation,
+    StreamPoint,
+    StreamTail
+};
+
+// Points per block are chosen for blocks of about this size
+uint64_t const block_bytes = 16 * 1024 * 1024;
+
+double const pi = 3.14159265358979323846;
+
+// Uniform in (0, 1), never 0 for the logarithm
+double uniform(uint32_t bits) {
+    return (bits + 0.5) * (1.0 / 4294967296.0);
+}
+
+// Four uniform values
+std::array<double, 4> uniform4(
+        cle::Philox4x32::Counter const& counter,
+        uint64_t key) {
+
+    auto bits = cle::Philox4x32::generate(counter, key);
+    return {{
+        uniform(bits[0]),
+        uniform(bits[1]),
+        uniform(bits[2]),
+        uniform(bits[3])
+    }};
+}
+
+// Four standard normal values (Box-Muller transform)
+std::array<double, 4> normal4(
+        cle::Philox4x32::Counter const& counter,
+        uint64_t key) {
+
+    auto u = uniform4(counter, key);
+    double r0 = std::sqrt(-2.0 * std::log(u[0]));
+    double r1 = std::sqrt(-2.0 * std::log(u[2]));
+    return {{
+        r0 * std::cos(2.0 * pi * u[1]),
+        r0 * std::sin(2.0 * pi * u[1]),
+        r1 * std::cos(2.0 * pi * u[3]),
+        r1 * std::sin(2.0 * pi * u[3])
+    }};
+}
+
+}
 
 void cle::ClusterGenerator::num_features(uint64_t features) {
     features_ = features;
@@ -39,158 +101,410 @@ void cle::ClusterGenerator::point_multiple(uint64_t multiple) {
     multiple_ = multiple;
 }
 
-/*
- * Generate binary file
- * File format:
- *
- * uint64_t num_features
- * uint64_t num_clusters
- * uint64_t num_points
- * float clusters[0 ... num_clusters-1], column major
- * float points[0 ... num_points-1], column major
- */
-void cle::ClusterGenerator::generate_matrix(
-        Matrix<float, std::allocator<float>, uint32_t>& points,
-        Matrix<float, std::allocator<float>, uint32_t>& centroids,
-        std::vector<uint32_t>& labels
-        ) {
-    uint64_t size = bytes_ / sizeof(float);
-    uint64_t num_points = size / features_;
-    uint64_t points_per_cluster = num_points / clusters_;
-    num_points = points_per_cluster * clusters_;
-    uint64_t remainder = num_points % multiple_;
-    num_points = num_points - remainder;
-
-    assert(features_ > 0);
-    assert(clusters_ > 0);
-    assert(num_points > 0);
-
-    std::default_random_engine rgen;
-    std::uniform_real_distribution<float> uniform(domain_min_, domain_max_);
-    std::normal_distribution<float> gaussian(-radius_, radius_);
-
-    points.resize(num_points, features_);
-    centroids.resize(clusters_, features_);
-    labels.resize(num_points);
+void cle::ClusterGenerator::int8(bool quantize) {
+    int8_ = quantize;
+}
 
-    for (uint64_t f = 0; f < features_; ++f) {
-        uint64_t tmp_remainder = remainder;
+void cle::ClusterGenerator::seed(uint64_t seed) {
+    seed_ = seed;
+}
 
-        for (uint64_t c = 0; c < clusters_; ++c) {
-            uint64_t row = 0;
-            float centroid = uniform(rgen);
-            centroids(c, f) = centroid;
+void cle::ClusterGenerator::num_threads(size_t threads) {
+    threads_ = threads;
+}
 
-            uint64_t start = 0;
-            if (tmp_remainder != 0 && c != 0) {
-                start = (clusters_ + tmp_remainder - 2) / (clusters_ - 1);
-                tmp_remainder = tmp_remainder - start;
-            }
+void cle::ClusterGenerator::imbalance(float exponent) {
+    imbalance_ = exponent;
+}
 
-            for (uint64_t p = start; p < points_per_cluster; ++p) {
-                float point = centroid + gaussian(rgen);
-                points(row, f) = point;
+void cle::ClusterGenerator::anisotropy(float factor) {
+    anisotropy_ = factor;
+}
 
-                if (f == 0) {
-                    labels[row] = c;
-                }
+void cle::ClusterGenerator::tail_degrees(uint64_t degrees) {
+    tail_degrees_ = degrees;
+}
 
-                ++row;
+uint64_t cle::ClusterGenerator::num_points() const {
+    uint64_t num_points = bytes_ / sizeof(float) / features_;
+    return num_points - num_points % std::max(multiple_, (uint64_t) 1);
+}
+
+void cle::ClusterGenerator::prepare() {
+    if (features_ == 0 || clusters_ == 0) {
+        throw std::invalid_argument(
+                "Need at least one feature and one cluster");
+    }
+
+    num_points_ = num_points();
+    if (num_points_ == 0) {
+        throw std::invalid_argument("Size too small for a single point");
+    }
+
+    // Power law cluster sizes, the remainder goes to the largest clusters
+    std::vector<double> weights(clusters_);
+    double total_weight = 0.0;
+    for (uint64_t c = 0; c < clusters_; ++c) {
+        weights[c] = std::pow((double) (c + 1), (double) -imbalance_);
+        total_weight += weights[c];
+    }
+
+    std::vector<uint64_t> sizes(clusters_);
+    uint64_t assigned = 0;
+    for (uint64_t c = 0; c < clusters_; ++c) {
+        sizes[c] = (uint64_t) (num_points_ * (weights[c] / total_weight));
+        assigned += sizes[c];
+    }
+    for (uint64_t c = 0; assigned < num_points_; c = (c + 1) % clusters_) {
+        ++sizes[c];
+        ++assigned;
+    }
+
+    cluster_begin_.resize(clusters_ + 1);
+    cluster_begin_[0] = 0;
+    for (uint64_t c = 0; c < clusters_; ++c) {
+        cluster_begin_[c + 1] = cluster_begin_[c] + sizes[c];
+    }
+
+    centroids_.resize(clusters_ * features_);
+    deviations_.resize(clusters_ * features_);
+    double const log_spread = std::log(1.0 + anisotropy_);
+    for (uint64_t c = 0; c < clusters_; ++c) {
+        for (uint64_t f = 0; f < features_; f += 4) {
+            Philox4x32::Counter counter = {{
+                (uint32_t) c,
+                (uint32_t) (c >> 32),
+                (uint32_t) (f / 4),
+                0
+            }};
+
+            counter[3] = StreamCentroid;
+            auto position = uniform4(counter, seed_);
+            counter[3] = StreamDeviation;
+            auto spread = uniform4(counter, seed_);
+
+            for (uint64_t i = 0; i < 4 && f + i < features_; ++i) {
+                centroids_[c * features_ + f + i] =
+                    domain_min_
+                    + (domain_max_ - domain_min_) * position[i];
+                deviations_[c * features_ + f + i] =
+                    radius_
+                    * std::exp(log_spread * (2.0 * spread[i] - 1.0));
             }
         }
     }
 }
 
-void cle::ClusterGenerator::generate_csv(char const* file_name) {
+uint32_t cle::ClusterGenerator::cluster(uint64_t point) const {
+    auto next = std::upper_bound(
+            cluster_begin_.begin() + 1,
+            cluster_begin_.end(),
+            point);
+    return next - (cluster_begin_.begin() + 1);
+}
 
-    uint64_t size = bytes_ / sizeof(float);
-    uint64_t num_points = size / features_;
-    uint64_t points_per_cluster = num_points / clusters_;
-    num_points = points_per_cluster * clusters_;
-    uint64_t remainder = num_points % multiple_;
-    num_points = num_points - remainder;
+void cle::ClusterGenerator::generate_point(
+        uint64_t point,
+        float *features,
+        size_t stride) const {
+
+    uint32_t const c = cluster(point);
+    Philox4x32::Counter counter = {{
+        (uint32_t) point,
+        (uint32_t) (point >> 32),
+        0,
+        0
+    }};
+
+    // Student's t: Gaussian scaled by sqrt(nu / chi-squared(nu))
+    double scale = 1.0;
+    if (tail_degrees_ > 0) {
+        double chi_squared = 0.0;
+        counter[3] = StreamTail;
+        for (uint64_t d = 0; d < tail_degrees_; d += 4) {
+            counter[2] = (uint32_t) (d / 4);
+            auto z = normal4(counter, seed_);
+            for (uint64_t i = 0; i < 4 && d + i < tail_degrees_; ++i) {
+                chi_squared += z[i] * z[i];
+            }
+        }
+        scale = std::sqrt(tail_degrees_ / chi_squared);
+    }
 
-    std::default_random_engine rgen;
-    std::uniform_real_distribution<float> uniform(domain_min_, domain_max_);
-    std::normal_distribution<float> gaussian(-radius_, radius_);
+    counter[3] = StreamPoint;
+    for (uint64_t f = 0; f < features_; f += 4) {
+        counter[2] = (uint32_t) (f / 4);
+        auto z = normal4(counter, seed_);
+        for (uint64_t i = 0; i < 4 && f + i < features_; ++i) {
+            uint64_t const cf = c * features_ + f + i;
+            features[(f + i) * stride] =
+                centroids_[cf] + deviations_[cf] * z[i] * scale;
+        }
+    }
+}
 
-    std::ofstream fh(file_name, std::fstream::trunc);
+void cle::ClusterGenerator::generate_blocks(BlockFunction visit) const {
+    uint64_t const block_points = std::max(
+            block_bytes / (features_ * sizeof(float)),
+            (uint64_t) 1024);
+    uint64_t const num_blocks =
+        (num_points_ + block_points - 1) / block_points;
 
-    for (uint64_t c = 0; c < clusters_; ++c) {
-        float centroid = uniform(rgen);
+    size_t num_threads = threads_;
+    if (num_threads == 0) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
 
-        uint64_t start = 0;
-        if (remainder != 0 && c != 0) {
-            start = (clusters_ + remainder - 2) / (clusters_ - 1);
-            remainder = remainder - start;
+    std::atomic<uint64_t> next_block(0);
+    auto worker = [&]() {
+        std::vector<float> block;
+
+        for (
+                uint64_t b = next_block++;
+                b < num_blocks;
+                b = next_block++
+            )
+        {
+            uint64_t const begin = b * block_points;
+            uint64_t const end = std::min(begin + block_points, num_points_);
+            uint64_t const stride = end - begin;
+
+            block.resize(stride * features_);
+            for (uint64_t p = begin; p < end; ++p) {
+                generate_point(p, &block[p - begin], stride);
+            }
+
+            visit(begin, end, block);
         }
+    };
 
-        for (uint64_t p = start; p < points_per_cluster; ++p) {
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
 
-            if (not (c == 0 and p == 0)) {
-                fh << '\n';
-            }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
 
-            for (uint64_t f = 0; f < features_; ++f) {
-                float point = centroid + gaussian(rgen);
+template <typename INT>
+void cle::ClusterGenerator::generate_matrix(
+        Matrix<float, std::allocator<float>, INT>& points,
+        Matrix<float, std::allocator<float>, INT>& centroids,
+        std::vector<uint32_t>& labels
+        ) {
+
+    prepare();
+
+    points.resize(num_points_, features_);
+    centroids.resize(clusters_, features_);
+    labels.resize(num_points_);
+
+    for (uint64_t c = 0; c < clusters_; ++c) {
+        for (uint64_t f = 0; f < features_; ++f) {
+            centroids(c, f) = centroids_[c * features_ + f];
+        }
+    }
+
+    generate_blocks([&](
+                uint64_t begin,
+                uint64_t end,
+                std::vector<float> const& block) {
 
-                if (f != 0) {
-                    fh << ',';
+            uint64_t const stride = end - begin;
+            for (uint64_t f = 0; f < features_; ++f) {
+                for (uint64_t p = begin; p < end; ++p) {
+                    points(p, f) = block[f * stride + p - begin];
                 }
+            }
+            for (uint64_t p = begin; p < end; ++p) {
+                labels[p] = cluster(p);
+            }
+            });
+}
+
+void cle::ClusterGenerator::generate_csv(char const* file_name) {
+
+    prepare();
+
+    std::ofstream fh(file_name, std::fstream::trunc);
+    std::vector<float> point(features_);
 
-                fh << point;
+    for (uint64_t p = 0; p < num_points_; ++p) {
+        generate_point(p, point.data(), 1);
+
+        if (p != 0) {
+            fh << '\n';
+        }
+
+        for (uint64_t f = 0; f < features_; ++f) {
+            if (f != 0) {
+                fh << ',';
             }
+
+            fh << point[f];
         }
     }
 }
 
 /*
- * Generate binary file
- * File format:
+ * Generate binary file in the version 2 format, see binary_format.hpp
  *
- * uint64_t num_features
- * uint64_t num_clusters
- * uint64_t num_points
- * float clusters[0 ... num_clusters-1], column major
- * float points[0 ... num_points-1], column major
+ * The file is sized up front, and each thread writes the columns and
+ * labels of its blocks in place. Int8 files take a first pass to find the
+ * range of each feature, which only computes the points again. The ground
+ * truth centroids and labels follow the points.
  */
 void cle::ClusterGenerator::generate_bin(char const* file_name) {
 
-    uint64_t size = bytes_ / sizeof(float);
-    uint64_t num_points = size / features_;
-    uint64_t points_per_cluster = num_points / clusters_;
-    num_points = points_per_cluster * clusters_;
-    uint64_t remainder = num_points % multiple_;
-    num_points = num_points - remainder;
+    prepare();
+
+    std::vector<float> min(features_, std::numeric_limits<float>::max());
+    std::vector<float> max(features_, std::numeric_limits<float>::lowest());
+    std::vector<float> scale(features_, 1.0f);
+
+    if (int8_) {
+        std::mutex range_mutex;
+        generate_blocks([&](
+                    uint64_t begin,
+                    uint64_t end,
+                    std::vector<float> const& block) {
+
+                uint64_t const stride = end - begin;
+                std::vector<float> block_min(features_);
+                std::vector<float> block_max(features_);
+                for (uint64_t f = 0; f < features_; ++f) {
+                    auto range = std::minmax_element(
+                            block.begin() + f * stride,
+                            block.begin() + (f + 1) * stride);
+                    block_min[f] = *range.first;
+                    block_max[f] = *range.second;
+                }
+
+                std::lock_guard<std::mutex> lock(range_mutex);
+                for (uint64_t f = 0; f < features_; ++f) {
+                    min[f] = std::min(min[f], block_min[f]);
+                    max[f] = std::max(max[f], block_max[f]);
+                }
+                });
+
+        for (uint64_t f = 0; f < features_; ++f) {
+            scale[f] = (max[f] > min[f]) ? (max[f] - min[f]) / 255.0f : 1.0f;
+        }
+    }
+
+    uint64_t const point_size = (int8_) ? sizeof(uint8_t) : sizeof(float);
+    uint64_t data_offset = 0;
+    uint64_t labels_offset = 0;
+    {
+        std::ofstream fh(
+                file_name,
+                std::fstream::binary | std::fstream::trunc);
+
+        uint64_t magic = Clustering::BinaryFormat::MAGIC_V2;
+        fh.write((char*)&magic, sizeof(magic));
+        uint64_t features = features_;
+        fh.write((char*)&features, sizeof(features));
+        uint64_t num_clusters = clusters_;
+        fh.write((char*)&num_clusters, sizeof(num_clusters));
+        uint64_t num_points = num_points_;
+        fh.write((char*)&num_points, sizeof(num_points));
+        uint64_t point_format = Clustering::BinaryFormat::FORMAT_FLOAT;
+        if (int8_) {
+            point_format = Clustering::BinaryFormat::FORMAT_INT8;
+        }
+        fh.write((char*)&point_format, sizeof(point_format));
+        if (int8_) {
+            fh.write((char*)min.data(), features_ * sizeof(float));
+            fh.write((char*)scale.data(), features_ * sizeof(float));
+        }
+
+        data_offset = fh.tellp();
 
-    std::default_random_engine rgen;
-    std::uniform_real_distribution<float> uniform(domain_min_, domain_max_);
-    std::normal_distribution<float> gaussian(-radius_, radius_);
+        // Centroids in column-major order, like the points
+        fh.seekp(data_offset + num_points_ * features_ * point_size);
+        for (uint64_t f = 0; f < features_; ++f) {
+            for (uint64_t c = 0; c < clusters_; ++c) {
+                fh.write(
+                        (char*)&centroids_[c * features_ + f],
+                        sizeof(float));
+            }
+        }
 
-    std::ofstream fh(file_name, std::fstream::binary | std::fstream::trunc);
+        labels_offset = fh.tellp();
 
-    uint64_t features = features_;
-    fh.write((char*)&features, sizeof(features));
-    uint64_t num_clusters = 0;
-    fh.write((char*)&num_clusters, sizeof(num_clusters));
-    fh.write((char*)&num_points, sizeof(num_points));
+        // Extend the file, so that blocks can be written in any order
+        fh.seekp(labels_offset + num_points_ * sizeof(uint32_t) - 1);
+        fh.put(0);
 
-    for (uint64_t f = 0; f < features_; ++f) {
-        uint64_t tmp_remainder = remainder;
+        if (not fh.good()) {
+            throw std::runtime_error(
+                    "Could not write file \"" + std::string(file_name)
+                    + "\"");
+        }
+    }
 
-        for (uint64_t c = 0; c < clusters_; ++c) {
-            float centroid = uniform(rgen);
+    std::atomic<bool> failed(false);
+    generate_blocks([&](
+                uint64_t begin,
+                uint64_t end,
+                std::vector<float> const& block) {
+
+            uint64_t const stride = end - begin;
+            std::fstream fh(
+                    file_name,
+                    std::fstream::binary
+                    | std::fstream::in
+                    | std::fstream::out);
+            std::vector<uint8_t> quantized;
+            std::vector<uint32_t> labels(stride);
 
-            uint64_t start = 0;
-            if (tmp_remainder != 0 && c != 0) {
-                start = (clusters_ + tmp_remainder - 2) / (clusters_ - 1);
-                tmp_remainder = tmp_remainder - start;
+            for (uint64_t f = 0; f < features_; ++f) {
+                fh.seekp(
+                        data_offset
+                        + (f * num_points_ + begin) * point_size);
+
+                float const* column = &block[f * stride];
+                if (int8_) {
+                    quantized.resize(stride);
+                    for (uint64_t p = 0; p < stride; ++p) {
+                        quantized[p] =
+                            Clustering::PointFormatHelper::quantize(
+                                    column[p],
+                                    min[f],
+                                    scale[f]);
+                    }
+                    fh.write((char*)quantized.data(), stride);
+                }
+                else {
+                    fh.write((char*)column, stride * sizeof(float));
+                }
             }
 
-            for (uint64_t p = start; p < points_per_cluster; ++p) {
-                float point = centroid + gaussian(rgen);
-                fh.write((char*)&point, sizeof(point));
+            for (uint64_t p = begin; p < end; ++p) {
+                labels[p - begin] = cluster(p);
             }
-        }
+            fh.seekp(labels_offset + begin * sizeof(uint32_t));
+            fh.write((char*)labels.data(), stride * sizeof(uint32_t));
+
+            if (not fh.good()) {
+                failed = true;
+            }
+            });
+
+    if (failed) {
+        throw std::runtime_error(
+                "Could not write file \"" + std::string(file_name) + "\"");
     }
 }
+
+template void cle::ClusterGenerator::generate_matrix(
+        cle::Matrix<float, std::allocator<float>, uint32_t>&,
+        cle::Matrix<float, std::allocator<float>, uint32_t>&,
+        std::vector<uint32_t>&);
+template void cle::ClusterGenerator::generate_matrix(
+        cle::Matrix<float, std::allocator<float>, uint64_t>&,
+        cle::Matrix<float, std::allocator<float>, uint64_t>&,
+        std::vector<uint32_t>&);
@@ -2,9 +2,9 @@
  * This Source Code Form is subject to the terms of the Mozilla Public License,
  * v. 2.0. If a copy of the MPL was not distributed with this file, You can
  * obtain one at http://mozilla.org/MPL/2.0/.
- * 
- * 
- * Copyright (c) 2016, Lutz, Clemens <lutzcle@cml.li>
+ *
+ *
+ * Copyright (c) 2016-2018, Lutz, Clemens <lutzcle@cml.li>
  */
 
 #ifndef CLUSTER_GENERATOR_HPP
@@ -12,10 +12,62 @@
 
 #include "matrix.hpp"
 
+#include <array>
 #include <cstdint>
+#include <functional>
 #include <vector>
 
 namespace cle {
+
+/*
+ * Philox4x32-10 counter-based random number generator
+ *
+ * Maps a 128-bit counter and a 64-bit key to 128 random bits, see Salmon et
+ * al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011. Any point of
+ * a data set can be drawn independently of all others.
+ */
+class Philox4x32 {
+public:
+    using Counter = std::array<uint32_t, 4>;
+
+    static Counter generate(Counter counter, uint64_t key) {
+        uint32_t k0 = (uint32_t) key;
+        uint32_t k1 = (uint32_t) (key >> 32);
+
+        for (int r = 0; r < 10; ++r) {
+            uint64_t p0 = (uint64_t) 0xD2511F53u * counter[0];
+            uint64_t p1 = (uint64_t) 0xCD9E8D57u * counter[2];
+
+            counter = {{
+                (uint32_t) (p1 >> 32) ^ counter[1] ^ k0,
+                (uint32_t) p1,
+                (uint32_t) (p0 >> 32) ^ counter[3] ^ k1,
+                (uint32_t) p0
+            }};
+
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+
+        return counter;
+    }
+};
+
+/*
+ * Gaussian clusters of points with known ground truth
+ *
+ * Every value is drawn from Philox4x32 with the point index as counter, so
+ * the data only depend on the seed and are the same for any number of
+ * threads. Files are generated in blocks by all threads and written in
+ * place, without holding the data set in memory.
+ *
+ * Clusters occupy consecutive ranges of points. The cluster sizes follow
+ * a power law with exponent imbalance (zero gives equal sizes). Each
+ * cluster has a standard deviation per feature of radius scaled by a
+ * factor in [1 / (1 + anisotropy), 1 + anisotropy]. With tail_degrees
+ * > 0, points follow a multivariate Student's t-distribution with that
+ * many degrees of freedom instead of a Gaussian.
+ */
 class ClusterGenerator {
 public:
     void num_features(uint64_t features);
@@ -24,10 +76,19 @@ public:
     void domain(float min, float max);
     void total_size(uint64_t bytes);
     void point_multiple(uint64_t multiple);
+    void int8(bool quantize);
+    void seed(uint64_t seed);
+    void num_threads(size_t threads);
+    void imbalance(float exponent);
+    void anisotropy(float factor);
+    void tail_degrees(uint64_t degrees);
 
+    uint64_t num_points() const;
+
+    template <typename INT>
     void generate_matrix(
-        Matrix<float, std::allocator<float>, uint32_t>& points,
-        Matrix<float, std::allocator<float>, uint32_t>& centroids,
+        Matrix<float, std::allocator<float>, INT>& points,
+        Matrix<float, std::allocator<float>, INT>& centroids,
         std::vector<uint32_t>& labels
         );
 
@@ -35,6 +96,19 @@ public:
     void generate_bin(char const* file_name);
 
 private:
+    // Points [begin, end) in column-major order, with a stride of
+    // end - begin between features
+    using BlockFunction = std::function<void(
+            uint64_t begin,
+            uint64_t end,
+            std::vector<float> const& block
+            )>;
+
+    void prepare();
+    uint32_t cluster(uint64_t point) const;
+    void generate_point(uint64_t point, float *features, size_t stride) const;
+    void generate_blocks(BlockFunction visit) const;
+
     uint64_t features_;
     uint64_t clusters_;
     float radius_;
@@ -42,6 +116,27 @@ private:
     float domain_max_;
     uint64_t bytes_;
     uint64_t multiple_;
+    bool int8_ = false;
+    uint64_t seed_ = 0;
+    size_t threads_ = 0;
+    float imbalance_ = 0.0f;
+    float anisotropy_ = 0.0f;
+    uint64_t tail_degrees_ = 0;
+
+    uint64_t num_points_;
+    std::vector<uint64_t> cluster_begin_;
+    std::vector<float> centroids_;
+    std::vector<float> deviations_;
 };
 }
+
+extern template void cle::ClusterGenerator::generate_matrix(
+        cle::Matrix<float, std::allocator<float>, uint32_t>&,
+        cle::Matrix<float, std::allocator<float>, uint32_t>&,
+        std::vector<uint32_t>&);
+extern template void cle::ClusterGenerator::generate_matrix(
+        cle::Matrix<float, std::allocator<float>, uint64_t>&,
+        cle::Matrix<float, std::allocator<float>, uint64_t>&,
+        std::vector<uint32_t>&);
+
 #endif /* CLUSTER_GENERATOR_HPP */
@@ -13,7 +13,9 @@
 
 #include "utility.hpp"
 
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <cstdint>
 #include <chrono>
 #include <vector>
@@ -42,7 +44,7 @@ void Clustering::ClusteringBenchmarkStats::set_dimensions(
 }
 
 void Clustering::ClusteringBenchmarkStats::print_times() {
-    std::cout << num_runs_ << " runs, in µs: [";
+    std::cout << microseconds.size() << " runs, in µs: [";
     for (uint32_t r = 0; r < microseconds.size(); ++r) {
         std::cout << microseconds[r];
         if (r != microseconds.size() - 1) {
@@ -50,14 +52,51 @@ void Clustering::ClusteringBenchmarkStats::print_times() {
         }
     }
     std::cout << "]" << std::endl;
+
+    BenchmarkHarness::print(
+            std::cout,
+            BenchmarkHarness::statistics(microseconds),
+            "µs");
+    std::cout << std::endl;
 }
 
-void Clustering::ClusteringBenchmarkStats::to_csv(
-        char const* csv_file,
-        char const* input_file
+void Clustering::ClusteringBenchmarkStats::set_peak(
+        double bandwidth,
+        double performance
         ) {
 
-    assert(microseconds.size() == measurements.size());
+    for (auto& m : measurements) {
+        m->set_peak(bandwidth, performance);
+    }
+}
+
+// Quality of the last run, as parameters of all runs
+void Clustering::ClusteringBenchmarkStats::set_quality(
+        ClusteringQuality const& quality
+        ) {
+
+    auto to_string = [](double value) {
+        std::ostringstream ss;
+        ss << std::setprecision(10) << value;
+        return ss.str();
+    };
+
+    for (auto& m : measurements) {
+        m->set_parameter("SSE", to_string(quality.sse));
+        if (quality.has_ground_truth()) {
+            m->set_parameter(
+                    "AdjustedRandIndex",
+                    to_string(quality.adjusted_rand_index));
+            m->set_parameter(
+                    "NormalizedMutualInformation",
+                    to_string(quality.normalized_mutual_information));
+        }
+    }
+}
+
+void Clustering::ClusteringBenchmarkStats::set_parameters(
+        char const* input_file
+        ) {
 
     char hostname[max_hostname_length];
     gethostname(hostname, max_hostname_length);
@@ -90,12 +129,42 @@ void Clustering::ClusteringBenchmarkStats::to_csv(
                 "NumClusters",
                 std::to_string(num_clusters_)
                 );
+    }
+}
 
+void Clustering::ClusteringBenchmarkStats::to_csv(
+        char const* csv_file,
+        char const* input_file
+        ) {
+
+    assert(microseconds.size() == measurements.size());
+
+    set_parameters(input_file);
+
+    for (auto& m : measurements) {
         m->write_csv(csv_file);
     }
 
 }
 
+void Clustering::ClusteringBenchmarkStats::to_columnar(
+        char const* columnar_file,
+        char const* input_file
+        ) {
+
+    set_parameters(input_file);
+
+    for (auto& m : measurements) {
+        m->write_columnar(columnar_file);
+    }
+}
+
+void Clustering::ClusteringBenchmarkStats::to_trace(char const* trace_file) {
+    for (auto& m : measurements) {
+        m->write_trace(trace_file);
+    }
+}
+
 template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
 Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::ClusteringBenchmark(
         const uint32_t num_runs,
@@ -109,7 +178,8 @@ Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::ClusteringBenc
         num_clusters_(0),
         max_iterations_(max_iterations),
         points_(std::move(points)),
-        labels_(num_points)
+        labels_(num_points),
+        harness_(num_runs)
 {}
 
 template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
@@ -132,6 +202,13 @@ int Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::finalize()
     return 1;
 }
 
+template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
+void Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::set_harness(
+        BenchmarkHarness harness) {
+
+    harness_ = harness;
+}
+
 template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
 Clustering::ClusteringBenchmarkStats Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::run(
         ClusteringFunction f) {
@@ -141,7 +218,7 @@ Clustering::ClusteringBenchmarkStats Clustering::ClusteringBenchmark<PointT, Lab
     ClusteringBenchmarkStats bs(this->num_runs_);
     bs.set_dimensions(points_.cols(), points_.rows(), centroids_.rows());
 
-    for (uint32_t r = 0; r < this->num_runs_; ++r) {
+    harness_.run([&](bool warmup) {
         init_centroids_(
                 points_,
                 centroids_
@@ -155,11 +232,14 @@ Clustering::ClusteringBenchmarkStats Clustering::ClusteringBenchmark<PointT, Lab
                 cluster_mass_,
                 labels_
                 );
-        bs.microseconds
-            .push_back(timer.stop<std::chrono::microseconds>());
-        measurement->set_run(r);
-        bs.measurements.push_back(measurement);
-    }
+        uint64_t microseconds = timer.stop<std::chrono::microseconds>();
+        if (not warmup) {
+            bs.microseconds.push_back(microseconds);
+            measurement->set_run(bs.measurements.size());
+            bs.measurements.push_back(measurement);
+        }
+        return microseconds;
+    });
 
     return bs;
 }
@@ -192,7 +272,7 @@ Clustering::ClusteringBenchmarkStats Clustering::ClusteringBenchmark<PointT, Lab
             [](std::vector<MassT> *){}
             );
 
-    for (uint32_t r = 0; r < this->num_runs_; ++r) {
+    harness_.run([&](bool warmup) {
         init_centroids_(
                 points_,
                 centroids_
@@ -207,11 +287,14 @@ Clustering::ClusteringBenchmarkStats Clustering::ClusteringBenchmark<PointT, Lab
                 masses,
                 labels
                 );
-        bs.microseconds
-            .push_back(timer.stop<std::chrono::microseconds>());
-        measurement->set_run(r);
-        bs.measurements.push_back(measurement);
-    }
+        uint64_t microseconds = timer.stop<std::chrono::microseconds>();
+        if (not warmup) {
+            bs.microseconds.push_back(microseconds);
+            measurement->set_run(bs.measurements.size());
+            bs.measurements.push_back(measurement);
+        }
+        return microseconds;
+    });
 
     return bs;
 }
@@ -325,14 +408,23 @@ double Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::mse() {
             );
 }
 
+template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
+Clustering::ClusteringQuality Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::quality(
+        std::vector<uint32_t> const& ground_truth) {
 
+    return QualityMetrics::evaluate(
+            points_,
+            centroids_,
+            labels_,
+            ground_truth);
+}
 
 template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
 void Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::print_labels() {
 
     std::cout << "Point Label" << std::endl;
     for (size_t i = 0; i < labels_.size(); ++i) {
-        std::cout << i << " " << labels_[i] << std::endl;
+        std::cout << i << " " << (uint64_t) labels_[i] << std::endl;
     }
 }
 
@@ -372,3 +464,7 @@ void Clustering::ClusteringBenchmark<PointT, LabelT, MassT, ColMajor>::print_res
 
 template class Clustering::ClusteringBenchmark<float, uint32_t, uint32_t, true>;
 template class Clustering::ClusteringBenchmark<double, uint64_t, uint64_t, true>;
+template class Clustering::ClusteringBenchmark<float, uint16_t, uint32_t, true>;
+template class Clustering::ClusteringBenchmark<double, uint16_t, uint64_t, true>;
+template class Clustering::ClusteringBenchmark<float, uint8_t, uint32_t, true>;
+template class Clustering::ClusteringBenchmark<double, uint8_t, uint64_t, true>;
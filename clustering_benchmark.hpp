@@ -12,6 +12,8 @@
 
 #include "timer.hpp"
 #include "matrix.hpp"
+#include "benchmark_harness.hpp"
+#include "clustering_quality.hpp"
 #include "measurement/measurement.hpp"
 
 #include <vector>
@@ -33,12 +35,18 @@ public:
             );
 
     void print_times();
+    void set_peak(double bandwidth, double performance);
+    void set_quality(ClusteringQuality const& quality);
     void to_csv(char const* csv_file, char const* input_file);
+    void to_trace(char const* trace_file);
+    void to_columnar(char const* columnar_file, char const* input_file);
 
     std::vector<uint64_t> microseconds;
     std::vector<std::shared_ptr<Measurement::Measurement>> measurements;
 
 private:
+    void set_parameters(char const* input_file);
+
     uint32_t num_runs_;
     uint64_t num_features_, num_points_, num_clusters_;
 
@@ -101,6 +109,9 @@ public:
             );
     int finalize();
 
+    // Replaces the default of num_runs runs without warmup
+    void set_harness(BenchmarkHarness harness);
+
     ClusteringBenchmarkStats run(ClusteringFunction f);
     ClusteringBenchmarkStats run(ClClusteringFunction f);
     void setVerificationReference(std::vector<LabelT>&& reference_labels);
@@ -108,6 +119,9 @@ public:
     uint64_t verify(ClusteringFunction f);
     uint64_t verify(ClClusteringFunction f);
     double mse();
+
+    // Quality of the last result, against ground truth labels if given
+    ClusteringQuality quality(std::vector<uint32_t> const& ground_truth);
     void print_labels();
     void print_result();
 
@@ -124,6 +138,7 @@ private:
     std::vector<LabelT> labels_;
     std::vector<LabelT> reference_labels_;
     InitCentroidsFunction init_centroids_;
+    BenchmarkHarness harness_;
 };
 
 }
@@ -0,0 +1,222 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef CLUSTERING_QUALITY_HPP
+#define CLUSTERING_QUALITY_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Clustering {
+
+struct ClusteringQuality {
+    // Sum of squared distances of the points to their centroids
+    double sse = 0.0;
+
+    // Against ground truth labels, NaN without ground truth
+    double adjusted_rand_index = std::numeric_limits<double>::quiet_NaN();
+    double normalized_mutual_information =
+        std::numeric_limits<double>::quiet_NaN();
+
+    bool has_ground_truth() const {
+        return not std::isnan(adjusted_rand_index);
+    }
+};
+
+class QualityMetrics {
+public:
+
+    /*
+     * Sum of squared errors
+     *
+     * Input:
+     *  points:     Points matrix
+     *  centroids:  Centroids matrix
+     *  labels:     Cluster of each point
+     */
+    template <typename PointMatrix, typename CentroidMatrix, typename Labels>
+    static double sse(
+            PointMatrix const& points,
+            CentroidMatrix const& centroids,
+            Labels const& labels)
+    {
+        double sum = 0.0;
+
+        for (size_t f = 0; f < points.cols(); ++f) {
+            for (size_t p = 0; p < points.rows(); ++p) {
+                double d =
+                    (double) points(p, f)
+                    - (double) centroids(labels[p], f);
+                sum += d * d;
+            }
+        }
+
+        return sum;
+    }
+
+    /*
+     * Adjusted Rand index (Hubert and Arabie)
+     *
+     * 1 for identical clusterings up to a permutation of the labels, about
+     * 0 for random labels.
+     */
+    template <typename Labels, typename Reference>
+    static double adjusted_rand_index(
+            Labels const& labels,
+            Reference const& reference)
+    {
+        Contingency table(labels, reference);
+        if (table.total < 2) {
+            return 1.0;
+        }
+
+        double index = 0.0;
+        for (auto n : table.counts) {
+            index += pairs(n);
+        }
+
+        double row_pairs = 0.0;
+        for (auto n : table.row_sums) {
+            row_pairs += pairs(n);
+        }
+
+        double col_pairs = 0.0;
+        for (auto n : table.col_sums) {
+            col_pairs += pairs(n);
+        }
+
+        double expected = row_pairs * col_pairs / pairs(table.total);
+        double max = 0.5 * (row_pairs + col_pairs);
+
+        if (max == expected) {
+            return 1.0;
+        }
+
+        return (index - expected) / (max - expected);
+    }
+
+    /*
+     * Normalized mutual information
+     *
+     * Normalized by the arithmetic mean of both entropies. 1 for identical
+     * clusterings up to a permutation of the labels, 0 for independent
+     * labels.
+     */
+    template <typename Labels, typename Reference>
+    static double normalized_mutual_information(
+            Labels const& labels,
+            Reference const& reference)
+    {
+        Contingency table(labels, reference);
+        double const n = table.total;
+
+        double mutual_information = 0.0;
+        for (size_t i = 0; i < table.rows; ++i) {
+            for (size_t j = 0; j < table.cols; ++j) {
+                double nij = table.counts[i * table.cols + j];
+                if (nij > 0.0) {
+                    mutual_information +=
+                        nij / n
+                        * std::log(
+                                n * nij
+                                / ((double) table.row_sums[i]
+                                    * (double) table.col_sums[j]));
+                }
+            }
+        }
+
+        double mean_entropy =
+            0.5 * (entropy(table.row_sums, n) + entropy(table.col_sums, n));
+
+        if (mean_entropy == 0.0) {
+            return 1.0;
+        }
+
+        return std::max(0.0, mutual_information / mean_entropy);
+    }
+
+    template <
+        typename PointMatrix,
+        typename CentroidMatrix,
+        typename Labels,
+        typename Reference
+        >
+    static ClusteringQuality evaluate(
+            PointMatrix const& points,
+            CentroidMatrix const& centroids,
+            Labels const& labels,
+            Reference const& reference)
+    {
+        ClusteringQuality quality;
+
+        quality.sse = sse(points, centroids, labels);
+        if (not reference.empty() && reference.size() == labels.size()) {
+            quality.adjusted_rand_index =
+                adjusted_rand_index(labels, reference);
+            quality.normalized_mutual_information =
+                normalized_mutual_information(labels, reference);
+        }
+
+        return quality;
+    }
+
+private:
+    struct Contingency {
+        template <typename Labels, typename Reference>
+        Contingency(Labels const& labels, Reference const& reference)
+            :
+                rows(0),
+                cols(0),
+                total(labels.size())
+        {
+            for (size_t p = 0; p < total; ++p) {
+                rows = std::max(rows, (size_t) labels[p] + 1);
+                cols = std::max(cols, (size_t) reference[p] + 1);
+            }
+
+            counts.assign(rows * cols, 0);
+            row_sums.assign(rows, 0);
+            col_sums.assign(cols, 0);
+
+            for (size_t p = 0; p < total; ++p) {
+                ++counts[(size_t) labels[p] * cols + (size_t) reference[p]];
+                ++row_sums[labels[p]];
+                ++col_sums[reference[p]];
+            }
+        }
+
+        size_t rows, cols;
+        uint64_t total;
+        std::vector<uint64_t> counts;
+        std::vector<uint64_t> row_sums;
+        std::vector<uint64_t> col_sums;
+    };
+
+    static double pairs(uint64_t n) {
+        return 0.5 * (double) n * ((double) n - 1.0);
+    }
+
+    static double entropy(std::vector<uint64_t> const& sums, double n) {
+        double h = 0.0;
+        for (auto s : sums) {
+            if (s > 0) {
+                h -= s / n * std::log(s / n);
+            }
+        }
+        return h;
+    }
+};
+
+}
+
+#endif /* CLUSTERING_QUALITY_HPP */
@@ -11,6 +11,7 @@
 
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <stdexcept>
 
@@ -34,12 +35,30 @@ void ConfigurationParser::parse_file(std::string file) {
     po::options_description desc;
     desc.add(benchmark_options());
     desc.add(kmeans_options());
+    desc.add(sweep_options());
 
     po::store(po::parse_config_file(handle, desc), this->vm);
 
     handle.close();
 }
 
+void ConfigurationParser::set_option(std::string name, std::string value) {
+
+    po::options_description desc;
+    desc.add(benchmark_options());
+    desc.add(kmeans_options());
+
+    std::istringstream line(name + " = " + value);
+    po::variables_map option;
+    po::store(po::parse_config_file(line, desc), option);
+
+    // store() doesn't replace values that were already set
+    for (auto const& o : option) {
+        this->vm.erase(o.first);
+        this->vm.insert(o);
+    }
+}
+
 po::options_description ConfigurationParser::benchmark_options() {
 
     po::options_description desc;
@@ -48,6 +67,13 @@ po::options_description ConfigurationParser::benchmark_options() {
 
         ("benchmark.runs", po::value<size_t>())
         ("benchmark.verify", po::value<bool>())
+        ("benchmark.event_capacity", po::value<size_t>())
+        ("benchmark.warmup_runs", po::value<size_t>())
+        ("benchmark.max_runs", po::value<size_t>())
+        ("benchmark.ci_width", po::value<double>())
+        ("benchmark.peak_bandwidth", po::value<double>())
+        ("benchmark.peak_performance", po::value<double>())
+        ("benchmark.hardware_counters", po::value<bool>())
 
         ;
 
@@ -65,6 +91,7 @@ po::options_description ConfigurationParser::kmeans_options() {
         ("kmeans.pipeline", po::value<std::string>())
         ("kmeans.iterations", po::value<size_t>())
         ("kmeans.converge", po::value<bool>())
+        ("kmeans.labels_final_only", po::value<bool>())
         ("kmeans.types.point", po::value<std::string>())
         ("kmeans.types.label", po::value<std::string>())
         ("kmeans.types.mass", po::value<std::string>())
@@ -76,8 +103,11 @@ po::options_description ConfigurationParser::kmeans_options() {
         ("kmeans.labeling.global_size", po::value<std::vector<size_t>>())
         ("kmeans.labeling.local_size", po::value<std::vector<size_t>>())
         ("kmeans.labeling.vector_length", po::value<size_t>())
+        ("kmeans.labeling.tuning", po::value<std::vector<std::string>>())
         ("kmeans.labeling.unroll_clusters_length", po::value<size_t>())
         ("kmeans.labeling.unroll_features_length", po::value<size_t>())
+        ("kmeans.labeling.mass_histogram", po::value<bool>())
+        ("kmeans.labeling.cluster_sse", po::value<bool>())
 
         // Mass sum specific
         ("kmeans.mass_update.platform", po::value<size_t>())
@@ -96,6 +126,9 @@ po::options_description ConfigurationParser::kmeans_options() {
         ("kmeans.centroid_update.local_features", po::value<size_t>())
         ("kmeans.centroid_update.thread_features", po::value<size_t>())
         ("kmeans.centroid_update.vector_length", po::value<size_t>())
+        ("kmeans.centroid_update.scratch_budget", po::value<size_t>())
+        ("kmeans.centroid_update.compensated_sum", po::value<bool>())
+        ("kmeans.centroid_update.tuning", po::value<std::vector<std::string>>())
 
         // Fused specific
         ("kmeans.fused.platform", po::value<size_t>())
@@ -104,6 +137,23 @@ po::options_description ConfigurationParser::kmeans_options() {
         ("kmeans.fused.global_size", po::value<std::vector<size_t>>())
         ("kmeans.fused.local_size", po::value<std::vector<size_t>>())
         ("kmeans.fused.vector_length", po::value<size_t>())
+        ("kmeans.fused.compensated_sum", po::value<bool>())
+        ("kmeans.fused.cluster_sse", po::value<bool>())
+        ("kmeans.fused.tuning", po::value<std::vector<std::string>>())
+
+        ;
+
+    return desc;
+}
+
+po::options_description ConfigurationParser::sweep_options() {
+
+    po::options_description desc;
+
+    desc.add_options()
+
+        ("sweep.data", po::value<std::vector<std::string>>())
+        ("sweep.vary", po::value<std::vector<std::string>>())
 
         ;
 
@@ -121,6 +171,27 @@ BenchmarkConfiguration ConfigurationParser::get_benchmark_configuration() {
         else if (option.first == "benchmark.verify") {
             conf.verify = option.second.as<bool>();
         }
+        else if (option.first == "benchmark.event_capacity") {
+            conf.event_capacity = option.second.as<size_t>();
+        }
+        else if (option.first == "benchmark.warmup_runs") {
+            conf.warmup_runs = option.second.as<size_t>();
+        }
+        else if (option.first == "benchmark.max_runs") {
+            conf.max_runs = option.second.as<size_t>();
+        }
+        else if (option.first == "benchmark.ci_width") {
+            conf.ci_width = option.second.as<double>();
+        }
+        else if (option.first == "benchmark.peak_bandwidth") {
+            conf.peak_bandwidth = option.second.as<double>();
+        }
+        else if (option.first == "benchmark.peak_performance") {
+            conf.peak_performance = option.second.as<double>();
+        }
+        else if (option.first == "benchmark.hardware_counters") {
+            conf.hardware_counters = option.second.as<bool>();
+        }
     }
 
     return conf;
@@ -143,6 +214,9 @@ KmeansConfiguration ConfigurationParser::get_kmeans_configuration() {
         else if (option.first == "kmeans.converge") {
             conf.converge = option.second.as<bool>();
         }
+        else if (option.first == "kmeans.labels_final_only") {
+            conf.labels_final_only = option.second.as<bool>();
+        }
         else if (option.first == "kmeans.types.point") {
             conf.point_type = option.second.as<std::string>();
         }
@@ -192,12 +266,24 @@ LabelingConfiguration ConfigurationParser::get_labeling_configuration() {
         else if (option.first == "kmeans.labeling.vector_length") {
             conf.vector_length = option.second.as<size_t>();
         }
+        else if (option.first == "kmeans.labeling.tuning") {
+            for (auto const& rule
+                    : option.second.as<std::vector<std::string>>()) {
+                conf.tuning.add(rule);
+            }
+        }
         else if (option.first == "kmeans.labeling.unroll_clusters_length") {
             conf.unroll_clusters_length = option.second.as<size_t>();
         }
         else if (option.first == "kmeans.labeling.unroll_features_length") {
             conf.unroll_features_length = option.second.as<size_t>();
         }
+        else if (option.first == "kmeans.labeling.mass_histogram") {
+            conf.mass_histogram = option.second.as<bool>();
+        }
+        else if (option.first == "kmeans.labeling.cluster_sse") {
+            conf.cluster_sse = option.second.as<bool>();
+        }
 
     }
 
@@ -283,6 +369,18 @@ CentroidUpdateConfiguration ConfigurationParser::get_centroid_update_configurati
         else if (option.first == "kmeans.centroid_update.vector_length") {
             conf.vector_length = option.second.as<size_t>();
         }
+        else if (option.first == "kmeans.centroid_update.scratch_budget") {
+            conf.scratch_budget = option.second.as<size_t>();
+        }
+        else if (option.first == "kmeans.centroid_update.compensated_sum") {
+            conf.compensated_sum = option.second.as<bool>();
+        }
+        else if (option.first == "kmeans.centroid_update.tuning") {
+            for (auto const& rule
+                    : option.second.as<std::vector<std::string>>()) {
+                conf.tuning.add(rule);
+            }
+        }
     }
 
     return conf;
@@ -322,6 +420,39 @@ FusedConfiguration ConfigurationParser::get_fused_configuration() {
         else if (option.first == "kmeans.fused.vector_length") {
             conf.vector_length = option.second.as<size_t>();
         }
+        else if (option.first == "kmeans.fused.compensated_sum") {
+            conf.compensated_sum = option.second.as<bool>();
+        }
+        else if (option.first == "kmeans.fused.cluster_sse") {
+            conf.cluster_sse = option.second.as<bool>();
+        }
+        else if (option.first == "kmeans.fused.tuning") {
+            for (auto const& rule
+                    : option.second.as<std::vector<std::string>>()) {
+                conf.tuning.add(rule);
+            }
+        }
+    }
+
+    return conf;
+}
+
+SweepConfiguration ConfigurationParser::get_sweep_configuration() {
+    SweepConfiguration conf;
+
+    for (auto const& option : vm) {
+        if (option.first == "sweep.data") {
+            for (auto const& file
+                    : option.second.as<std::vector<std::string>>()) {
+                conf.add_data_file(file);
+            }
+        }
+        else if (option.first == "sweep.vary") {
+            for (auto const& axis
+                    : option.second.as<std::vector<std::string>>()) {
+                conf.add_axis(axis);
+            }
+        }
     }
 
     return conf;
@@ -16,6 +16,7 @@
 #include "mass_update_configuration.hpp"
 #include "centroid_update_configuration.hpp"
 #include "fused_configuration.hpp"
+#include "sweep_configuration.hpp"
 
 #include <cstddef>
 #include <string>
@@ -34,10 +35,15 @@ public:
     MassUpdateConfiguration get_mass_update_configuration();
     CentroidUpdateConfiguration get_centroid_update_configuration();
     FusedConfiguration get_fused_configuration();
+    SweepConfiguration get_sweep_configuration();
+
+    // Override an option of the parsed file, e.g. for a sweep point
+    void set_option(std::string name, std::string value);
 
 private:
     boost::program_options::options_description benchmark_options();
     boost::program_options::options_description kmeans_options();
+    boost::program_options::options_description sweep_options();
 
     boost::program_options::variables_map vm;
 
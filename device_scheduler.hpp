@@ -70,6 +70,35 @@ namespace Clustering {
                 Measurement::DataPoint&
                 )>;
 
+        /*
+         * Function that reports the modified ranges of a buffer, after an
+         * enqueued function has modified it.
+         *
+         * The parameters are the Boost::Compute CommandQueue, the Buffer and
+         * the events of the enqueued function. The function shall return a
+         * BufferCache::DirtyBitmap.
+         */
+        using FunDirty = std::function<BufferCache::DirtyBitmap(
+                Queue,
+                Buffer,
+                WaitList
+                )>;
+
+        /*
+         * Access of an enqueued function to an object.
+         *
+         * Buffers of objects that are only read are unlocked as unmodified,
+         * such that the BufferCache need not write them back on eviction.
+         * Buffers of objects that are overwritten completely are not
+         * written to the device before the function runs, except for a
+         * last buffer that is shorter than the step.
+         */
+        enum class ObjectAccess {
+            Read,
+            ReadWrite,
+            Write
+        };
+
         virtual ~DeviceScheduler() {};
 
         /*
@@ -105,6 +134,10 @@ namespace Clustering {
          * that all objects consist of an equal number of "step"-sized buffers.
          * Buffers with corresponding indices will be passed at the same time,
          * as in: map[f(fst(x), snd(x)), with x = zip(fst_object, snd_object)]
+         *
+         * Objects are presumed to be modified unless their ObjectAccess
+         * is given. If a FunDirty is given for the snd object, only the
+         * ranges that it reports are presumed to be modified.
          */
         virtual int enqueue(
                 FunUnary kernel_function,
@@ -113,12 +146,43 @@ namespace Clustering {
                 std::future<std::deque<Event>>& kernel_events,
                 Measurement::DataPoint& datapoint
                 ) = 0;
+        virtual int enqueue(
+                FunUnary kernel_function,
+                uint32_t object_id,
+                size_t step,
+                ObjectAccess access,
+                std::future<std::deque<Event>>& kernel_events,
+                Measurement::DataPoint& datapoint
+                ) = 0;
+        virtual int enqueue(
+                FunBinary kernel_function,
+                uint32_t fst_object_id,
+                uint32_t snd_object_id,
+                size_t fst_step,
+                size_t snd_step,
+                std::future<std::deque<Event>>& kernel_events,
+                Measurement::DataPoint& datapoint
+                ) = 0;
+        virtual int enqueue(
+                FunBinary kernel_function,
+                uint32_t fst_object_id,
+                uint32_t snd_object_id,
+                size_t fst_step,
+                size_t snd_step,
+                ObjectAccess fst_access,
+                ObjectAccess snd_access,
+                std::future<std::deque<Event>>& kernel_events,
+                Measurement::DataPoint& datapoint
+                ) = 0;
         virtual int enqueue(
                 FunBinary kernel_function,
                 uint32_t fst_object_id,
                 uint32_t snd_object_id,
                 size_t fst_step,
                 size_t snd_step,
+                ObjectAccess fst_access,
+                ObjectAccess snd_access,
+                FunDirty snd_dirty,
                 std::future<std::deque<Event>>& kernel_events,
                 Measurement::DataPoint& datapoint
                 ) = 0;
@@ -10,6 +10,9 @@
 #ifndef FUSED_CONFIGURATION_HPP
 #define FUSED_CONFIGURATION_HPP
 
+#include "point_format.hpp"
+#include "tuning_table.hpp"
+
 #include <cstddef>
 #include <string>
 
@@ -22,6 +25,15 @@ struct FusedConfiguration {
     size_t global_size[3];
     size_t local_size[3];
     size_t vector_length;
+    std::string point_format;
+    PointQuantization point_quantization;
+    TuningTable tuning;
+    // Kahan summation of the private centroids
+    bool compensated_sum = false;
+    // Sum the squared distances of the points per cluster
+    bool cluster_sse = false;
+    // Flag the blocks of labels that changed, set by the buffered pipelines
+    bool label_changes = false;
 };
 
 }
@@ -11,6 +11,7 @@
 #define FUSED_FACTORY_HPP
 
 #include "fused_configuration.hpp"
+#include "tuned_strategy.hpp"
 
 #include "cl_kernels/fused_cluster_merge.hpp"
 #include "cl_kernels/fused_feature_sum.hpp"
@@ -18,6 +19,7 @@
 #include <functional>
 #include <string>
 #include <stdexcept>
+#include <vector>
 
 #include <boost/compute/core.hpp>
 #include <boost/compute/iterator/buffer_iterator.hpp>
@@ -47,6 +49,8 @@ public:
                 BufferIterator<LabelT> labels_end,
                 BufferIterator<MassT> masses_begin,
                 BufferIterator<MassT> masses_end,
+                BufferIterator<PointT> cluster_sse_begin,
+                BufferIterator<PointT> cluster_sse_end,
                 Measurement::DataPoint& datapoint,
                 boost::compute::wait_list const& events
                 )
@@ -57,6 +61,30 @@ public:
             FusedConfiguration config,
             Measurement::Measurement& measurement)
     {
+        check(config);
+
+        measurement.set_parameter(
+                "FusedClusterSse",
+                (config.cluster_sse) ? "true" : "false"
+                );
+
+        // Select the strategy when the data shape is known
+        if (not config.tuning.empty()) {
+            measurement.set_parameter(
+                    "FusedTuningRules",
+                    std::to_string(config.tuning.size())
+                    );
+
+            TuningTable tuning = config.tuning;
+            config.tuning = TuningTable();
+            return TunedStrategy<FusedFunction, FusedConfiguration>(
+                    config,
+                    tuning,
+                    [context](FusedConfiguration c) {
+                        return create_strategy(context, c);
+                    });
+        }
+
         measurement.set_parameter(
                 "FusedGlobalSize",
                 std::to_string(config.global_size[0])
@@ -69,7 +97,116 @@ public:
                 "FusedVectorLength",
                 std::to_string(config.vector_length)
                 );
+        measurement.set_parameter(
+                "FusedCompensatedSum",
+                (config.compensated_sum) ? "true" : "false"
+                );
+
+        return create_strategy(context, config);
+    }
+
+    /*
+     * Build the strategy that the tuning table selects for the data shape
+     *
+     * Pipelines call this before they start timing.
+     */
+    static void prepare(
+            FusedFunction& f,
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_clusters)
+    {
+        TunedStrategy<FusedFunction, FusedConfiguration>::prepare(
+                f,
+                queue,
+                num_features,
+                num_clusters);
+    }
+
+    /*
+     * Blocks of labels that the last call on labels changed, in the format
+     * of BufferCache::unlock
+     *
+     * Requires label_changes. Reports the whole buffer as changed if no
+     * strategy flagged the blocks of labels.
+     */
+    static std::vector<bool> changed_blocks(
+            FusedFunction& f,
+            boost::compute::command_queue queue,
+            boost::compute::buffer const& labels,
+            boost::compute::wait_list const& events)
+    {
+        using ClusterMerge = FusedClusterMerge<
+            PointT,
+            LabelT,
+            MassT,
+            ColMajor>;
+        using FeatureSum = FusedFeatureSum<
+            PointT,
+            LabelT,
+            MassT,
+            ColMajor>;
 
+        std::vector<bool> changed;
+        TunedStrategy<FusedFunction, FusedConfiguration>::for_each(
+                f,
+                [&](FusedFunction& strategy) {
+                    std::vector<bool> blocks;
+                    ClusterMerge* cluster_merge =
+                        strategy.template target<ClusterMerge>();
+                    FeatureSum* feature_sum =
+                        strategy.template target<FeatureSum>();
+                    bool const found = (cluster_merge)
+                        ? cluster_merge->changed_blocks(
+                                queue, labels, events, blocks)
+                        : (feature_sum)
+                        ? feature_sum->changed_blocks(
+                                queue, labels, events, blocks)
+                        : false;
+                    if (not found) {
+                        return;
+                    }
+
+                    // Strategies that ran on labels earlier may still
+                    // hold flags of labels, which only add blocks
+                    changed.resize(blocks.size(), false);
+                    for (size_t i = 0; i < blocks.size(); ++i) {
+                        changed[i] = changed[i] or blocks[i];
+                    }
+                });
+
+        if (changed.empty()) {
+            changed.assign(1, true);
+        }
+
+        return changed;
+    }
+
+private:
+    /*
+     * Reject options that the base strategy or a tuned strategy cannot
+     * run, before any strategy is built
+     */
+    static void check(FusedConfiguration const& config) {
+        if (not config.compensated_sum) {
+            return;
+        }
+
+        bool supported = (config.strategy == "cluster_merge");
+        for (auto const& rule : config.tuning.rules()) {
+            supported = supported && (rule.strategy == "cluster_merge");
+        }
+
+        if (not supported) {
+            throw std::invalid_argument(
+                    "compensated_sum requires cluster_merge");
+        }
+    }
+
+    static FusedFunction create_strategy(
+            boost::compute::context context,
+            FusedConfiguration config)
+    {
         if (config.strategy == "cluster_merge") {
             FusedClusterMerge<PointT, LabelT, MassT, ColMajor> strategy;
             strategy.prepare(context, config);
@@ -9,6 +9,7 @@
 
 #include "cluster_generator.hpp"
 
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <string>
@@ -36,6 +37,7 @@ public:
         cmdline.add_options()
             ("help", "Produce help message")
             ("csv", "Generate CSV file (default output is binary)")
+            ("int8", "Quantize binary file to 8-bit points (version 2 format)")
             ("size", po::value<uint64_t>(&megabytes_)->default_value(100),
              "Target file size in MiB (as float-type data)")
             ("features", po::value<uint64_t>(&features_)->default_value(2),
@@ -50,6 +52,16 @@ public:
              "Domain space (maximum value for centroids)")
             ("divisor", po::value<uint64_t>(&multiple_)->default_value(8),
              "Number of points are multiple of divisor")
+            ("seed", po::value<uint64_t>(&seed_)->default_value(0),
+             "Random seed (output is the same for any number of threads)")
+            ("threads", po::value<size_t>(&threads_)->default_value(0),
+             "Number of threads (0 uses all hardware threads)")
+            ("imbalance", po::value<float>(&imbalance_)->default_value(0.0f),
+             "Cluster sizes follow a power law with this exponent")
+            ("anisotropy", po::value<float>(&anisotropy_)->default_value(0.0f),
+             "Scale radius per feature by up to a factor of 1 + anisotropy")
+            ("tail", po::value<uint64_t>(&tail_degrees_)->default_value(0),
+             "Heavy-tailed clusters (Student's t with this many degrees of freedom)")
             ;
 
         po::options_description hidden("Hidden options");
@@ -82,6 +94,8 @@ public:
             csv_format_ = false;
         }
 
+        int8_ = vm.count("int8") > 0;
+
         // Ensure we have required options
         if (output_file_.empty()) {
             std::cout << "Give me an output file!" << std::endl;
@@ -95,6 +109,10 @@ public:
         return csv_format_;
     }
 
+    bool int8() const {
+        return int8_;
+    }
+
     uint64_t features() const {
         return features_;
     }
@@ -123,6 +141,26 @@ public:
         return domain_max_;
     }
 
+    uint64_t seed() const {
+        return seed_;
+    }
+
+    size_t threads() const {
+        return threads_;
+    }
+
+    float imbalance() const {
+        return imbalance_;
+    }
+
+    float anisotropy() const {
+        return anisotropy_;
+    }
+
+    uint64_t tail_degrees() const {
+        return tail_degrees_;
+    }
+
     std::string output_file() const {
         return output_file_;
     }
@@ -130,6 +168,7 @@ public:
 private:
     std::string output_file_;
     bool csv_format_;
+    bool int8_;
     uint64_t features_;
     uint64_t clusters_;
     uint64_t megabytes_;
@@ -137,6 +176,11 @@ private:
     float radius_;
     float domain_min_;
     float domain_max_;
+    uint64_t seed_;
+    size_t threads_;
+    float imbalance_;
+    float anisotropy_;
+    uint64_t tail_degrees_;
 };
 
 int main(int argc, char **argv) {
@@ -154,6 +198,12 @@ int main(int argc, char **argv) {
     generator.num_features(options.features());
     generator.num_clusters(options.clusters());
     generator.point_multiple(options.multiple());
+    generator.int8(options.int8());
+    generator.seed(options.seed());
+    generator.num_threads(options.threads());
+    generator.imbalance(options.imbalance());
+    generator.anisotropy(options.anisotropy());
+    generator.tail_degrees(options.tail_degrees());
 
     if (options.csv_format()) {
         generator.generate_csv(options.output_file().c_str());
@@ -23,6 +23,9 @@ struct KmeansConfiguration {
     std::string point_type;
     std::string label_type;
     std::string mass_type;
+    // Buffered single stage: labels only leave the device in the last
+    // iteration
+    bool labels_final_only = false;
 };
 
 }
@@ -8,6 +8,7 @@
  */
 
 #include "kmeans_naive.hpp"
+#include "timer.hpp"
 
 #include <cassert>
 #include <algorithm>
@@ -27,6 +28,18 @@ int Clustering::KmeansNaive<PointT, LabelT, MassT>::initialize() { return 1; }
 template <typename PointT, typename LabelT, typename MassT>
 int Clustering::KmeansNaive<PointT, LabelT, MassT>::finalize() { return 1; }
 
+template <typename PointT, typename LabelT, typename MassT>
+void Clustering::KmeansNaive<PointT, LabelT, MassT>::set_hardware_counters(
+        bool enable) {
+
+    if (enable) {
+        hardware_counters_.reset(new Measurement::HardwareCounters);
+    }
+    else {
+        hardware_counters_.reset();
+    }
+}
+
 template <typename PointT, typename LabelT, typename MassT>
 std::shared_ptr<Measurement::Measurement>
 Clustering::KmeansNaive<PointT, LabelT, MassT>::operator() (
@@ -39,6 +52,15 @@ Clustering::KmeansNaive<PointT, LabelT, MassT>::operator() (
     assert(labels.size() == points.rows());
     assert(cluster_mass.size() == centroids.rows());
 
+    auto measurement = std::make_shared<Measurement::Measurement>();
+
+    if (hardware_counters_) {
+        hardware_counters_->start();
+    }
+
+    Timer::Timer total_timer;
+    total_timer.start();
+
     uint32_t iterations = 0;
     bool did_changes = true;
     while (/*did_changes == true && */ iterations < max_iterations) {
@@ -102,8 +124,20 @@ Clustering::KmeansNaive<PointT, LabelT, MassT>::operator() (
         ++iterations;
     }
 
-    return std::make_shared<Measurement::Measurement>();
+    uint64_t total_time = total_timer.stop<std::chrono::nanoseconds>();
+    auto& total_datapoint = measurement->add_datapoint()
+        .set_name("TotalTime");
+    total_datapoint.add_value() = total_time;
+    if (hardware_counters_) {
+        hardware_counters_->stop(total_datapoint);
+    }
+
+    return measurement;
 }
 
 template class Clustering::KmeansNaive<float, uint32_t, uint32_t>;
 template class Clustering::KmeansNaive<double, uint64_t, uint64_t>;
+template class Clustering::KmeansNaive<float, uint16_t, uint32_t>;
+template class Clustering::KmeansNaive<double, uint16_t, uint64_t>;
+template class Clustering::KmeansNaive<float, uint8_t, uint32_t>;
+template class Clustering::KmeansNaive<double, uint8_t, uint64_t>;
@@ -13,6 +13,7 @@
 #include "kmeans_common.hpp"
 #include "matrix.hpp"
 #include "measurement/measurement.hpp"
+#include "measurement/hardware_counters.hpp"
 
 #include <vector>
 #include <memory>
@@ -27,6 +28,9 @@ public:
     int initialize();
     int finalize();
 
+    // Sample host-side hardware counters around the iterations
+    void set_hardware_counters(bool enable);
+
     std::shared_ptr<Measurement::Measurement> operator() (
             uint32_t const max_iterations,
             cle::Matrix<PointT, std::allocator<PointT>, size_t, true> const& points,
@@ -34,6 +38,9 @@ public:
             std::vector<MassT>& cluster_mass,
             std::vector<LabelT>& labels
             );
+
+private:
+    std::shared_ptr<Measurement::HardwareCounters> hardware_counters_;
 };
 
 using KmeansNaive32 =
@@ -12,6 +12,9 @@
 
 #include "abstract_kmeans.hpp"
 #include "fused_factory.hpp"
+#include "point_format.hpp"
+
+#include "cl_kernels/stream_merge.hpp"
 
 #include "measurement/measurement.hpp"
 #include "timer.hpp"
@@ -20,6 +23,7 @@
 #include <algorithm>
 #include <vector>
 #include <memory>
+#include <stdexcept>
 
 #include <boost/compute/core.hpp>
 #include <boost/compute/container/vector.hpp>
@@ -38,6 +42,8 @@ public:
     template <typename T>
     using VectorPtr = std::shared_ptr<Vector<T>>;
     template <typename T>
+    using HostVector = std::vector<T>;
+    template <typename T>
     using HostVectorPtr = std::shared_ptr<std::vector<T>>;
     using Event = boost::compute::event;
     using Future = boost::compute::future<void>;
@@ -46,16 +52,30 @@ public:
     using FusedFunction = typename FusedFactory<PointT, LabelT, MassT, ColMajor>::FusedFunction;
 
     KmeansSingleStage() :
-        AbstractKmeans<PointT, LabelT, MassT, ColMajor>()
+        AbstractKmeans<PointT, LabelT, MassT, ColMajor>(),
+        point_format(PointFormat::Native),
+        stream_initialized(false),
+        stream_synced(true)
     {}
 
+    char const* pipeline_name() const {
+        return "single_stage";
+    }
+
     void run() {
 
         Event fu_event;
         WaitList fu_wait_list;
 
+        // run() replaces the device buffers used by ingest()
+        stream_initialized = false;
+        stream_synced = true;
+
         buffer_manager.set_queue(this->queue);
         buffer_manager.set_context(this->context);
+        buffer_manager.set_point_format(
+                this->point_format,
+                this->point_quantization);
         buffer_manager.set_parameters(
                 this->num_features,
                 this->num_points,
@@ -82,10 +102,27 @@ public:
                     buffer_manager.get_centroids());
         }
 
+        this->device_cluster_sse = std::move(
+                Vector<PointT>(
+                    (this->cluster_sse) ? this->num_clusters : 0,
+                    this->context));
+
+        // Build the strategy that a tuning table selects for this data
+        // shape, so that building is not timed
+        FusedFactory<PointT, LabelT, MassT, ColMajor>::prepare(
+                this->f_fused,
+                this->queue,
+                this->num_features,
+                this->num_clusters);
+
         // Wait for all preprocessing steps to finish before
         // starting timer
         this->queue.finish();
 
+        if (this->hardware_counters) {
+            this->hardware_counters->start();
+        }
+
         Timer::Timer total_timer;
         total_timer.start();
 
@@ -110,6 +147,13 @@ public:
                         this->queue
                         )
                 .get_event();
+            if (this->cluster_sse) {
+                boost::compute::fill_async(
+                        this->device_cluster_sse.begin(),
+                        this->device_cluster_sse.end(),
+                        0,
+                        this->queue);
+            }
 
             // execute fused variant
             fu_event = this->f_fused(
@@ -127,6 +171,8 @@ public:
                     buffer_manager.get_labels().end(),
                     buffer_manager.get_masses().begin(),
                     buffer_manager.get_masses().end(),
+                    this->device_cluster_sse.begin(),
+                    this->device_cluster_sse.end(),
                     this->measurement->add_datapoint(iteration),
                     fu_wait_list);
 
@@ -155,9 +201,12 @@ public:
 
         uint64_t total_time = total_timer
             .stop<std::chrono::nanoseconds>();
-        this->measurement->add_datapoint()
-            .set_name("TotalTime")
-            .add_value() = total_time;
+        auto& total_datapoint = this->measurement->add_datapoint()
+            .set_name("TotalTime");
+        total_datapoint.add_value() = total_time;
+        if (this->hardware_counters) {
+            this->hardware_counters->stop(total_datapoint);
+        }
 
         // Copy centroids and labels to host
         buffer_manager.get_centroids(
@@ -169,9 +218,141 @@ public:
         buffer_manager.get_masses(
                 this->host_masses,
                 this->measurement->add_datapoint());
+        copy_cluster_sse();
+    }
+
+    void ingest(PointT const *batch, size_t num_batch_points) {
+
+        assert(this->num_features > 0);
+        assert(this->num_clusters > 0);
+        assert(num_batch_points > 0);
+
+        if (not stream_initialized) {
+            stream_begin(batch, num_batch_points);
+        }
+        else if (this->num_features != stream_num_features
+                || this->num_clusters != stream_num_clusters) {
+            throw std::invalid_argument(
+                    "batch must have as many features and clusters as "
+                    "the first batch of the stream");
+        }
+
+        size_t const num_features = this->num_features;
+        size_t const num_clusters = this->num_clusters;
+
+        Timer::Timer ingest_timer;
+        ingest_timer.start();
+
+        buffer_manager.set_parameters(
+                num_features,
+                num_batch_points,
+                num_clusters);
+        buffer_manager.set_stream_points_buffer(
+                batch,
+                num_batch_points,
+                this->measurement->add_datapoint());
+        buffer_manager.reserve_labels_buffer();
+
+        boost::compute::fill_async(
+                buffer_manager.get_masses().begin(),
+                buffer_manager.get_masses().end(),
+                0,
+                this->queue);
+        boost::compute::fill_async(
+                buffer_manager.get_new_centroids().begin(),
+                buffer_manager.get_new_centroids().end(),
+                0,
+                this->queue);
+        if (this->cluster_sse) {
+            boost::compute::fill_async(
+                    this->device_cluster_sse.begin(),
+                    this->device_cluster_sse.end(),
+                    0,
+                    this->queue);
+        }
+
+        // Label the batch and sum up points per cluster
+        WaitList fu_wait_list;
+        this->f_fused(
+                this->queue,
+                num_features,
+                num_batch_points,
+                num_clusters,
+                buffer_manager.get_points().begin(),
+                buffer_manager.get_points().begin()
+                + PointFormatHelper::storage_length<PointT>(
+                    this->point_format,
+                    num_batch_points * num_features),
+                buffer_manager.get_centroids().begin(),
+                buffer_manager.get_centroids().end(),
+                buffer_manager.get_new_centroids().begin(),
+                buffer_manager.get_new_centroids().end(),
+                buffer_manager.get_labels().begin(),
+                buffer_manager.get_labels().begin() + num_batch_points,
+                buffer_manager.get_masses().begin(),
+                buffer_manager.get_masses().end(),
+                this->device_cluster_sse.begin(),
+                this->device_cluster_sse.end(),
+                this->measurement->add_datapoint(),
+                fu_wait_list);
+
+        // Fold the batch into the decayed history on the device. Centroids
+        // and masses stay resident until a getter asks for them.
+        WaitList merge_wait_list;
+        this->stream_merge(
+                this->queue,
+                num_features,
+                num_clusters,
+                this->decay,
+                buffer_manager.get_centroids().begin(),
+                buffer_manager.get_centroids().end(),
+                buffer_manager.get_new_centroids().begin(),
+                buffer_manager.get_new_centroids().end(),
+                buffer_manager.get_masses().begin(),
+                buffer_manager.get_masses().end(),
+                this->measurement->add_datapoint(),
+                merge_wait_list);
+
+        stream_synced = false;
+
+        uint64_t ingest_time = ingest_timer
+            .stop<std::chrono::nanoseconds>();
+        this->measurement->add_datapoint()
+            .set_name("IngestTime")
+            .add_value() = ingest_time;
+    }
+
+    HostVector<PointT> const& get_centroids() const {
+        this->sync_stream();
+        return *this->host_centroids;
+    }
+
+    HostVector<MassT> const& get_cluster_masses() const {
+        this->sync_stream();
+        return *this->host_masses;
+    }
+
+    // The cluster SSE of the last ingested batch while streaming
+    HostVector<PointT> const& get_cluster_sse() const {
+        if (not stream_initialized) {
+            return this->host_cluster_sse;
+        }
+
+        this->sync_stream();
+        return this->stream_cluster_sse;
+    }
+
+    HostVector<PointT> snapshot_centroids() const {
+        this->sync_stream();
+        return AbstractKmeans<PointT, LabelT, MassT, ColMajor>
+            ::snapshot_centroids();
     }
 
     void set_fused(FusedConfiguration config) {
+        cluster_sse = config.cluster_sse;
+        point_format = PointFormatHelper::parse(config.point_format);
+        point_quantization = config.point_quantization;
+
         FusedFactory<PointT, LabelT, MassT, ColMajor> factory;
         f_fused = factory.create(
                 this->context,
@@ -198,12 +379,123 @@ public:
     }
 
 private:
+    void stream_begin(PointT const *batch, size_t num_batch_points) {
+
+        size_t const num_features = this->num_features;
+        size_t const num_clusters = this->num_clusters;
+
+        if (not this->host_centroids
+                || this->host_centroids->size()
+                != num_clusters * num_features)
+        {
+            // Take the first k points of the batch as centroids
+            if (num_batch_points < num_clusters) {
+                throw std::invalid_argument(
+                        "first batch must have at least as many points "
+                        "as clusters");
+            }
+
+            this->host_centroids = std::make_shared<std::vector<PointT>>(
+                    num_clusters * num_features);
+            for (size_t f = 0; f < num_features; ++f) {
+                for (size_t c = 0; c < num_clusters; ++c) {
+                    (*this->host_centroids)[f * num_clusters + c] =
+                        batch[f * num_batch_points + c];
+                }
+            }
+        }
+
+        this->host_masses = std::make_shared<std::vector<MassT>>(
+                num_clusters, 0);
+
+        buffer_manager.set_queue(this->queue);
+        buffer_manager.set_context(this->context);
+        buffer_manager.set_point_format(
+                this->point_format,
+                this->point_quantization);
+        buffer_manager.set_parameters(
+                num_features,
+                num_batch_points,
+                num_clusters);
+        buffer_manager.set_centroids_buffer(
+                this->host_centroids,
+                this->measurement->add_datapoint());
+        buffer_manager.set_new_centroids_buffer();
+        buffer_manager.set_masses_buffer();
+
+        this->stream_merge.prepare(this->context);
+        this->stream_merge.reset(this->queue, num_clusters);
+
+        this->device_cluster_sse = std::move(
+                Vector<PointT>(
+                    (this->cluster_sse) ? num_clusters : 0,
+                    this->context));
+        this->stream_cluster_sse.resize(this->device_cluster_sse.size());
+
+        FusedFactory<PointT, LabelT, MassT, ColMajor>::prepare(
+                this->f_fused,
+                this->queue,
+                num_features,
+                num_clusters);
+
+        stream_num_features = num_features;
+        stream_num_clusters = num_clusters;
+        stream_initialized = true;
+    }
+
+    // Copies the centroids, masses and cluster SSE of the last ingested
+    // batch to the host
+    void sync_stream() const {
+        if (stream_synced) {
+            return;
+        }
+
+        boost::compute::command_queue queue = this->queue;
+        boost::compute::copy(
+                buffer_manager.centroids->begin(),
+                buffer_manager.centroids->end(),
+                this->host_centroids->begin(),
+                queue);
+        boost::compute::copy(
+                buffer_manager.masses->begin(),
+                buffer_manager.masses->end(),
+                this->host_masses->begin(),
+                queue);
+        boost::compute::copy(
+                this->device_cluster_sse.begin(),
+                this->device_cluster_sse.end(),
+                this->stream_cluster_sse.begin(),
+                queue);
+
+        stream_synced = true;
+    }
+
+    void copy_cluster_sse() {
+        this->host_cluster_sse.resize(this->device_cluster_sse.size());
+        boost::compute::copy(
+                this->device_cluster_sse.begin(),
+                this->device_cluster_sse.end(),
+                this->host_cluster_sse.begin(),
+                this->queue);
+    }
+
     FusedFunction f_fused;
     MatrixBinaryOp<PointT, MassT> matrix_divide;
+    PointFormat point_format;
+    PointQuantization point_quantization;
+    bool cluster_sse = false;
+    Vector<PointT> device_cluster_sse;
 
     boost::compute::context context;
     boost::compute::command_queue queue;
 
+    StreamMerge<PointT, MassT> stream_merge;
+    bool stream_initialized;
+    mutable bool stream_synced;
+    mutable HostVector<PointT> stream_cluster_sse;
+    size_t stream_num_features = 0;
+    size_t stream_num_clusters = 0;
+
     struct BufferManager {
 
         void set_queue(boost::compute::command_queue q) {
@@ -214,6 +506,11 @@ private:
             context = c;
         }
 
+        void set_point_format(PointFormat f, PointQuantization const& q) {
+            point_format = f;
+            point_quantization = q;
+        }
+
         void set_parameters(size_t num_features, size_t num_points, size_t num_clusters) {
             this->num_features = num_features;
             this->num_points = num_points;
@@ -226,21 +523,80 @@ private:
         {
             dp.set_name("PointsH2D");
 
-            if (not points || points->size() != buf->size()) {
+            size_t const length = PointFormatHelper::storage_length<PointT>(
+                    point_format,
+                    buf->size());
+            if (not points || points->size() != length) {
                 points.reset();
                 points = std::make_shared<Vector<PointT>>(
-                        buf->size(),
+                        length,
                         context);
             }
 
-            Future future = boost::compute::copy_async(
-                    buf->begin(),
-                    buf->end(),
-                    points->begin(),
-                    queue);
+            write_points(buf->data(), buf->size(), dp);
+        }
 
-            dp.add_event() = future.get_event();
-            future.wait();
+        // Grows the points buffer to fit the batch and copies the batch to
+        // the front of it. Kernels only see the first num_points points.
+        void set_stream_points_buffer(
+                PointT const *buf,
+                size_t num_points,
+                Measurement::DataPoint& dp)
+        {
+            dp.set_name("PointsH2D");
+
+            size_t const size = num_points * num_features;
+            size_t const length = PointFormatHelper::storage_length<PointT>(
+                    point_format,
+                    size);
+            if (not points || points->size() < length) {
+                points.reset();
+                points = std::make_shared<Vector<PointT>>(
+                        length,
+                        context);
+            }
+
+            write_points(buf, size, dp);
+        }
+
+        // Copies points to the front of the points buffer, converting
+        // them to the storage format on the host if necessary
+        void write_points(
+                PointT const *buf,
+                size_t size,
+                Measurement::DataPoint& dp)
+        {
+            if (point_format == PointFormat::Native) {
+                Future future = boost::compute::copy_async(
+                        buf,
+                        buf + size,
+                        points->begin(),
+                        queue);
+
+                dp.add_event() = future.get_event();
+                future.wait();
+                return;
+            }
+
+            size_t const bytes =
+                size * PointFormatHelper::value_size<PointT>(point_format);
+            packed_points.resize(bytes);
+            PointFormatHelper::pack(
+                    point_format,
+                    buf,
+                    size / num_features,
+                    num_features,
+                    point_quantization,
+                    packed_points.data());
+
+            Event event = queue.enqueue_write_buffer_async(
+                    points->get_buffer(),
+                    0,
+                    bytes,
+                    packed_points.data());
+
+            dp.add_event() = event;
+            event.wait();
         }
 
         void set_centroids_buffer(
@@ -249,9 +605,12 @@ private:
         {
             dp.set_name("CentroidsH2D");
 
-            centroids = std::make_shared<Vector<PointT>>(
-                    buf->size(),
-                    context);
+            if (not centroids || centroids->size() != buf->size()) {
+                centroids.reset();
+                centroids = std::make_shared<Vector<PointT>>(
+                        buf->size(),
+                        context);
+            }
 
             Future future = boost::compute::copy_async(
                     buf->begin(),
@@ -282,6 +641,17 @@ private:
             }
         }
 
+        void reserve_labels_buffer()
+        {
+            if (not labels || labels->size() < num_points) {
+                labels.reset();
+                labels = std::make_shared<Vector<LabelT>>(
+                        num_points,
+                        0,
+                        queue);
+            }
+        }
+
         void set_masses_buffer()
         {
             masses = std::make_shared<Vector<MassT>>(
@@ -329,6 +699,25 @@ private:
             future.wait();
         }
 
+        void get_new_centroids(
+                HostVectorPtr<PointT> buf,
+                Measurement::DataPoint& dp)
+        {
+            assert(buf->size() >= num_clusters * num_features);
+
+            dp.set_name("NewCentroidsD2H");
+
+            Future future = boost::compute::copy_async(
+                    new_centroids->begin(),
+                    new_centroids->begin()
+                    + num_clusters * num_features,
+                    buf->begin(),
+                    queue);
+
+            dp.add_event() = future.get_event();
+            future.wait();
+        }
+
         void get_labels(
                 HostVectorPtr<LabelT> buf,
                 Measurement::DataPoint& dp
@@ -370,8 +759,11 @@ private:
         size_t num_features;
         size_t num_points;
         size_t num_clusters;
+        PointFormat point_format = PointFormat::Native;
+        PointQuantization point_quantization;
         boost::compute::context context;
         boost::compute::command_queue queue;
+        std::vector<char> packed_points;
         VectorPtr<PointT> points;
         VectorPtr<PointT> centroids;
         VectorPtr<PointT> new_centroids;
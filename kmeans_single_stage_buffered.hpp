@@ -12,6 +12,7 @@
 
 #include "abstract_kmeans.hpp"
 #include "fused_factory.hpp"
+#include "point_format.hpp"
 #include "simple_buffer_cache.hpp"
 #include "single_device_scheduler.hpp"
 #include "buffer_helper.hpp"
@@ -40,12 +41,18 @@ class KmeansSingleStageBuffered :
 public:
 
     using FusedFunction = typename FusedFactory<PointT, LabelT, MassT, ColMajor>::FusedFunction;
+    using ObjectAccess = SingleDeviceScheduler::ObjectAccess;
 
     KmeansSingleStageBuffered() :
-        AbstractKmeans<PointT, LabelT, MassT, ColMajor>()
+        AbstractKmeans<PointT, LabelT, MassT, ColMajor>(),
+        point_format(PointFormat::Native)
     {
     }
 
+    char const* pipeline_name() const {
+        return "single_stage_buffered";
+    }
+
     void run() {
 
         buffer_cache = std::make_shared<SimpleBufferCache>(
@@ -58,14 +65,55 @@ public:
                 matrix_divide.Divide
                 );
 
-        this->host_points_partitioned.resize(this->host_points->size());
-        BufferHelper::partition_matrix(
-                this->host_points->data(),
-                &this->host_points_partitioned[0],
-                this->host_points->size() * sizeof(PointT),
-                this->num_features,
-                this->buffer_cache->buffer_size()
-                );
+        // Points are streamed in their storage format. Each buffer holds
+        // the same number of points and labels. Kernels skip the points
+        // after the last whole vector, so buffers hold whole vectors of the
+        // longest OpenCL vector length, and only the last buffer has a tail.
+        size_t const points_bytes =
+            this->host_points->size()
+            * PointFormatHelper::value_size<PointT>(this->point_format);
+        size_t const buffer_points =
+            PointFormatHelper::points_per_buffer<PointT, LabelT>(
+                    this->point_format,
+                    this->num_features,
+                    buffer_size)
+            / MAX_VECTOR_LENGTH * MAX_VECTOR_LENGTH;
+        size_t const points_buffer_size =
+            buffer_points
+            * this->num_features
+            * PointFormatHelper::value_size<PointT>(this->point_format);
+        size_t const labels_buffer_size = buffer_points * sizeof(LabelT);
+
+        this->host_points_partitioned.resize(
+                PointFormatHelper::storage_length<PointT>(
+                    this->point_format,
+                    this->host_points->size()));
+        if (this->point_format == PointFormat::Native) {
+            BufferHelper::partition_matrix(
+                    this->host_points->data(),
+                    &this->host_points_partitioned[0],
+                    points_bytes,
+                    this->num_features,
+                    points_buffer_size
+                    );
+        }
+        else {
+            std::vector<char> packed_points(points_bytes);
+            PointFormatHelper::pack(
+                    this->point_format,
+                    this->host_points->data(),
+                    this->num_points,
+                    this->num_features,
+                    this->point_quantization,
+                    packed_points.data());
+            BufferHelper::partition_matrix(
+                    packed_points.data(),
+                    &this->host_points_partitioned[0],
+                    points_bytes,
+                    this->num_features,
+                    points_buffer_size
+                    );
+        }
 
         device_old_centroids = decltype(device_old_centroids)(
                 this->num_clusters * this->num_features,
@@ -86,6 +134,10 @@ public:
                 this->num_clusters,
                 this->queue.get_context()
                 );
+        device_cluster_sse = decltype(device_cluster_sse)(
+                (this->cluster_sse) ? this->num_clusters : 0,
+                this->queue.get_context()
+                );
 
         assert(true ==
                 this->scheduler.add_device(
@@ -108,7 +160,7 @@ public:
                     ));
         auto points_handle = this->buffer_cache->add_object(
                 (void*)this->host_points_partitioned.data(),
-                this->host_points->size() * sizeof(PointT),
+                points_bytes,
                 ObjectMode::ReadOnly
                 );
         auto labels_handle = this->buffer_cache->add_object(
@@ -117,6 +169,19 @@ public:
                 ObjectMode::ReadWrite
                 );
 
+        // Labels are only written by the fused kernel, so all but the last
+        // iteration can keep them on the device and drop them on eviction.
+        // The transient labels have no host data and are addressed by
+        // offsets.
+        auto transient_labels_handle = (labels_final_only)
+            ? this->buffer_cache->add_object(
+                    nullptr,
+                    this->host_labels->size() * sizeof(LabelT),
+                    ObjectMode::Transient
+                    )
+            : labels_handle
+            ;
+
         // If centroids initializer function is callable, then call
         if (this->centroids_initializer) {
             this->centroids_initializer(
@@ -125,10 +190,22 @@ public:
                     );
         }
 
+        // Build the strategy that a tuning table selects for this data
+        // shape, so that building is not timed
+        FusedFactory<PointT, LabelT, MassT, ColMajor>::prepare(
+                this->f_fused,
+                this->queue,
+                this->num_features,
+                this->num_clusters);
+
         // Wait for all preprocessing steps to finish before
         // starting timer
         this->queue.finish();
 
+        if (this->hardware_counters) {
+            this->hardware_counters->start();
+        }
+
         Timer::Timer total_timer;
         total_timer.start();
 
@@ -151,6 +228,13 @@ public:
                         this->queue
                         )
                 .get_event();
+            if (this->cluster_sse) {
+                boost::compute::fill_async(
+                        device_cluster_sse.begin(),
+                        device_cluster_sse.end(),
+                        0,
+                        this->queue);
+            }
 
             auto lambda = [
                 f_fused = this->f_fused,
@@ -158,7 +242,8 @@ public:
                 num_clusters = this->num_clusters,
                 &device_old_centroids = this->device_old_centroids,
                 &device_new_centroids = this->device_new_centroids,
-                &device_masses = this->device_masses
+                &device_masses = this->device_masses,
+                &device_cluster_sse = this->device_cluster_sse
             ]
             (
              boost::compute::command_queue queue,
@@ -180,7 +265,8 @@ public:
                             ),
                     points_end(
                             points,
-                            point_bytes / sizeof(PointT)
+                            (point_bytes + sizeof(PointT) - 1)
+                            / sizeof(PointT)
                             );
 
                 boost::compute::buffer_iterator<LabelT>
@@ -208,19 +294,48 @@ public:
                         labels_end,
                         device_masses.begin(),
                         device_masses.end(),
+                        device_cluster_sse.begin(),
+                        device_cluster_sse.end(),
                         datapoint,
                         wait_list
                         );
             };
 
+            // Labels that the device holds are compared with the new
+            // labels, such that only the blocks that changed are written
+            // back. Overwritten labels are not on the device.
+            auto dirty_lambda = [f_fused = this->f_fused]
+            (
+             boost::compute::command_queue queue,
+             boost::compute::buffer labels,
+             boost::compute::wait_list wait_list
+            ) mutable
+            {
+                return FusedFactory<PointT, LabelT, MassT, ColMajor>
+                    ::changed_blocks(f_fused, queue, labels, wait_list);
+            };
+
+            // The fused kernel overwrites all labels, such that the last
+            // iteration need not copy the host labels to the device
+            bool const last_iteration =
+                iterations + 1 == this->max_iterations;
             std::future<std::deque<boost::compute::event>> fu_future;
             assert(true ==
                     scheduler.enqueue(
                         lambda,
                         points_handle,
-                        labels_handle,
-                        buffer_size,
-                        buffer_size / this->num_features,
+                        (last_iteration)
+                        ? labels_handle
+                        : transient_labels_handle,
+                        points_buffer_size,
+                        labels_buffer_size,
+                        ObjectAccess::Read,
+                        (last_iteration and labels_final_only)
+                        ? ObjectAccess::Write
+                        : ObjectAccess::ReadWrite,
+                        (labels_final_only)
+                        ? SingleDeviceScheduler::FunDirty()
+                        : SingleDeviceScheduler::FunDirty(dirty_lambda),
                         fu_future,
                         this->measurement->add_datapoint(iterations)
                         ));
@@ -249,9 +364,12 @@ public:
 
         uint64_t total_time = total_timer
             .stop<std::chrono::nanoseconds>();
-        this->measurement->add_datapoint()
-            .set_name("TotalTime")
-            .add_value() = total_time;
+        auto& total_datapoint = this->measurement->add_datapoint()
+            .set_name("TotalTime");
+        total_datapoint.add_value() = total_time;
+        if (this->hardware_counters) {
+            this->hardware_counters->stop(total_datapoint);
+        }
 
         boost::compute::event centroids_copy_event = boost::compute::copy_async(
                 this->device_old_centroids.begin(),
@@ -269,9 +387,16 @@ public:
                 ).get_event();
         masses_copy_event.wait();
 
+        this->host_cluster_sse.resize(this->device_cluster_sse.size());
+        boost::compute::copy(
+                this->device_cluster_sse.begin(),
+                this->device_cluster_sse.end(),
+                this->host_cluster_sse.begin(),
+                this->queue);
+
         {
             char *begin, *iter, *end;
-            size_t labels_content_size = buffer_size / this->num_features;
+            size_t labels_content_size = labels_buffer_size;
             for (
                     begin = (char*) this->host_labels->data(),
                     end = begin + this->host_labels->size() * sizeof(LabelT),
@@ -304,6 +429,11 @@ public:
     }
 
     void set_fused(FusedConfiguration config) {
+        cluster_sse = config.cluster_sse;
+        point_format = PointFormatHelper::parse(config.point_format);
+        point_quantization = config.point_quantization;
+        config.label_changes = true;
+
         FusedFactory<PointT, LabelT, MassT, ColMajor> factory;
         f_fused = factory.create(
                 this->context,
@@ -311,6 +441,18 @@ public:
                 *this->measurement);
     }
 
+    /*
+     * Write labels back to the host only in the last iteration
+     */
+    void set_labels_final_only(bool final_only) {
+        labels_final_only = final_only;
+
+        this->measurement->set_parameter(
+                "LabelsFinalOnly",
+                (final_only) ? "true" : "false"
+                );
+    }
+
     void set_context(boost::compute::context c) {
         context = c;
     }
@@ -331,8 +473,12 @@ public:
 
 private:
     static constexpr size_t buffer_size = 16ul * 1024ul * 1024ul;
+    static constexpr size_t MAX_VECTOR_LENGTH = 16;
 
     FusedFunction f_fused;
+    PointFormat point_format;
+    PointQuantization point_quantization;
+    bool labels_final_only = false;
 
     boost::compute::context context;
     boost::compute::command_queue queue;
@@ -345,6 +491,9 @@ private:
     boost::compute::vector<PointT> device_old_centroids;
     boost::compute::vector<PointT> device_new_centroids;
     boost::compute::vector<MassT> device_masses;
+    // Summed over all buffers of an iteration
+    bool cluster_sse = false;
+    boost::compute::vector<PointT> device_cluster_sse;
 };
 
 }
@@ -56,6 +56,7 @@ public:
     using Future = boost::compute::future<void>;
 
     using LabelingFunction = typename LabelingFactory<PointT, LabelT, ColMajor>::LabelingFunction;
+    using LabelingMassFunction = typename LabelingFactory<PointT, LabelT, ColMajor>::template LabelingMassFunction<MassT>;
     using MassUpdateFunction = typename MassUpdateFactory<LabelT, MassT>::MassUpdateFunction;
     using CentroidUpdateFunction = typename CentroidUpdateFactory<PointT, LabelT, MassT, ColMajor>::CentroidUpdateFunction;
 
@@ -63,6 +64,10 @@ public:
         AbstractKmeans<PointT, LabelT, MassT, ColMajor>()
     {}
 
+    char const* pipeline_name() const {
+        return "three_stage";
+    }
+
     void run() {
 
         boost::compute::wait_list ll_wait_list, mu_wait_list, cu_wait_list;
@@ -104,12 +109,46 @@ public:
                     buffer_map.get_centroids(BufferMap::ll));
         }
 
+        // Build the strategies that tuning tables select for this data
+        // shape, so that building is not timed
+        LabelingFactory<PointT, LabelT, ColMajor>::prepare(
+                this->f_labeling,
+                this->q_labeling,
+                this->num_features,
+                this->num_clusters);
+        LabelingFactory<PointT, LabelT, ColMajor>::template prepare<MassT>(
+                this->f_labeling_mass,
+                this->q_labeling,
+                this->num_features,
+                this->num_clusters);
+        CentroidUpdateFactory<PointT, LabelT, MassT, ColMajor>::prepare(
+                this->f_centroid_update,
+                this->q_centroid_update,
+                this->num_features,
+                this->num_clusters);
+
         // Wait for all preprocessing steps to finish before
         // starting timer
         this->q_labeling.finish();
         this->q_mass_update.finish();
         this->q_centroid_update.finish();
 
+        // Count masses during labeling if both stages share a queue,
+        // otherwise run the separate mass update
+        bool const fuse_mass_update =
+            static_cast<bool>(this->f_labeling_mass)
+            && buffer_map.device_map[BufferMap::ll][BufferMap::mu];
+
+        // Labeling sums the cluster SSE on its own queue
+        this->device_cluster_sse = std::move(
+                Vector<PointT>(
+                    (this->cluster_sse) ? this->num_clusters : 0,
+                    this->context_labeling));
+
+        if (this->hardware_counters) {
+            this->hardware_counters->start();
+        }
+
         Timer::Timer total_timer;
         total_timer.start();
 
@@ -123,30 +162,62 @@ public:
             // TODO
             // ll_wait_list.insert(
             //         sync_centroids_event);
-            ll_event = this->f_labeling(
-                    this->q_labeling,
-                    this->num_features,
-                    this->num_points,
-                    this->num_clusters,
-                    buffer_map.get_points(BufferMap::ll).begin(),
-                    buffer_map.get_points(BufferMap::ll).end(),
-                    buffer_map.get_centroids(BufferMap::ll).begin(),
-                    buffer_map.get_centroids(BufferMap::ll).end(),
-                    buffer_map.get_labels(BufferMap::ll).begin(),
-                    buffer_map.get_labels(BufferMap::ll).end(),
-                    this->measurement->add_datapoint(iterations),
-                    ll_wait_list);
-
-            if (/* not converged */ true) {
+            if (this->cluster_sse) {
+                boost::compute::fill_async(
+                        this->device_cluster_sse.begin(),
+                        this->device_cluster_sse.end(),
+                        0,
+                        this->q_labeling);
+            }
 
+            if (fuse_mass_update) {
                 boost::compute::event fill_masses_event =
                     boost::compute::fill_async(
                             buffer_map.get_masses(BufferMap::mu).begin(),
                             buffer_map.get_masses(BufferMap::mu).end(),
                             0,
-                            this->q_mass_update
+                            this->q_labeling
                             )
                     .get_event();
+
+                ll_event = this->f_labeling_mass(
+                        this->q_labeling,
+                        this->num_features,
+                        this->num_points,
+                        this->num_clusters,
+                        buffer_map.get_points(BufferMap::ll).begin(),
+                        buffer_map.get_points(BufferMap::ll).end(),
+                        buffer_map.get_centroids(BufferMap::ll).begin(),
+                        buffer_map.get_centroids(BufferMap::ll).end(),
+                        buffer_map.get_labels(BufferMap::ll).begin(),
+                        buffer_map.get_labels(BufferMap::ll).end(),
+                        buffer_map.get_masses(BufferMap::mu).begin(),
+                        buffer_map.get_masses(BufferMap::mu).end(),
+                        this->device_cluster_sse.begin(),
+                        this->device_cluster_sse.end(),
+                        this->measurement->add_datapoint(iterations),
+                        ll_wait_list);
+            }
+            else {
+                ll_event = this->f_labeling(
+                        this->q_labeling,
+                        this->num_features,
+                        this->num_points,
+                        this->num_clusters,
+                        buffer_map.get_points(BufferMap::ll).begin(),
+                        buffer_map.get_points(BufferMap::ll).end(),
+                        buffer_map.get_centroids(BufferMap::ll).begin(),
+                        buffer_map.get_centroids(BufferMap::ll).end(),
+                        buffer_map.get_labels(BufferMap::ll).begin(),
+                        buffer_map.get_labels(BufferMap::ll).end(),
+                        this->device_cluster_sse.begin(),
+                        this->device_cluster_sse.end(),
+                        this->measurement->add_datapoint(iterations),
+                        ll_wait_list);
+            }
+
+            if (/* not converged */ true) {
+
                 boost::compute::event fill_centroids_event =
                     boost::compute::fill_async(
                             buffer_map.get_centroids(BufferMap::cu).begin(),
@@ -155,6 +226,9 @@ public:
                             this->q_centroid_update
                             )
                     .get_event();
+                CentroidUpdateFactory<PointT, LabelT, MassT, ColMajor>::reset(
+                        this->f_centroid_update,
+                        buffer_map.get_centroids(BufferMap::cu).get_buffer());
 
                 // execute mass update
                 sync_labels_event = buffer_map.sync_labels(
@@ -165,16 +239,27 @@ public:
                 //         sync_labels_event);
                 // cu_wait_list.insert(
                 //         sync_labels_event);
-                mu_event = this->f_mass_update(
-                        this->q_mass_update,
-                        this->num_points,
-                        this->num_clusters,
-                        buffer_map.get_labels(BufferMap::mu).begin(),
-                        buffer_map.get_labels(BufferMap::mu).end(),
-                        buffer_map.get_masses(BufferMap::mu).begin(),
-                        buffer_map.get_masses(BufferMap::mu).end(),
-                        this->measurement->add_datapoint(iterations),
-                        mu_wait_list);
+                if (not fuse_mass_update) {
+                    boost::compute::event fill_masses_event =
+                        boost::compute::fill_async(
+                                buffer_map.get_masses(BufferMap::mu).begin(),
+                                buffer_map.get_masses(BufferMap::mu).end(),
+                                0,
+                                this->q_mass_update
+                                )
+                        .get_event();
+
+                    mu_event = this->f_mass_update(
+                            this->q_mass_update,
+                            this->num_points,
+                            this->num_clusters,
+                            buffer_map.get_labels(BufferMap::mu).begin(),
+                            buffer_map.get_labels(BufferMap::mu).end(),
+                            buffer_map.get_masses(BufferMap::mu).begin(),
+                            buffer_map.get_masses(BufferMap::mu).end(),
+                            this->measurement->add_datapoint(iterations),
+                            mu_wait_list);
+                }
                 // TODO
                 // sync_masses_wait_list.insert(
                 //         mu_event);
@@ -226,9 +311,12 @@ public:
 
         uint64_t total_time = total_timer
             .stop<std::chrono::nanoseconds>();
-        this->measurement->add_datapoint()
-            .set_name("TotalTime")
-            .add_value() = total_time;
+        auto& total_datapoint = this->measurement->add_datapoint()
+            .set_name("TotalTime");
+        total_datapoint.add_value() = total_time;
+        if (this->hardware_counters) {
+            this->hardware_counters->stop(total_datapoint);
+        }
 
         // copy centroids and labels to host
         buffer_map.get_centroids(
@@ -240,14 +328,30 @@ public:
         buffer_map.get_masses(
                 this->host_masses,
                 this->measurement->add_datapoint());
+
+        this->host_cluster_sse.resize(this->device_cluster_sse.size());
+        boost::compute::copy(
+                this->device_cluster_sse.begin(),
+                this->device_cluster_sse.end(),
+                this->host_cluster_sse.begin(),
+                this->q_labeling);
     }
 
     void set_labeler(LabelingConfiguration config) {
+        cluster_sse = config.cluster_sse;
+
         LabelingFactory<PointT, LabelT, ColMajor> factory;
         f_labeling = factory.create(
                 this->context_labeling,
                 config,
                 *this->measurement);
+
+        if (config.mass_histogram) {
+            f_labeling_mass = factory.template create_with_masses<MassT>(
+                    this->context_labeling,
+                    config,
+                    *this->measurement);
+        }
     }
 
     void set_mass_updater(MassUpdateConfiguration config) {
@@ -322,9 +426,12 @@ public:
 
 private:
     LabelingFunction f_labeling;
+    LabelingMassFunction f_labeling_mass;
     MassUpdateFunction f_mass_update;
     CentroidUpdateFunction f_centroid_update;
     MatrixBinaryOp<PointT, MassT> matrix_divide;
+    bool cluster_sse = false;
+    Vector<PointT> device_cluster_sse;
 
     boost::compute::context context_labeling;
     boost::compute::context context_mass_update;
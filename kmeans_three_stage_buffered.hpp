@@ -17,6 +17,7 @@
 #include "simple_buffer_cache.hpp"
 #include "single_device_scheduler.hpp"
 #include "buffer_helper.hpp"
+#include "point_format.hpp"
 #include "cl_kernels/matrix_binary_op.hpp"
 
 #include "measurement/measurement.hpp"
@@ -39,12 +40,17 @@ public:
     using LabelingFunction = typename LabelingFactory<PointT, LabelT, ColMajor>::LabelingFunction;
     using MassUpdateFunction = typename MassUpdateFactory<LabelT, MassT>::MassUpdateFunction;
     using CentroidUpdateFunction = typename CentroidUpdateFactory<PointT, LabelT, MassT, ColMajor>::CentroidUpdateFunction;
+    using ObjectAccess = SingleDeviceScheduler::ObjectAccess;
 
     KmeansThreeStageBuffered() :
         AbstractKmeans<PointT, LabelT, MassT, ColMajor>()
     {
     }
 
+    char const* pipeline_name() const {
+        return "three_stage_buffered";
+    }
+
     void run() {
 
         buffer_cache = std::make_shared<SimpleBufferCache>(
@@ -57,13 +63,23 @@ public:
                 matrix_divide.Divide
                 );
 
+        // Each buffer holds the same number of points and labels
+        size_t const buffer_points =
+            PointFormatHelper::points_per_buffer<PointT, LabelT>(
+                    PointFormat::Native,
+                    this->num_features,
+                    buffer_size);
+        size_t const points_buffer_size =
+            buffer_points * this->num_features * sizeof(PointT);
+        size_t const labels_buffer_size = buffer_points * sizeof(LabelT);
+
         this->host_points_partitioned.resize(this->host_points->size());
         BufferHelper::partition_matrix(
                 this->host_points->data(),
                 &this->host_points_partitioned[0],
                 this->host_points->size() * sizeof(PointT),
                 this->num_features,
-                this->buffer_cache->buffer_size()
+                points_buffer_size
                 );
 
         device_old_centroids = decltype(device_old_centroids)(
@@ -84,6 +100,10 @@ public:
                 this->num_clusters,
                 this->queue.get_context()
                 );
+        device_cluster_sse = decltype(device_cluster_sse)(
+                (this->cluster_sse) ? this->num_clusters : 0,
+                this->queue.get_context()
+                );
 
         assert(true ==
                 this->scheduler.add_device(
@@ -123,10 +143,27 @@ public:
                     );
         }
 
+        // Build the strategies that tuning tables select for this data
+        // shape, so that building is not timed
+        LabelingFactory<PointT, LabelT, ColMajor>::prepare(
+                this->f_labeling,
+                this->queue,
+                this->num_features,
+                this->num_clusters);
+        CentroidUpdateFactory<PointT, LabelT, MassT, ColMajor>::prepare(
+                this->f_centroid_update,
+                this->queue,
+                this->num_features,
+                this->num_clusters);
+
         // Wait for all preprocessing steps to finish before
         // starting timer
         this->queue.finish();
 
+        if (this->hardware_counters) {
+            this->hardware_counters->start();
+        }
+
         Timer::Timer total_timer;
         total_timer.start();
 
@@ -149,12 +186,23 @@ public:
                         this->queue
                         )
                 .get_event();
+            CentroidUpdateFactory<PointT, LabelT, MassT, ColMajor>::reset(
+                    this->f_centroid_update,
+                    device_new_centroids.get_buffer());
+            if (this->cluster_sse) {
+                boost::compute::fill_async(
+                        device_cluster_sse.begin(),
+                        device_cluster_sse.end(),
+                        0,
+                        this->queue);
+            }
 
             auto labeling_lambda = [
                 f_labeling = this->f_labeling,
                 num_features = this->num_features,
                 num_clusters = this->num_clusters,
-                &device_old_centroids = this->device_old_centroids
+                &device_old_centroids = this->device_old_centroids,
+                &device_cluster_sse = this->device_cluster_sse
             ]
             (
              boost::compute::command_queue queue,
@@ -201,19 +249,36 @@ public:
                         device_old_centroids.end(),
                         labels_begin,
                         labels_end,
+                        device_cluster_sse.begin(),
+                        device_cluster_sse.end(),
                         datapoint,
                         wait_list
                         );
             };
 
+            // Only the blocks of labels that changed are written back
+            auto dirty_lambda = [f_labeling = this->f_labeling]
+            (
+             boost::compute::command_queue queue,
+             boost::compute::buffer labels,
+             boost::compute::wait_list wait_list
+            ) mutable
+            {
+                return LabelingFactory<PointT, LabelT, ColMajor>
+                    ::changed_blocks(f_labeling, queue, labels, wait_list);
+            };
+
             std::future<std::deque<boost::compute::event>> ll_future;
             assert(true ==
                     scheduler.enqueue(
                         labeling_lambda,
                         points_handle,
                         labels_handle,
-                        buffer_size,
-                        buffer_size / this->num_features,
+                        points_buffer_size,
+                        labels_buffer_size,
+                        ObjectAccess::Read,
+                        ObjectAccess::ReadWrite,
+                        dirty_lambda,
                         ll_future,
                         this->measurement->add_datapoint(iterations)
                         ));
@@ -261,7 +326,8 @@ public:
                     scheduler.enqueue(
                         mass_update_lambda,
                         labels_handle,
-                        buffer_size / this->num_features,
+                        labels_buffer_size,
+                        ObjectAccess::Read,
                         mu_future,
                         this->measurement->add_datapoint(iterations)
                         ));
@@ -330,8 +396,10 @@ public:
                         centroid_update_lambda,
                         points_handle,
                         labels_handle,
-                        buffer_size,
-                        buffer_size / this->num_features,
+                        points_buffer_size,
+                        labels_buffer_size,
+                        ObjectAccess::Read,
+                        ObjectAccess::Read,
                         cu_future,
                         this->measurement->add_datapoint(iterations)
                         ));
@@ -360,9 +428,12 @@ public:
 
         uint64_t total_time = total_timer
             .stop<std::chrono::nanoseconds>();
-        this->measurement->add_datapoint()
-            .set_name("TotalTime")
-            .add_value() = total_time;
+        auto& total_datapoint = this->measurement->add_datapoint()
+            .set_name("TotalTime");
+        total_datapoint.add_value() = total_time;
+        if (this->hardware_counters) {
+            this->hardware_counters->stop(total_datapoint);
+        }
 
         boost::compute::event centroids_copy_event = boost::compute::copy_async(
                 this->device_old_centroids.begin(),
@@ -380,9 +451,16 @@ public:
                 ).get_event();
         masses_copy_event.wait();
 
+        this->host_cluster_sse.resize(this->device_cluster_sse.size());
+        boost::compute::copy(
+                this->device_cluster_sse.begin(),
+                this->device_cluster_sse.end(),
+                this->host_cluster_sse.begin(),
+                this->queue);
+
         {
             char *begin, *iter, *end;
-            size_t labels_content_size = buffer_size / this->num_features;
+            size_t labels_content_size = labels_buffer_size;
             for (
                     begin = (char*) this->host_labels->data(),
                     end = begin + this->host_labels->size() * sizeof(LabelT),
@@ -415,6 +493,9 @@ public:
     }
 
     void set_labeler(LabelingConfiguration config) {
+        cluster_sse = config.cluster_sse;
+        config.label_changes = true;
+
         LabelingFactory<PointT, LabelT, ColMajor> factory;
         f_labeling = factory.create(
                 this->context,
@@ -541,6 +622,9 @@ private:
     boost::compute::vector<PointT> device_old_centroids;
     boost::compute::vector<PointT> device_new_centroids;
     boost::compute::vector<MassT> device_masses;
+    // Summed over all buffers of an iteration
+    bool cluster_sse = false;
+    boost::compute::vector<PointT> device_cluster_sse;
 };
 } // namespace Clustering
 
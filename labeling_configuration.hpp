@@ -10,6 +10,8 @@
 #ifndef LABELING_CONFIGURATION_HPP
 #define LABELING_CONFIGURATION_HPP
 
+#include "tuning_table.hpp"
+
 #include <cstddef>
 #include <string>
 
@@ -24,6 +26,13 @@ struct LabelingConfiguration {
     size_t vector_length;
     size_t unroll_clusters_length;
     size_t unroll_features_length;
+    TuningTable tuning;
+    // Count masses during labeling if mass update runs on the same queue
+    bool mass_histogram = false;
+    // Sum the squared distances of the points per cluster
+    bool cluster_sse = false;
+    // Flag the blocks of labels that changed, set by the buffered pipelines
+    bool label_changes = false;
 };
 
 }
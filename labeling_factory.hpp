@@ -12,12 +12,15 @@
 
 #include "labeling_configuration.hpp"
 #include "measurement/measurement.hpp"
+#include "tuned_strategy.hpp"
 
 #include "cl_kernels/labeling_unroll_vector.hpp"
 
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <stdexcept>
+#include <vector>
 
 #include <boost/compute/core.hpp>
 #include <boost/compute/iterator/buffer_iterator.hpp>
@@ -42,6 +45,30 @@ public:
                 BufferIterator<PointT> centroids_end,
                 BufferIterator<LabelT> labels_begin,
                 BufferIterator<LabelT> labels_end,
+                BufferIterator<PointT> cluster_sse_begin,
+                BufferIterator<PointT> cluster_sse_end,
+                Measurement::DataPoint& datapoint,
+                boost::compute::wait_list const& events
+            )
+        >;
+
+    template <typename MassT>
+    using LabelingMassFunction = std::function<
+        boost::compute::event(
+                boost::compute::command_queue queue,
+                size_t num_features,
+                size_t num_points,
+                size_t num_clusters,
+                BufferIterator<PointT> points_begin,
+                BufferIterator<PointT> points_end,
+                BufferIterator<PointT> centroids_begin,
+                BufferIterator<PointT> centroids_end,
+                BufferIterator<LabelT> labels_begin,
+                BufferIterator<LabelT> labels_end,
+                BufferIterator<MassT> masses_begin,
+                BufferIterator<MassT> masses_end,
+                BufferIterator<PointT> cluster_sse_begin,
+                BufferIterator<PointT> cluster_sse_end,
                 Measurement::DataPoint& datapoint,
                 boost::compute::wait_list const& events
             )
@@ -52,6 +79,31 @@ public:
             LabelingConfiguration config,
             Measurement::Measurement& measurement) {
 
+        // The mass histogram needs the masses of create_with_masses
+        config.mass_histogram = false;
+
+        measurement.set_parameter(
+                "LabelingClusterSse",
+                (config.cluster_sse) ? "true" : "false"
+                );
+
+        // Select the strategy when the data shape is known
+        if (not config.tuning.empty()) {
+            measurement.set_parameter(
+                    "LabelingTuningRules",
+                    std::to_string(config.tuning.size())
+                    );
+
+            TuningTable tuning = config.tuning;
+            config.tuning = TuningTable();
+            return TunedStrategy<LabelingFunction, LabelingConfiguration>(
+                    config,
+                    tuning,
+                    [context](LabelingConfiguration c) {
+                        return create_strategy<LabelingFunction>(context, c);
+                    });
+        }
+
         measurement.set_parameter(
                 "LabelingGlobalSize",
                 std::to_string(config.global_size[0])
@@ -74,8 +126,141 @@ public:
                     "LabelingUnrollFeaturesLength",
                     std::to_string(config.unroll_features_length)
                     );
+        }
 
-            LabelingUnrollVector<PointT, LabelT, ColMajor> strategy;
+        return create_strategy<LabelingFunction>(context, config);
+    }
+
+    /*
+     * Labeling that also counts the cluster masses
+     *
+     * Parameters other than the mass histogram are recorded by create.
+     */
+    template <typename MassT>
+    LabelingMassFunction<MassT> create_with_masses(
+            boost::compute::context context,
+            LabelingConfiguration config,
+            Measurement::Measurement& measurement) {
+
+        config.mass_histogram = true;
+
+        measurement.set_parameter(
+                "LabelingMassHistogram",
+                "true"
+                );
+
+        if (not config.tuning.empty()) {
+            TuningTable tuning = config.tuning;
+            config.tuning = TuningTable();
+            return TunedStrategy<
+                LabelingMassFunction<MassT>,
+                LabelingConfiguration>(
+                    config,
+                    tuning,
+                    [context](LabelingConfiguration c) {
+                        return create_strategy<
+                            LabelingMassFunction<MassT>,
+                            MassT>(context, c);
+                    });
+        }
+
+        return create_strategy<LabelingMassFunction<MassT>, MassT>(
+                context,
+                config);
+    }
+
+    /*
+     * Build the strategy that the tuning table selects for the data shape
+     *
+     * Pipelines call this before they start timing.
+     */
+    static void prepare(
+            LabelingFunction& f,
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_clusters) {
+
+        TunedStrategy<LabelingFunction, LabelingConfiguration>::prepare(
+                f,
+                queue,
+                num_features,
+                num_clusters);
+    }
+
+    template <typename MassT>
+    static void prepare(
+            LabelingMassFunction<MassT>& f,
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_clusters) {
+
+        TunedStrategy<
+            LabelingMassFunction<MassT>,
+            LabelingConfiguration>::prepare(
+                    f,
+                    queue,
+                    num_features,
+                    num_clusters);
+    }
+
+    /*
+     * Blocks of labels that the last call on labels changed, in the format
+     * of BufferCache::unlock
+     *
+     * Requires label_changes. Reports the whole buffer as changed if no
+     * strategy flagged the blocks of labels. MassT is the mass type of
+     * create_with_masses.
+     */
+    template <typename Function, typename MassT = uint32_t>
+    static std::vector<bool> changed_blocks(
+            Function& f,
+            boost::compute::command_queue queue,
+            boost::compute::buffer const& labels,
+            boost::compute::wait_list const& events) {
+
+        using UnrollVector = LabelingUnrollVector<
+            PointT,
+            LabelT,
+            MassT,
+            ColMajor>;
+
+        std::vector<bool> changed;
+        TunedStrategy<Function, LabelingConfiguration>::for_each(
+                f,
+                [&](Function& strategy) {
+                    std::vector<bool> blocks;
+                    UnrollVector* unroll_vector =
+                        strategy.template target<UnrollVector>();
+                    if (not (unroll_vector
+                                and unroll_vector->changed_blocks(
+                                    queue, labels, events, blocks))) {
+                        return;
+                    }
+
+                    // Strategies that ran on labels earlier may still
+                    // hold flags of labels, which only add blocks
+                    changed.resize(blocks.size(), false);
+                    for (size_t i = 0; i < blocks.size(); ++i) {
+                        changed[i] = changed[i] or blocks[i];
+                    }
+                });
+
+        if (changed.empty()) {
+            changed.assign(1, true);
+        }
+
+        return changed;
+    }
+
+private:
+    // MassT is only used with a mass histogram
+    template <typename Function, typename MassT = uint32_t>
+    static Function create_strategy(
+            boost::compute::context context,
+            LabelingConfiguration config) {
+
+        if (config.strategy == "unroll_vector") {
+            LabelingUnrollVector<PointT, LabelT, MassT, ColMajor> strategy;
             strategy.prepare(context, config);
             return strategy;
         }
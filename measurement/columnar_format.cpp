@@ -0,0 +1,220 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include "columnar_format.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+constexpr char Measurement::ColumnarBlock::MAGIC[4];
+constexpr uint32_t Measurement::ColumnarBlock::VERSION;
+
+namespace {
+
+template <typename T>
+void write_value(std::ostream& os, T const& value) {
+    os.write(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+template <typename T>
+void write_column(std::ostream& os, std::vector<T> const& column) {
+    os.write(
+            reinterpret_cast<char const*>(column.data()),
+            column.size() * sizeof(T));
+}
+
+template <typename T>
+T read_value(std::istream& is) {
+    T value;
+    is.read(reinterpret_cast<char*>(&value), sizeof(T));
+    if (not is) {
+        throw std::runtime_error("Truncated columnar block");
+    }
+    return value;
+}
+
+template <typename T>
+void read_column(std::istream& is, std::vector<T>& column, size_t length) {
+    column.resize(length);
+    is.read(reinterpret_cast<char*>(column.data()), length * sizeof(T));
+    if (not is) {
+        throw std::runtime_error("Truncated columnar block");
+    }
+}
+
+}
+
+uint32_t Measurement::ColumnarBlock::string_id(std::string const& str) {
+    auto it = std::find(strings.begin(), strings.end(), str);
+    if (it != strings.end()) {
+        return it - strings.begin();
+    }
+
+    strings.push_back(str);
+    return strings.size() - 1;
+}
+
+void Measurement::ColumnarBlock::summarize() {
+    summaries = summarize(measurement_type_name, measurement_value);
+}
+
+std::vector<Measurement::ColumnarBlock::Summary>
+Measurement::ColumnarBlock::summarize(
+        std::vector<uint32_t> const& type_name,
+        std::vector<uint64_t> const& value)
+{
+    std::map<uint32_t, std::vector<uint64_t>> by_name;
+    for (size_t i = 0; i < type_name.size(); ++i) {
+        by_name[type_name[i]].push_back(value[i]);
+    }
+
+    std::vector<Summary> summaries;
+    for (auto& n : by_name) {
+        std::vector<uint64_t>& values = n.second;
+        std::sort(values.begin(), values.end());
+
+        Summary s;
+        s.type_name = n.first;
+        s.count = values.size();
+        s.sum = 0;
+        for (uint64_t v : values) {
+            s.sum += v;
+        }
+        s.min = values.front();
+        s.median = values[(values.size() - 1) / 2];
+
+        // Nearest rank, ceil(0.99 * count)
+        size_t rank = (99 * values.size() + 99) / 100;
+        s.p99 = values[rank - 1];
+
+        summaries.push_back(s);
+    }
+
+    return summaries;
+}
+
+void Measurement::ColumnarBlock::write(std::ostream& os) const {
+    std::ostringstream payload;
+
+    write_value<uint32_t>(payload, strings.size());
+    for (auto const& s : strings) {
+        write_value<uint32_t>(payload, s.size());
+        payload.write(s.data(), s.size());
+    }
+
+    write_value<uint32_t>(payload, parameters.size());
+    for (auto const& p : parameters) {
+        write_value<uint32_t>(payload, p.first);
+        write_value<uint32_t>(payload, p.second);
+    }
+
+    write_value<int32_t>(payload, run);
+
+    write_value<uint64_t>(payload, measurement_type_name.size());
+    write_column(payload, measurement_type_name);
+    write_column(payload, measurement_iteration);
+    write_column(payload, measurement_value);
+
+    write_value<uint64_t>(payload, event_type_name.size());
+    write_column(payload, event_type_name);
+    write_column(payload, event_iteration);
+    write_column(payload, event_queue_id);
+    write_column(payload, event_queued);
+    write_column(payload, event_submit);
+    write_column(payload, event_start);
+    write_column(payload, event_end);
+
+    write_value<uint32_t>(payload, summaries.size());
+    for (auto const& s : summaries) {
+        write_value<uint32_t>(payload, s.type_name);
+        write_value<uint64_t>(payload, s.count);
+        write_value<uint64_t>(payload, s.sum);
+        write_value<uint64_t>(payload, s.min);
+        write_value<uint64_t>(payload, s.median);
+        write_value<uint64_t>(payload, s.p99);
+    }
+
+    std::string const& buffer = payload.str();
+    os.write(MAGIC, sizeof(MAGIC));
+    write_value<uint32_t>(os, VERSION);
+    write_value<uint64_t>(os, buffer.size());
+    os.write(buffer.data(), buffer.size());
+}
+
+bool Measurement::ColumnarBlock::read(std::istream& is) {
+    char magic[sizeof(MAGIC)];
+    is.read(magic, sizeof(magic));
+    if (is.gcount() == 0 && is.eof()) {
+        return false;
+    }
+    if (not is || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("Not a columnar measurement block");
+    }
+
+    uint32_t version = read_value<uint32_t>(is);
+    if (version != VERSION) {
+        throw std::runtime_error(
+                "Unsupported columnar format version "
+                + std::to_string(version));
+    }
+    read_value<uint64_t>(is);
+
+    uint32_t num_strings = read_value<uint32_t>(is);
+    strings.resize(num_strings);
+    for (auto& s : strings) {
+        uint32_t length = read_value<uint32_t>(is);
+        s.resize(length);
+        is.read(&s[0], length);
+    }
+
+    uint32_t num_parameters = read_value<uint32_t>(is);
+    parameters.resize(num_parameters);
+    for (auto& p : parameters) {
+        p.first = read_value<uint32_t>(is);
+        p.second = read_value<uint32_t>(is);
+    }
+
+    run = read_value<int32_t>(is);
+
+    uint64_t num_measurements = read_value<uint64_t>(is);
+    read_column(is, measurement_type_name, num_measurements);
+    read_column(is, measurement_iteration, num_measurements);
+    read_column(is, measurement_value, num_measurements);
+
+    uint64_t num_events = read_value<uint64_t>(is);
+    read_column(is, event_type_name, num_events);
+    read_column(is, event_iteration, num_events);
+    read_column(is, event_queue_id, num_events);
+    read_column(is, event_queued, num_events);
+    read_column(is, event_submit, num_events);
+    read_column(is, event_start, num_events);
+    read_column(is, event_end, num_events);
+
+    uint32_t num_summaries = read_value<uint32_t>(is);
+    summaries.resize(num_summaries);
+    for (auto& s : summaries) {
+        s.type_name = read_value<uint32_t>(is);
+        s.count = read_value<uint64_t>(is);
+        s.sum = read_value<uint64_t>(is);
+        s.min = read_value<uint64_t>(is);
+        s.median = read_value<uint64_t>(is);
+        s.p99 = read_value<uint64_t>(is);
+    }
+
+    for (auto const& p : parameters) {
+        if (p.first >= strings.size() || p.second >= strings.size()) {
+            throw std::runtime_error("Invalid string id in columnar block");
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,98 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef COLUMNAR_FORMAT_HPP
+#define COLUMNAR_FORMAT_HPP
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Measurement {
+
+/*
+ * Append-only binary file of measurements, one block per run
+ *
+ * All integers are in native byte order. Strings are stored once per block
+ * and referenced by their index (string id).
+ *
+ *   char[4]  magic "CLKM"
+ *   uint32   version
+ *   uint64   payload size in bytes, to skip the block
+ *   payload:
+ *     uint32 num_strings, per string: uint32 length, char[length]
+ *     uint32 num_parameters, per parameter: uint32 name, uint32 value
+ *     int32  run
+ *     uint64 num_measurements, followed by the columns
+ *            uint32 type_name[], int32 iteration[], uint64 value[]
+ *     uint64 num_events, followed by the columns
+ *            uint32 type_name[], int32 iteration[], uint64 queue_id[],
+ *            uint64 queued[], uint64 submit[], uint64 start[], uint64 end[]
+ *     uint32 num_summaries, per summary:
+ *            uint32 type_name, uint64 count, uint64 sum, uint64 min,
+ *            uint64 median, uint64 p99
+ *
+ * Iterations are -1 for non-iterative datapoints. Summaries are over the
+ * measurement values of each type name.
+ */
+class ColumnarBlock {
+public:
+    static constexpr char MAGIC[4] = {'C', 'L', 'K', 'M'};
+    static constexpr uint32_t VERSION = 1;
+
+    struct Summary {
+        uint32_t type_name;
+        uint64_t count;
+        uint64_t sum;
+        uint64_t min;
+        uint64_t median;
+        uint64_t p99;
+    };
+
+    // Returns the id of str, adding it if necessary
+    uint32_t string_id(std::string const& str);
+
+    // Computes the summaries from the measurement columns
+    void summarize();
+
+    void write(std::ostream& os) const;
+
+    // Returns false at the end of the stream, throws on malformed blocks
+    bool read(std::istream& is);
+
+    // Summaries of a value column by type name
+    static std::vector<Summary> summarize(
+            std::vector<uint32_t> const& type_name,
+            std::vector<uint64_t> const& value);
+
+    std::vector<std::string> strings;
+    std::vector<std::pair<uint32_t, uint32_t>> parameters;
+    int32_t run = 0;
+
+    std::vector<uint32_t> measurement_type_name;
+    std::vector<int32_t> measurement_iteration;
+    std::vector<uint64_t> measurement_value;
+
+    std::vector<uint32_t> event_type_name;
+    std::vector<int32_t> event_iteration;
+    std::vector<uint64_t> event_queue_id;
+    std::vector<uint64_t> event_queued;
+    std::vector<uint64_t> event_submit;
+    std::vector<uint64_t> event_start;
+    std::vector<uint64_t> event_end;
+
+    std::vector<Summary> summaries;
+};
+
+}
+
+#endif /* COLUMNAR_FORMAT_HPP */
@@ -0,0 +1,185 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include "hardware_counters.hpp"
+#include "measurement.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Bytes transferred from memory per last level cache miss
+uint64_t const cache_line_size = 64;
+
+enum CounterEvent : size_t {
+    Cycles = 0,
+    Instructions,
+    LLCMisses,
+    NumEvents
+};
+
+#ifdef __linux__
+uint64_t const event_config[NumEvents] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES
+};
+
+int perf_event_open(perf_event_attr *attr, pid_t tid) {
+    return ::syscall(SYS_perf_event_open, attr, tid, -1, -1, 0);
+}
+#endif
+
+}
+
+Measurement::HardwareCounters::HardwareCounters()
+    :
+        start_values_(NumEvents, 0),
+        start_time_(0)
+{
+    open_threads();
+}
+
+Measurement::HardwareCounters::~HardwareCounters() {
+    close_threads();
+}
+
+bool Measurement::HardwareCounters::available() {
+    for (auto const& t : threads_) {
+        if (not t.second.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> const& Measurement::HardwareCounters::names() {
+    static std::vector<std::string> const counter_names = {
+        "Cycles",
+        "Instructions",
+        "LLCMisses"
+    };
+    return counter_names;
+}
+
+void Measurement::HardwareCounters::start() {
+    open_threads();
+    start_values_ = read();
+    start_time_ = DataPoint::host_timestamp();
+}
+
+void Measurement::HardwareCounters::stop(DataPoint& datapoint) {
+    std::vector<uint64_t> values = read();
+    uint64_t const time = DataPoint::host_timestamp() - start_time_;
+
+    if (not available()) {
+        return;
+    }
+
+    for (size_t e = 0; e < NumEvents; ++e) {
+        datapoint.add_counter(names()[e], values[e] - start_values_[e]);
+    }
+
+    // Bytes per nanosecond are GB/s, exported in MB/s
+    if (time > 0) {
+        datapoint.add_counter(
+                "MemoryBandwidth",
+                (values[LLCMisses] - start_values_[LLCMisses])
+                * cache_line_size * 1000 / time);
+    }
+}
+
+// Counters of exited threads are closed and reused thread IDs get new
+// counters. Reopening all threads instead of adding the new ones avoids
+// counting a thread both on its own and through inheritance.
+void Measurement::HardwareCounters::open_threads() {
+    close_threads();
+
+#ifdef __linux__
+    DIR *tasks = ::opendir("/proc/self/task");
+    if (tasks == nullptr) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = ::readdir(tasks)) != nullptr) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        int tid = std::atoi(entry->d_name);
+        std::vector<Counter>& counters = threads_[tid];
+        for (size_t e = 0; e < NumEvents; ++e) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = event_config[e];
+            attr.read_format =
+                PERF_FORMAT_TOTAL_TIME_ENABLED
+                | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // Threads spawned later add to the counter of their parent
+            attr.inherit = 1;
+
+            int fd = perf_event_open(&attr, tid);
+            if (fd != -1) {
+                counters.push_back({fd, e});
+            }
+        }
+    }
+
+    ::closedir(tasks);
+#endif
+}
+
+void Measurement::HardwareCounters::close_threads() {
+#ifdef __linux__
+    for (auto& t : threads_) {
+        for (auto& c : t.second) {
+            ::close(c.fd);
+        }
+    }
+#endif
+    threads_.clear();
+}
+
+std::vector<uint64_t> Measurement::HardwareCounters::read() {
+    std::vector<uint64_t> values(NumEvents, 0);
+
+#ifdef __linux__
+    for (auto const& t : threads_) {
+        for (auto const& c : t.second) {
+            uint64_t buffer[3];
+            if (::read(c.fd, buffer, sizeof(buffer)) != sizeof(buffer)) {
+                continue;
+            }
+
+            // Scale counters that were multiplexed with others
+            uint64_t value = buffer[0];
+            if (buffer[2] > 0 && buffer[2] < buffer[1]) {
+                value = (uint64_t)
+                    ((double) value * buffer[1] / buffer[2]);
+            }
+            values[c.event] += value;
+        }
+    }
+#endif
+
+    return values;
+}
@@ -0,0 +1,70 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef HARDWARE_COUNTERS_HPP
+#define HARDWARE_COUNTERS_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Measurement {
+
+class DataPoint;
+
+/*
+ * Host-side hardware counters with perf_event_open
+ *
+ * Counts cycles, instructions and last level cache misses in user space of
+ * every thread of this process, including the worker threads of a CPU
+ * OpenCL runtime. start() opens the counters of the running threads anew.
+ * Threads that these spawn before stop() inherit the counters. Counters
+ * that the kernel or the CPU doesn't support are left out, and on other
+ * systems than Linux there are none.
+ *
+ * stop() attaches the counts since start() to a DataPoint, together with
+ * the memory bandwidth implied by the cache misses. Device-side work must
+ * have finished before stop(), e.g. by a queue finish.
+ */
+class HardwareCounters {
+public:
+    HardwareCounters();
+    ~HardwareCounters();
+
+    HardwareCounters(HardwareCounters const&) = delete;
+    HardwareCounters& operator=(HardwareCounters const&) = delete;
+
+    // True if at least one counter could be opened
+    bool available();
+
+    void start();
+    void stop(DataPoint& datapoint);
+
+    // Names of the counters as exported, e.g. "Cycles"
+    static std::vector<std::string> const& names();
+
+private:
+    struct Counter {
+        int fd;
+        size_t event;
+    };
+
+    void open_threads();
+    void close_threads();
+    std::vector<uint64_t> read();
+
+    std::map<int, std::vector<Counter>> threads_;
+    std::vector<uint64_t> start_values_;
+    uint64_t start_time_;
+};
+
+}
+
+#endif /* HARDWARE_COUNTERS_HPP */
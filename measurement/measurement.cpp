@@ -8,14 +8,19 @@
  */
 
 #include "measurement.hpp"
+#include "columnar_format.hpp"
 
 #include <boost/filesystem/path.hpp>
+#include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <iomanip>
+#include <limits>
 #include <unistd.h>
 #include <random>
 #include <sstream>
 #include <iostream>
+#include <thread>
 
 #include <boost/compute/core.hpp>
 
@@ -27,6 +32,32 @@ char const *const timestamp_format = "%F-%H-%M-%S";
 char const *const experiment_file_suffix = "_expm";
 char const *const measurements_file_suffix = "_mnts";
 char const *const events_file_suffix = "_evnt";
+char const *const roofline_file_suffix = "_roof";
+char const *const trace_file_suffix = "_trce";
+char const *const trace_file_extension = ".json";
+
+namespace {
+
+// Escape a string for a JSON string literal
+std::string json_escape(std::string const& str) {
+    std::string escaped;
+    for (char c : str) {
+        if (c == '"' or c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if ((unsigned char) c < 0x20) {
+            escaped += ' ';
+        }
+        else {
+            escaped += c;
+        }
+    }
+
+    return escaped;
+}
+
+}
 
 std::string Measurement::DataPoint::get_name() { return name_; }
 
@@ -37,7 +68,11 @@ int Measurement::DataPoint::get_iteration() { return iteration_; }
 uint64_t Measurement::DataPoint::get_value() {
   uint64_t value = 0;
 
-  if (has_event_ && not events_.empty()) {
+  if (has_event_ && not (events_.empty() && records_.empty())) {
+      for (size_t const& id : records_) {
+          EventRecord const& r = arena_->record(id);
+          value += r.end - r.start;
+      }
       for (Event const& e : events_) {
           e.wait();
           value += e.duration<std::chrono::nanoseconds>().count();
@@ -65,17 +100,20 @@ size_t Measurement::DataPoint::num_events() {
         return 0;
     }
     else {
-        return events_.size();
+        return records_.size() + events_.size();
     }
 }
 
 uint64_t Measurement::DataPoint::get_event_queued(size_t i) {
 
-    if (not has_event_ or i >= events_.size()) {
+    if (not has_event_ or i >= num_events()) {
         return 0;
     }
+    else if (i < records_.size()) {
+        return arena_->record(records_[i]).queued;
+    }
     else {
-        auto& e = events_[i];
+        auto& e = events_[i - records_.size()];
 
         auto status = e.status();
         if (
@@ -97,11 +135,14 @@ uint64_t Measurement::DataPoint::get_event_queued(size_t i) {
 
 uint64_t Measurement::DataPoint::get_event_submit(size_t i) {
 
-    if (not has_event_ or i >= events_.size()) {
+    if (not has_event_ or i >= num_events()) {
         return 0;
     }
+    else if (i < records_.size()) {
+        return arena_->record(records_[i]).submit;
+    }
     else {
-        auto& e = events_[i];
+        auto& e = events_[i - records_.size()];
 
         auto status = e.status();
         if (
@@ -123,11 +164,14 @@ uint64_t Measurement::DataPoint::get_event_submit(size_t i) {
 
 uint64_t Measurement::DataPoint::get_event_start(size_t i) {
 
-    if (not has_event_ or i >= events_.size()) {
+    if (not has_event_ or i >= num_events()) {
         return 0;
     }
+    else if (i < records_.size()) {
+        return arena_->record(records_[i]).start;
+    }
     else {
-        auto& e = events_[i];
+        auto& e = events_[i - records_.size()];
 
         auto status = e.status();
         if (
@@ -149,11 +193,14 @@ uint64_t Measurement::DataPoint::get_event_start(size_t i) {
 
 uint64_t Measurement::DataPoint::get_event_end(size_t i) {
 
-    if (not has_event_ or i >= events_.size()) {
+    if (not has_event_ or i >= num_events()) {
         return 0;
     }
+    else if (i < records_.size()) {
+        return arena_->record(records_[i]).end;
+    }
     else {
-        auto& e = events_[i];
+        auto& e = events_[i - records_.size()];
 
         auto status = e.status();
         if (
@@ -175,24 +222,179 @@ uint64_t Measurement::DataPoint::get_event_end(size_t i) {
 
 uint64_t Measurement::DataPoint::get_event_queue_id(size_t i) {
 
-    if (not has_event_ or i >= events_.size()) {
+    if (not has_event_ or i >= num_events()) {
         return 0;
     }
+    else if (i < records_.size()) {
+        return arena_->record(records_[i]).queue_id;
+    }
     else {
-        auto& e = events_[i];
+        auto& e = events_[i - records_.size()];
         cl_command_queue queue_ptr = e.get_info<cl_command_queue>(CL_EVENT_COMMAND_QUEUE);
         return (uint64_t) queue_ptr;
     }
 }
 
-Measurement::Measurement::Measurement() {
+cl_event Measurement::DataPoint::get_event_handle(size_t i) {
+
+    // Released events have no handle
+    if (not has_event_ or i < records_.size() or i >= num_events()) {
+        return nullptr;
+    }
+    else {
+        return events_[i - records_.size()].get();
+    }
+}
+
+Measurement::EventArena::EventArena(size_t capacity)
+    :
+        records_(new EventRecord[capacity]),
+        capacity_(capacity),
+        next_(0),
+        outstanding_(0)
+{}
+
+Measurement::EventArena::~EventArena() {
+    // Callbacks write into the records
+    while (outstanding_.load() > 0) {
+        std::this_thread::yield();
+    }
+}
+
+boost::compute::event &Measurement::EventArena::add_pending(DataPoint *owner) {
+    flush();
+
+    pending_.push_back({Event(), owner});
+    return pending_.back().event;
+}
+
+void Measurement::EventArena::flush() {
+    for (auto& p : pending_) {
+        if (p.event.get() == nullptr) {
+            continue;
+        }
+
+        int64_t id = track(p.event);
+        if (id < 0) {
+            p.owner->events_.push_back(p.event);
+        }
+        else {
+            p.owner->records_.push_back(id);
+        }
+    }
+
+    pending_.clear();
+}
+
+Measurement::EventRecord const &Measurement::EventArena::record(size_t id) {
+    EventRecord const& r = records_[id];
+
+    while (not r.done.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    if (r.status < 0) {
+        std::cerr << bc::opencl_error::to_string(r.status) << std::endl;
+        throw new bc::opencl_error(r.status);
+    }
+
+    return r;
+}
+
+int64_t Measurement::EventArena::track(Event const& event) {
+    if (next_ >= capacity_) {
+        return -1;
+    }
+
+    size_t id = next_;
+    EventRecord& r = records_[id];
+    r.arena = this;
+    r.done.store(false);
+
+    // The record holds a reference until the callback
+    clRetainEvent(event.get());
+    ++outstanding_;
+    cl_int err = clSetEventCallback(
+            event.get(),
+            CL_COMPLETE,
+            &EventArena::complete,
+            &r
+            );
+    if (err != CL_SUCCESS) {
+        clReleaseEvent(event.get());
+        --outstanding_;
+        return -1;
+    }
+
+    ++next_;
+    return id;
+}
+
+void CL_CALLBACK Measurement::EventArena::complete(cl_event event, cl_int status, void *user_data) {
+    EventRecord& r = *static_cast<EventRecord*>(user_data);
+
+    if (status == CL_COMPLETE) {
+        cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, nullptr);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, nullptr);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr);
+
+        cl_command_queue queue = nullptr;
+        clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof(cl_command_queue), &queue, nullptr);
+
+        r.queued = queued;
+        r.submit = submit;
+        r.start = start;
+        r.end = end;
+        r.queue_id = (uint64_t) queue;
+    }
+    r.status = status;
+
+    EventArena *arena = r.arena;
+    r.done.store(true, std::memory_order_release);
+    clReleaseEvent(event);
+    --arena->outstanding_;
+}
+
+void Measurement::Measurement::set_event_capacity(size_t capacity) {
+    if (capacity == 0) {
+        arena_.reset();
+    }
+    else {
+        arena_ = std::make_shared<EventArena>(capacity);
+    }
+}
+
+void Measurement::Measurement::flush_events() {
+    if (arena_) {
+        arena_->flush();
+    }
+}
+
+Measurement::Measurement::Measurement()
+    :
+        peak_bandwidth_(0.0),
+        peak_performance_(0.0)
+{
     run_date_ = std::chrono::system_clock::now();
+    experiment_id_ = get_unique_id();
     set_parameter("TimeStamp", get_datetime());
 }
-Measurement::Measurement::~Measurement() {}
+Measurement::Measurement::~Measurement() {
+    // Pending events refer to the datapoints
+    flush_events();
+}
 
 void Measurement::Measurement::set_run(int run) { run_ = run; }
 
+void Measurement::Measurement::set_peak(double bandwidth, double performance) {
+    peak_bandwidth_ = bandwidth;
+    peak_performance_ = performance;
+    set_parameter("PeakBandwidth", std::to_string(bandwidth));
+    set_parameter("PeakPerformance", std::to_string(performance));
+}
+
 void Measurement::Measurement::set_parameter(
         std::string name,
         std::string value
@@ -201,7 +403,9 @@ void Measurement::Measurement::set_parameter(
 }
 
 void Measurement::Measurement::write_csv(std::string filename) {
-  std::string experiment_id = get_unique_id();
+  flush_events();
+
+  std::string const& experiment_id = experiment_id_;
 
   {
     std::string experiment_file =
@@ -321,6 +525,357 @@ void Measurement::Measurement::write_csv(std::string filename) {
     ef.close();
     ef.clear();
   }
+
+  write_roofline(filename);
+}
+
+void Measurement::Measurement::write_roofline(std::string filename) {
+    std::deque<DataPoint> work_points;
+    for (DataPoint& dp : get_all_datapoints()) {
+        if (dp.bytes_read_ + dp.bytes_written_ + dp.flops_ > 0) {
+            work_points.push_back(dp);
+        }
+    }
+
+    if (work_points.empty()) {
+        return;
+    }
+
+    std::string roofline_file =
+        format_filename(filename, experiment_id_, roofline_file_suffix);
+    std::ofstream rf(roofline_file, std::ios_base::out | std::ios::trunc);
+
+    rf << "ExperimentID";
+    rf << ',';
+    rf << "Run";
+    rf << ',';
+    rf << "TypeName";
+    rf << ',';
+    rf << "Iteration";
+    rf << ',';
+    rf << "BytesRead";
+    rf << ',';
+    rf << "BytesWritten";
+    rf << ',';
+    rf << "Flops";
+    rf << ',';
+    rf << "Time";
+    rf << ',';
+    rf << "Bandwidth";
+    rf << ',';
+    rf << "Performance";
+    rf << ',';
+    rf << "Intensity";
+    rf << ',';
+    rf << "BandwidthUtilization";
+    rf << ',';
+    rf << "PerformanceUtilization";
+    rf << ',';
+    rf << "Bound";
+
+    rf << '\n';
+
+    for (DataPoint& dp : work_points) {
+        uint64_t const bytes = dp.bytes_read_ + dp.bytes_written_;
+        uint64_t const time = get_total_time(dp);
+
+        // Bytes and FLOPs per nanosecond are GB/s and GFLOP/s
+        double const bandwidth = (time > 0) ? (double) bytes / time : 0.0;
+        double const performance =
+            (time > 0) ? (double) dp.flops_ / time : 0.0;
+        double const intensity = (bytes > 0) ? (double) dp.flops_ / bytes : 0.0;
+
+        rf << experiment_id_;
+        rf << ',';
+        rf << run_;
+        rf << ',';
+        rf << dp.get_name();
+        rf << ',';
+        if (dp.is_iterative() == true) {
+            rf << dp.get_iteration();
+        }
+        rf << ',';
+        rf << dp.bytes_read_;
+        rf << ',';
+        rf << dp.bytes_written_;
+        rf << ',';
+        rf << dp.flops_;
+        rf << ',';
+        rf << time;
+        rf << ',';
+        rf << bandwidth;
+        rf << ',';
+        rf << performance;
+        rf << ',';
+        rf << intensity;
+        rf << ',';
+        if (peak_bandwidth_ > 0.0) {
+            rf << bandwidth / peak_bandwidth_;
+        }
+        rf << ',';
+        if (peak_performance_ > 0.0) {
+            rf << performance / peak_performance_;
+        }
+        rf << ',';
+        // Left of the ridge point, the roof is the bandwidth
+        if (peak_bandwidth_ > 0.0 && peak_performance_ > 0.0) {
+            rf << ((intensity * peak_bandwidth_ < peak_performance_)
+                    ? "Memory"
+                    : "Compute");
+        }
+        rf << '\n';
+    }
+
+    rf.close();
+    rf.clear();
+}
+
+void Measurement::Measurement::write_columnar(std::string filename) {
+    flush_events();
+
+    ColumnarBlock block;
+
+    block.parameters.emplace_back(
+            block.string_id("ExperimentID"),
+            block.string_id(experiment_id_));
+    for (auto const& p : parameters_) {
+        block.parameters.emplace_back(
+                block.string_id(p.first),
+                block.string_id(p.second));
+    }
+
+    block.run = run_;
+
+    for (DataPoint dp : get_flattened_datapoints()) {
+        block.measurement_type_name.push_back(block.string_id(dp.get_name()));
+        block.measurement_iteration.push_back(
+                dp.is_iterative() ? dp.get_iteration() : -1);
+        block.measurement_value.push_back(dp.get_value());
+    }
+
+    for (DataPoint dp : get_datapoints_with_events()) {
+        uint32_t name = block.string_id(dp.get_name());
+        int32_t iteration = dp.is_iterative() ? dp.get_iteration() : -1;
+        size_t num_events = dp.num_events();
+        for (size_t i = 0; i < num_events; ++i) {
+            block.event_type_name.push_back(name);
+            block.event_iteration.push_back(iteration);
+            block.event_queue_id.push_back(dp.get_event_queue_id(i));
+            block.event_queued.push_back(dp.get_event_queued(i));
+            block.event_submit.push_back(dp.get_event_submit(i));
+            block.event_start.push_back(dp.get_event_start(i));
+            block.event_end.push_back(dp.get_event_end(i));
+        }
+    }
+
+    block.summarize();
+
+    std::ofstream cf(
+            filename,
+            std::ios_base::out | std::ios::app | std::ios::binary);
+    block.write(cf);
+    cf.close();
+}
+
+void Measurement::Measurement::write_trace(std::string filename) {
+    flush_events();
+
+
+    struct Slice {
+        std::string name;
+        int iteration;
+        uint64_t track;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    struct Flow {
+        cl_event from;
+        size_t to;
+    };
+
+    // Tracks are numbered in order of first appearance; command queues
+    // are in process 1 and host tracks in process 2
+    std::map<uint64_t, uint64_t> queue_tracks;
+    std::map<std::string, uint64_t> host_tracks;
+    std::vector<Slice> device_slices;
+    std::vector<Slice> host_slices;
+    std::map<cl_event, size_t> event_slice;
+    std::vector<Flow> device_flows;
+    std::vector<Flow> host_flows;
+
+    for (DataPoint dp : get_all_datapoints()) {
+        int iteration = (dp.is_iterative()) ? dp.get_iteration() : -1;
+
+        size_t first_slice = device_slices.size();
+        size_t num_events = dp.num_events();
+        for (size_t i = 0; i < num_events; ++i) {
+            uint64_t queue_id = dp.get_event_queue_id(i);
+            auto track = queue_tracks.emplace(queue_id, queue_tracks.size());
+
+            cl_event handle = dp.get_event_handle(i);
+            if (handle != nullptr) {
+                event_slice[handle] = device_slices.size();
+            }
+            device_slices.push_back({
+                    dp.get_name(),
+                    iteration,
+                    track.first->second,
+                    dp.get_event_start(i),
+                    dp.get_event_end(i)
+                    });
+        }
+
+        if (num_events > 0) {
+            for (auto const& dep : dp.dependencies_) {
+                device_flows.push_back({dep.get(), first_slice});
+            }
+        }
+
+        for (auto const& span : dp.host_spans_) {
+            auto track = host_tracks.emplace(span.track, host_tracks.size());
+
+            for (size_t i = 0; i < span.dependencies.size(); ++i) {
+                host_flows.push_back({
+                        span.dependencies[i].get(),
+                        host_slices.size()
+                        });
+            }
+
+            host_slices.push_back({
+                    dp.get_name(),
+                    iteration,
+                    track.first->second,
+                    span.start,
+                    span.end
+                    });
+        }
+    }
+
+    // Device and host clocks differ. A host span starts after the device
+    // events that it waits on, thus the smallest difference between the
+    // two is taken as the clock offset.
+    int64_t host_offset = std::numeric_limits<int64_t>::max();
+    for (auto const& flow : host_flows) {
+        auto it = event_slice.find(flow.from);
+        if (it != event_slice.end()) {
+            int64_t diff =
+                (int64_t) host_slices[flow.to].start
+                - (int64_t) device_slices[it->second].end;
+            host_offset = std::min(host_offset, diff);
+        }
+    }
+
+    uint64_t device_begin = std::numeric_limits<uint64_t>::max();
+    for (auto const& s : device_slices) {
+        device_begin = std::min(device_begin, s.start);
+    }
+    uint64_t host_begin = std::numeric_limits<uint64_t>::max();
+    for (auto const& s : host_slices) {
+        host_begin = std::min(host_begin, s.start);
+    }
+    if (device_slices.empty()) {
+        device_begin = host_begin;
+    }
+    if (host_offset == std::numeric_limits<int64_t>::max()) {
+        host_offset = (int64_t) host_begin - (int64_t) device_begin;
+    }
+
+    // Timestamps in microseconds relative to the first device event
+    auto device_us = [device_begin](uint64_t t) {
+        return ((double) t - (double) device_begin) / 1000.0;
+    };
+    auto host_us = [device_begin, host_offset](uint64_t t) {
+        return ((double) t - (double) host_offset - (double) device_begin)
+            / 1000.0;
+    };
+
+    std::string trace_file = boost::filesystem::path(
+            format_filename(filename, experiment_id_, trace_file_suffix)
+            ).replace_extension(trace_file_extension).string();
+
+    std::ofstream tf(trace_file, std::ios_base::out | std::ios::trunc);
+    tf << std::fixed << std::setprecision(3);
+
+    tf << "{\"traceEvents\":[\n";
+    tf << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+        << "\"args\":{\"name\":\"Command Queues\"}},\n";
+    tf << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,"
+        << "\"args\":{\"name\":\"Host\"}}";
+
+    for (auto const& q : queue_tracks) {
+        tf << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            << "\"tid\":" << q.second << ","
+            << "\"args\":{\"name\":\"Queue " << q.second << "\"}}";
+    }
+    for (auto const& h : host_tracks) {
+        tf << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,"
+            << "\"tid\":" << h.second << ","
+            << "\"args\":{\"name\":\"" << json_escape(h.first) << "\"}}";
+    }
+
+    auto write_slice = [&tf](Slice const& s, int pid, double ts, double dur) {
+        tf << ",\n{\"name\":\"" << json_escape(s.name) << "\","
+            << "\"ph\":\"X\",\"pid\":" << pid << ","
+            << "\"tid\":" << s.track << ","
+            << "\"ts\":" << ts << ",\"dur\":" << dur;
+        if (s.iteration >= 0) {
+            tf << ",\"args\":{\"iteration\":" << s.iteration << "}";
+        }
+        tf << "}";
+    };
+
+    for (auto const& s : device_slices) {
+        write_slice(s, 1, device_us(s.start), (s.end - s.start) / 1000.0);
+    }
+    for (auto const& s : host_slices) {
+        write_slice(s, 2, host_us(s.start), (s.end - s.start) / 1000.0);
+    }
+
+    // Flow arrows start at the end of the dependency and bind to the
+    // enclosing slices
+    uint64_t flow_id = 0;
+    auto write_flow = [&](cl_event from, int to_pid, uint64_t to_track, double to_ts) {
+        auto it = event_slice.find(from);
+        if (it == event_slice.end()) {
+            // Dependency was not recorded
+            return;
+        }
+        Slice const& src = device_slices[it->second];
+        double from_ts = std::max(device_us(src.start), device_us(src.end) - 0.001);
+
+        tf << ",\n{\"name\":\"wait\",\"cat\":\"dependency\",\"ph\":\"s\","
+            << "\"id\":" << flow_id << ",\"pid\":1,"
+            << "\"tid\":" << src.track << ",\"ts\":" << from_ts << "}";
+        tf << ",\n{\"name\":\"wait\",\"cat\":\"dependency\",\"ph\":\"f\","
+            << "\"bp\":\"e\",\"id\":" << flow_id << ",\"pid\":" << to_pid << ","
+            << "\"tid\":" << to_track << ",\"ts\":" << to_ts << "}";
+        ++flow_id;
+    };
+
+    for (auto const& flow : device_flows) {
+        Slice const& dst = device_slices[flow.to];
+        write_flow(flow.from, 1, dst.track, device_us(dst.start));
+    }
+    for (auto const& flow : host_flows) {
+        Slice const& dst = host_slices[flow.to];
+        write_flow(flow.from, 2, dst.track, host_us(dst.start));
+    }
+
+    tf << "\n],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{";
+    bool first_parameter = true;
+    for (auto const& p : parameters_) {
+        if (not first_parameter) {
+            tf << ",";
+        }
+        first_parameter = false;
+        tf << "\"" << json_escape(p.first) << "\":\""
+            << json_escape(p.second) << "\"";
+    }
+    tf << "}}\n";
+
+    tf.close();
+    tf.clear();
 }
 
 std::string Measurement::Measurement::get_unique_id() {
@@ -387,6 +942,16 @@ Measurement::Measurement::get_flattened_datapoints() {
             subpoints.push_back(cp);
         }
 
+        for (auto const& counter : dp.counters_) {
+            DataPoint cp;
+            if (dp.is_iterative()) {
+                cp = DataPoint(dp.get_iteration());
+            }
+            cp.set_name(dp.get_name() + "#" + counter.first);
+            cp.add_value() = counter.second;
+            subpoints.push_back(cp);
+        }
+
         subpoints.push_back(dp);
     }
 
@@ -413,3 +978,30 @@ Measurement::Measurement::get_datapoints_with_events() {
 
     return event_points;
 }
+
+uint64_t Measurement::Measurement::get_total_time(DataPoint& dp) {
+    uint64_t time = dp.get_value();
+    for (auto& child : dp.children_) {
+        time += get_total_time(child);
+    }
+    return time;
+}
+
+std::deque<Measurement::DataPoint>
+Measurement::Measurement::get_all_datapoints() {
+    std::deque<DataPoint> all_points;
+    std::deque<DataPoint> stack(data_points_);
+
+    while (not stack.empty()) {
+        auto dp = stack.front();
+        stack.pop_front();
+
+        all_points.push_back(dp);
+
+        for (auto& cp : dp.children_) {
+            stack.push_front(cp);
+        }
+    }
+
+    return all_points;
+}
@@ -10,23 +10,84 @@
 #ifndef MEASUREMENT_HPP
 #define MEASUREMENT_HPP
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <deque>
 #include <map>
+#include <memory>
 #include <string>
 #include <regex>
 #include <tuple>
+#include <utility>
 
 #include <boost/compute/event.hpp>
+#include <boost/compute/utility/wait_list.hpp>
 
 namespace Measurement {
 
 class Measurement;
+class DataPoint;
+
+/*
+ * Profiling info of an OpenCL event, resolved by an event callback
+ */
+class EventArena;
+
+struct EventRecord {
+    EventArena *arena;
+    uint64_t queued;
+    uint64_t submit;
+    uint64_t start;
+    uint64_t end;
+    uint64_t queue_id;
+    int32_t status;
+    std::atomic<bool> done;
+};
+
+/*
+ * Preallocated EventRecords for low-overhead measurements
+ *
+ * Events are tracked as soon as the next event is added. Their profiling
+ * info is written to a record on completion, after which the event is
+ * released. Events that don't fit into the arena are retained as usual.
+ */
+class EventArena {
+using Event = boost::compute::event;
+
+public:
+    EventArena(size_t capacity);
+    ~EventArena();
+
+    Event &add_pending(DataPoint *owner);
+    void flush();
+
+    // Waits for completion of the event
+    EventRecord const &record(size_t id);
+
+private:
+    struct Pending {
+        Event event;
+        DataPoint *owner;
+    };
+
+    static void CL_CALLBACK complete(cl_event event, cl_int status, void *user_data);
+
+    int64_t track(Event const& event);
+
+    std::unique_ptr<EventRecord[]> records_;
+    size_t capacity_;
+    size_t next_;
+    std::atomic<size_t> outstanding_;
+    std::deque<Pending> pending_;
+};
 
 class DataPoint {
 friend class Measurement;
+friend class EventArena;
 
 using Event = boost::compute::event;
+using WaitList = boost::compute::wait_list;
 
 public:
     DataPoint &set_name(std::string name) {
@@ -37,6 +98,9 @@ public:
 
     inline Event &add_event() {
         has_event_ = true;
+        if (arena_) {
+            return arena_->add_pending(this);
+        }
         events_.push_back(Event());
         return events_.back();
     }
@@ -48,21 +112,92 @@ public:
 
     DataPoint& create_child() {
         children_.push_back(DataPoint());
+        children_.back().arena_ = arena_;
         return children_.back();
     }
 
+    /*
+     * Record that the events of this DataPoint waited on wait_list.
+     * Shown as flow arrows in the trace. Not recorded for low-overhead
+     * measurements, which don't retain events.
+     */
+    inline void add_dependencies(WaitList const& wait_list) {
+        if (arena_) {
+            return;
+        }
+        for (size_t i = 0; i < wait_list.size(); ++i) {
+            dependencies_.push_back(wait_list[i]);
+        }
+    }
+
+    /*
+     * Record a host-side interval, e.g. a memcpy in an IO thread.
+     * start and end are host_timestamp() values. The interval is shown
+     * on its own track in the trace, after the events in wait_list.
+     */
+    inline void add_host_span(
+            std::string track,
+            uint64_t start,
+            uint64_t end,
+            WaitList const& wait_list
+            )
+    {
+        host_spans_.push_back({
+                track,
+                start,
+                end,
+                (arena_) ? WaitList() : wait_list
+                });
+    }
+
+    /*
+     * Record the analytical work of a kernel launch, i.e. the bytes it
+     * must read and write and its floating point operations. Used for the
+     * roofline, together with the time of this DataPoint and its children.
+     */
+    inline void add_work(
+            uint64_t bytes_read,
+            uint64_t bytes_written,
+            uint64_t flops
+            )
+    {
+        bytes_read_ += bytes_read;
+        bytes_written_ += bytes_written;
+        flops_ += flops;
+    }
+
+    /*
+     * Record a host-side counter, e.g. a hardware counter sampled around
+     * this DataPoint. Exported as the datapoint "<name>#<counter>".
+     */
+    inline void add_counter(std::string counter, uint64_t value) {
+        counters_.push_back(std::make_pair(counter, value));
+    }
+
+    static inline uint64_t host_timestamp() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()
+                ).count();
+    }
+
 private:
     inline DataPoint()
         :
             iterative_(false),
-            has_event_(false)
+            has_event_(false),
+            bytes_read_(0),
+            bytes_written_(0),
+            flops_(0)
     {}
 
     inline DataPoint(int iteration)
         :
             iterative_(true),
             iteration_(iteration),
-            has_event_(false)
+            has_event_(false),
+            bytes_read_(0),
+            bytes_written_(0),
+            flops_(0)
     {}
 
     std::string get_name();
@@ -75,14 +210,30 @@ private:
     uint64_t get_event_start(size_t i);
     uint64_t get_event_end(size_t i);
     uint64_t get_event_queue_id(size_t i);
+    cl_event get_event_handle(size_t i);
+
+    struct HostSpan {
+        std::string track;
+        uint64_t start;
+        uint64_t end;
+        WaitList dependencies;
+    };
 
     std::string name_;
     bool iterative_;
     int iteration_;
     bool has_event_;
+    std::deque<size_t> records_;
     std::deque<Event> events_;
     std::deque<uint64_t> values_;
     std::deque<DataPoint> children_;
+    std::deque<Event> dependencies_;
+    std::deque<HostSpan> host_spans_;
+    std::deque<std::pair<std::string, uint64_t>> counters_;
+    std::shared_ptr<EventArena> arena_;
+    uint64_t bytes_read_;
+    uint64_t bytes_written_;
+    uint64_t flops_;
 };
 
 class Measurement {
@@ -93,21 +244,51 @@ public:
   void set_run(int run);
   void set_parameter(std::string name, std::string value);
 
+  /*
+   * Low-overhead mode with capacity preallocated event records.
+   * Must be set before adding datapoints. Zero retains every event.
+   */
+  void set_event_capacity(size_t capacity);
+
+  /*
+   * Device peak memory bandwidth in GB/s and peak performance in GFLOP/s,
+   * e.g. as measured by transfer_bench --peak. write_csv compares the
+   * work of each kernel against them.
+   */
+  void set_peak(double bandwidth, double performance);
+
   inline DataPoint &add_datapoint() {
     data_points_.push_back(DataPoint());
+    data_points_.back().arena_ = arena_;
     return data_points_.back();
   }
 
   inline DataPoint &add_datapoint(int iteration) {
     data_points_.push_back(DataPoint(iteration));
+    data_points_.back().arena_ = arena_;
     return data_points_.back();
   }
 
   void write_csv(std::string filename);
 
+  /*
+   * Write a Chrome JSON trace, viewable in chrome://tracing or Perfetto.
+   * Contains one track per command queue and one per host track, e.g.
+   * IO thread, and flow arrows for recorded dependencies.
+   */
+  void write_trace(std::string filename);
+
+  /*
+   * Append the run as one block to a binary columnar file, see
+   * columnar_format.hpp. Unlike write_csv, filename is used as is, so that
+   * all runs of a sweep go into the same file.
+   */
+  void write_columnar(std::string filename);
+
   template <typename UnitT = std::chrono::nanoseconds>
   std::vector<std::tuple<std::string, uint64_t>> get_execution_times_by_name(std::regex expression) {
       std::vector<std::tuple<std::string, uint64_t>> times;
+      flush_events();
       auto datapoints = get_datapoints_with_events();
       for (auto& dp : datapoints) {
           if (std::regex_match(dp.get_name(), expression)) {
@@ -135,11 +316,19 @@ private:
   std::string format_filename(std::string basefile, std::string experiment_id, std::string suffix);
   std::deque<DataPoint> get_flattened_datapoints();
   std::deque<DataPoint> get_datapoints_with_events();
+  std::deque<DataPoint> get_all_datapoints();
+  uint64_t get_total_time(DataPoint& dp);
+  void flush_events();
+  void write_roofline(std::string filename);
 
   int run_;
+  std::string experiment_id_;
   std::deque<DataPoint> data_points_;
   std::map<std::string, std::string> parameters_;
+  std::shared_ptr<EventArena> arena_;
   std::chrono::system_clock::time_point run_date_;
+  double peak_bandwidth_;
+  double peak_performance_;
 };
 }
 
@@ -0,0 +1,255 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include "measurement/columnar_format.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <SystemConfig.h>
+
+#include <boost/program_options.hpp>
+
+// Suppress editor errors about MEASUREMENT_READER_NAME not defined
+#ifndef MEASUREMENT_READER_NAME
+#define MEASUREMENT_READER_NAME ""
+#endif
+
+namespace po = boost::program_options;
+
+class CmdOptions {
+public:
+    int parse(int argc, char **argv) {
+        char help_msg[] =
+            "Usage: " MEASUREMENT_READER_NAME " [OPTION] [INPUT FILE]\n"
+            "Prints the summaries of a columnar measurement file\n"
+            "Options"
+            ;
+
+        po::options_description cmdline(help_msg);
+        cmdline.add_options()
+            ("help", "Produce help message")
+            ("merge", "Summarize all runs together instead of per run")
+            ("csv", "Print the measurements as CSV")
+            ("events", "Print the events as CSV")
+            ;
+
+        po::options_description hidden("Hidden options");
+        hidden.add_options()
+            ("input-file", po::value<std::string>(&input_file_),
+             "input file")
+            ;
+
+        po::options_description visible;
+        visible.add(cmdline).add(hidden);
+
+        po::positional_options_description pos;
+        pos.add("input-file", 1);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(visible)
+                .positional(pos).run(),
+                vm);
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            std::cout << cmdline << std::endl;
+            return -1;
+        }
+
+        merge_ = vm.count("merge") > 0;
+        csv_ = vm.count("csv") > 0;
+        events_ = vm.count("events") > 0;
+
+        if (input_file_.empty()) {
+            std::cout << "Give me an input file!" << std::endl;
+            return -1;
+        }
+
+        return 1;
+    }
+
+    bool merge() const {
+        return merge_;
+    }
+
+    bool csv() const {
+        return csv_;
+    }
+
+    bool events() const {
+        return events_;
+    }
+
+    std::string input_file() const {
+        return input_file_;
+    }
+
+private:
+    std::string input_file_;
+    bool merge_;
+    bool csv_;
+    bool events_;
+};
+
+using Block = Measurement::ColumnarBlock;
+
+std::string experiment_id(Block const& block) {
+    for (auto const& p : block.parameters) {
+        if (block.strings[p.first] == "ExperimentID") {
+            return block.strings[p.second];
+        }
+    }
+    return "";
+}
+
+void print_summary_header() {
+    std::cout
+        << "ExperimentID,Run,TypeName,Count,Sum,Min,Median,P99"
+        << '\n';
+}
+
+void print_summaries(
+        std::string const& experiment_id,
+        std::string const& run,
+        std::vector<std::string> const& strings,
+        std::vector<Block::Summary> const& summaries)
+{
+    for (auto const& s : summaries) {
+        std::cout
+            << experiment_id << ','
+            << run << ','
+            << strings[s.type_name] << ','
+            << s.count << ','
+            << s.sum << ','
+            << s.min << ','
+            << s.median << ','
+            << s.p99 << '\n';
+    }
+}
+
+void print_measurements(Block const& block) {
+    std::string id = experiment_id(block);
+    for (size_t i = 0; i < block.measurement_value.size(); ++i) {
+        std::cout
+            << id << ','
+            << block.run << ','
+            << block.strings[block.measurement_type_name[i]] << ',';
+        if (block.measurement_iteration[i] >= 0) {
+            std::cout << block.measurement_iteration[i];
+        }
+        std::cout
+            << ','
+            << block.measurement_value[i] << '\n';
+    }
+}
+
+void print_events(Block const& block) {
+    std::string id = experiment_id(block);
+    for (size_t i = 0; i < block.event_end.size(); ++i) {
+        std::cout
+            << id << ','
+            << block.run << ','
+            << block.strings[block.event_type_name[i]] << ',';
+        if (block.event_iteration[i] >= 0) {
+            std::cout << block.event_iteration[i];
+        }
+        std::cout
+            << ','
+            << block.event_queue_id[i] << ','
+            << block.event_queued[i] << ','
+            << block.event_submit[i] << ','
+            << block.event_start[i] << ','
+            << block.event_end[i] << '\n';
+    }
+}
+
+int main(int argc, char **argv) {
+
+    CmdOptions options;
+    if (options.parse(argc, argv) < 0) {
+        return 1;
+    }
+
+    std::ifstream is(options.input_file(), std::ios::in | std::ios::binary);
+    if (not is) {
+        std::cerr << "Cannot open " << options.input_file() << std::endl;
+        return 1;
+    }
+
+    if (options.csv()) {
+        std::cout << "ExperimentID,Run,TypeName,Iteration,Value" << '\n';
+    }
+    else if (options.events()) {
+        std::cout
+            << "ExperimentID,Run,TypeName,Iteration,CommandQueueID,"
+            << "Queued,Submit,Start,End"
+            << '\n';
+    }
+    else {
+        print_summary_header();
+    }
+
+    // Merged summaries are recomputed from the values of all runs, as
+    // medians and percentiles cannot be combined
+    std::vector<std::string> merged_strings;
+    std::map<std::string, uint32_t> merged_ids;
+    std::vector<uint32_t> merged_type_name;
+    std::vector<uint64_t> merged_value;
+
+    try {
+        Block block;
+        while (block.read(is)) {
+            if (options.csv()) {
+                print_measurements(block);
+            }
+            else if (options.events()) {
+                print_events(block);
+            }
+            else if (options.merge()) {
+                for (size_t i = 0; i < block.measurement_value.size(); ++i) {
+                    std::string const& name =
+                        block.strings[block.measurement_type_name[i]];
+                    auto id = merged_ids.emplace(name, merged_strings.size());
+                    if (id.second) {
+                        merged_strings.push_back(name);
+                    }
+                    merged_type_name.push_back(id.first->second);
+                    merged_value.push_back(block.measurement_value[i]);
+                }
+            }
+            else {
+                print_summaries(
+                        experiment_id(block),
+                        std::to_string(block.run),
+                        block.strings,
+                        block.summaries);
+            }
+        }
+    }
+    catch (std::runtime_error const& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (options.merge() && not options.csv() && not options.events()) {
+        print_summaries(
+                "",
+                "",
+                merged_strings,
+                Block::summarize(merged_type_name, merged_value));
+    }
+
+    return 0;
+}
@@ -0,0 +1,362 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef PIPELINE_FACTORY_HPP
+#define PIPELINE_FACTORY_HPP
+
+#include "abstract_kmeans.hpp"
+#include "binary_format.hpp"
+#include "configuration_parser.hpp"
+#include "kmeans_three_stage.hpp"
+#include "kmeans_three_stage_buffered.hpp"
+#include "kmeans_single_stage.hpp"
+#include "kmeans_single_stage_buffered.hpp"
+#include "matrix.hpp"
+#include "point_format.hpp"
+
+#include "cl_kernels/centroid_update_fixed_point.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/compute/core.hpp>
+
+namespace Clustering {
+
+/*
+ * Command queues of the configured devices
+ *
+ * Stages on the same device share a queue and context.
+ */
+class QueueCache {
+public:
+    boost::compute::command_queue queue(size_t platform, size_t device) {
+        boost::compute::device dev =
+            boost::compute::system::platforms()[platform].devices()[device];
+
+        for (auto& q : queues_) {
+            if (q.get_device().id() == dev.id()) {
+                return q;
+            }
+        }
+
+        boost::compute::context context(dev);
+        boost::compute::command_queue queue(
+                context,
+                dev,
+                boost::compute::command_queue::enable_profiling);
+        queues_.push_back(queue);
+
+        return queue;
+    }
+
+private:
+    std::vector<boost::compute::command_queue> queues_;
+};
+
+/*
+ * Configurations of all stages of a pipeline
+ */
+struct PipelineConfiguration {
+    BenchmarkConfiguration benchmark;
+    KmeansConfiguration kmeans;
+    LabelingConfiguration labeling;
+    MassUpdateConfiguration mass_update;
+    CentroidUpdateConfiguration centroid_update;
+    FusedConfiguration fused;
+};
+
+/*
+ * Builds the pipeline of a configuration, as used by bench and autotune
+ */
+template <typename PointT, typename LabelT, typename MassT, bool ColMajor>
+class PipelineFactory {
+public:
+    using Kmeans = AbstractKmeans<PointT, LabelT, MassT, ColMajor>;
+    using Points = cle::Matrix<PointT, std::allocator<PointT>, size_t, true>;
+
+    /*
+     * Parse the stage configurations and derive their data dependent
+     * parameters from the points of input_file
+     */
+    static PipelineConfiguration configure(
+            ConfigurationParser& parser,
+            std::string const& input_file,
+            Points const& points)
+    {
+        PipelineConfiguration config;
+        config.benchmark = parser.get_benchmark_configuration();
+        config.kmeans = parser.get_kmeans_configuration();
+        config.labeling = parser.get_labeling_configuration();
+        config.mass_update = parser.get_mass_update_configuration();
+        config.centroid_update = parser.get_centroid_update_configuration();
+        config.fused = parser.get_fused_configuration();
+
+        // Int8 points keep the quantization of the input file if it has
+        // one, otherwise quantize to the range of each feature
+        config.fused.point_format = config.kmeans.point_type;
+        if (
+                PointFormatHelper::parse(config.kmeans.point_type)
+                == PointFormat::Int8
+           )
+        {
+            BinaryFormat binformat;
+            if (
+                    binformat.read_quantization(
+                        input_file.c_str(),
+                        config.fused.point_quantization) != 1
+               )
+            {
+                config.fused.point_quantization =
+                    PointFormatHelper::quantization(
+                            points.data(),
+                            points.rows(),
+                            points.cols());
+            }
+        }
+
+        // The fixed_point centroid update steps are chosen such that the
+        // sum over all points cannot overflow
+        if (
+                config.centroid_update.strategy == "fixed_point"
+                or not config.centroid_update.tuning.empty()
+           )
+        {
+            config.centroid_update.fixed_point_exponent =
+                CentroidUpdateFixedPoint<
+                    PointT,
+                    LabelT,
+                    MassT,
+                    ColMajor>::fixed_point_exponent(
+                            points.data(),
+                            points.rows() * points.cols(),
+                            points.rows());
+        }
+
+        return config;
+    }
+
+    static std::unique_ptr<Kmeans> create(
+            PipelineConfiguration const& config,
+            QueueCache& queues)
+    {
+        std::string const& pipeline = config.kmeans.pipeline;
+
+        check_fixed_point(config);
+
+        if (pipeline == "three_stage" or pipeline == "three_stage_buffered") {
+            // The centroid update stage reads points in PointT
+            if (
+                    PointFormatHelper::parse(config.kmeans.point_type)
+                    != PointFormat::Native
+               )
+            {
+                throw std::invalid_argument(
+                        "Point type " + config.kmeans.point_type
+                        + " requires a single stage pipeline");
+            }
+
+            if (pipeline == "three_stage") {
+                auto p = new KmeansThreeStage<
+                    PointT, LabelT, MassT, ColMajor>;
+                std::unique_ptr<Kmeans> kmeans(p);
+                set_up_three_stage(*p, config, queues);
+                return kmeans;
+            }
+            else {
+                auto p = new KmeansThreeStageBuffered<
+                    PointT, LabelT, MassT, ColMajor>;
+                std::unique_ptr<Kmeans> kmeans(p);
+                set_up_three_stage(*p, config, queues);
+                return kmeans;
+            }
+        }
+        else if (pipeline == "single_stage") {
+            auto p = new KmeansSingleStage<PointT, LabelT, MassT, ColMajor>;
+            std::unique_ptr<Kmeans> kmeans(p);
+            set_up_single_stage(*p, config, queues);
+            return kmeans;
+        }
+        else if (pipeline == "single_stage_buffered") {
+            auto p = new KmeansSingleStageBuffered<
+                PointT, LabelT, MassT, ColMajor>;
+            std::unique_ptr<Kmeans> kmeans(p);
+            set_up_single_stage(*p, config, queues);
+            p->set_labels_final_only(config.kmeans.labels_final_only);
+            return kmeans;
+        }
+        else {
+            throw std::invalid_argument(
+                    "Unknown pipeline " + pipeline);
+        }
+    }
+
+private:
+    /*
+     * fixed_point makes only the centroid update of the three stage
+     * pipelines deterministic. Reject pipelines and options that would sum
+     * floats in a run dependent order.
+     */
+    static void check_fixed_point(PipelineConfiguration const& config) {
+        bool fixed_point =
+            config.centroid_update.strategy == "fixed_point";
+        for (auto const& rule : config.centroid_update.tuning.rules()) {
+            fixed_point = fixed_point or rule.strategy == "fixed_point";
+        }
+
+        if (not fixed_point) {
+            return;
+        }
+
+        std::string const& pipeline = config.kmeans.pipeline;
+        if (pipeline != "three_stage" and pipeline != "three_stage_buffered") {
+            throw std::invalid_argument(
+                    "fixed_point requires a three stage pipeline");
+        }
+
+        if (config.labeling.cluster_sse) {
+            throw std::invalid_argument(
+                    "cluster_sse is not deterministic with fixed_point");
+        }
+    }
+
+    template <typename Pipeline>
+    static void set_up_three_stage(
+            Pipeline& p,
+            PipelineConfiguration const& config,
+            QueueCache& queues)
+    {
+        boost::compute::command_queue ll_queue = queues.queue(
+                config.labeling.platform,
+                config.labeling.device);
+        boost::compute::command_queue mu_queue = queues.queue(
+                config.mass_update.platform,
+                config.mass_update.device);
+        boost::compute::command_queue cu_queue = queues.queue(
+                config.centroid_update.platform,
+                config.centroid_update.device);
+
+        p.set_labeling_queue(ll_queue);
+        p.set_mass_update_queue(mu_queue);
+        p.set_centroid_update_queue(cu_queue);
+        p.set_labeling_context(ll_queue.get_context());
+        p.set_mass_update_context(mu_queue.get_context());
+        p.set_centroid_update_context(cu_queue.get_context());
+        p.set_labeler(config.labeling);
+        p.set_mass_updater(config.mass_update);
+        p.set_centroid_updater(config.centroid_update);
+        p.set_event_capacity(config.benchmark.event_capacity);
+        p.set_hardware_counters(config.benchmark.hardware_counters);
+    }
+
+    template <typename Pipeline>
+    static void set_up_single_stage(
+            Pipeline& p,
+            PipelineConfiguration const& config,
+            QueueCache& queues)
+    {
+        boost::compute::command_queue queue = queues.queue(
+                config.fused.platform,
+                config.fused.device);
+
+        p.set_queue(queue);
+        p.set_context(queue.get_context());
+        p.set_fused(config.fused);
+        p.set_event_capacity(config.benchmark.event_capacity);
+        p.set_hardware_counters(config.benchmark.hardware_counters);
+    }
+};
+
+namespace PipelineTypes {
+
+template <
+    template <typename, typename, typename, bool> class Runner,
+    typename PointT,
+    typename LabelT,
+    typename MassT,
+    typename... Args>
+int run(KmeansConfiguration const& km_config, Args&&... args) {
+    if (
+            km_config.clusters
+            > (uint64_t) std::numeric_limits<LabelT>::max() + 1
+       )
+    {
+        throw std::invalid_argument(
+                "Label type " + km_config.label_type
+                + " cannot hold "
+                + std::to_string(km_config.clusters)
+                + " clusters");
+    }
+
+    Runner<PointT, LabelT, MassT, true> runner;
+    return runner.run(std::forward<Args>(args)...);
+}
+
+}
+
+/*
+ * Calls Runner<PointT, LabelT, MassT, true>().run(args...) with the types
+ * of the k-means configuration
+ *
+ * Half, bfloat16 and int8 points are stored in float on the host.
+ */
+template <
+    template <typename, typename, typename, bool> class Runner,
+    typename... Args>
+int dispatch_pipeline_types(
+        KmeansConfiguration const& km_config,
+        Args&&... args)
+{
+    bool const single =
+        km_config.point_type == "float"
+        || km_config.point_type == "half"
+        || km_config.point_type == "bfloat16"
+        || km_config.point_type == "int8";
+    bool const dual = km_config.point_type == "double";
+
+    if (dual && km_config.mass_type == "uint64") {
+        if (km_config.label_type == "uint64") {
+            return PipelineTypes::run<Runner, double, uint64_t, uint64_t>(
+                    km_config, std::forward<Args>(args)...);
+        }
+        else if (km_config.label_type == "uint16") {
+            return PipelineTypes::run<Runner, double, uint16_t, uint64_t>(
+                    km_config, std::forward<Args>(args)...);
+        }
+        else if (km_config.label_type == "uint8") {
+            return PipelineTypes::run<Runner, double, uint8_t, uint64_t>(
+                    km_config, std::forward<Args>(args)...);
+        }
+    }
+    else if (single && km_config.mass_type == "uint32") {
+        if (km_config.label_type == "uint32") {
+            return PipelineTypes::run<Runner, float, uint32_t, uint32_t>(
+                    km_config, std::forward<Args>(args)...);
+        }
+        else if (km_config.label_type == "uint16") {
+            return PipelineTypes::run<Runner, float, uint16_t, uint32_t>(
+                    km_config, std::forward<Args>(args)...);
+        }
+        else if (km_config.label_type == "uint8") {
+            return PipelineTypes::run<Runner, float, uint8_t, uint32_t>(
+                    km_config, std::forward<Args>(args)...);
+        }
+    }
+
+    throw std::invalid_argument("Invalid type");
+}
+
+}
+
+#endif /* PIPELINE_FACTORY_HPP */
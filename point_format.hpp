@@ -0,0 +1,283 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef POINT_FORMAT_HPP
+#define POINT_FORMAT_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace Clustering {
+
+/*
+ * Storage format of points in device memory
+ *
+ * Compressed formats are converted to PointT in-register by the fused
+ * kernels. Centroids and accumulators stay in PointT.
+ */
+enum class PointFormat {
+    Native,
+    Half,
+    BFloat16,
+    Int8
+};
+
+/*
+ * Per-feature affine quantization of Int8 points
+ *
+ * value = min[f] + scale[f] * q, with q in [0, 255]
+ */
+struct PointQuantization {
+    std::vector<float> min;
+    std::vector<float> scale;
+};
+
+class PointFormatHelper {
+public:
+
+    /*
+     * Parse the point type as given in the configuration
+     *
+     * Anything else than "half", "bfloat16" or "int8" is stored natively.
+     */
+    static PointFormat parse(std::string const& type) {
+        if (type == "half") {
+            return PointFormat::Half;
+        }
+        else if (type == "bfloat16") {
+            return PointFormat::BFloat16;
+        }
+        else if (type == "int8") {
+            return PointFormat::Int8;
+        }
+        else {
+            return PointFormat::Native;
+        }
+    }
+
+    template <typename PointT>
+    static std::string defines(PointFormat format) {
+        if (format != PointFormat::Native
+                && not std::is_same<float, PointT>::value) {
+            throw std::invalid_argument(
+                    "Compressed point formats require float points");
+        }
+
+        switch (format) {
+            case PointFormat::Half:
+                return " -DCL_POINT_STORE=half -DPOINT_HALF";
+            case PointFormat::BFloat16:
+                return " -DCL_POINT_STORE=ushort -DPOINT_BFLOAT16";
+            case PointFormat::Int8:
+                return " -DCL_POINT_STORE=uchar -DPOINT_INT8";
+            default:
+                return "";
+        }
+    }
+
+    /*
+     * Bytes per stored value
+     */
+    template <typename PointT>
+    static size_t value_size(PointFormat format) {
+        switch (format) {
+            case PointFormat::Native:
+                return sizeof(PointT);
+            case PointFormat::Int8:
+                return sizeof(uint8_t);
+            default:
+                return sizeof(uint16_t);
+        }
+    }
+
+    /*
+     * Length of a PointT vector that holds num_values stored values
+     */
+    template <typename PointT>
+    static size_t storage_length(PointFormat format, size_t num_values) {
+        return
+            (num_values * value_size<PointT>(format) + sizeof(PointT) - 1)
+            / sizeof(PointT);
+    }
+
+    /*
+     * Number of points per buffer when each buffer holds the points and
+     * labels of the same range
+     *
+     * Neither the points nor the labels of a buffer may exceed
+     * buffer_size, which matters for narrow points and wide labels, e.g.
+     * one int8 feature with 32-bit labels.
+     */
+    template <typename PointT, typename LabelT>
+    static size_t points_per_buffer(
+            PointFormat format,
+            size_t num_features,
+            size_t buffer_size) {
+        return buffer_size
+            / std::max(
+                    num_features * value_size<PointT>(format),
+                    sizeof(LabelT));
+    }
+
+    /*
+     * Per-feature quantization range of a column-major point matrix
+     *
+     * Constant features get a scale of one to avoid division by zero.
+     */
+    template <typename PointT>
+    static PointQuantization quantization(
+            PointT const *src,
+            size_t num_points,
+            size_t num_features)
+    {
+        PointQuantization quant;
+        quant.min.resize(num_features);
+        quant.scale.resize(num_features);
+
+        for (size_t f = 0; f < num_features; ++f) {
+            auto minmax = std::minmax_element(
+                    src + f * num_points,
+                    src + (f + 1) * num_points);
+            float min = (num_points == 0) ? 0.0f : (float) *minmax.first;
+            float max = (num_points == 0) ? 0.0f : (float) *minmax.second;
+
+            quant.min[f] = min;
+            quant.scale[f] = (max > min) ? (max - min) / 255.0f : 1.0f;
+        }
+
+        return quant;
+    }
+
+    static uint8_t quantize(float value, float min, float scale) {
+        float q = std::nearbyint((value - min) / scale);
+        return (uint8_t) std::min(std::max(q, 0.0f), 255.0f);
+    }
+
+    /*
+     * Convert a column-major point matrix to the storage format
+     *
+     * dst must hold at least num_points * num_features * value_size()
+     * bytes. quant is only used by Int8.
+     */
+    template <typename PointT>
+    static void pack(
+            PointFormat format,
+            PointT const *src,
+            size_t num_points,
+            size_t num_features,
+            PointQuantization const& quant,
+            void *dst)
+    {
+        size_t const num_values = num_points * num_features;
+
+        if (format == PointFormat::Native) {
+            std::memcpy(dst, src, num_values * sizeof(PointT));
+        }
+        else if (format == PointFormat::Int8) {
+            assert(quant.min.size() == num_features);
+            assert(quant.scale.size() == num_features);
+
+            uint8_t *packed = (uint8_t*) dst;
+            for (size_t f = 0; f < num_features; ++f) {
+                for (size_t p = 0; p < num_points; ++p) {
+                    size_t i = f * num_points + p;
+                    packed[i] = quantize(
+                            (float) src[i],
+                            quant.min[f],
+                            quant.scale[f]);
+                }
+            }
+        }
+        else {
+            uint16_t *packed = (uint16_t*) dst;
+            for (size_t i = 0; i < num_values; ++i) {
+                packed[i] = (format == PointFormat::Half)
+                    ? float_to_half((float) src[i])
+                    : float_to_bfloat16((float) src[i])
+                    ;
+            }
+        }
+    }
+
+    // IEEE 754 binary16 with round to nearest even
+    static uint16_t float_to_half(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        uint32_t sign = (bits >> 16) & 0x8000u;
+        uint32_t exponent = (bits >> 23) & 0xffu;
+        uint32_t mantissa = bits & 0x7fffffu;
+
+        // Inf and NaN
+        if (exponent == 0xffu) {
+            return sign | 0x7c00u | (mantissa ? 0x200u : 0u);
+        }
+
+        int32_t half_exponent = (int32_t) exponent - 127 + 15;
+
+        // Overflow to Inf
+        if (half_exponent >= 0x1f) {
+            return sign | 0x7c00u;
+        }
+
+        // Subnormal or zero
+        if (half_exponent <= 0) {
+            if (half_exponent < -10) {
+                return sign;
+            }
+
+            mantissa |= 0x800000u;
+            uint32_t shift = 14 - half_exponent;
+            uint32_t half_mantissa = mantissa >> shift;
+            uint32_t rest = mantissa & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+            if (rest > halfway
+                    || (rest == halfway && (half_mantissa & 1u))) {
+                ++half_mantissa;
+            }
+            return sign | half_mantissa;
+        }
+
+        uint32_t half = sign
+            | ((uint32_t) half_exponent << 10)
+            | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1fffu;
+        // Carry into the exponent yields the correct rounded value
+        if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) {
+            ++half;
+        }
+        return half;
+    }
+
+    // Upper half of IEEE 754 binary32 with round to nearest even
+    static uint16_t float_to_bfloat16(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        // Keep NaN quiet instead of rounding it to Inf
+        if ((bits & 0x7fffffffu) > 0x7f800000u) {
+            return (bits >> 16) | 0x40u;
+        }
+
+        bits += 0x7fffu + ((bits >> 16) & 1u);
+        return bits >> 16;
+    }
+};
+
+}
+
+#endif /* POINT_FORMAT_HPP */
@@ -7,13 +7,14 @@
  * Copyright (c) 2017-2018, Lutz, Clemens <lutzcle@cml.li>
  */
 
-#include "timer.hpp"
 #include "simple_buffer_cache.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <string>
 
 #define VERBOSE false
 #define CPU_ZERO_COPY true
@@ -67,8 +68,8 @@ int SimpleBufferCache::add_device(Context context, Device device, size_t pool_si
     info.slot_lock.resize(num_cache_slots, {});
     info.cached_object_id.resize(num_cache_slots, -1);
     info.cached_buffer_id.resize(num_cache_slots, 0);
-    info.cached_ptr.resize(num_cache_slots, nullptr);
     info.cached_content_length.resize(num_cache_slots, 0);
+    info.dirty_blocks.resize(num_cache_slots, DirtyBitmap(DirtyBlocks, false));
     info.device_buffer.resize(num_cache_slots);
     info.host_buffer.resize(num_cache_slots);
     info.host_ptr.resize(num_cache_slots, nullptr);
@@ -101,9 +102,13 @@ int SimpleBufferCache::add_device(Context context, Device device, size_t pool_si
     return 1;
 }
 
-// TODO: Objects in ObjectMode::Transient don't need an underlying host object
 uint32_t SimpleBufferCache::add_object(void *data_object, size_t size, ObjectMode mode)
 {
+    if (data_object == nullptr and mode != ObjectMode::Transient) {
+        std::cerr << "add_object: only transient objects may omit host data" << std::endl;
+        return 0;
+    }
+
     uint32_t oid = object_info_i.size();
     object_info_i.emplace_back();
     ObjectInfo& obj = object_info_i[oid];
@@ -128,14 +133,23 @@ void SimpleBufferCache::object(uint32_t oid, void *& data_object, size_t& length
 }
 
 int SimpleBufferCache::get(Queue queue, uint32_t oid, void *begin, void *end, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
+{
+    size_t begin_offset = 0, end_offset = 0;
+    if (find_offset(oid, begin, begin_offset) < 0 or find_offset(oid, end, end_offset) < 0) {
+        std::cerr << "get: bad range" << std::endl;
+        return -1;
+    }
+
+    return get(queue, oid, begin_offset, end_offset, buffers, event, wait_list, datapoint);
+}
+
+int SimpleBufferCache::get(Queue queue, uint32_t oid, size_t begin, size_t end, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
 {
     int ret = 0;
 
     datapoint.set_name("BufferCache::get");
 
-    char *cbegin = (char*) begin, *cend = (char*) end;
-    size_t size = cend - cbegin;
-
+    size_t size = end - begin;
 
     if (size > buffer_size_i) {
         std::cerr << "get: ranges > buffer_size not supported" << std::endl;
@@ -150,7 +164,7 @@ int SimpleBufferCache::get(Queue queue, uint32_t oid, void *begin, void *end, Bu
     size_t buffer_id = 0;
     ret = find_buffer_id(device_id, oid, begin, buffer_id);
     if (ret < 0) {
-        std::cerr << "get: bad begin ptr" << std::endl;
+        std::cerr << "get: bad begin offset" << std::endl;
         return buffer_id;
     }
 
@@ -183,32 +197,90 @@ int SimpleBufferCache::get(Queue queue, uint32_t oid, void *begin, void *end, Bu
 
 int SimpleBufferCache::write_and_get(Queue queue, uint32_t oid, void *begin, void *end, BufferList& buffers, Event& finish_event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
 {
-    int ret = 0;
+    size_t begin_offset = 0, end_offset = 0;
+    if (find_offset(oid, begin, begin_offset) < 0 or find_offset(oid, end, end_offset) < 0) {
+        std::cerr << "write_and_get: bad range" << std::endl;
+        return -1;
+    }
+
+    return write_and_get(queue, oid, begin_offset, end_offset, buffers, finish_event, wait_list, datapoint);
+}
 
+int SimpleBufferCache::write_and_get(Queue queue, uint32_t oid, size_t begin, size_t end, BufferList& buffers, Event& finish_event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
+{
     datapoint.set_name("BufferCache::write_and_get");
 
-    char *cbegin = (char*) begin, *cend = (char*) end;
-    size_t size = cend - cbegin;
+    return assign_and_get(queue, oid, begin, end, true, buffers, finish_event, wait_list, datapoint);
+}
+
+int SimpleBufferCache::overwrite_and_get(Queue queue, uint32_t oid, void *begin, void *end, BufferList& buffers, Event& finish_event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
+{
+    size_t begin_offset = 0, end_offset = 0;
+    if (find_offset(oid, begin, begin_offset) < 0 or find_offset(oid, end, end_offset) < 0) {
+        std::cerr << "overwrite_and_get: bad range" << std::endl;
+        return -1;
+    }
+
+    return overwrite_and_get(queue, oid, begin_offset, end_offset, buffers, finish_event, wait_list, datapoint);
+}
+
+int SimpleBufferCache::overwrite_and_get(Queue queue, uint32_t oid, size_t begin, size_t end, BufferList& buffers, Event& finish_event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
+{
+    datapoint.set_name("BufferCache::overwrite_and_get");
+
+    auto device_id = find_device_id(queue.get_device());
+    if (device_id < 0) {
+        std::cerr << "overwrite_and_get: bad device" << std::endl;
+        return -1;
+    }
+    size_t buffer_id = 0;
+    if (find_buffer_id(device_id, oid, begin, buffer_id) < 0) {
+        std::cerr << "overwrite_and_get: bad begin offset" << std::endl;
+        return -1;
+    }
+
+    auto cache_slot = find_cache_slot(device_id, oid, buffer_id);
+    if (cache_slot == -2) {
+        // Case: not yet in cache
+        return assign_and_get(queue, oid, begin, end, false, buffers, finish_event, wait_list, datapoint);
+    }
+    else if (cache_slot < 0) {
+        // Case: other error
+        std::cerr << "overwrite_and_get: find_cache_slot error" << std::endl;
+        return cache_slot;
+    }
+
+    // Case: in cache
+    return get(queue, oid, begin, end, buffers, finish_event, wait_list, datapoint.create_child());
+}
+
+// Assign a cache slot and lock it. Writes the range from host to device if
+// write is set.
+int SimpleBufferCache::assign_and_get(Queue queue, uint32_t oid, size_t begin, size_t end, bool write, BufferList& buffers, Event& finish_event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
+{
+    int ret = 0;
+
+    size_t size = end - begin;
 
     if (size > buffer_size_i) {
-        std::cerr << "write_and_get: ranges > buffer_size not supported" << std::endl;
+        std::cerr << "assign_and_get: ranges > buffer_size not supported" << std::endl;
         return -1;
     }
 
     auto device_id = find_device_id(queue.get_device());
     if (device_id < 0) {
-        std::cerr << "write_and_get: bad device" << std::endl;
+        std::cerr << "assign_and_get: bad device" << std::endl;
         return -1;
     }
     size_t buffer_id = 0;
     ret = find_buffer_id(device_id, oid, begin, buffer_id);
     if (ret < 0) {
-        std::cerr << "write_and_get: bad begin ptr" << std::endl;
+        std::cerr << "assign_and_get: bad begin offset" << std::endl;
         return -1;
     }
     auto cache_slot = assign_cache_slot(device_id, oid, buffer_id);
     if (cache_slot < 0) {
-        std::cerr << "write_and_get: no free cache slot" << std::endl;
+        std::cerr << "assign_and_get: no free cache slot" << std::endl;
         return -1;
     }
     auto& device_info = device_info_i[device_id];
@@ -217,13 +289,13 @@ int SimpleBufferCache::write_and_get(Queue queue, uint32_t oid, void *begin, voi
 
     auto locked = try_write_lock(device_id, cache_slot);
     if (locked != 1) {
-        std::cerr << "write_and_get: cannot lock cache slot " << cache_slot << std::endl;
+        std::cerr << "assign_and_get: cannot lock cache slot " << cache_slot << std::endl;
         return -1;
     }
 
     Event evict_event;
     if (evict_cache_slot(queue, device_id, cache_slot, evict_event, wait_list, datapoint.create_child()) < 0) {
-        std::cerr << "write_and_get: cannot evict cache slot " << cache_slot << std::endl;
+        std::cerr << "assign_and_get: cannot evict cache slot " << cache_slot << std::endl;
         return -1;
     }
 
@@ -231,29 +303,48 @@ int SimpleBufferCache::write_and_get(Queue queue, uint32_t oid, void *begin, voi
 
     device_info.cached_object_id[cache_slot] = oid;
     device_info.cached_buffer_id[cache_slot] = buffer_id;
-    device_info.cached_ptr[cache_slot] = begin;
     device_info.cached_content_length[cache_slot] = size;
+    device_info.dirty_blocks[cache_slot].assign(DirtyBlocks, false);
+
+    auto& mode = object_info_i[oid].mode;
+    bool const zero_copy =
+        CPU_ZERO_COPY and device_info.device.type() == Device::cpu;
+    if (mode == ObjectMode::Transient) {
+        // Don't need to actually write anything, locking is enough. Zero
+        // copy buffers are replaced by device buffers, because transient
+        // objects may have no host data
+        if (zero_copy and (
+                    device_buffer.get() == nullptr
+                    or (device_buffer.get_memory_flags() & Buffer::use_host_ptr)
+                    ))
+        {
+            device_buffer = Buffer(device_info.context, buffer_size_i);
+        }
+
+        buffers.push_back({device_buffer, size, buffer_id});
+        finish_event = evict_event;
+        return 1;
+    }
 
-    if (CPU_ZERO_COPY and device_info.device.type() == Device::cpu) {
+    // Other objects have host data
+    char *host_begin = (char*) object_info_i[oid].ptr + begin;
+    if (zero_copy) {
         device_buffer = Buffer(
                 device_info.context,
                 size,
                 Buffer::use_host_ptr | Buffer::read_write,
-                begin
+                host_begin
                 );
 
         buffers.push_back({device_buffer, size, buffer_id});
     }
+    else if (not write) {
+        buffers.push_back({device_buffer, size, buffer_id});
+        finish_event = evict_event;
+    }
     else {
         buffers.push_back({device_buffer, size, buffer_id});
 
-        auto& mode = object_info_i[oid].mode;
-        if (mode == ObjectMode::Transient) {
-            // Don't need to actually write anything, locking is enough
-            finish_event = evict_event;
-            return 1;
-        }
-
         WaitList task_wait_list(wait_list);
         Event const empty_event;
         if (evict_event != empty_event) {
@@ -263,7 +354,7 @@ int SimpleBufferCache::write_and_get(Queue queue, uint32_t oid, void *begin, voi
         auto& iot = this->get_io_thread(queue);
         AsyncTask *async_task = new AsyncTask{
             &iot,
-                begin,
+                host_begin,
                 host_ptr,
                 size,
                 task_wait_list,
@@ -282,6 +373,7 @@ int SimpleBufferCache::write_and_get(Queue queue, uint32_t oid, void *begin, voi
                 write_wait_list
                 );
         datapoint.add_event() = finish_event;
+        datapoint.add_dependencies(wait_list);
     }
 
     return 1;
@@ -306,8 +398,11 @@ int SimpleBufferCache::read(Queue queue, uint32_t oid, void *begin, void *end, E
         std::cerr << "read: find_device_id error" << std::endl;
         return device_id;
     }
-    size_t buffer_id = 0;
-    ret = find_buffer_id(device_id, oid, begin, buffer_id);
+    size_t offset = 0, buffer_id = 0;
+    ret = find_offset(oid, begin, offset);
+    if (ret >= 0) {
+        ret = find_buffer_id(device_id, oid, offset, buffer_id);
+    }
     if (ret < 0) {
         std::cerr << "read: find_buffer_id error" << std::endl;
         return buffer_id;
@@ -330,8 +425,6 @@ int SimpleBufferCache::read(Queue queue, uint32_t oid, void *begin, void *end, E
     // else Case: in device cache, must read back
 
     auto& device_info = device_info_i[device_id];
-    void *host_ptr = device_info.host_ptr[cache_slot];
-    auto& device_buffer = device_info.device_buffer[cache_slot];
 
     if (VERBOSE) {
         std::cerr << "read: OID " << oid << " BID " << buffer_id << " destination " << begin << " length " << size << " DID " << device_id << std::endl;
@@ -342,24 +435,42 @@ int SimpleBufferCache::read(Queue queue, uint32_t oid, void *begin, void *end, E
         return -1;
     }
 
+    ret = read_back(queue, device_id, cache_slot, 0, size, begin, finish_event, wait_list, datapoint);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // Host object is up-to-date with the device buffer
+    device_info.dirty_blocks[cache_slot].assign(DirtyBlocks, false);
+
+    return 1;
+}
+
+int SimpleBufferCache::read_back(Queue queue, uint32_t device_id, uint32_t cache_slot, size_t offset, size_t size, void *dst, Event& finish_event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
+{
+    auto& device_info = device_info_i[device_id];
+    char *host_ptr = (char*) device_info.host_ptr[cache_slot];
+    auto& device_buffer = device_info.device_buffer[cache_slot];
+
     if (not (CPU_ZERO_COPY and device_info.device.type() == Device::cpu)) {
         Event read_event;
         read_event = queue.enqueue_read_buffer_async(
                 device_buffer,
-                0,
+                offset,
                 size,
-                host_ptr,
+                host_ptr + offset,
                 wait_list
                 );
         datapoint.add_event() = read_event;
+        datapoint.add_dependencies(wait_list);
 
         WaitList task_wait_list(read_event);
         boost::compute::user_event task_uevent(queue.get_context());
         auto& iot = this->get_io_thread(queue);
         AsyncTask *async_task = new AsyncTask{
             &iot,
-                host_ptr,
-                begin,
+                host_ptr + offset,
+                dst,
                 size,
                 task_wait_list,
                 task_uevent,
@@ -384,45 +495,80 @@ int SimpleBufferCache::evict_cache_slot(Queue queue, uint32_t device_id, uint32_
     DeviceInfo& devinfo = device_info_i[device_id];
     int64_t& object_id = devinfo.cached_object_id[cache_slot];
     size_t& buffer_id = devinfo.cached_buffer_id[cache_slot];
-    void*& cached_ptr = devinfo.cached_ptr[cache_slot];
     size_t& content_length = devinfo.cached_content_length[cache_slot];
-    ObjectMode mode = object_info_i[object_id].mode;
+    DirtyBitmap& dirty_blocks = devinfo.dirty_blocks[cache_slot];
 
-    if (object_id == -1 and buffer_id == 0 and cached_ptr == nullptr) {
+    if (object_id == -1) {
         // Case: cache slot is empty
         return 1;
     }
-    else if (mode == ObjectMode::ReadOnly or mode == ObjectMode::Transient) {
+
+    ObjectMode mode = object_info_i[object_id].mode;
+    if (mode == ObjectMode::ReadOnly or mode == ObjectMode::Transient) {
         // Case: object is immutable, can trivially be evicted
         object_id = -1;
         buffer_id = 0;
-        cached_ptr = nullptr;
         content_length = 0;
 
         return 1;
     }
 
     if (not (CPU_ZERO_COPY and devinfo.device.type() == Device::cpu)) {
-        // Case: object is mutable and presumed dirty, must write back to evict
-        int ret = read(
-                queue,
-                object_id,
-                cached_ptr,
-                ((char*)cached_ptr) + content_length,
-                event,
-                wait_list,
-                datapoint.create_child()
-                );
-        if (ret < 0) {
-            std::cerr << "evict_cache_slot: write-back error" << std::endl;
-            return -1;
+        // Case: object is mutable, must write back dirty blocks to evict
+        char *cached_ptr = (char*) object_info_i[object_id].ptr + buffer_id;
+        size_t const block_size = (buffer_size_i + DirtyBlocks - 1) / DirtyBlocks;
+        WaitList write_back_events;
+        uint32_t block = 0;
+        while (block < DirtyBlocks) {
+            if (not dirty_blocks[block]) {
+                ++block;
+                continue;
+            }
+
+            uint32_t end_block = block;
+            while (end_block < DirtyBlocks and dirty_blocks[end_block]) {
+                ++end_block;
+            }
+
+            size_t offset = block * block_size;
+            size_t end_offset = std::min(end_block * block_size, content_length);
+            block = end_block;
+            if (offset >= end_offset) {
+                continue;
+            }
+
+            Event read_event;
+            int ret = read_back(
+                    queue,
+                    device_id,
+                    cache_slot,
+                    offset,
+                    end_offset - offset,
+                    cached_ptr + offset,
+                    read_event,
+                    wait_list,
+                    datapoint.create_child()
+                    .set_name("BufferCache::write_back")
+                    );
+            if (ret < 0) {
+                std::cerr << "evict_cache_slot: write-back error" << std::endl;
+                return -1;
+            }
+            write_back_events.insert(read_event);
+        }
+
+        if (write_back_events.size() == 1) {
+            event = write_back_events[0];
+        }
+        else if (write_back_events.size() > 1) {
+            event = queue.enqueue_barrier(write_back_events);
         }
     }
 
     object_id = -1;
     buffer_id = 0;
-    cached_ptr = nullptr;
     content_length = 0;
+    dirty_blocks.assign(DirtyBlocks, false);
 
     return 1;
 }
@@ -480,7 +626,18 @@ int SimpleBufferCache::try_write_lock(uint32_t device_id, uint32_t cache_slot)
     }
 }
 
-int SimpleBufferCache::unlock(Queue queue, uint32_t oid, BufferList const& buffers, Event&, WaitList const&, Measurement::DataPoint& datapoint)
+int SimpleBufferCache::unlock(Queue queue, uint32_t oid, BufferList const& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
+{
+    return unlock(queue, oid, buffers, true, event, wait_list, datapoint);
+}
+
+int SimpleBufferCache::unlock(Queue queue, uint32_t oid, BufferList const& buffers, bool modified, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint)
+{
+    std::vector<DirtyBitmap> dirty(buffers.size(), DirtyBitmap(1, modified));
+    return unlock(queue, oid, buffers, dirty, event, wait_list, datapoint);
+}
+
+int SimpleBufferCache::unlock(Queue queue, uint32_t oid, BufferList const& buffers, std::vector<DirtyBitmap> const& dirty, Event&, WaitList const&, Measurement::DataPoint& datapoint)
 {
     datapoint.set_name("BufferCache::unlock");
 
@@ -498,6 +655,10 @@ int SimpleBufferCache::unlock(Queue queue, uint32_t oid, BufferList const& buffe
         std::cerr << "unlock: multiple buffers not supported" << std::endl;
         return -1;
     }
+    if (dirty.size() != buffers.size()) {
+        std::cerr << "unlock: need one dirty bitmap per buffer" << std::endl;
+        return -1;
+    }
     if (buffers.front().content_length == 0) {
         std::cerr << "unlock: Warning: content length is 0."
             << " Invalid buffer?"
@@ -537,6 +698,22 @@ int SimpleBufferCache::unlock(Queue queue, uint32_t oid, BufferList const& buffe
         return -1;
     }
 
+    // Merge the reported ranges into the dirty blocks of the slot
+    DirtyBitmap const& bitmap = dirty.front();
+    size_t const content_length = buffers.front().content_length;
+    size_t const block_size = (buffer_size_i + DirtyBlocks - 1) / DirtyBlocks;
+    for (size_t i = 0; i < bitmap.size(); ++i) {
+        if (not bitmap[i]) {
+            continue;
+        }
+
+        size_t begin = i * content_length / bitmap.size();
+        size_t end = (i + 1) * content_length / bitmap.size();
+        for (size_t b = begin / block_size; b * block_size < end; ++b) {
+            dev.dirty_blocks[slot_id][b] = true;
+        }
+    }
+
     return 1;
 }
 
@@ -551,7 +728,31 @@ int64_t SimpleBufferCache::find_device_id(Device device)
     return -1;
 }
 
-int SimpleBufferCache::find_buffer_id(uint32_t device_id, uint32_t oid, void *ptr, size_t& buffer_id)
+// Byte offset of a host pointer into an object with host data. The end of
+// the object is a valid pointer for the end of a range.
+int SimpleBufferCache::find_offset(uint32_t oid, void *ptr, size_t& offset)
+{
+    if (oid == 0 or oid >= object_info_i.size()) {
+        std::cerr << "find_offset: invalid OID " << oid << std::endl;
+        return -1;
+    }
+    ObjectInfo& oinfo = object_info_i[oid];
+    if (oinfo.ptr == nullptr) {
+        std::cerr << "find_offset: object has no host data, use offsets" << std::endl;
+        return -1;
+    }
+    char *begin = (char*) oinfo.ptr, *end = begin + oinfo.size;
+    if ((char*)ptr < begin or (char*)ptr > end) {
+        std::cerr << "find_offset: invalid pointer " << ptr << std::endl;
+        return -1;
+    }
+
+    offset = (char*)ptr - begin;
+
+    return 1;
+}
+
+int SimpleBufferCache::find_buffer_id(uint32_t device_id, uint32_t oid, size_t offset, size_t& buffer_id)
 {
     if (device_id >= device_info_i.size()) {
         std::cerr << "find_buffer_id: invalid DID " << device_id << std::endl;
@@ -562,13 +763,12 @@ int SimpleBufferCache::find_buffer_id(uint32_t device_id, uint32_t oid, void *pt
         return -1;
     }
     ObjectInfo& oinfo = object_info_i[oid];
-    if (not ptr or ptr < oinfo.ptr or ptr >= &((char*)oinfo.ptr)[oinfo.size]) {
-        std::cerr << "find_buffer_id: invalid pointer " << ptr << std::endl;
+    if (offset >= oinfo.size) {
+        std::cerr << "find_buffer_id: invalid offset " << offset << std::endl;
         return -1;
     }
 
-    size_t bid = ((char*)ptr - (char*)oinfo.ptr);
-    buffer_id = bid;
+    buffer_id = offset;
 
     return 1;
 }
@@ -624,15 +824,17 @@ SimpleBufferCache::IOThread& SimpleBufferCache::get_io_thread(Queue& queue) {
 
     auto iot = this->io_thread.find(queue);
     if (iot == this->io_thread.end()) {
-        this->io_thread[queue].launch();
+        uint32_t id = this->io_thread.size();
+        this->io_thread[queue].launch(id);
         iot = this->io_thread.find(queue);
     }
 
     return iot->second;
 }
 
-void SimpleBufferCache::IOThread::launch() {
+void SimpleBufferCache::IOThread::launch(uint32_t id) {
 
+    this->id = id;
     this->queue_locked = false;
     this->thread = std::thread(&work, this);
 }
@@ -662,12 +864,16 @@ void SimpleBufferCache::IOThread::work(IOThread *io_thread) {
 
 void SimpleBufferCache::IOThread::async_memcpy(AsyncTask& task) {
 
-    Timer::Timer memcpy_timer;
-    memcpy_timer.start();
+    uint64_t start = Measurement::DataPoint::host_timestamp();
     std::memcpy(task.dst_ptr, task.src_ptr, task.size);
-    uint64_t memcpy_time = memcpy_timer
-        .stop<std::chrono::nanoseconds>();
-    task.datapoint->add_value() = memcpy_time;
+    uint64_t end = Measurement::DataPoint::host_timestamp();
+    task.datapoint->add_value() = end - start;
+    task.datapoint->add_host_span(
+            "IOThread " + std::to_string(task.io_thread->id),
+            start,
+            end,
+            task.wait_list
+            );
 }
 
 void SimpleBufferCache::IOThread::push_back(AsyncTask *task) {
@@ -34,6 +34,7 @@ public:
 
     using Buffer = boost::compute::buffer;
     using BufferList = typename BufferCache::BufferList;
+    using DirtyBitmap = typename BufferCache::DirtyBitmap;
     using Context = boost::compute::context;
     using Device = boost::compute::device;
     using Event = boost::compute::event;
@@ -50,14 +51,22 @@ public:
     uint32_t add_object(void *data_object, size_t length, ObjectMode mode = ObjectMode::ReadOnly);
     void object(uint32_t object_id, void *& data_object, size_t& length);
     int get(Queue queue, uint32_t oid, void *begin, void *end, BufferList& buffer, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
+    int get(Queue queue, uint32_t oid, size_t begin, size_t end, BufferList& buffer, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
     int write_and_get(Queue queue, uint32_t oid, void *begin, void *end, BufferList& buffer, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
+    int write_and_get(Queue queue, uint32_t oid, size_t begin, size_t end, BufferList& buffer, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
+    int overwrite_and_get(Queue queue, uint32_t oid, void *begin, void *end, BufferList& buffer, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
+    int overwrite_and_get(Queue queue, uint32_t oid, size_t begin, size_t end, BufferList& buffer, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
     int read(Queue queue, uint32_t oid, void *begin, void *end, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
     int sync_and_get(Queue, Queue, uint32_t, void*, void*, Event&, WaitList const&, Measurement::DataPoint&) { return -1; /* not supported */ };
     int unlock(Queue queue, uint32_t oid, BufferList const& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
+    int unlock(Queue queue, uint32_t oid, BufferList const& buffers, bool modified, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
+    int unlock(Queue queue, uint32_t oid, BufferList const& buffers, std::vector<DirtyBitmap> const& dirty, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
 
 private:
 
     uint32_t static constexpr DoubleBuffering = 2u;
+    // Granularity of write-back on eviction
+    uint32_t static constexpr DirtyBlocks = 64u;
 
     struct DeviceInfo {
         struct SlotLock {
@@ -73,8 +82,8 @@ private:
         std::vector<SlotLock> slot_lock;
         std::vector<int64_t> cached_object_id;
         std::vector<size_t> cached_buffer_id;
-        std::vector<void*> cached_ptr;
         std::vector<size_t> cached_content_length;
+        std::vector<DirtyBitmap> dirty_blocks;
         std::vector<Buffer> device_buffer;
         std::vector<Buffer> host_buffer;
         std::vector<void*> host_ptr;
@@ -90,11 +99,13 @@ private:
 
     class IOThread {
     public:
-        void launch();
+        void launch(uint32_t id);
         void join();
         static void work(IOThread *io_thread);
         void push_back(AsyncTask *task);
 
+        uint32_t id;
+
     private:
         std::thread thread;
         std::list<AsyncTask*> tasks;
@@ -120,11 +131,14 @@ private:
     std::vector<ObjectInfo> object_info_i;
     std::map<Queue, IOThread> io_thread;
 
+    int assign_and_get(Queue queue, uint32_t oid, size_t begin, size_t end, bool write, BufferList& buffers, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
+    int read_back(Queue queue, uint32_t device_id, uint32_t cache_slot, size_t offset, size_t size, void *dst, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
     int evict_cache_slot(Queue queue, uint32_t device_id, uint32_t cache_slot, Event& event, WaitList const& wait_list, Measurement::DataPoint& datapoint);
     int try_read_lock(uint32_t device_id, uint32_t cache_slot);
     int try_write_lock(uint32_t device_id, uint32_t cache_slot);
     int64_t find_device_id(Device device);
-    int find_buffer_id(uint32_t device_id, uint32_t oid, void *ptr, size_t& buffer_id);
+    int find_offset(uint32_t oid, void *ptr, size_t& offset);
+    int find_buffer_id(uint32_t device_id, uint32_t oid, size_t offset, size_t& buffer_id);
     int64_t find_cache_slot(uint32_t device_id, uint32_t oid, size_t buffer_id);
     int64_t assign_cache_slot(uint32_t device_id, uint32_t oid, size_t buffer_id);
     IOThread& get_io_thread(Queue& queue);
@@ -12,6 +12,7 @@
 #include <future>
 #include <deque>
 #include <iostream>
+#include <vector>
 
 #include <boost/compute/wait_list.hpp>
 
@@ -61,11 +62,31 @@ int sds::enqueue(
         Measurement::DataPoint& datapoint
         )
 {
+    return enqueue(
+            kernel_function,
+            object_id,
+            step,
+            ObjectAccess::ReadWrite,
+            kernel_events,
+            datapoint
+            );
+}
+
+int sds::enqueue(
+        FunUnary kernel_function,
+        uint32_t object_id,
+        size_t step,
+        ObjectAccess access,
+        std::future<std::deque<Event>>& kernel_events,
+        Measurement::DataPoint& datapoint
+        )
+{
 
     auto runnable = std::make_unique<UnaryRunnable>();
     runnable->kernel_function = kernel_function;
     runnable->object_id = object_id;
     runnable->step = step;
+    runnable->access = access;
     runnable->datapoint = &datapoint;
 
     kernel_events = runnable->events_promise.get_future();
@@ -84,6 +105,58 @@ int sds::enqueue(
         std::future<std::deque<Event>>& kernel_events,
         Measurement::DataPoint& datapoint
         )
+{
+    return enqueue(
+            kernel_function,
+            fst_object_id,
+            snd_object_id,
+            fst_step,
+            snd_step,
+            ObjectAccess::ReadWrite,
+            ObjectAccess::ReadWrite,
+            kernel_events,
+            datapoint
+            );
+}
+
+int sds::enqueue(
+        FunBinary kernel_function,
+        uint32_t fst_object_id,
+        uint32_t snd_object_id,
+        size_t fst_step,
+        size_t snd_step,
+        ObjectAccess fst_access,
+        ObjectAccess snd_access,
+        std::future<std::deque<Event>>& kernel_events,
+        Measurement::DataPoint& datapoint
+        )
+{
+    return enqueue(
+            kernel_function,
+            fst_object_id,
+            snd_object_id,
+            fst_step,
+            snd_step,
+            fst_access,
+            snd_access,
+            FunDirty(),
+            kernel_events,
+            datapoint
+            );
+}
+
+int sds::enqueue(
+        FunBinary kernel_function,
+        uint32_t fst_object_id,
+        uint32_t snd_object_id,
+        size_t fst_step,
+        size_t snd_step,
+        ObjectAccess fst_access,
+        ObjectAccess snd_access,
+        FunDirty snd_dirty,
+        std::future<std::deque<Event>>& kernel_events,
+        Measurement::DataPoint& datapoint
+        )
 {
     auto runnable = std::make_unique<BinaryRunnable>();
     runnable->kernel_function = kernel_function;
@@ -91,6 +164,9 @@ int sds::enqueue(
     runnable->snd_object_id = snd_object_id;
     runnable->fst_step = fst_step;
     runnable->snd_step = snd_step;
+    runnable->fst_access = fst_access;
+    runnable->snd_access = snd_access;
+    runnable->snd_dirty = snd_dirty;
     runnable->datapoint = &datapoint;
 
     kernel_events = runnable->events_promise.get_future();
@@ -280,13 +356,12 @@ BufferCache::BufferList& sds::RState::active_buffers(uint32_t object_id)
     return this->active_buffers_i.at(object_id);
 }
 
-int sds::RState::activate_buffers(uint32_t object_id, size_t runnable_step, BufferCache& buffer_cache, uint32_t index, WaitList wait_list, std::deque<Event>& events, Event& last_event, Measurement::DataPoint& datapoint)
+int sds::RState::activate_buffers(uint32_t object_id, size_t runnable_step, ObjectAccess access, BufferCache& buffer_cache, uint32_t index, WaitList wait_list, std::deque<Event>& events, Event& last_event, Measurement::DataPoint& datapoint)
 {
-    void *object_vptr = nullptr;
-    char *object_ptr = nullptr;
+    // Objects are addressed by offsets, because they may have no host data
+    void *object_ptr = nullptr;
     size_t object_size = 0;
-    buffer_cache.object(object_id, object_vptr, object_size);
-    object_ptr = (char*) object_vptr;
+    buffer_cache.object(object_id, object_ptr, object_size);
 
     size_t offset = runnable_step * index;
 
@@ -295,8 +370,13 @@ int sds::RState::activate_buffers(uint32_t object_id, size_t runnable_step, Buff
         : object_size
         ;
 
+    // Kernels that process vectors may skip the tail of a shorter last
+    // buffer, so its content is written to the device
+    bool const overwrite = access == ObjectAccess::Write
+        and end_offset - offset == runnable_step;
+
     if (VERBOSE) {
-        std::cout << "[RState::activate_buffers] objectptr: " << (uint64_t)object_ptr << " offset " << offset << " endoffset " << end_offset << std::endl;
+        std::cout << "[RState::activate_buffers] object " << object_id << " offset " << offset << " endoffset " << end_offset << std::endl;
     }
 
     auto& ab = this->active_buffers_i;
@@ -306,16 +386,27 @@ int sds::RState::activate_buffers(uint32_t object_id, size_t runnable_step, Buff
 
         events.emplace_back();
         Event& transfer_event = events.back();
-        int ret = buffer_cache.get(
-                this->queue_i,
-                object_id,
-                object_ptr + offset,
-                object_ptr + end_offset,
-                buffers,
-                transfer_event,
-                wait_list,
-                datapoint
-                );
+        int ret = (overwrite)
+            ? buffer_cache.overwrite_and_get(
+                    this->queue_i,
+                    object_id,
+                    offset,
+                    end_offset,
+                    buffers,
+                    transfer_event,
+                    wait_list,
+                    datapoint
+                    )
+            : buffer_cache.get(
+                    this->queue_i,
+                    object_id,
+                    offset,
+                    end_offset,
+                    buffers,
+                    transfer_event,
+                    wait_list,
+                    datapoint
+                    );
         last_event = transfer_event;
 
         if (ret < 0) {
@@ -326,19 +417,34 @@ int sds::RState::activate_buffers(uint32_t object_id, size_t runnable_step, Buff
     return 1;
 }
 
-int sds::RState::deactivate_buffers(uint32_t object_id, BufferCache& buffer_cache, WaitList wait_list, std::deque<Event>& events, Event& last_event, Measurement::DataPoint& datapoint)
+int sds::RState::deactivate_buffers(uint32_t object_id, bool modified, FunDirty const& dirty, BufferCache& buffer_cache, WaitList wait_list, std::deque<Event>& events, Event& last_event, Measurement::DataPoint& datapoint)
 {
     auto& ab = this->active_buffers_i;
     auto it = ab.find(object_id);
     if (it != ab.end()) {
         auto& buffers = it->second;
 
+        // Ask for the modified ranges only if the object is modified
+        std::vector<BufferCache::DirtyBitmap> dirty_bitmaps;
+        if (modified and dirty) {
+            for (auto const& bdesc : buffers) {
+                dirty_bitmaps.push_back(
+                        dirty(this->queue_i, bdesc.buffer, wait_list));
+            }
+        }
+        else {
+            dirty_bitmaps.assign(
+                    buffers.size(),
+                    BufferCache::DirtyBitmap(1, modified));
+        }
+
         events.emplace_back();
         Event& unlock_event = events.back();
         int ret = buffer_cache.unlock(
                 this->queue_i,
                 object_id,
                 buffers,
+                dirty_bitmaps,
                 unlock_event,
                 wait_list,
                 datapoint
@@ -365,6 +471,7 @@ int sds::UnaryRunnable::activate_buffers(RState& rstate, BufferCache& buffer_cac
     return rstate.activate_buffers(
             this->object_id,
             this->step,
+            this->access,
             buffer_cache,
             index,
             wait_list,
@@ -378,6 +485,8 @@ int sds::UnaryRunnable::deactivate_buffers(RState& rstate, BufferCache& buffer_c
 {
     return rstate.deactivate_buffers(
             this->object_id,
+            this->access != ObjectAccess::Read,
+            FunDirty(),
             buffer_cache,
             wait_list,
             this->events,
@@ -394,6 +503,7 @@ int sds::UnaryRunnable::run(RState& rstate, BufferCache&, uint32_t, WaitList wai
     }
 
     auto& bdesc = rstate.active_buffers(this->object_id).front();
+    this->datapoint->add_dependencies(wait_list);
     last_event = kernel_function(
             rstate.queue(),
             0,
@@ -454,6 +564,7 @@ int sds::BinaryRunnable::activate_buffers(RState& rstate, BufferCache& buffer_ca
     ret = rstate.activate_buffers(
             this->fst_object_id,
             this->fst_step,
+            this->fst_access,
             buffer_cache,
             index,
             wait_list,
@@ -470,6 +581,7 @@ int sds::BinaryRunnable::activate_buffers(RState& rstate, BufferCache& buffer_ca
     ret = rstate.activate_buffers(
             this->snd_object_id,
             this->snd_step,
+            this->snd_access,
             buffer_cache,
             index,
             snd_wait_list,
@@ -492,6 +604,8 @@ int sds::BinaryRunnable::deactivate_buffers(RState& rstate, BufferCache& buffer_
     Event fst_event;
     ret = rstate.deactivate_buffers(
             this->fst_object_id,
+            this->fst_access != ObjectAccess::Read,
+            FunDirty(),
             buffer_cache,
             wait_list,
             this->events,
@@ -506,6 +620,8 @@ int sds::BinaryRunnable::deactivate_buffers(RState& rstate, BufferCache& buffer_
     WaitList snd_wait_list(fst_event);
     ret = rstate.deactivate_buffers(
             this->snd_object_id,
+            this->snd_access != ObjectAccess::Read,
+            this->snd_dirty,
             buffer_cache,
             snd_wait_list,
             this->events,
@@ -529,6 +645,7 @@ int sds::BinaryRunnable::run(RState& rstate, BufferCache&, uint32_t, WaitList wa
 
     auto& fst_bdesc = rstate.active_buffers(this->fst_object_id).front();
     auto& snd_bdesc = rstate.active_buffers(this->snd_object_id).front();
+    this->datapoint->add_dependencies(wait_list);
     last_event = kernel_function(
             rstate.queue(),
             0,
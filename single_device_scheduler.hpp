@@ -37,6 +37,8 @@ namespace Clustering {
         using Event = boost::compute::event;
         using FunUnary = typename DeviceScheduler::FunUnary;
         using FunBinary = typename DeviceScheduler::FunBinary;
+        using FunDirty = typename DeviceScheduler::FunDirty;
+        using ObjectAccess = typename DeviceScheduler::ObjectAccess;
         using Queue = boost::compute::command_queue;
 
         SingleDeviceScheduler();
@@ -54,12 +56,43 @@ namespace Clustering {
                 std::future<std::deque<Event>>& kernel_events,
                 Measurement::DataPoint& datapoint
                 );
+        int enqueue(
+                FunUnary kernel_function,
+                uint32_t object_id,
+                size_t step,
+                ObjectAccess access,
+                std::future<std::deque<Event>>& kernel_events,
+                Measurement::DataPoint& datapoint
+                );
+        int enqueue(
+                FunBinary kernel_function,
+                uint32_t fst_object_id,
+                uint32_t snd_object_id,
+                size_t fst_step,
+                size_t snd_step,
+                std::future<std::deque<Event>>& kernel_events,
+                Measurement::DataPoint& datapoint
+                );
+        int enqueue(
+                FunBinary kernel_function,
+                uint32_t fst_object_id,
+                uint32_t snd_object_id,
+                size_t fst_step,
+                size_t snd_step,
+                ObjectAccess fst_access,
+                ObjectAccess snd_access,
+                std::future<std::deque<Event>>& kernel_events,
+                Measurement::DataPoint& datapoint
+                );
         int enqueue(
                 FunBinary kernel_function,
                 uint32_t fst_object_id,
                 uint32_t snd_object_id,
                 size_t fst_step,
                 size_t snd_step,
+                ObjectAccess fst_access,
+                ObjectAccess snd_access,
+                FunDirty snd_dirty,
                 std::future<std::deque<Event>>& kernel_events,
                 Measurement::DataPoint& datapoint
                 );
@@ -78,8 +111,8 @@ namespace Clustering {
             void last_event(Event event);
             Event last_event();
             BufferCache::BufferList& active_buffers(uint32_t object_id);
-            int activate_buffers(uint32_t object_id, size_t runnable_step, BufferCache& buffer_cache, uint32_t index, WaitList wait_list, std::deque<Event>& events, Event& last_event, Measurement::DataPoint& datapoint);
-            int deactivate_buffers(uint32_t object_id, BufferCache& buffer_cache, WaitList wait_list, std::deque<Event>& events, Event& last_event, Measurement::DataPoint& datapoint);
+            int activate_buffers(uint32_t object_id, size_t runnable_step, ObjectAccess access, BufferCache& buffer_cache, uint32_t index, WaitList wait_list, std::deque<Event>& events, Event& last_event, Measurement::DataPoint& datapoint);
+            int deactivate_buffers(uint32_t object_id, bool modified, FunDirty const& dirty, BufferCache& buffer_cache, WaitList wait_list, std::deque<Event>& events, Event& last_event, Measurement::DataPoint& datapoint);
 
         private:
             Queue queue_i;
@@ -106,6 +139,7 @@ namespace Clustering {
             FunUnary kernel_function;
             uint32_t object_id;
             size_t step;
+            ObjectAccess access = ObjectAccess::ReadWrite;
             std::deque<Event> events;
             Measurement::DataPoint *datapoint = nullptr;
             std::promise<std::deque<Event>> events_promise;
@@ -123,6 +157,9 @@ namespace Clustering {
             uint32_t snd_object_id;
             size_t fst_step;
             size_t snd_step;
+            ObjectAccess fst_access = ObjectAccess::ReadWrite;
+            ObjectAccess snd_access = ObjectAccess::ReadWrite;
+            FunDirty snd_dirty;
             std::deque<Event> events;
             Measurement::DataPoint *datapoint = nullptr;
             std::promise<std::deque<Event>> events_promise;
@@ -0,0 +1,121 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef SWEEP_CONFIGURATION_HPP
+#define SWEEP_CONFIGURATION_HPP
+
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Clustering {
+
+/*
+ * Configuration options of one point of a sweep, as (option, value)
+ */
+using SweepPoint = std::vector<std::pair<std::string, std::string>>;
+
+/*
+ * Values of one configuration option
+ */
+struct SweepAxis {
+    std::string option;
+    std::vector<std::string> values;
+};
+
+/*
+ * Cross product of configuration options, run by bench --sweep
+ *
+ * Written in the [sweep] section of a configuration file as
+ *   data = <file>
+ *   vary = <option> <value>...
+ * with one line per data file and per varied option, e.g.
+ *   vary = kmeans.clusters 4 8 16
+ *   vary = kmeans.labeling.vector_length 1 2 4
+ * The remaining sections are the base configuration. The last option
+ * varies fastest.
+ */
+class SweepConfiguration {
+public:
+    void add_data_file(std::string const& file) {
+        data_files_.push_back(file);
+    }
+
+    void add_axis(SweepAxis const& axis) {
+        axes_.push_back(axis);
+    }
+
+    void add_axis(std::string const& axis) {
+        axes_.push_back(parse_axis(axis));
+    }
+
+    std::vector<std::string> const& data_files() const {
+        return data_files_;
+    }
+
+    std::vector<SweepAxis> const& axes() const {
+        return axes_;
+    }
+
+    // Number of points per data file
+    size_t size() const {
+        size_t points = 1;
+        for (auto const& axis : axes_) {
+            points *= axis.values.size();
+        }
+        return points;
+    }
+
+    SweepPoint point(size_t index) const {
+        if (index >= size()) {
+            throw std::out_of_range("Sweep point "
+                    + std::to_string(index));
+        }
+
+        SweepPoint options(axes_.size());
+        for (size_t a = axes_.size(); a > 0; --a) {
+            SweepAxis const& axis = axes_[a - 1];
+            options[a - 1] = std::make_pair(
+                    axis.option,
+                    axis.values[index % axis.values.size()]);
+            index /= axis.values.size();
+        }
+
+        return options;
+    }
+
+    static SweepAxis parse_axis(std::string const& line) {
+        std::istringstream fields(line);
+        SweepAxis axis;
+        std::string value;
+
+        fields >> axis.option;
+        while (fields >> value) {
+            axis.values.push_back(value);
+        }
+
+        if (axis.option.empty() || axis.values.empty()) {
+            throw std::invalid_argument(
+                    "Malformed sweep option \"" + line + "\"");
+        }
+
+        return axis;
+    }
+
+private:
+    std::vector<std::string> data_files_;
+    std::vector<SweepAxis> axes_;
+};
+
+}
+
+#endif /* SWEEP_CONFIGURATION_HPP */
@@ -0,0 +1,91 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <benchmark_harness.hpp>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(BenchmarkHarness, FixedRuns) {
+    size_t warmup = 0;
+    size_t measured = 0;
+
+    Clustering::BenchmarkHarness harness(10, 3);
+    harness.run([&](bool is_warmup) {
+        if (is_warmup) {
+            ++warmup;
+            return (uint64_t) 1000000;
+        }
+        ++measured;
+        return (uint64_t) 100;
+    });
+
+    // Warmup samples are discarded
+    EXPECT_EQ(3u, warmup);
+    EXPECT_EQ(10u, measured);
+    EXPECT_EQ(10u, harness.samples().size());
+    EXPECT_EQ(100.0, harness.statistics().median);
+    EXPECT_EQ(100.0, harness.statistics().p95);
+}
+
+TEST(BenchmarkHarness, Statistics) {
+    std::vector<uint64_t> samples;
+    for (uint64_t s = 1; s <= 100; ++s) {
+        samples.push_back(s);
+    }
+    samples.push_back(10000);
+
+    auto stats = Clustering::BenchmarkHarness::statistics(samples);
+    EXPECT_EQ(101u, stats.count);
+    EXPECT_EQ(1u, stats.outliers);
+    EXPECT_EQ(51.0, stats.median);
+    EXPECT_EQ(96.0, stats.p95);
+    EXPECT_LT(stats.median_ci_low, stats.median);
+    EXPECT_GT(stats.median_ci_high, stats.median);
+
+    // The outlier does not widen the interval
+    EXPECT_LT(stats.median_ci_high, 100.0);
+}
+
+TEST(BenchmarkHarness, AdaptiveRuns) {
+    std::default_random_engine rgen;
+    std::normal_distribution<double> noise(1000.0, 50.0);
+
+    Clustering::BenchmarkHarness harness(5, 0, 10000, 0.02);
+    harness.run([&](bool) {
+        return (uint64_t) noise(rgen);
+    });
+
+    auto stats = harness.statistics();
+    EXPECT_GT(stats.count, 5u);
+    EXPECT_LT(stats.count, 10000u);
+    EXPECT_LE(
+            (stats.median_ci_high - stats.median_ci_low) / stats.median,
+            0.02);
+}
+
+TEST(BenchmarkHarness, MaxRuns) {
+    uint64_t sample = 0;
+
+    // Never converges
+    Clustering::BenchmarkHarness harness(5, 0, 20, 1e-9);
+    harness.run([&](bool) {
+        return sample++ * 1000;
+    });
+
+    EXPECT_EQ(20u, harness.samples().size());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
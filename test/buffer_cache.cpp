@@ -12,6 +12,8 @@
 
 #include <gtest/gtest.h>
 #include <boost/compute/core.hpp>
+#include <boost/compute/algorithm/fill_n.hpp>
+#include <boost/compute/iterator/buffer_iterator.hpp>
 
 #include <vector>
 
@@ -312,6 +314,225 @@ TEST_F(SimpleBufferCache, GetReadDeadBeef)
     event.wait();
 }
 
+TEST_F(SimpleBufferCache, TransientWithoutHostData)
+{
+    boost::compute::event event;
+    boost::compute::wait_list wait_list;
+    Measurement::Measurement measurement;
+    Clustering::BufferCache::BufferList buffers;
+    int ret = 0;
+
+    // Without host data, chunks are addressed by offsets
+    uint32_t transient_id = buffer_cache.add_object(nullptr, 4 * buffer_size, Clustering::ObjectMode::Transient);
+    ASSERT_LT(0u, transient_id);
+
+    for (size_t i = 0; i < 4; ++i) {
+        size_t begin = i * buffer_size;
+        size_t end = begin + buffer_size;
+
+        ret = buffer_cache.write_and_get(queue, transient_id, begin, end, buffers, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+        ASSERT_EQ(1u, buffers.size());
+        EXPECT_EQ(buffer_size, buffers[0].content_length);
+
+        bc::fill_n(bc::make_buffer_iterator<uint32_t>(buffers[0].buffer, 0), buffer_ints, 0xDEADBEEFu, queue);
+
+        // Eviction of earlier chunks must not write back
+        ret = buffer_cache.unlock(queue, transient_id, buffers, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+        buffers.clear();
+    }
+    queue.finish();
+
+    // Pointers require host data
+    void *no_data = &buffers;
+    EXPECT_GT(0, buffer_cache.get(queue, transient_id, no_data, no_data, buffers, event, wait_list, measurement.add_datapoint()));
+
+    // Host data objects are still required for other modes
+    EXPECT_EQ(0u, buffer_cache.add_object(nullptr, buffer_size, Clustering::ObjectMode::ReadWrite));
+}
+
+TEST_F(SimpleBufferCache, TransientNoWriteBack)
+{
+    boost::compute::event event;
+    boost::compute::wait_list wait_list;
+    Measurement::Measurement measurement;
+    Clustering::BufferCache::BufferList buffers;
+    int ret = 0;
+
+    std::vector<uint32_t> transient_object(4 * buffer_ints, 0xCAFED00Du);
+    uint32_t transient_id = buffer_cache.add_object(transient_object.data(), transient_object.size() * sizeof(uint32_t), Clustering::ObjectMode::Transient);
+
+    for (size_t i = 0; i < 4; ++i) {
+        uint32_t *begin = &transient_object[i * buffer_ints];
+        uint32_t *end = begin + buffer_ints;
+
+        ret = buffer_cache.write_and_get(queue, transient_id, begin, end, buffers, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+        bc::fill_n(bc::make_buffer_iterator<uint32_t>(buffers[0].buffer, 0), buffer_ints, 0xDEADBEEFu, queue);
+        ret = buffer_cache.unlock(queue, transient_id, buffers, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+        buffers.clear();
+    }
+
+    ret = buffer_cache.read(queue, transient_id, &transient_object[0], &transient_object[buffer_ints], event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+    queue.finish();
+
+    uint32_t failed_fields = 0;
+    for (size_t i = 0; i < transient_object.size(); ++i) {
+        if (transient_object[i] != 0xCAFED00Du){
+            ++failed_fields;
+        }
+        if (failed_fields < MAX_PRINT_FAILURES) {
+            EXPECT_EQ(0xCAFED00Du, transient_object[i]) << "Object differs at index " << i;
+        }
+    }
+    EXPECT_EQ(0u, failed_fields);
+}
+
+TEST_F(SimpleBufferCache, CleanUnlockNoWriteBack)
+{
+    boost::compute::event event;
+    boost::compute::wait_list wait_list;
+    Measurement::Measurement measurement;
+    Clustering::BufferCache::BufferList buffers;
+    int ret = 0;
+
+    // CPU buffers are zero copy and have no write-back
+    if (device.type() == bc::device::cpu) {
+        return;
+    }
+
+    // Modify the device buffer, but report it unmodified
+    ret = buffer_cache.write_and_get(queue, object_id, &data_object[0], &data_object[buffer_ints], buffers, event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+    bc::fill_n(bc::make_buffer_iterator<uint32_t>(buffers[0].buffer, 0), buffer_ints, 0xDEADBEEFu, queue);
+    ret = buffer_cache.unlock(queue, object_id, buffers, false, event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+
+    // Evict the first buffer
+    for (size_t i = 1; i < 3; ++i) {
+        uint32_t *begin = &data_object[i * buffer_ints];
+        ret = buffer_cache.write_and_get(queue, object_id, begin, begin + buffer_ints, buffers, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+        ret = buffer_cache.unlock(queue, object_id, buffers, false, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+    }
+    queue.finish();
+
+    uint32_t failed_fields = 0;
+    for (uint32_t i = 0; i < buffer_ints; ++i) {
+        if (data_object[i] != i) {
+            ++failed_fields;
+        }
+        if (failed_fields < MAX_PRINT_FAILURES) {
+            EXPECT_EQ(i, data_object[i]) << "Object differs at index " << i;
+        }
+    }
+    EXPECT_EQ(0u, failed_fields);
+}
+
+TEST_F(SimpleBufferCache, DirtyBitmapWriteBack)
+{
+    boost::compute::event event;
+    boost::compute::wait_list wait_list;
+    Measurement::Measurement measurement;
+    Clustering::BufferCache::BufferList buffers;
+    int ret = 0;
+
+    // CPU buffers are zero copy and have no write-back
+    if (device.type() == bc::device::cpu) {
+        return;
+    }
+
+    // Modify the whole device buffer, but report only the first quarter
+    ret = buffer_cache.write_and_get(queue, object_id, &data_object[0], &data_object[buffer_ints], buffers, event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+    bc::fill_n(bc::make_buffer_iterator<uint32_t>(buffers[0].buffer, 0), buffer_ints, 0xDEADBEEFu, queue);
+    std::vector<Clustering::BufferCache::DirtyBitmap> dirty{{true, false, false, false}};
+    ret = buffer_cache.unlock(queue, object_id, buffers, dirty, event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+
+    // Evict the first buffer
+    for (size_t i = 1; i < 3; ++i) {
+        uint32_t *begin = &data_object[i * buffer_ints];
+        ret = buffer_cache.write_and_get(queue, object_id, begin, begin + buffer_ints, buffers, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+        ret = buffer_cache.unlock(queue, object_id, buffers, false, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+    }
+    queue.finish();
+
+    uint32_t failed_fields = 0;
+    for (uint32_t i = 0; i < buffer_ints; ++i) {
+        uint32_t expected = (i < buffer_ints / 4) ? 0xDEADBEEFu : i;
+        if (data_object[i] != expected) {
+            ++failed_fields;
+        }
+        if (failed_fields < MAX_PRINT_FAILURES) {
+            EXPECT_EQ(expected, data_object[i]) << "Object differs at index " << i;
+        }
+    }
+    EXPECT_EQ(0u, failed_fields);
+}
+
+TEST_F(SimpleBufferCache, DirtyBitmapScatteredWriteBack)
+{
+    boost::compute::event event;
+    boost::compute::wait_list wait_list;
+    Measurement::Measurement measurement;
+    Clustering::BufferCache::BufferList buffers;
+    int ret = 0;
+
+    // CPU buffers are zero copy and have no write-back
+    if (device.type() == bc::device::cpu) {
+        return;
+    }
+
+    // Modify the whole device buffer, but report eighths 1, 2 and 6
+    ret = buffer_cache.write_and_get(queue, object_id, &data_object[0], &data_object[buffer_ints], buffers, event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+    bc::fill_n(bc::make_buffer_iterator<uint32_t>(buffers[0].buffer, 0), buffer_ints, 0xDEADBEEFu, queue);
+    std::vector<Clustering::BufferCache::DirtyBitmap> dirty{{false, true, true, false, false, false, true, false}};
+    ret = buffer_cache.unlock(queue, object_id, buffers, dirty, event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+
+    // Lock the cached buffer again and report eighth 4, which merges with
+    // the earlier report
+    ret = buffer_cache.get(queue, object_id, &data_object[0], &data_object[buffer_ints], buffers, event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+    std::vector<Clustering::BufferCache::DirtyBitmap> more_dirty{{false, false, false, false, true, false, false, false}};
+    ret = buffer_cache.unlock(queue, object_id, buffers, more_dirty, event, wait_list, measurement.add_datapoint());
+    ASSERT_EQ(true, ret);
+
+    // Evict the first buffer
+    for (size_t i = 1; i < 3; ++i) {
+        uint32_t *begin = &data_object[i * buffer_ints];
+        ret = buffer_cache.write_and_get(queue, object_id, begin, begin + buffer_ints, buffers, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+        ret = buffer_cache.unlock(queue, object_id, buffers, false, event, wait_list, measurement.add_datapoint());
+        ASSERT_EQ(true, ret);
+    }
+    queue.finish();
+
+    // Only the reported eighths are read back
+    uint32_t failed_fields = 0;
+    for (uint32_t i = 0; i < buffer_ints; ++i) {
+        uint32_t const eighth = i / (buffer_ints / 8);
+        bool const is_dirty =
+            eighth == 1 or eighth == 2 or eighth == 4 or eighth == 6;
+        uint32_t expected = (is_dirty) ? 0xDEADBEEFu : i;
+        if (data_object[i] != expected) {
+            ++failed_fields;
+        }
+        if (failed_fields < MAX_PRINT_FAILURES) {
+            EXPECT_EQ(expected, data_object[i]) << "Object differs at index " << i;
+        }
+    }
+    EXPECT_EQ(0u, failed_fields);
+}
+
 TEST_F(SimpleBufferCache, ParallelWrites)
 {
     constexpr int DUAL_QUEUE = 2;
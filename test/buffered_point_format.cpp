@@ -0,0 +1,154 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <kmeans_single_stage_buffered.hpp>
+#include <fused_configuration.hpp>
+#include <point_format.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+
+size_t const num_points = 1 << 16;
+size_t const num_clusters = 4;
+
+// Runs the buffered single stage pipeline on narrow points, where the
+// labels of a buffer take at least as many bytes as its points
+class BufferedPointFormat : public ::testing::Test {
+protected:
+    using Kmeans = Clustering::KmeansSingleStageBuffered<
+        float, uint32_t, uint32_t, true>;
+
+    void run_buffered(std::string point_format, size_t num_features) {
+        this->run_buffered(
+                point_format,
+                num_features,
+                {0.0f, 100.0f, 200.0f, 300.0f},
+                2);
+    }
+
+    // Initial centroids have the same position in all features. Clusters
+    // beyond the blobs must stay empty.
+    void run_buffered(
+            std::string point_format,
+            size_t num_features,
+            std::vector<float> const& positions,
+            size_t num_iterations) {
+
+        size_t const k = positions.size();
+
+        // Well separated blobs, point p belongs to blob p % num_clusters
+        std::default_random_engine rgen;
+        std::uniform_real_distribution<float> noise(-5.0f, 5.0f);
+
+        auto points = std::make_shared<std::vector<float>>(
+                num_points * num_features);
+        auto centroids = std::make_shared<std::vector<float>>(
+                k * num_features);
+        for (size_t f = 0; f < num_features; ++f) {
+            for (size_t p = 0; p < num_points; ++p) {
+                (*points)[f * num_points + p] =
+                    (float) ((p % num_clusters) * 100) + noise(rgen);
+            }
+            for (size_t c = 0; c < k; ++c) {
+                (*centroids)[f * k + c] = positions[c];
+            }
+        }
+        auto masses = std::make_shared<std::vector<uint32_t>>(k);
+        auto labels = std::make_shared<std::vector<uint32_t>>(num_points);
+
+        Clustering::FusedConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "cluster_merge";
+        config.global_size[0] = 8192;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = 64;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = 1;
+        config.point_format = point_format;
+        config.point_quantization = Clustering::PointFormatHelper::quantization(
+                points->data(),
+                num_points,
+                num_features);
+
+        Kmeans kmeans;
+        kmeans.set_context(clenv->context);
+        kmeans.set_queue(boost::compute::command_queue(
+                    clenv->context,
+                    clenv->device));
+        kmeans.set_fused(config);
+        kmeans(num_iterations, num_features, points, centroids, masses, labels);
+
+        size_t wrong = 0;
+        for (size_t p = 0; p < num_points; ++p) {
+            wrong += ((*labels)[p] != p % num_clusters);
+        }
+        EXPECT_EQ(0u, wrong);
+
+        for (size_t c = 0; c < k; ++c) {
+            EXPECT_EQ(
+                    (c < num_clusters) ? num_points / num_clusters : 0,
+                    (*masses)[c]);
+        }
+    }
+};
+
+// The kernels are built for powers of two from two features on. Smaller
+// and odd feature counts are covered by PointFormat.PointsPerBuffer.
+TEST_F(BufferedPointFormat, Int8TwoFeatures) {
+    this->run_buffered("int8", 2);
+}
+
+// Four and more features take the vectorized coarse int8 labeling
+TEST_F(BufferedPointFormat, Int8WideFeatures) {
+    for (size_t num_features : {4, 8}) {
+        SCOPED_TRACE(num_features);
+        this->run_buffered("int8", num_features);
+    }
+}
+
+// The last centroid lies beyond the quantization range and saturates to
+// the grid point next to the last blob. Its coarse bounds would claim the
+// points of that blob, whose own centroid is 20 away.
+TEST_F(BufferedPointFormat, Int8SaturatedCentroid) {
+    for (size_t num_features : {2, 4}) {
+        SCOPED_TRACE(num_features);
+        this->run_buffered(
+                "int8",
+                num_features,
+                {0.0f, 100.0f, 200.0f, 280.0f, 400.0f},
+                1);
+    }
+}
+
+TEST_F(BufferedPointFormat, HalfTwoFeatures) {
+    this->run_buffered("half", 2);
+}
+
+TEST_F(BufferedPointFormat, BFloat16TwoFeatures) {
+    this->run_buffered("bfloat16", 2);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,140 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <cluster_generator.hpp>
+#include <binary_format.hpp>
+#include <matrix.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using Matrix32 = cle::Matrix<float, std::allocator<float>, uint32_t>;
+using Matrix64 = cle::Matrix<float, std::allocator<float>, uint64_t>;
+
+namespace {
+
+cle::ClusterGenerator make_generator() {
+    cle::ClusterGenerator generator;
+    generator.total_size(3 * 1024 * 1024);
+    generator.num_features(3);
+    generator.num_clusters(5);
+    generator.point_multiple(8);
+    generator.domain(-100.0f, 100.0f);
+    generator.cluster_radius(10.0f);
+    generator.seed(42);
+    return generator;
+}
+
+std::vector<char> read_file(std::string const& file) {
+    std::ifstream fh(file, std::ifstream::binary);
+    return std::vector<char>(
+            std::istreambuf_iterator<char>(fh),
+            std::istreambuf_iterator<char>());
+}
+
+}
+
+TEST(ClusterGenerator, PhiloxKnownAnswer)
+{
+    // Philox4x32-10 test vector of the Random123 library
+    auto r = cle::Philox4x32::generate({{0, 0, 0, 0}}, 0);
+
+    EXPECT_EQ(0x6627e8d5u, r[0]);
+    EXPECT_EQ(0xe169c58du, r[1]);
+    EXPECT_EQ(0xbc57ac4cu, r[2]);
+    EXPECT_EQ(0x9b00dbd8u, r[3]);
+}
+
+TEST(ClusterGenerator, SameFileForAnyNumberOfThreads)
+{
+    std::string single = "cluster_generator_single.bin";
+    std::string multi = "cluster_generator_multi.bin";
+
+    auto generator = make_generator();
+    generator.tail_degrees(3);
+    generator.anisotropy(2.0f);
+    generator.num_threads(1);
+    generator.generate_bin(single.c_str());
+    generator.num_threads(4);
+    generator.generate_bin(multi.c_str());
+
+    auto single_data = read_file(single);
+    auto multi_data = read_file(multi);
+    std::remove(single.c_str());
+    std::remove(multi.c_str());
+
+    EXPECT_FALSE(single_data.empty());
+    EXPECT_TRUE(single_data == multi_data);
+}
+
+TEST(ClusterGenerator, ReadBack)
+{
+    std::string file = "cluster_generator_read_back.bin";
+
+    auto generator = make_generator();
+    generator.num_threads(4);
+    generator.generate_bin(file.c_str());
+
+    Matrix32 read_points;
+    Clustering::BinaryFormat format;
+    EXPECT_EQ(1, format.read(file.c_str(), read_points));
+    std::remove(file.c_str());
+
+    Matrix64 points, centroids;
+    std::vector<uint32_t> labels;
+    generator.generate_matrix(points, centroids, labels);
+
+    ASSERT_EQ(generator.num_points(), read_points.rows());
+    ASSERT_EQ(points.rows(), read_points.rows());
+    ASSERT_EQ(3u, read_points.cols());
+    EXPECT_EQ(5u, centroids.rows());
+    EXPECT_EQ(points.rows(), labels.size());
+
+    for (uint64_t p = 0; p < points.rows(); p += 997) {
+        for (uint64_t f = 0; f < points.cols(); ++f) {
+            EXPECT_EQ(points(p, f), read_points(p, f));
+        }
+    }
+}
+
+TEST(ClusterGenerator, ImbalancedClusters)
+{
+    auto generator = make_generator();
+    generator.imbalance(1.0f);
+
+    Matrix64 points, centroids;
+    std::vector<uint32_t> labels;
+    generator.generate_matrix(points, centroids, labels);
+
+    std::vector<uint64_t> sizes(5, 0);
+    for (auto label : labels) {
+        ASSERT_LT(label, 5u);
+        ++sizes[label];
+    }
+
+    // Sizes proportional to 1 / (c + 1)
+    for (uint64_t c = 1; c < sizes.size(); ++c) {
+        EXPECT_LT(sizes[c], sizes[c - 1]);
+        EXPECT_NEAR(
+                (double) sizes[0] / (c + 1),
+                (double) sizes[c],
+                1.0);
+    }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
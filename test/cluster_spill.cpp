@@ -0,0 +1,206 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <cl_kernels/centroid_update_cluster_spill.hpp>
+#include <centroid_update_configuration.hpp>
+#include <measurement/measurement.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/algorithm/copy.hpp>
+
+namespace bc = boost::compute;
+
+using ClusterSpill = Clustering::CentroidUpdateClusterSpill<
+    float, uint32_t, uint32_t, true>;
+
+size_t const num_points = 1 << 18;
+size_t const num_features = 4;
+size_t const global_size = 1024;
+size_t const local_size = 64;
+
+// Scratch space of one private copy per work item
+size_t const copy_size = global_size * num_features * sizeof(float);
+
+class ClusterSpillTest : public ::testing::Test {
+protected:
+    // Points in [0, 1) with skewed cluster masses. Every fifth cluster is
+    // empty, such that hot slots are assigned among tied masses.
+    void generate(size_t num_clusters) {
+        points.resize(num_points * num_features);
+        labels.resize(num_points);
+        masses.assign(num_clusters, 0);
+
+        std::default_random_engine rgen;
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        for (auto& x : points) {
+            x = uniform(rgen);
+        }
+        for (auto& l : labels) {
+            float u = uniform(rgen);
+            l = std::min(
+                    (uint32_t) (u * u * num_clusters),
+                    (uint32_t) num_clusters - 1);
+            if (num_clusters > 1 && l % 5 == 4) {
+                l -= 1;
+            }
+            masses[l] += 1;
+        }
+    }
+
+    // Sums of the points per cluster, and the expected hot clusters
+    void reference(
+            size_t num_clusters,
+            size_t num_hot,
+            std::vector<double>& sums,
+            std::vector<uint32_t>& hot)
+    {
+        sums.assign(num_clusters * num_features, 0.0);
+        for (size_t p = 0; p < num_points; ++p) {
+            for (size_t f = 0; f < num_features; ++f) {
+                sums[f * num_clusters + labels[p]] +=
+                    points[f * num_points + p];
+            }
+        }
+
+        std::vector<uint32_t> order(num_clusters);
+        for (size_t c = 0; c < num_clusters; ++c) {
+            order[c] = c;
+        }
+        std::stable_sort(
+                order.begin(),
+                order.end(),
+                [this](uint32_t a, uint32_t b) {
+                    return masses[a] > masses[b];
+                });
+        hot.assign(order.begin(), order.begin() + num_hot);
+    }
+
+    void run(size_t num_clusters, size_t num_hot) {
+        SCOPED_TRACE(num_clusters);
+        SCOPED_TRACE(num_hot);
+
+        bc::command_queue queue(
+                clenv->context,
+                clenv->device,
+                bc::command_queue::enable_profiling);
+
+        Clustering::CentroidUpdateConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "cluster_spill";
+        config.global_size[0] = global_size;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = local_size;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = 1;
+        // Budgets below one copy spill all clusters
+        config.scratch_budget = std::max(num_hot * copy_size, (size_t) 1);
+
+        ClusterSpill spill;
+        spill.prepare(clenv->context, config);
+        ASSERT_EQ(num_hot, spill.num_hot_clusters(num_features, num_clusters));
+
+        bc::vector<float> d_points(points.begin(), points.end(), queue);
+        bc::vector<float> d_centroids(
+                num_clusters * num_features, 0.0f, queue);
+        bc::vector<uint32_t> d_labels(labels.begin(), labels.end(), queue);
+        bc::vector<uint32_t> d_masses(masses.begin(), masses.end(), queue);
+
+        Measurement::Measurement measurement;
+        bc::wait_list wait_list;
+        spill(
+                queue,
+                num_features,
+                num_points,
+                num_clusters,
+                d_points.begin(),
+                d_points.end(),
+                d_centroids.begin(),
+                d_centroids.end(),
+                d_labels.begin(),
+                d_labels.end(),
+                d_masses.begin(),
+                d_masses.end(),
+                measurement.add_datapoint(),
+                wait_list).wait();
+
+        std::vector<float> centroids(num_clusters * num_features);
+        bc::copy(
+                d_centroids.begin(),
+                d_centroids.end(),
+                centroids.begin(),
+                queue);
+
+        std::vector<double> sums;
+        std::vector<uint32_t> hot;
+        reference(num_clusters, num_hot, sums, hot);
+
+        for (size_t i = 0; i < sums.size(); ++i) {
+            EXPECT_NEAR(centroids[i], sums[i], sums[i] * 1e-5 + 1e-3)
+                << "cluster " << i % num_clusters;
+        }
+
+        // Slot order is only defined if some clusters spill
+        if (num_hot < num_clusters) {
+            std::vector<cl_uint> device_hot = spill.hot_clusters(queue);
+            ASSERT_EQ(hot.size(), device_hot.size());
+            for (size_t h = 0; h < hot.size(); ++h) {
+                EXPECT_EQ(hot[h], device_hot[h]) << "slot " << h;
+            }
+        }
+    }
+
+    std::vector<float> points;
+    std::vector<uint32_t> labels;
+    std::vector<uint32_t> masses;
+};
+
+TEST_F(ClusterSpillTest, AllHot) {
+    for (size_t k : {1, 7, 64}) {
+        generate(k);
+        run(k, k);
+    }
+}
+
+TEST_F(ClusterSpillTest, AllSpilled) {
+    for (size_t k : {1, 7, 64}) {
+        generate(k);
+        run(k, 0);
+    }
+}
+
+TEST_F(ClusterSpillTest, SomeHot) {
+    for (size_t k : {7, 64, 1000}) {
+        generate(k);
+        run(k, 1);
+        run(k, k / 3);
+        // Includes empty clusters of tied mass
+        run(k, k - 1);
+    }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
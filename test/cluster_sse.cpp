@@ -0,0 +1,195 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <kmeans_single_stage.hpp>
+#include <kmeans_single_stage_buffered.hpp>
+#include <fused_configuration.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+
+size_t const num_features = 2;
+size_t const num_points = 1 << 18;
+// The buffered pipeline takes 2^21 points with two features per buffer,
+// the last buffer is shorter
+size_t const num_buffered_points = 2 * (1 << 21) + 4096;
+
+// The cluster SSE bins take at most a quarter of the local memory, see
+// ClusterSseArgs::LOCAL_MEMORY_FRACTION
+size_t const local_bins_fraction = 4;
+
+// Points of a cluster are either interleaved, such that each work item
+// sees a new label at every point, or in runs longer than the global size,
+// such that clusters beyond the bins are summed per run
+enum class Layout { Interleaved, Runs };
+
+// Parameters are (local size, layout)
+class ClusterSse
+    : public ::testing::TestWithParam<std::tuple<size_t, Layout>> {
+protected:
+    void SetUp() override {
+        std::tie(local_size, layout) = GetParam();
+
+        // The global size must be a multiple of the local size
+        global_size = local_size * 128;
+
+        // Exceed the bins even if the kernel had all of its quarter of
+        // local memory
+        size_t const max_bins =
+            clenv->device.local_memory_size()
+            / local_bins_fraction
+            / (local_size * sizeof(float));
+        num_clusters = max_bins + 17;
+
+        centroids.resize(num_clusters * num_features);
+        for (size_t c = 0; c < num_clusters; ++c) {
+            centroids[0 * num_clusters + c] = (float) (c * 10);
+            centroids[1 * num_clusters + c] = (float) ((c % 7) * 10);
+        }
+    }
+
+    std::vector<float> generate_points(size_t n) {
+        std::default_random_engine rgen;
+        std::uniform_real_distribution<float> noise(-3.0f, 3.0f);
+
+        size_t const run_length = 4 * global_size;
+
+        std::vector<float> points(n * num_features);
+        for (size_t p = 0; p < n; ++p) {
+            size_t const c = (layout == Layout::Interleaved)
+                ? p % num_clusters
+                : (p / run_length) % num_clusters;
+            for (size_t f = 0; f < num_features; ++f) {
+                points[f * n + p] =
+                    centroids[f * num_clusters + c] + noise(rgen);
+            }
+        }
+
+        return points;
+    }
+
+    // SSE of the points against the initial centroids, i.e. of the first
+    // labeling pass
+    std::vector<double> reference_sse(std::vector<float> const& points) {
+        size_t const n = points.size() / num_features;
+
+        std::vector<double> sse(num_clusters, 0.0);
+        for (size_t p = 0; p < n; ++p) {
+            float min_dist = std::numeric_limits<float>::max();
+            size_t label = 0;
+            for (size_t c = 0; c < num_clusters; ++c) {
+                float dist = 0.0f;
+                for (size_t f = 0; f < num_features; ++f) {
+                    float d = points[f * n + p]
+                        - centroids[f * num_clusters + c];
+                    dist = std::fma(d, d, dist);
+                }
+                if (dist < min_dist) {
+                    min_dist = dist;
+                    label = c;
+                }
+            }
+            sse[label] += min_dist;
+        }
+
+        return sse;
+    }
+
+    Clustering::FusedConfiguration fused_config() {
+        Clustering::FusedConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "cluster_merge";
+        config.global_size[0] = global_size;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = local_size;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = 1;
+        config.point_format = "float";
+        config.cluster_sse = true;
+        return config;
+    }
+
+    // Runs one iteration, whose SSE is against the initial centroids
+    template <typename Kmeans>
+    void run_and_verify(size_t n) {
+        auto points = std::make_shared<std::vector<float>>(
+                generate_points(n));
+        auto host_centroids = std::make_shared<std::vector<float>>(centroids);
+        auto masses = std::make_shared<std::vector<uint32_t>>(num_clusters);
+        auto labels = std::make_shared<std::vector<uint32_t>>(n);
+
+        Kmeans kmeans;
+        kmeans.set_context(clenv->context);
+        kmeans.set_queue(boost::compute::command_queue(
+                    clenv->context,
+                    clenv->device));
+        kmeans.set_fused(fused_config());
+        kmeans(1, num_features, points, host_centroids, masses, labels);
+
+        std::vector<double> reference = reference_sse(*points);
+        auto const& sse = kmeans.get_cluster_sse();
+        ASSERT_EQ(num_clusters, sse.size());
+
+        double total = 0.0;
+        for (size_t c = 0; c < num_clusters; ++c) {
+            EXPECT_NEAR(sse[c], reference[c], reference[c] * 1e-3 + 1e-3)
+                << "cluster " << c;
+            total += reference[c];
+        }
+        EXPECT_NEAR(kmeans.get_inertia(), total, total * 1e-3);
+    }
+
+    size_t local_size;
+    size_t global_size;
+    Layout layout;
+    size_t num_clusters;
+    std::vector<float> centroids;
+};
+
+TEST_P(ClusterSse, SingleStage) {
+    this->run_and_verify<
+        Clustering::KmeansSingleStage<float, uint32_t, uint32_t, true>
+        >(num_points);
+}
+
+// Sums the SSE over all buffers of an iteration
+TEST_P(ClusterSse, SingleStageBuffered) {
+    this->run_and_verify<
+        Clustering::KmeansSingleStageBuffered<float, uint32_t, uint32_t, true>
+        >(num_buffered_points);
+}
+
+// 63 work items reduce with a tree that is not a power of two
+INSTANTIATE_TEST_CASE_P(LocalSizeLayout,
+        ClusterSse,
+        ::testing::Combine(
+            ::testing::Values((size_t) 64, (size_t) 63),
+            ::testing::Values(Layout::Interleaved, Layout::Runs)
+            ));
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,135 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <clustering_quality.hpp>
+#include <cluster_generator.hpp>
+#include <binary_format.hpp>
+#include <matrix.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using Clustering::QualityMetrics;
+
+TEST(ClusteringQuality, IdenticalUpToPermutation)
+{
+    std::vector<uint32_t> labels = {0, 0, 1, 1, 2, 2};
+    std::vector<uint8_t> reference = {2, 2, 0, 0, 1, 1};
+
+    EXPECT_DOUBLE_EQ(
+            1.0,
+            QualityMetrics::adjusted_rand_index(labels, reference));
+    EXPECT_DOUBLE_EQ(
+            1.0,
+            QualityMetrics::normalized_mutual_information(labels, reference));
+}
+
+TEST(ClusteringQuality, KnownValues)
+{
+    std::vector<uint32_t> labels = {0, 0, 1, 1};
+    std::vector<uint32_t> reference = {0, 0, 1, 2};
+
+    EXPECT_NEAR(
+            0.5714285714,
+            QualityMetrics::adjusted_rand_index(labels, reference),
+            1e-9);
+    EXPECT_NEAR(
+            0.8,
+            QualityMetrics::normalized_mutual_information(labels, reference),
+            1e-9);
+
+    // Splitting a cluster in half is as good as chance
+    std::vector<uint32_t> single = {0, 0, 0, 0};
+    EXPECT_DOUBLE_EQ(
+            0.0,
+            QualityMetrics::adjusted_rand_index(single, reference));
+    EXPECT_DOUBLE_EQ(
+            0.0,
+            QualityMetrics::normalized_mutual_information(single, reference));
+}
+
+TEST(ClusteringQuality, SumOfSquaredErrors)
+{
+    cle::Matrix<float, std::allocator<float>, size_t> points;
+    cle::Matrix<float, std::allocator<float>, size_t> centroids;
+    points.resize(4, 2);
+    centroids.resize(2, 2);
+    std::vector<uint32_t> labels = {0, 0, 1, 1};
+
+    float const values[4][2] = {{0, 0}, {2, 0}, {10, 10}, {10, 14}};
+    for (size_t p = 0; p < 4; ++p) {
+        for (size_t f = 0; f < 2; ++f) {
+            points(p, f) = values[p][f];
+        }
+    }
+    centroids(0, 0) = 1; centroids(0, 1) = 0;
+    centroids(1, 0) = 10; centroids(1, 1) = 12;
+
+    auto quality =
+        QualityMetrics::evaluate(
+                points,
+                centroids,
+                labels,
+                std::vector<uint32_t>());
+
+    EXPECT_DOUBLE_EQ(1.0 + 1.0 + 4.0 + 4.0, quality.sse);
+    EXPECT_FALSE(quality.has_ground_truth());
+}
+
+TEST(ClusteringQuality, GeneratedGroundTruth)
+{
+    std::string file = "clustering_quality_ground_truth.bin";
+
+    cle::ClusterGenerator generator;
+    generator.total_size(1024 * 1024);
+    generator.num_features(2);
+    generator.num_clusters(4);
+    generator.point_multiple(8);
+    generator.domain(-100.0f, 100.0f);
+    generator.cluster_radius(1.0f);
+    generator.imbalance(0.5f);
+    generator.int8(true);
+    generator.generate_bin(file.c_str());
+
+    Clustering::BinaryFormat format;
+    cle::Matrix<float, std::allocator<float>, size_t> points;
+    cle::Matrix<float, std::allocator<float>, size_t> centroids;
+    std::vector<uint32_t> labels;
+    EXPECT_EQ(1, format.read(file.c_str(), points));
+    EXPECT_EQ(1, format.read_ground_truth(file.c_str(), centroids, labels));
+    std::remove(file.c_str());
+
+    cle::Matrix<float, std::allocator<float>, uint64_t> gen_points;
+    cle::Matrix<float, std::allocator<float>, uint64_t> gen_centroids;
+    std::vector<uint32_t> gen_labels;
+    generator.generate_matrix(gen_points, gen_centroids, gen_labels);
+
+    ASSERT_EQ(4u, centroids.rows());
+    ASSERT_EQ(2u, centroids.cols());
+    for (size_t c = 0; c < 4; ++c) {
+        EXPECT_EQ(gen_centroids(c, 0), centroids(c, 0));
+        EXPECT_EQ(gen_centroids(c, 1), centroids(c, 1));
+    }
+    EXPECT_TRUE(gen_labels == labels);
+
+    auto quality =
+        QualityMetrics::evaluate(points, centroids, labels, labels);
+    EXPECT_DOUBLE_EQ(1.0, quality.adjusted_rand_index);
+    EXPECT_DOUBLE_EQ(1.0, quality.normalized_mutual_information);
+    EXPECT_GT(quality.sse, 0.0);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
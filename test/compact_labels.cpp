@@ -0,0 +1,286 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <labeling_factory.hpp>
+#include <mass_update_factory.hpp>
+#include <centroid_update_factory.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/algorithm/copy.hpp>
+
+namespace bc = boost::compute;
+
+size_t const num_points = 1 << 18;
+size_t const num_features = 4;
+
+template <typename LabelT>
+class CompactLabels : public ::testing::Test {
+protected:
+    using MassT = uint32_t;
+
+    // The largest k that fits, or k = 300 for wider labels
+    size_t const num_clusters = std::min(
+            (size_t) std::numeric_limits<LabelT>::max() + 1,
+            (size_t) 300);
+
+    void SetUp() override {
+        points.resize(num_points * num_features);
+        centroids.resize(num_clusters * num_features);
+
+        std::default_random_engine rgen;
+        std::uniform_real_distribution<float> uniform(0.0f, 1000.0f);
+        for (auto& x : points) {
+            x = uniform(rgen);
+        }
+        for (size_t c = 0; c < num_clusters; ++c) {
+            for (size_t f = 0; f < num_features; ++f) {
+                centroids[f * num_clusters + c] = points[f * num_points + c];
+            }
+        }
+
+        reference_labels.resize(num_points);
+        reference_masses.assign(num_clusters, 0);
+        reference_sums.assign(num_clusters * num_features, 0.0);
+        reference_sse.assign(num_clusters, 0.0);
+        for (size_t p = 0; p < num_points; ++p) {
+            float min_dist = std::numeric_limits<float>::max();
+            size_t label = 0;
+            for (size_t c = 0; c < num_clusters; ++c) {
+                float dist = 0.0f;
+                for (size_t f = 0; f < num_features; ++f) {
+                    float d = points[f * num_points + p]
+                        - centroids[f * num_clusters + c];
+                    dist = std::fma(d, d, dist);
+                }
+                if (dist < min_dist) {
+                    min_dist = dist;
+                    label = c;
+                }
+            }
+            reference_labels[p] = label;
+            reference_masses[label] += 1;
+            reference_sse[label] += min_dist;
+            for (size_t f = 0; f < num_features; ++f) {
+                reference_sums[f * num_clusters + label] +=
+                    points[f * num_points + p];
+            }
+        }
+    }
+
+    void set_sizes(size_t (&global)[3], size_t (&local)[3]) {
+        global[0] = 8192;
+        global[1] = 1;
+        global[2] = 1;
+        local[0] = 64;
+        local[1] = 1;
+        local[2] = 1;
+    }
+
+    void run_labeling(size_t vector_length, bool cluster_sse = false) {
+        bc::command_queue queue(clenv->context, clenv->device);
+
+        Clustering::LabelingConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "unroll_vector";
+        set_sizes(config.global_size, config.local_size);
+        config.vector_length = vector_length;
+        config.unroll_clusters_length = 1;
+        config.unroll_features_length = 1;
+        config.cluster_sse = cluster_sse;
+
+        Measurement::Measurement measurement;
+        Clustering::LabelingFactory<float, LabelT, true> factory;
+        auto labeling = factory.create(clenv->context, config, measurement);
+
+        bc::vector<float> d_points(points.begin(), points.end(), queue);
+        bc::vector<float> d_centroids(centroids.begin(), centroids.end(), queue);
+        bc::vector<LabelT> d_labels(num_points, clenv->context);
+        bc::vector<float> d_cluster_sse(num_clusters, 0.0f, queue);
+
+        labeling(
+                queue,
+                num_features,
+                num_points,
+                num_clusters,
+                d_points.begin(),
+                d_points.end(),
+                d_centroids.begin(),
+                d_centroids.end(),
+                d_labels.begin(),
+                d_labels.end(),
+                d_cluster_sse.begin(),
+                d_cluster_sse.end(),
+                measurement.add_datapoint(),
+                bc::wait_list());
+
+        std::vector<LabelT> labels(num_points);
+        bc::copy(d_labels.begin(), d_labels.end(), labels.begin(), queue);
+
+        size_t wrong = 0;
+        for (size_t p = 0; p < num_points; ++p) {
+            wrong += (labels[p] != reference_labels[p]);
+        }
+        EXPECT_EQ(wrong, 0u);
+
+        if (cluster_sse) {
+            std::vector<float> sse(num_clusters);
+            bc::copy(
+                    d_cluster_sse.begin(),
+                    d_cluster_sse.end(),
+                    sse.begin(),
+                    queue);
+            for (size_t c = 0; c < num_clusters; ++c) {
+                EXPECT_NEAR(sse[c], reference_sse[c], reference_sse[c] * 1e-4);
+            }
+        }
+    }
+
+    void run_mass_update(std::string strategy) {
+        bc::command_queue queue(clenv->context, clenv->device);
+
+        Clustering::MassUpdateConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = strategy;
+        set_sizes(config.global_size, config.local_size);
+        config.vector_length = 1;
+
+        Measurement::Measurement measurement;
+        Clustering::MassUpdateFactory<LabelT, MassT> factory;
+        auto mass_update = factory.create(clenv->context, config, measurement);
+
+        bc::vector<LabelT> d_labels(
+                reference_labels.begin(),
+                reference_labels.end(),
+                queue);
+        bc::vector<MassT> d_masses(num_clusters, 0, queue);
+
+        mass_update(
+                queue,
+                num_points,
+                num_clusters,
+                d_labels.begin(),
+                d_labels.end(),
+                d_masses.begin(),
+                d_masses.end(),
+                measurement.add_datapoint(),
+                bc::wait_list());
+
+        std::vector<MassT> masses(num_clusters);
+        bc::copy(d_masses.begin(), d_masses.end(), masses.begin(), queue);
+        EXPECT_EQ(masses, reference_masses);
+    }
+
+    void run_centroid_update(std::string strategy) {
+        bc::command_queue queue(clenv->context, clenv->device);
+
+        Clustering::CentroidUpdateConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = strategy;
+        set_sizes(config.global_size, config.local_size);
+        config.vector_length = 1;
+        config.fixed_point_exponent = 20;
+
+        Measurement::Measurement measurement;
+        Clustering::CentroidUpdateFactory<float, LabelT, MassT, true> factory;
+        auto centroid_update =
+            factory.create(clenv->context, config, measurement);
+
+        bc::vector<float> d_points(points.begin(), points.end(), queue);
+        bc::vector<float> d_sums(num_clusters * num_features, 0.0f, queue);
+        bc::vector<LabelT> d_labels(
+                reference_labels.begin(),
+                reference_labels.end(),
+                queue);
+        bc::vector<MassT> d_masses(
+                reference_masses.begin(),
+                reference_masses.end(),
+                queue);
+
+        centroid_update(
+                queue,
+                num_features,
+                num_points,
+                num_clusters,
+                d_points.begin(),
+                d_points.end(),
+                d_sums.begin(),
+                d_sums.end(),
+                d_labels.begin(),
+                d_labels.end(),
+                d_masses.begin(),
+                d_masses.end(),
+                measurement.add_datapoint(),
+                bc::wait_list());
+
+        std::vector<float> sums(num_clusters * num_features);
+        bc::copy(d_sums.begin(), d_sums.end(), sums.begin(), queue);
+        for (size_t i = 0; i < sums.size(); ++i) {
+            EXPECT_NEAR(sums[i], reference_sums[i], reference_sums[i] * 1e-4);
+        }
+    }
+
+    std::vector<float> points;
+    std::vector<float> centroids;
+    std::vector<LabelT> reference_labels;
+    std::vector<MassT> reference_masses;
+    std::vector<double> reference_sums;
+    std::vector<double> reference_sse;
+};
+
+using LabelTypes = ::testing::Types<uint8_t, uint16_t, uint32_t>;
+TYPED_TEST_CASE(CompactLabels, LabelTypes);
+
+TYPED_TEST(CompactLabels, Labeling) {
+    this->run_labeling(1);
+    this->run_labeling(4);
+}
+
+TYPED_TEST(CompactLabels, ClusterSse) {
+    this->run_labeling(1, true);
+    this->run_labeling(4, true);
+}
+
+TYPED_TEST(CompactLabels, MassUpdate) {
+    for (auto strategy : {
+            "global_atomic", "part_global", "part_local", "part_private"}) {
+        SCOPED_TRACE(strategy);
+        this->run_mass_update(strategy);
+    }
+}
+
+TYPED_TEST(CompactLabels, CentroidUpdate) {
+    for (auto strategy : {
+            "feature_sum", "cluster_merge", "sorted_segment", "fixed_point"}) {
+        SCOPED_TRACE(strategy);
+        this->run_centroid_update(strategy);
+    }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,212 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <benchmark_harness.hpp>
+#include <centroid_update_factory.hpp>
+#include <centroid_update_configuration.hpp>
+#include <fused_factory.hpp>
+#include <fused_configuration.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/algorithm/copy.hpp>
+
+namespace bc = boost::compute;
+
+size_t const num_points = 1 << 22;
+size_t const num_features = 2;
+size_t const num_clusters = 4;
+
+struct SumResult {
+    double max_relative_error;
+    uint64_t kernel_time;
+};
+
+// Sums of many values around 1.0, at which float accumulation loses bits
+SumResult centroid_sum_run(std::string strategy, bool compensated_sum) {
+
+    std::vector<float> points(num_points * num_features);
+    std::vector<uint32_t> labels(num_points);
+    std::vector<double> reference(num_clusters * num_features, 0.0);
+
+    std::default_random_engine rgen;
+    std::uniform_real_distribution<float> uniform(1.0f, 1.001f);
+    for (size_t p = 0; p < num_points; ++p) {
+        labels[p] = p % num_clusters;
+        for (size_t f = 0; f < num_features; ++f) {
+            float x = uniform(rgen);
+            points[f * num_points + p] = x;
+            reference[f * num_clusters + labels[p]] += x;
+        }
+    }
+
+    bc::command_queue queue(
+            clenv->context,
+            clenv->device,
+            bc::command_queue::enable_profiling);
+
+    bc::vector<float> d_points(points.begin(), points.end(), queue);
+    bc::vector<float> d_centroids(num_clusters * num_features, 0.0f, queue);
+    bc::vector<uint32_t> d_labels(labels.begin(), labels.end(), queue);
+    bc::vector<uint32_t> d_masses(num_clusters, 0, queue);
+
+    Clustering::CentroidUpdateConfiguration config;
+    config.platform = 0;
+    config.device = 0;
+    config.strategy = strategy;
+    config.global_size[0] = 1024;
+    config.global_size[1] = 1;
+    config.global_size[2] = 1;
+    config.local_size[0] = 64;
+    config.local_size[1] = 1;
+    config.local_size[2] = 1;
+    config.vector_length = 1;
+    config.compensated_sum = compensated_sum;
+
+    Measurement::Measurement measurement;
+    Clustering::CentroidUpdateFactory<float, uint32_t, uint32_t, true> factory;
+    auto centroid_update = factory.create(
+            clenv->context,
+            config,
+            measurement);
+
+    bc::wait_list wait_list;
+    centroid_update(
+            queue,
+            num_features,
+            num_points,
+            num_clusters,
+            d_points.begin(),
+            d_points.end(),
+            d_centroids.begin(),
+            d_centroids.end(),
+            d_labels.begin(),
+            d_labels.end(),
+            d_masses.begin(),
+            d_masses.end(),
+            measurement.add_datapoint(),
+            wait_list);
+
+    std::vector<float> centroids(num_clusters * num_features);
+    bc::copy(d_centroids.begin(), d_centroids.end(), centroids.begin(), queue);
+
+    SumResult result = {0.0, 0};
+    for (size_t i = 0; i < centroids.size(); ++i) {
+        double error =
+            std::abs(centroids[i] - reference[i]) / reference[i];
+        result.max_relative_error = std::max(result.max_relative_error, error);
+    }
+
+    auto times = measurement.get_execution_times_by_name(
+            std::regex("CentroidUpdate.*"));
+    for (auto const& t : times) {
+        result.kernel_time += std::get<1>(t);
+    }
+
+    return result;
+}
+
+void compensated_sum_compare(std::string strategy) {
+
+    Clustering::BenchmarkHarness harness(5, 1);
+
+    SumResult plain;
+    harness.run([&](bool) {
+        plain = centroid_sum_run(strategy, false);
+        return plain.kernel_time;
+    });
+    Clustering::SampleStatistics plain_time = harness.statistics();
+
+    SumResult compensated;
+    harness.run([&](bool) {
+        compensated = centroid_sum_run(strategy, true);
+        return compensated.kernel_time;
+    });
+    Clustering::SampleStatistics compensated_time = harness.statistics();
+
+    std::cout
+        << strategy
+        << " plain: error " << plain.max_relative_error << ", ";
+    Clustering::BenchmarkHarness::print(std::cout, plain_time, "ns");
+    std::cout
+        << std::endl
+        << strategy
+        << " compensated: error " << compensated.max_relative_error << ", ";
+    Clustering::BenchmarkHarness::print(std::cout, compensated_time, "ns");
+    std::cout << std::endl;
+
+    // Within rounding of the float result
+    EXPECT_LT(compensated.max_relative_error, 1e-6);
+    EXPECT_LE(compensated.max_relative_error, plain.max_relative_error);
+}
+
+TEST(CompensatedSum, ClusterMerge) {
+    compensated_sum_compare("cluster_merge");
+}
+
+TEST(CompensatedSum, FeatureSum) {
+    compensated_sum_compare("feature_sum");
+}
+
+TEST(CompensatedSum, Unsupported) {
+    Clustering::CentroidUpdateConfiguration config;
+    config.strategy = "cluster_spill";
+    config.compensated_sum = true;
+
+    Measurement::Measurement measurement;
+    Clustering::CentroidUpdateFactory<float, uint32_t, uint32_t, true> factory;
+    EXPECT_THROW(
+            factory.create(clenv->context, config, measurement),
+            std::invalid_argument);
+}
+
+// Tuned strategies are checked when the pipeline is configured, not when
+// the tuning table first selects them
+TEST(CompensatedSum, UnsupportedTuningRule) {
+    Clustering::CentroidUpdateConfiguration config;
+    config.strategy = "cluster_merge";
+    config.compensated_sum = true;
+    config.tuning.add("* 1- 1- sorted_segment 32768 64 1");
+
+    Measurement::Measurement measurement;
+    Clustering::CentroidUpdateFactory<float, uint32_t, uint32_t, true> factory;
+    EXPECT_THROW(
+            factory.create(clenv->context, config, measurement),
+            std::invalid_argument);
+
+    Clustering::FusedConfiguration fused_config;
+    fused_config.strategy = "cluster_merge";
+    fused_config.compensated_sum = true;
+    fused_config.tuning.add("* 1- 1- feature_sum 32768 64 1");
+
+    Clustering::FusedFactory<float, uint32_t, uint32_t, true> fused_factory;
+    EXPECT_THROW(
+            fused_factory.create(clenv->context, fused_config, measurement),
+            std::invalid_argument);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
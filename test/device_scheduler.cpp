@@ -9,12 +9,14 @@
 
 #include <simple_buffer_cache.hpp>
 #include <single_device_scheduler.hpp>
+#include <cl_kernels/kernel_args.hpp>
 
 #include <chrono>
 #include <cstdint>
 #include <deque>
 #include <future>
 #include <memory>
+#include <regex>
 
 #include <gtest/gtest.h>
 #include <boost/compute/core.hpp>
@@ -28,8 +30,10 @@ constexpr size_t POOL_SIZE = 128ul << 20;   // 128 MB
 constexpr size_t OBJECT_SIZE = 256ul << 20; // 256 MB
 constexpr size_t GLOBAL_SIZE = 2048ul;
 constexpr size_t LOCAL_SIZE  = 64;
+constexpr uint32_t NUM_LABELS = 7;
 
 namespace bc = boost::compute;
+using LabelChangeArgs = Clustering::LabelChangeArgs;
 
 constexpr char zero_source[] =
 R"ENDSTR(
@@ -71,6 +75,20 @@ __kernel void reduce(__global int * const restrict dst, __global int * const res
 }
 )ENDSTR";
 
+constexpr char relabel_source[] =
+R"ENDSTR(
+#define CL_INT uint
+#define CL_LABEL uint
+#include "label_changes.cl"
+
+__kernel void relabel(__global int const * const restrict points, __global CL_LABEL * const restrict labels, CL_INT size, __global uchar * const restrict label_changes)
+{
+    for (uint i = get_global_id(0); i < size; i += get_global_size(0)) {
+        label_changes_store(labels, label_changes, size, i, points[i] % NUM_LABELS);
+    }
+}
+)ENDSTR";
+
 class DeviceSchedulerEnvironment : public ::testing::Environment
 {
 public:
@@ -200,6 +218,53 @@ public:
             dp.add_event() = event;
             return event;
         };
+
+        bc::program relabel_program = bc::program::build_with_source(
+                relabel_source,
+                queue.get_context(),
+                LabelChangeArgs::defines()
+                + " -DNUM_LABELS=" + std::to_string(NUM_LABELS)
+                );
+
+        relabel_f = [relabel_program, label_change_args = this->label_change_args](
+                bc::command_queue queue,
+                size_t cl_offset,
+                size_t /* points_size */,
+                size_t labels_size,
+                bc::buffer points,
+                bc::buffer labels,
+                bc::wait_list wait_list,
+                Measurement::DataPoint& dp
+                ) mutable
+        {
+            dp.set_name("relabel");
+            bc::kernel kernel = relabel_program.create_kernel("relabel");
+            kernel.set_args(points, labels, (cl_uint) (labels_size / sizeof(cl_uint)));
+            wait_list.insert(label_change_args(queue, kernel, 3, labels));
+            bc::event event;
+            event = queue.enqueue_1d_range_kernel(
+                    kernel,
+                    cl_offset / sizeof(cl_uint),
+                    GLOBAL_SIZE,
+                    LOCAL_SIZE,
+                    wait_list
+                    );
+            dp.add_event() = event;
+            return event;
+        };
+
+        relabel_dirty_f = [label_change_args = this->label_change_args](
+                bc::command_queue queue,
+                bc::buffer labels,
+                bc::wait_list wait_list
+                )
+        {
+            Clustering::BufferCache::DirtyBitmap dirty;
+            if (not label_change_args.changed_blocks(queue, labels, wait_list, dirty)) {
+                dirty.assign(1, true);
+            }
+            return dirty;
+        };
     }
 
     void TearDown()
@@ -211,6 +276,9 @@ public:
     Clustering::DeviceScheduler::FunUnary increment_f;
     Clustering::DeviceScheduler::FunBinary copy_f;
     Clustering::DeviceScheduler::FunBinary reduce_f;
+    Clustering::DeviceScheduler::FunBinary relabel_f;
+    Clustering::DeviceScheduler::FunDirty relabel_dirty_f;
+    LabelChangeArgs label_change_args;
 } *dsenv = nullptr;
 
 class SingleDeviceScheduler : public ::testing::Test {
@@ -446,6 +514,90 @@ TEST_F(SingleDeviceScheduler, RunBinaryWithSteps)
     EXPECT_EQ(0ul, failed_fields);
 }
 
+// The objects exceed the pool, such that the labels are evicted while the
+// scheduler runs
+TEST_F(SingleDeviceScheduler, ConvergedLabelsNotWrittenBack)
+{
+    int ret = 0;
+    std::future<std::deque<bc::event>> relabel_fevents;
+    Measurement::Measurement measurement;
+
+    for (size_t i = 0; i < snd_data_object.size(); ++i) {
+        snd_data_object[i] = fst_data_object[i] % NUM_LABELS;
+    }
+
+    ret = scheduler->enqueue(
+            dsenv->relabel_f,
+            fst_object_id,
+            snd_object_id,
+            buffer_size,
+            buffer_size,
+            Clustering::DeviceScheduler::ObjectAccess::Read,
+            Clustering::DeviceScheduler::ObjectAccess::ReadWrite,
+            dsenv->relabel_dirty_f,
+            relabel_fevents,
+            measurement.add_datapoint()
+            );
+    ASSERT_EQ(true, ret);
+
+    ret = scheduler->run();
+    ASSERT_EQ(true, ret);
+    dsenv->queue.finish();
+
+    auto write_backs = measurement.get_execution_times_by_name(
+            std::regex("BufferCache::write_back"));
+    EXPECT_EQ(0ul, write_backs.size());
+}
+
+TEST_F(SingleDeviceScheduler, ChangedLabelsWrittenBack)
+{
+    int ret = 0;
+    std::future<std::deque<bc::event>> relabel_fevents;
+    Measurement::Measurement measurement;
+    bc::wait_list dummy_wait_list;
+
+    for (size_t i = 0; i < snd_data_object.size(); ++i) {
+        snd_data_object[i] = fst_data_object[i] % NUM_LABELS;
+    }
+    snd_data_object[1] = NUM_LABELS;
+
+    ret = scheduler->enqueue(
+            dsenv->relabel_f,
+            fst_object_id,
+            snd_object_id,
+            buffer_size,
+            buffer_size,
+            Clustering::DeviceScheduler::ObjectAccess::Read,
+            Clustering::DeviceScheduler::ObjectAccess::ReadWrite,
+            dsenv->relabel_dirty_f,
+            relabel_fevents,
+            measurement.add_datapoint()
+            );
+    ASSERT_EQ(true, ret);
+
+    ret = scheduler->run();
+    ASSERT_EQ(true, ret);
+
+    bc::event read_event;
+    ret = buffer_cache->read(
+            dsenv->queue,
+            snd_object_id,
+            &snd_data_object[0],
+            &snd_data_object[buffer_ints],
+            read_event,
+            dummy_wait_list,
+            measurement.add_datapoint()
+            );
+    ASSERT_EQ(true, ret);
+    dsenv->queue.finish();
+
+    // Only the block of the changed label is written back on eviction
+    auto write_backs = measurement.get_execution_times_by_name(
+            std::regex("BufferCache::write_back"));
+    EXPECT_EQ(1ul, write_backs.size());
+    EXPECT_EQ(1u, snd_data_object[1]);
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,327 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <benchmark_harness.hpp>
+#include <centroid_update_factory.hpp>
+#include <centroid_update_configuration.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/algorithm/copy.hpp>
+#include <boost/compute/algorithm/fill.hpp>
+
+namespace bc = boost::compute;
+
+using FixedPoint = Clustering::CentroidUpdateFixedPoint<
+    float, uint32_t, uint32_t, true>;
+
+size_t const num_points = 1 << 20;
+size_t const num_features = 4;
+size_t const num_clusters = 16;
+
+class FixedPointTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        points.resize(num_points * num_features);
+        labels.resize(num_points);
+
+        std::default_random_engine rgen;
+        std::normal_distribution<float> normal(0.0f, 100.0f);
+        std::uniform_int_distribution<uint32_t> cluster(0, num_clusters - 1);
+        for (auto& x : points) {
+            x = normal(rgen);
+        }
+        for (auto& l : labels) {
+            l = cluster(rgen);
+        }
+    }
+
+    // Sum the points in chunks of chunk_points, as the buffered pipelines do
+    std::vector<float> run(
+            size_t global_size,
+            size_t local_size,
+            size_t chunk_points,
+            uint64_t *kernel_time = nullptr,
+            std::string strategy = "fixed_point")
+    {
+        bc::command_queue queue(
+                clenv->context,
+                clenv->device,
+                bc::command_queue::enable_profiling);
+
+        Clustering::CentroidUpdateConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = strategy;
+        config.global_size[0] = global_size;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = local_size;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = 1;
+        config.fixed_point_exponent = FixedPoint::fixed_point_exponent(
+                points.data(),
+                points.size(),
+                num_points);
+
+        Measurement::Measurement measurement;
+        Clustering::CentroidUpdateFactory<float, uint32_t, uint32_t, true>
+            factory;
+        auto centroid_update = factory.create(
+                clenv->context,
+                config,
+                measurement);
+
+        bc::vector<float> d_centroids(
+                num_clusters * num_features, 0.0f, queue);
+        bc::vector<uint32_t> d_masses(num_clusters, 0, queue);
+
+        // Run two iterations to check that the accumulator restarts
+        for (size_t iteration = 0; iteration < 2; ++iteration) {
+            bc::fill(d_centroids.begin(), d_centroids.end(), 0.0f, queue);
+            Clustering::CentroidUpdateFactory<
+                float,
+                uint32_t,
+                uint32_t,
+                true>::reset(centroid_update, d_centroids.get_buffer());
+
+            for (size_t begin = 0; begin < num_points; begin += chunk_points) {
+                size_t const size = std::min(chunk_points, num_points - begin);
+
+                std::vector<float> chunk(size * num_features);
+                for (size_t f = 0; f < num_features; ++f) {
+                    std::copy(
+                            points.begin() + f * num_points + begin,
+                            points.begin() + f * num_points + begin + size,
+                            chunk.begin() + f * size);
+                }
+                bc::vector<float> d_points(chunk.begin(), chunk.end(), queue);
+                bc::vector<uint32_t> d_labels(
+                        labels.begin() + begin,
+                        labels.begin() + begin + size,
+                        queue);
+
+                bc::wait_list wait_list;
+                centroid_update(
+                        queue,
+                        num_features,
+                        size,
+                        num_clusters,
+                        d_points.begin(),
+                        d_points.end(),
+                        d_centroids.begin(),
+                        d_centroids.end(),
+                        d_labels.begin(),
+                        d_labels.end(),
+                        d_masses.begin(),
+                        d_masses.end(),
+                        measurement.add_datapoint(),
+                        wait_list);
+            }
+        }
+
+        std::vector<float> centroids(num_clusters * num_features);
+        bc::copy(d_centroids.begin(), d_centroids.end(), centroids.begin(), queue);
+
+        if (kernel_time) {
+            *kernel_time = 0;
+            auto times = measurement.get_execution_times_by_name(
+                    std::regex("CentroidUpdate.*"));
+            for (auto const& t : times) {
+                *kernel_time += std::get<1>(t);
+            }
+        }
+
+        return centroids;
+    }
+
+    std::vector<float> points;
+    std::vector<uint32_t> labels;
+};
+
+bool bitwise_equal(std::vector<float> const& a, std::vector<float> const& b) {
+    return a.size() == b.size()
+        && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+TEST_F(FixedPointTest, RunToRun) {
+    auto first = run(8192, 64, num_points);
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_TRUE(bitwise_equal(first, run(8192, 64, num_points)));
+    }
+}
+
+TEST_F(FixedPointTest, WorkSizes) {
+    auto reference = run(8192, 64, num_points);
+    EXPECT_TRUE(bitwise_equal(reference, run(1024, 32, num_points)));
+    EXPECT_TRUE(bitwise_equal(reference, run(32768, 256, num_points)));
+}
+
+TEST_F(FixedPointTest, BufferChunks) {
+    std::vector<float> reference;
+    Clustering::BenchmarkHarness harness(5, 1);
+    harness.run([&](bool) {
+        uint64_t whole_time = 0;
+        reference = run(8192, 64, num_points, &whole_time);
+        return whole_time;
+    });
+
+    for (size_t chunk : {num_points / 2, num_points / 7, (size_t) 4096}) {
+        EXPECT_TRUE(bitwise_equal(reference, run(8192, 64, chunk)))
+            << "chunk " << chunk;
+    }
+
+    std::vector<double> exact(num_clusters * num_features, 0.0);
+    for (size_t p = 0; p < num_points; ++p) {
+        for (size_t f = 0; f < num_features; ++f) {
+            exact[f * num_clusters + labels[p]] +=
+                points[f * num_points + p];
+        }
+    }
+    for (size_t i = 0; i < exact.size(); ++i) {
+        EXPECT_NEAR(reference[i], exact[i], std::abs(exact[i]) * 1e-6 + 1e-3);
+    }
+
+    std::cout << "fixed_point ";
+    Clustering::BenchmarkHarness::print(std::cout, harness.statistics(), "ns");
+    std::cout << std::endl;
+}
+
+// Without reset, the second call adds to the sums of the first call
+TEST_F(FixedPointTest, Reset) {
+    bc::command_queue queue(clenv->context, clenv->device);
+
+    Clustering::CentroidUpdateConfiguration config;
+    config.platform = 0;
+    config.device = 0;
+    config.strategy = "fixed_point";
+    config.global_size[0] = 8192;
+    config.global_size[1] = 1;
+    config.global_size[2] = 1;
+    config.local_size[0] = 64;
+    config.local_size[1] = 1;
+    config.local_size[2] = 1;
+    config.vector_length = 1;
+    config.fixed_point_exponent = FixedPoint::fixed_point_exponent(
+            points.data(),
+            points.size(),
+            num_points);
+
+    Measurement::Measurement measurement;
+    Clustering::CentroidUpdateFactory<float, uint32_t, uint32_t, true>
+        factory;
+    auto centroid_update = factory.create(
+            clenv->context,
+            config,
+            measurement);
+
+    bc::vector<float> d_points(points.begin(), points.end(), queue);
+    bc::vector<uint32_t> d_labels(labels.begin(), labels.end(), queue);
+    bc::vector<float> d_centroids(
+            num_clusters * num_features, 0.0f, queue);
+    bc::vector<uint32_t> d_masses(num_clusters, 0, queue);
+
+    auto update = [&]() {
+        centroid_update(
+                queue,
+                num_features,
+                num_points,
+                num_clusters,
+                d_points.begin(),
+                d_points.end(),
+                d_centroids.begin(),
+                d_centroids.end(),
+                d_labels.begin(),
+                d_labels.end(),
+                d_masses.begin(),
+                d_masses.end(),
+                measurement.add_datapoint(),
+                bc::wait_list());
+        std::vector<float> centroids(num_clusters * num_features);
+        bc::copy(
+                d_centroids.begin(),
+                d_centroids.end(),
+                centroids.begin(),
+                queue);
+        return centroids;
+    };
+
+    std::vector<float> once = update();
+
+    // The centroids hold exactly the values of the last call, but the
+    // reset must still restart the sums from zero
+    bc::fill(d_centroids.begin(), d_centroids.end(), 0.0f, queue);
+    Clustering::CentroidUpdateFactory<float, uint32_t, uint32_t, true>::reset(
+            centroid_update,
+            d_centroids.get_buffer());
+    EXPECT_TRUE(bitwise_equal(once, update()));
+
+    std::vector<float> twice = update();
+    for (size_t i = 0; i < once.size(); ++i) {
+        EXPECT_NEAR(twice[i], 2 * once[i], std::abs(once[i]) * 1e-6 + 1e-3);
+    }
+}
+
+// Kernel time of fixed_point relative to cluster_merge
+TEST_F(FixedPointTest, Overhead) {
+    Clustering::BenchmarkHarness fixed_harness(5, 1);
+    fixed_harness.run([&](bool) {
+        uint64_t time = 0;
+        run(8192, 64, num_points, &time, "fixed_point");
+        return time;
+    });
+
+    Clustering::BenchmarkHarness merge_harness(5, 1);
+    merge_harness.run([&](bool) {
+        uint64_t time = 0;
+        run(8192, 64, num_points, &time, "cluster_merge");
+        return time;
+    });
+
+    double const overhead =
+        fixed_harness.statistics().median
+        / merge_harness.statistics().median;
+    EXPECT_GT(overhead, 0.0);
+
+    std::cout << "fixed_point ";
+    Clustering::BenchmarkHarness::print(
+            std::cout,
+            fixed_harness.statistics(),
+            "ns");
+    std::cout << std::endl << "cluster_merge ";
+    Clustering::BenchmarkHarness::print(
+            std::cout,
+            merge_harness.statistics(),
+            "ns");
+    std::cout << std::endl
+        << "fixed_point / cluster_merge " << overhead << std::endl;
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
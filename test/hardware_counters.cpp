@@ -0,0 +1,131 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <measurement/measurement.hpp>
+#include <measurement/hardware_counters.hpp>
+#include <measurement/columnar_format.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+uint64_t const num_iterations = 10000000;
+char const *const busy_name = "Busy";
+
+// At least one instruction per iteration
+uint64_t busy_loop() {
+    volatile uint64_t sum = 0;
+    for (uint64_t i = 0; i < num_iterations; ++i) {
+        sum = sum + i;
+    }
+    return sum;
+}
+
+// Counters of the datapoint as exported, by counter name
+std::map<std::string, uint64_t> exported_counters(
+        Measurement::Measurement& measurement) {
+
+    std::string const filename = "hardware_counters_test.clkm";
+    std::remove(filename.c_str());
+    measurement.write_columnar(filename);
+
+    std::ifstream is(filename, std::ios::in | std::ios::binary);
+    Measurement::ColumnarBlock block;
+    EXPECT_TRUE(block.read(is));
+    is.close();
+    std::remove(filename.c_str());
+
+    std::string const prefix = std::string(busy_name) + "#";
+    std::map<std::string, uint64_t> counters;
+    for (size_t i = 0; i < block.measurement_value.size(); ++i) {
+        std::string const& name =
+            block.strings[block.measurement_type_name[i]];
+        if (name.compare(0, prefix.size(), prefix) == 0) {
+            counters[name.substr(prefix.size())] = block.measurement_value[i];
+        }
+    }
+
+    return counters;
+}
+
+TEST(HardwareCounters, BusyLoop) {
+    Measurement::HardwareCounters counters;
+    if (not counters.available()) {
+        // Covered by WithoutPerf
+        return;
+    }
+
+    Measurement::Measurement measurement;
+    auto& dp = measurement.add_datapoint();
+    dp.set_name(busy_name);
+
+    counters.start();
+    busy_loop();
+    counters.stop(dp);
+
+    auto values = exported_counters(measurement);
+
+    // Counters that the CPU doesn't support are exported as zero
+    for (auto const& name : Measurement::HardwareCounters::names()) {
+        EXPECT_EQ(1u, values.count(name)) << name;
+    }
+    EXPECT_EQ(1u, values.count("MemoryBandwidth"));
+
+    EXPECT_LT(0u, values["Cycles"] + values["Instructions"]);
+    if (values["Instructions"] > 0) {
+        EXPECT_LE(num_iterations, values["Instructions"]);
+    }
+}
+
+TEST(HardwareCounters, WithoutPerf) {
+    // Without perf_event_open, e.g. in a container or with a high
+    // perf_event_paranoid, start and stop do nothing
+    Measurement::HardwareCounters counters;
+    if (counters.available()) {
+        // Covered by BusyLoop
+        return;
+    }
+
+    Measurement::Measurement measurement;
+    auto& dp = measurement.add_datapoint();
+    dp.set_name(busy_name);
+
+    counters.start();
+    busy_loop();
+    counters.stop(dp);
+
+    EXPECT_FALSE(counters.available());
+    EXPECT_TRUE(exported_counters(measurement).empty());
+}
+
+// stop() without start() counts from zero and must not fail
+TEST(HardwareCounters, StopWithoutStart) {
+    Measurement::HardwareCounters counters;
+
+    Measurement::Measurement measurement;
+    auto& dp = measurement.add_datapoint();
+    dp.set_name(busy_name);
+
+    counters.stop(dp);
+
+    // The counters and the memory bandwidth
+    size_t const expected = (counters.available())
+        ? Measurement::HardwareCounters::names().size() + 1
+        : 0;
+    EXPECT_EQ(expected, exported_counters(measurement).size());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,242 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <labeling_factory.hpp>
+#include <measurement/measurement.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/filesystem.hpp>
+
+namespace bc = boost::compute;
+namespace fs = boost::filesystem;
+
+size_t const num_points = 1 << 16;
+size_t const num_features = 4;
+size_t const num_clusters = 16;
+
+// Peaks that put the labeling left of the ridge point
+double const peak_bandwidth = 100.0;
+double const peak_performance = 1000.0;
+
+// write_csv prints six significant digits
+double const csv_precision = 1e-5;
+
+// One row of the roofline file, by column name
+using RooflineRow = std::map<std::string, std::string>;
+
+std::vector<std::string> split_csv(std::string const& line) {
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ',')) {
+        fields.push_back(field);
+    }
+    if (not line.empty() && line.back() == ',') {
+        fields.push_back(std::string());
+    }
+    return fields;
+}
+
+// Runs one labeling launch and reads its row of the roofline file
+class KernelWork : public ::testing::TestWithParam<bool> {
+protected:
+    using LabelT = uint32_t;
+    using MassT = uint32_t;
+
+    void run_labeling(bool mass_histogram, RooflineRow& row, uint64_t& time) {
+        bc::command_queue queue(
+                clenv->context,
+                clenv->device,
+                bc::command_queue::enable_profiling);
+
+        Clustering::LabelingConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "unroll_vector";
+        config.global_size[0] = 8192;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = 64;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = 1;
+        config.unroll_clusters_length = 1;
+        config.unroll_features_length = 1;
+
+        Measurement::Measurement measurement;
+        measurement.set_peak(peak_bandwidth, peak_performance);
+
+        std::vector<float> points(num_points * num_features, 1.0f);
+        std::vector<float> centroids(num_clusters * num_features, 0.0f);
+        bc::vector<float> d_points(points.begin(), points.end(), queue);
+        bc::vector<float> d_centroids(centroids.begin(), centroids.end(), queue);
+        bc::vector<LabelT> d_labels(num_points, clenv->context);
+        bc::vector<MassT> d_masses(num_clusters, 0, queue);
+
+        Clustering::LabelingFactory<float, LabelT, true> factory;
+        if (mass_histogram) {
+            auto labeling = factory.create_with_masses<MassT>(
+                    clenv->context,
+                    config,
+                    measurement);
+            labeling(
+                    queue,
+                    num_features,
+                    num_points,
+                    num_clusters,
+                    d_points.begin(),
+                    d_points.end(),
+                    d_centroids.begin(),
+                    d_centroids.end(),
+                    d_labels.begin(),
+                    d_labels.end(),
+                    d_masses.begin(),
+                    d_masses.end(),
+                    bc::buffer_iterator<float>(),
+                    bc::buffer_iterator<float>(),
+                    measurement.add_datapoint(),
+                    bc::wait_list());
+        }
+        else {
+            auto labeling = factory.create(
+                    clenv->context,
+                    config,
+                    measurement);
+            labeling(
+                    queue,
+                    num_features,
+                    num_points,
+                    num_clusters,
+                    d_points.begin(),
+                    d_points.end(),
+                    d_centroids.begin(),
+                    d_centroids.end(),
+                    d_labels.begin(),
+                    d_labels.end(),
+                    bc::buffer_iterator<float>(),
+                    bc::buffer_iterator<float>(),
+                    measurement.add_datapoint(),
+                    bc::wait_list());
+        }
+        queue.finish();
+
+        auto times = measurement.get_execution_times_by_name(
+                std::regex("LabelingUnrollVector"));
+        ASSERT_EQ(1u, times.size());
+        time = std::get<1>(times[0]);
+
+        fs::path const dir = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(dir);
+        measurement.write_csv((dir / "work.csv").string());
+
+        std::string const suffix = "_work_roof.csv";
+        std::string roofline_file;
+        for (fs::directory_iterator it(dir); it != fs::directory_iterator(); ++it) {
+            std::string const name = it->path().filename().string();
+            if (name.size() >= suffix.size()
+                    && name.compare(
+                        name.size() - suffix.size(),
+                        suffix.size(),
+                        suffix) == 0) {
+                roofline_file = it->path().string();
+            }
+        }
+        ASSERT_FALSE(roofline_file.empty());
+
+        std::ifstream rf(roofline_file);
+        std::string header, line;
+        ASSERT_TRUE(std::getline(rf, header).good());
+        ASSERT_TRUE(std::getline(rf, line).good());
+        rf.close();
+        fs::remove_all(dir);
+
+        std::vector<std::string> columns = split_csv(header);
+        std::vector<std::string> fields = split_csv(line);
+        ASSERT_EQ(columns.size(), fields.size());
+        for (size_t i = 0; i < columns.size(); ++i) {
+            row[columns[i]] = fields[i];
+        }
+    }
+};
+
+TEST_P(KernelWork, Labeling) {
+    bool const mass_histogram = GetParam();
+
+    RooflineRow row;
+    uint64_t time = 0;
+    this->run_labeling(mass_histogram, row, time);
+    ASSERT_LT(0u, time);
+
+    // Points and centroids are read once, a label per point and a mass per
+    // cluster are written once, and each distance takes a subtract,
+    // multiply and add per feature
+    uint64_t const bytes_read =
+        num_points * num_features * sizeof(float)
+        + num_clusters * num_features * sizeof(float);
+    uint64_t const bytes_written =
+        num_points * sizeof(LabelT)
+        + ((mass_histogram) ? num_clusters * sizeof(MassT) : 0);
+    uint64_t const flops =
+        3 * (uint64_t) num_points * num_clusters * num_features;
+
+    EXPECT_EQ(1048832u, bytes_read);
+    EXPECT_EQ(12582912u, flops);
+
+    EXPECT_EQ("LabelingUnrollVector", row["TypeName"]);
+    EXPECT_EQ(std::to_string(bytes_read), row["BytesRead"]);
+    EXPECT_EQ(std::to_string(bytes_written), row["BytesWritten"]);
+    EXPECT_EQ(std::to_string(flops), row["Flops"]);
+    EXPECT_EQ(std::to_string(time), row["Time"]);
+
+    // Bytes and FLOPs per nanosecond are GB/s and GFLOP/s
+    double const bandwidth = (double) (bytes_read + bytes_written) / time;
+    double const performance = (double) flops / time;
+    double const intensity = (double) flops / (bytes_read + bytes_written);
+
+    EXPECT_NEAR(bandwidth, std::stod(row["Bandwidth"]),
+            bandwidth * csv_precision);
+    EXPECT_NEAR(performance, std::stod(row["Performance"]),
+            performance * csv_precision);
+    EXPECT_NEAR(intensity, std::stod(row["Intensity"]),
+            intensity * csv_precision);
+    EXPECT_NEAR(bandwidth / peak_bandwidth,
+            std::stod(row["BandwidthUtilization"]),
+            bandwidth / peak_bandwidth * csv_precision);
+    EXPECT_NEAR(performance / peak_performance,
+            std::stod(row["PerformanceUtilization"]),
+            performance / peak_performance * csv_precision);
+
+    // An intensity of about 9.6 FLOP/B is below the ridge point at 10
+    EXPECT_EQ("Memory", row["Bound"]);
+}
+
+INSTANTIATE_TEST_CASE_P(MassHistogram,
+        KernelWork,
+        ::testing::Bool());
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,128 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <kmeans_single_stage_buffered.hpp>
+#include <fused_configuration.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+
+size_t const num_features = 2;
+size_t const num_clusters = 4;
+size_t const vector_length = 4;
+// Two buffers of float points with two features, and a last buffer with a
+// tail that is shorter than a vector
+size_t const num_points = 2 * (1 << 21) + 1003;
+uint32_t const no_label = 0xFFFFFFFFu;
+
+// Runs the buffered single stage pipeline with and without
+// labels_final_only, which must write back the same labels
+class LabelsFinalOnly : public ::testing::Test {
+protected:
+    using Kmeans = Clustering::KmeansSingleStageBuffered<
+        float, uint32_t, uint32_t, true>;
+
+    void SetUp() {
+        // Well separated blobs, point p belongs to blob p % k
+        std::default_random_engine rgen;
+        std::uniform_real_distribution<float> noise(-5.0f, 5.0f);
+
+        points = std::make_shared<std::vector<float>>(
+                num_points * num_features);
+        for (size_t f = 0; f < num_features; ++f) {
+            for (size_t p = 0; p < num_points; ++p) {
+                (*points)[f * num_points + p] =
+                    (float) ((p % num_clusters) * 100) + noise(rgen);
+            }
+        }
+    }
+
+    void run_buffered(
+            bool final_only,
+            std::vector<uint32_t>& labels,
+            std::vector<uint32_t>& masses) {
+
+        auto centroids = std::make_shared<std::vector<float>>(
+                num_clusters * num_features);
+        for (size_t f = 0; f < num_features; ++f) {
+            for (size_t c = 0; c < num_clusters; ++c) {
+                (*centroids)[f * num_clusters + c] = (float) (c * 100 + 10);
+            }
+        }
+        auto host_masses =
+            std::make_shared<std::vector<uint32_t>>(num_clusters);
+        auto host_labels =
+            std::make_shared<std::vector<uint32_t>>(num_points, no_label);
+
+        Clustering::FusedConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "cluster_merge";
+        config.global_size[0] = 8192;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = 64;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = vector_length;
+        config.point_format = "native";
+
+        Kmeans kmeans;
+        kmeans.set_context(clenv->context);
+        kmeans.set_queue(boost::compute::command_queue(
+                    clenv->context,
+                    clenv->device));
+        kmeans.set_fused(config);
+        kmeans.set_labels_final_only(final_only);
+        kmeans(3, num_features, points, centroids, host_masses, host_labels);
+
+        labels = *host_labels;
+        masses = *host_masses;
+    }
+
+    std::shared_ptr<std::vector<float>> points;
+};
+
+TEST_F(LabelsFinalOnly, SameLabelsAsReadWrite) {
+    std::vector<uint32_t> labels, final_only_labels;
+    std::vector<uint32_t> masses, final_only_masses;
+
+    this->run_buffered(false, labels, masses);
+    this->run_buffered(true, final_only_labels, final_only_masses);
+
+    // The kernels skip the points after the last whole vector, which keep
+    // their host labels in both modes
+    size_t const labeled_points = num_points - num_points % vector_length;
+
+    size_t wrong = 0, differing = 0;
+    for (size_t p = 0; p < num_points; ++p) {
+        uint32_t const expected =
+            (p < labeled_points) ? p % num_clusters : no_label;
+        wrong += (labels[p] != expected);
+        differing += (final_only_labels[p] != labels[p]);
+    }
+    EXPECT_EQ(0u, wrong);
+    EXPECT_EQ(0u, differing);
+    EXPECT_EQ(masses, final_only_masses);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,216 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <labeling_factory.hpp>
+#include <mass_update_factory.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/algorithm/copy.hpp>
+
+namespace bc = boost::compute;
+
+// A multiple of all vector lengths, such that no point is skipped
+size_t const num_points = 1 << 16;
+size_t const num_features = 4;
+
+// Number of clusters below the local bins
+size_t const few_clusters = 20;
+
+// The labeling kernel takes at most a quarter of the local memory for bins,
+// see LabelingUnrollVector::LOCAL_BINS_FRACTION
+size_t const local_bins_fraction = 4;
+
+void histogram_verify(
+        std::vector<uint32_t> const& data,
+        std::vector<uint32_t>& histogram
+        ) {
+
+    std::fill(histogram.begin(), histogram.end(), 0);
+
+    for_each(data.begin(), data.end(), [&](uint32_t x){ ++histogram[x]; });
+}
+
+// Parameters are (k above the local bins, vector length, cluster SSE)
+class MassHistogram
+    : public ::testing::TestWithParam<std::tuple<bool, size_t, bool>> {
+protected:
+    using LabelT = uint32_t;
+    using MassT = uint32_t;
+
+    void SetUp() override {
+        bool above_bins;
+        std::tie(above_bins, vector_length, cluster_sse) = GetParam();
+
+        // Exceed the bins even if the kernel had all of its quarter of
+        // local memory
+        size_t const max_bins =
+            clenv->device.local_memory_size()
+            / local_bins_fraction
+            / sizeof(MassT);
+        num_clusters = (above_bins) ? max_bins + 37 : few_clusters;
+
+        points.resize(num_points * num_features);
+        centroids.resize(num_clusters * num_features);
+
+        std::default_random_engine rgen;
+        std::uniform_real_distribution<float> uniform(0.0f, 1000.0f);
+        for (auto& x : points) {
+            x = uniform(rgen);
+        }
+        for (size_t c = 0; c < num_clusters; ++c) {
+            for (size_t f = 0; f < num_features; ++f) {
+                centroids[f * num_clusters + c] =
+                    points[f * num_points + c % num_points];
+            }
+        }
+    }
+
+    void set_sizes(size_t (&global)[3], size_t (&local)[3]) {
+        global[0] = 8192;
+        global[1] = 1;
+        global[2] = 1;
+        local[0] = 64;
+        local[1] = 1;
+        local[2] = 1;
+    }
+
+    // Label with the mass histogram and return the labels and masses
+    void run_labeling(
+            std::vector<LabelT>& labels,
+            std::vector<MassT>& masses) {
+
+        bc::command_queue queue(clenv->context, clenv->device);
+
+        Clustering::LabelingConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "unroll_vector";
+        set_sizes(config.global_size, config.local_size);
+        config.vector_length = vector_length;
+        config.unroll_clusters_length = 1;
+        config.unroll_features_length = 1;
+        config.cluster_sse = cluster_sse;
+
+        Measurement::Measurement measurement;
+        Clustering::LabelingFactory<float, LabelT, true> factory;
+        auto labeling = factory.create_with_masses<MassT>(
+                clenv->context,
+                config,
+                measurement);
+
+        bc::vector<float> d_points(points.begin(), points.end(), queue);
+        bc::vector<float> d_centroids(centroids.begin(), centroids.end(), queue);
+        bc::vector<LabelT> d_labels(num_points, clenv->context);
+        bc::vector<MassT> d_masses(num_clusters, 0, queue);
+        bc::vector<float> d_cluster_sse(num_clusters, 0.0f, queue);
+
+        labeling(
+                queue,
+                num_features,
+                num_points,
+                num_clusters,
+                d_points.begin(),
+                d_points.end(),
+                d_centroids.begin(),
+                d_centroids.end(),
+                d_labels.begin(),
+                d_labels.end(),
+                d_masses.begin(),
+                d_masses.end(),
+                d_cluster_sse.begin(),
+                d_cluster_sse.end(),
+                measurement.add_datapoint(),
+                bc::wait_list());
+
+        labels.resize(num_points);
+        masses.resize(num_clusters);
+        bc::copy(d_labels.begin(), d_labels.end(), labels.begin(), queue);
+        bc::copy(d_masses.begin(), d_masses.end(), masses.begin(), queue);
+    }
+
+    // Count the labels with histogram_global
+    void run_histogram_global(
+            std::vector<LabelT> const& labels,
+            std::vector<MassT>& masses) {
+
+        bc::command_queue queue(clenv->context, clenv->device);
+
+        Clustering::MassUpdateConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "global_atomic";
+        set_sizes(config.global_size, config.local_size);
+        config.vector_length = 1;
+
+        Measurement::Measurement measurement;
+        Clustering::MassUpdateFactory<LabelT, MassT> factory;
+        auto mass_update = factory.create(clenv->context, config, measurement);
+
+        bc::vector<LabelT> d_labels(labels.begin(), labels.end(), queue);
+        bc::vector<MassT> d_masses(num_clusters, 0, queue);
+
+        mass_update(
+                queue,
+                num_points,
+                num_clusters,
+                d_labels.begin(),
+                d_labels.end(),
+                d_masses.begin(),
+                d_masses.end(),
+                measurement.add_datapoint(),
+                bc::wait_list());
+
+        masses.resize(num_clusters);
+        bc::copy(d_masses.begin(), d_masses.end(), masses.begin(), queue);
+    }
+
+    size_t num_clusters;
+    size_t vector_length;
+    bool cluster_sse;
+    std::vector<float> points;
+    std::vector<float> centroids;
+};
+
+TEST_P(MassHistogram, SameAsHistogramGlobal) {
+    std::vector<LabelT> labels;
+    std::vector<MassT> masses, global_masses, reference_masses(num_clusters);
+
+    this->run_labeling(labels, masses);
+    this->run_histogram_global(labels, global_masses);
+    histogram_verify(labels, reference_masses);
+
+    EXPECT_EQ(global_masses, reference_masses);
+    EXPECT_EQ(masses, global_masses);
+}
+
+INSTANTIATE_TEST_CASE_P(BinsVectorSse,
+        MassHistogram,
+        ::testing::Combine(
+            ::testing::Bool(),
+            ::testing::Values((size_t) 1, (size_t) 4),
+            ::testing::Bool()
+            ));
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,333 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <measurement/measurement.hpp>
+#include <measurement/columnar_format.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace bc = boost::compute;
+namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
+
+size_t const num_writes = 16;
+size_t const write_size = 1 << 20;
+
+// Trace timestamps are in microseconds with three decimals, a start plus
+// a duration is off by up to two roundings
+double const trace_resolution = 0.002;
+
+// Writes a buffer num_writes times, one datapoint per write
+void enqueue_writes(Measurement::Measurement& measurement) {
+    bc::command_queue queue(
+            clenv->context,
+            clenv->device,
+            bc::command_queue::enable_profiling);
+
+    std::vector<uint32_t> host(write_size / sizeof(uint32_t), 1);
+    bc::buffer buffer(clenv->context, write_size);
+
+    for (size_t i = 0; i < num_writes; ++i) {
+        auto& dp = measurement.add_datapoint(i);
+        dp.set_name("Write");
+        dp.add_event() = queue.enqueue_write_buffer_async(
+                buffer,
+                0,
+                write_size,
+                host.data());
+    }
+
+    queue.finish();
+}
+
+void check_times(Measurement::Measurement& measurement) {
+    auto times = measurement.get_execution_times_by_name(std::regex("Write"));
+    EXPECT_EQ(num_writes, times.size());
+    for (auto const& t : times) {
+        EXPECT_LT(0u, std::get<1>(t));
+    }
+}
+
+TEST(Measurement, RetainEvents) {
+    Measurement::Measurement measurement;
+    enqueue_writes(measurement);
+    check_times(measurement);
+}
+
+TEST(Measurement, EventCapacity) {
+    Measurement::Measurement measurement;
+    measurement.set_event_capacity(2 * num_writes);
+    enqueue_writes(measurement);
+    check_times(measurement);
+}
+
+TEST(Measurement, EventCapacityExceeded) {
+    // Events beyond the capacity are retained
+    Measurement::Measurement measurement;
+    measurement.set_event_capacity(num_writes / 4);
+    enqueue_writes(measurement);
+    check_times(measurement);
+}
+
+TEST(Measurement, ColumnarAppend) {
+    std::string const filename = "measurement_test.clkm";
+    std::remove(filename.c_str());
+
+    for (int run = 0; run < 2; ++run) {
+        Measurement::Measurement measurement;
+        measurement.set_run(run);
+        measurement.set_parameter("NumPoints", "42");
+        enqueue_writes(measurement);
+        measurement.write_columnar(filename);
+    }
+
+    std::ifstream is(filename, std::ios::in | std::ios::binary);
+    Measurement::ColumnarBlock block;
+    for (int run = 0; run < 2; ++run) {
+        ASSERT_TRUE(block.read(is));
+        EXPECT_EQ(run, block.run);
+        EXPECT_EQ(2u, block.parameters.size());
+        EXPECT_EQ(num_writes, block.measurement_value.size());
+        EXPECT_EQ(num_writes, block.event_end.size());
+
+        ASSERT_EQ(1u, block.summaries.size());
+        auto const& s = block.summaries[0];
+        EXPECT_EQ("Write", block.strings[s.type_name]);
+        EXPECT_EQ(num_writes, s.count);
+        EXPECT_LE(s.min, s.median);
+        EXPECT_LE(s.median, s.p99);
+        EXPECT_LE(s.min * num_writes, s.sum);
+    }
+    EXPECT_FALSE(block.read(is));
+
+    is.close();
+    std::remove(filename.c_str());
+}
+
+// Finds the file that Measurement wrote into dir, whose name starts with
+// the date and experiment ID
+std::string find_output(fs::path const& dir, std::string const& suffix) {
+    for (fs::directory_iterator it(dir); it != fs::directory_iterator(); ++it) {
+        std::string const name = it->path().filename().string();
+        if (name.size() >= suffix.size()
+                && name.compare(
+                    name.size() - suffix.size(),
+                    suffix.size(),
+                    suffix) == 0) {
+            return it->path().string();
+        }
+    }
+    return std::string();
+}
+
+// Three writes, a copy after the last write and a host span that waits on
+// the last write
+TEST(Measurement, TraceExport) {
+    size_t const num_trace_writes = 3;
+    uint64_t const host_duration = 5000;
+
+    fs::path const dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+
+    bc::command_queue queue(
+            clenv->context,
+            clenv->device,
+            bc::command_queue::enable_profiling);
+
+    std::vector<uint32_t> host(write_size / sizeof(uint32_t), 1);
+    bc::buffer src(clenv->context, write_size);
+    bc::buffer dst(clenv->context, write_size);
+
+    Measurement::Measurement measurement;
+    measurement.set_parameter("NumPoints", "42");
+
+    bc::event last_write;
+    for (size_t i = 0; i < num_trace_writes; ++i) {
+        auto& dp = measurement.add_datapoint(i);
+        dp.set_name("Write");
+        last_write = queue.enqueue_write_buffer_async(
+                src,
+                0,
+                write_size,
+                host.data());
+        dp.add_event() = last_write;
+    }
+
+    bc::wait_list after_write;
+    after_write.insert(last_write);
+
+    auto& copy = measurement.add_datapoint();
+    copy.set_name("Copy");
+    copy.add_dependencies(after_write);
+    copy.add_event() = queue.enqueue_copy_buffer(
+            src,
+            dst,
+            0,
+            0,
+            write_size,
+            after_write);
+
+    queue.finish();
+
+    uint64_t const host_start = Measurement::DataPoint::host_timestamp();
+    auto& io = measurement.add_datapoint();
+    io.set_name("Memcpy");
+    io.add_host_span("IO", host_start, host_start + host_duration, after_write);
+
+    measurement.write_trace((dir / "trace.json").string());
+    std::string const trace_file = find_output(dir, "_trace_trce.json");
+    ASSERT_FALSE(trace_file.empty());
+
+    pt::ptree trace;
+    ASSERT_NO_THROW(pt::read_json(trace_file, trace));
+    fs::remove_all(dir);
+
+    EXPECT_EQ("ns", trace.get<std::string>("displayTimeUnit"));
+    EXPECT_EQ("42", trace.get<std::string>("otherData.NumPoints"));
+
+    std::map<std::string, std::vector<pt::ptree>> slices;
+    std::map<std::string, std::vector<pt::ptree>> metadata;
+    std::vector<pt::ptree> flow_starts, flow_ends;
+    for (auto const& e : trace.get_child("traceEvents")) {
+        std::string const ph = e.second.get<std::string>("ph");
+        std::string const name = e.second.get<std::string>("name");
+        if (ph == "X") {
+            slices[name].push_back(e.second);
+        }
+        else if (ph == "M") {
+            metadata[name].push_back(e.second);
+        }
+        else if (ph == "s") {
+            flow_starts.push_back(e.second);
+        }
+        else if (ph == "f") {
+            flow_ends.push_back(e.second);
+        }
+        else {
+            ADD_FAILURE() << "unexpected phase " << ph;
+        }
+    }
+
+    // One process for the queues and one for the host
+    ASSERT_EQ(2u, metadata["process_name"].size());
+    EXPECT_EQ("Command Queues",
+            metadata["process_name"][0].get<std::string>("args.name"));
+    EXPECT_EQ("Host",
+            metadata["process_name"][1].get<std::string>("args.name"));
+    ASSERT_EQ(2u, metadata["thread_name"].size());
+    EXPECT_EQ(1, metadata["thread_name"][0].get<int>("pid"));
+    EXPECT_EQ("Queue 0",
+            metadata["thread_name"][0].get<std::string>("args.name"));
+    EXPECT_EQ(2, metadata["thread_name"][1].get<int>("pid"));
+    EXPECT_EQ("IO", metadata["thread_name"][1].get<std::string>("args.name"));
+
+    // Device slices are relative to the first write and as long as the
+    // events
+    auto times = measurement.get_execution_times_by_name(std::regex("Write"));
+    ASSERT_EQ(num_trace_writes, times.size());
+    auto const& writes = slices["Write"];
+    ASSERT_EQ(num_trace_writes, writes.size());
+    for (size_t i = 0; i < num_trace_writes; ++i) {
+        EXPECT_EQ(1, writes[i].get<int>("pid"));
+        EXPECT_EQ(0, writes[i].get<int>("tid"));
+        EXPECT_EQ((int) i, writes[i].get<int>("args.iteration"));
+        EXPECT_NEAR(
+                std::get<1>(times[i]) / 1000.0,
+                writes[i].get<double>("dur"),
+                trace_resolution);
+    }
+    EXPECT_NEAR(0.0, writes[0].get<double>("ts"), trace_resolution);
+
+    // The queue is in order
+    for (size_t i = 1; i < num_trace_writes; ++i) {
+        EXPECT_LE(
+                writes[i - 1].get<double>("ts")
+                + writes[i - 1].get<double>("dur"),
+                writes[i].get<double>("ts") + trace_resolution);
+    }
+    double const last_write_end =
+        writes.back().get<double>("ts") + writes.back().get<double>("dur");
+
+    ASSERT_EQ(1u, slices["Copy"].size());
+    pt::ptree const& copy_slice = slices["Copy"][0];
+    EXPECT_EQ(1, copy_slice.get<int>("pid"));
+    EXPECT_EQ(0u, copy_slice.count("args"));
+    EXPECT_LE(last_write_end, copy_slice.get<double>("ts") + trace_resolution);
+
+    // The host clock is aligned such that the only host span starts at the
+    // end of the write it waits on
+    ASSERT_EQ(1u, slices["Memcpy"].size());
+    pt::ptree const& io_slice = slices["Memcpy"][0];
+    EXPECT_EQ(2, io_slice.get<int>("pid"));
+    EXPECT_EQ(0, io_slice.get<int>("tid"));
+    EXPECT_NEAR(host_duration / 1000.0, io_slice.get<double>("dur"),
+            trace_resolution);
+    EXPECT_NEAR(last_write_end, io_slice.get<double>("ts"),
+            trace_resolution);
+
+    // Flows from the last write to the copy and to the host span
+    ASSERT_EQ(2u, flow_starts.size());
+    ASSERT_EQ(2u, flow_ends.size());
+    for (size_t i = 0; i < 2; ++i) {
+        EXPECT_EQ((int) i, flow_starts[i].get<int>("id"));
+        EXPECT_EQ((int) i, flow_ends[i].get<int>("id"));
+        EXPECT_EQ(1, flow_starts[i].get<int>("pid"));
+        EXPECT_LE(writes.back().get<double>("ts"),
+                flow_starts[i].get<double>("ts"));
+        EXPECT_GE(last_write_end, flow_starts[i].get<double>("ts"));
+        EXPECT_EQ("e", flow_ends[i].get<std::string>("bp"));
+    }
+    EXPECT_EQ(1, flow_ends[0].get<int>("pid"));
+    EXPECT_EQ(copy_slice.get<double>("ts"), flow_ends[0].get<double>("ts"));
+    EXPECT_EQ(2, flow_ends[1].get<int>("pid"));
+    EXPECT_EQ(io_slice.get<double>("ts"), flow_ends[1].get<double>("ts"));
+}
+
+TEST(Measurement, ColumnarSummary) {
+    std::vector<uint32_t> names;
+    std::vector<uint64_t> values;
+    for (uint64_t v = 1; v <= 200; ++v) {
+        names.push_back(v % 2);
+        values.push_back(v);
+    }
+
+    auto summaries = Measurement::ColumnarBlock::summarize(names, values);
+    ASSERT_EQ(2u, summaries.size());
+
+    // Even values 2..200
+    EXPECT_EQ(0u, summaries[0].type_name);
+    EXPECT_EQ(100u, summaries[0].count);
+    EXPECT_EQ(10100u, summaries[0].sum);
+    EXPECT_EQ(2u, summaries[0].min);
+    EXPECT_EQ(100u, summaries[0].median);
+    EXPECT_EQ(198u, summaries[0].p99);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
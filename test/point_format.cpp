@@ -0,0 +1,206 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <point_format.hpp>
+#include <buffer_helper.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using Clustering::PointFormat;
+using Clustering::PointFormatHelper;
+
+TEST(PointFormat, Parse)
+{
+    EXPECT_EQ(PointFormat::Half, PointFormatHelper::parse("half"));
+    EXPECT_EQ(PointFormat::BFloat16, PointFormatHelper::parse("bfloat16"));
+    EXPECT_EQ(PointFormat::Int8, PointFormatHelper::parse("int8"));
+    EXPECT_EQ(PointFormat::Native, PointFormatHelper::parse("float"));
+    EXPECT_EQ(PointFormat::Native, PointFormatHelper::parse(""));
+}
+
+TEST(PointFormat, StorageLength)
+{
+    EXPECT_EQ(8u, PointFormatHelper::storage_length<float>(PointFormat::Native, 8));
+    EXPECT_EQ(4u, PointFormatHelper::storage_length<float>(PointFormat::Half, 8));
+    EXPECT_EQ(5u, PointFormatHelper::storage_length<float>(PointFormat::BFloat16, 9));
+    EXPECT_EQ(3u, PointFormatHelper::storage_length<float>(PointFormat::Int8, 9));
+}
+
+TEST(PointFormat, HalfExact)
+{
+    EXPECT_EQ(0x0000, PointFormatHelper::float_to_half(0.0f));
+    EXPECT_EQ(0x8000, PointFormatHelper::float_to_half(-0.0f));
+    EXPECT_EQ(0x3c00, PointFormatHelper::float_to_half(1.0f));
+    EXPECT_EQ(0xc100, PointFormatHelper::float_to_half(-2.5f));
+    EXPECT_EQ(0x7bff, PointFormatHelper::float_to_half(65504.0f));
+    // Smallest subnormal
+    EXPECT_EQ(0x0001, PointFormatHelper::float_to_half(std::ldexp(1.0f, -24)));
+}
+
+TEST(PointFormat, HalfRounding)
+{
+    // Overflow and ties to even
+    EXPECT_EQ(0x7c00, PointFormatHelper::float_to_half(1e6f));
+    EXPECT_EQ(0x3c00, PointFormatHelper::float_to_half(1.0f + std::ldexp(1.0f, -11)));
+    EXPECT_EQ(0x3c02, PointFormatHelper::float_to_half(1.0f + 3.0f * std::ldexp(1.0f, -11)));
+    EXPECT_EQ(0x7e00, PointFormatHelper::float_to_half(std::numeric_limits<float>::quiet_NaN()) & 0x7e00);
+}
+
+TEST(PointFormat, BFloat16)
+{
+    EXPECT_EQ(0x3f80, PointFormatHelper::float_to_bfloat16(1.0f));
+    EXPECT_EQ(0xc020, PointFormatHelper::float_to_bfloat16(-2.5f));
+    // Ties to even
+    EXPECT_EQ(0x3f80, PointFormatHelper::float_to_bfloat16(1.0f + std::ldexp(1.0f, -8)));
+    EXPECT_EQ(0x3f82, PointFormatHelper::float_to_bfloat16(1.0f + 3.0f * std::ldexp(1.0f, -8)));
+    // NaN stays NaN
+    uint16_t nan = PointFormatHelper::float_to_bfloat16(std::numeric_limits<float>::quiet_NaN());
+    EXPECT_EQ(0x7f80, nan & 0x7f80);
+    EXPECT_NE(0, nan & 0x007f);
+}
+
+TEST(PointFormat, Int8RoundTrip)
+{
+    size_t const num_points = 1000;
+    size_t const num_features = 3;
+    std::vector<float> points(num_points * num_features);
+    for (size_t f = 0; f < num_features; ++f) {
+        for (size_t p = 0; p < num_points; ++p) {
+            points[f * num_points + p] = (f == 2)
+                ? 7.0f
+                : std::sin((float) p) * (f + 1) * 10.0f;
+        }
+    }
+
+    auto quant = PointFormatHelper::quantization(
+            points.data(),
+            num_points,
+            num_features);
+    ASSERT_EQ(num_features, quant.min.size());
+    ASSERT_EQ(num_features, quant.scale.size());
+    // Constant feature
+    EXPECT_EQ(7.0f, quant.min[2]);
+    EXPECT_EQ(1.0f, quant.scale[2]);
+
+    std::vector<uint8_t> packed(num_points * num_features);
+    PointFormatHelper::pack(
+            PointFormat::Int8,
+            points.data(),
+            num_points,
+            num_features,
+            quant,
+            packed.data());
+
+    for (size_t f = 0; f < num_features; ++f) {
+        for (size_t p = 0; p < num_points; ++p) {
+            size_t i = f * num_points + p;
+            float value = quant.min[f] + quant.scale[f] * packed[i];
+            EXPECT_NEAR(points[i], value, quant.scale[f] / 2.0f * 1.001f);
+        }
+    }
+}
+
+TEST(PointFormat, PointsPerBuffer)
+{
+    size_t const buffer_size = 16 * 1024;
+
+    // Labels are wider than the points for int8 with F < 4 and for
+    // half and bfloat16 with F = 1
+    for (size_t num_features : {1, 2, 3, 4, 5}) {
+        for (auto format : {
+                PointFormat::Int8,
+                PointFormat::Half,
+                PointFormat::BFloat16,
+                PointFormat::Native}) {
+            size_t points = PointFormatHelper::points_per_buffer<
+                float, uint32_t>(format, num_features, buffer_size);
+            size_t point_bytes = points * num_features
+                * PointFormatHelper::value_size<float>(format);
+
+            EXPECT_LE(point_bytes, buffer_size);
+            EXPECT_LE(points * sizeof(uint32_t), buffer_size);
+            // The wider of points and labels fills the buffer
+            EXPECT_GT(
+                    std::max(point_bytes, points * sizeof(uint32_t))
+                    + std::max(
+                        num_features
+                        * PointFormatHelper::value_size<float>(format),
+                        sizeof(uint32_t)),
+                    buffer_size);
+        }
+    }
+
+    EXPECT_EQ(4096u, (PointFormatHelper::points_per_buffer<float, uint32_t>(
+                    PointFormat::Int8, 1, buffer_size)));
+    EXPECT_EQ(4096u, (PointFormatHelper::points_per_buffer<float, uint32_t>(
+                    PointFormat::Int8, 3, buffer_size)));
+    EXPECT_EQ(4096u, (PointFormatHelper::points_per_buffer<float, uint32_t>(
+                    PointFormat::Half, 1, buffer_size)));
+    EXPECT_EQ(8192u, (PointFormatHelper::points_per_buffer<float, uint8_t>(
+                    PointFormat::Half, 1, buffer_size)));
+}
+
+TEST(PointFormat, Int8Partition)
+{
+    // Packed int8 points with fewer features than a 32-bit label has
+    // bytes, partitioned as in KmeansSingleStageBuffered
+    size_t const num_points = 1000;
+    size_t const buffer_size = 256;
+
+    for (size_t num_features : {1, 2, 3}) {
+        SCOPED_TRACE(num_features);
+
+        std::vector<uint8_t> packed(num_points * num_features);
+        for (size_t i = 0; i < packed.size(); ++i) {
+            packed[i] = (uint8_t) (i * 7);
+        }
+
+        size_t const buffer_points =
+            PointFormatHelper::points_per_buffer<float, uint32_t>(
+                    PointFormat::Int8,
+                    num_features,
+                    buffer_size);
+        size_t const points_buffer_size = buffer_points * num_features;
+        ASSERT_LE(buffer_points * sizeof(uint32_t), buffer_size);
+
+        std::vector<uint8_t> partitioned(packed.size());
+        ASSERT_LT(0, Clustering::BufferHelper::partition_matrix(
+                    packed.data(),
+                    partitioned.data(),
+                    packed.size(),
+                    num_features,
+                    points_buffer_size));
+
+        for (size_t p = 0; p < num_points; ++p) {
+            size_t b = p / buffer_points;
+            size_t chunk_points =
+                std::min(buffer_points, num_points - b * buffer_points);
+            for (size_t f = 0; f < num_features; ++f) {
+                EXPECT_EQ(
+                        packed[f * num_points + p],
+                        partitioned[
+                            b * points_buffer_size
+                            + f * chunk_points
+                            + p % buffer_points]);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
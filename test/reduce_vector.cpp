@@ -7,12 +7,16 @@
  * Copyright (c) 2016-2017, Lutz, Clemens <lutzcle@cml.li>
  */
 
+#include <benchmark_harness.hpp>
 #include <cl_kernels/reduce_vector_parcol.hpp>
 
 #include <cstdint>
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <iostream>
+#include <regex>
+#include <tuple>
 
 #include <gtest/gtest.h>
 
@@ -42,7 +46,8 @@ void reduce_vector_run(
         boost::compute::command_queue queue,
         cle::Matrix<uint32_t, std::allocator<uint32_t>, uint32_t> const& data,
         std::vector<uint32_t>& reduced,
-        Measurement::Measurement& measurement
+        Measurement::Measurement& measurement,
+        bool host_finish = false
         ) {
 
     reduced.resize(data.rows());
@@ -50,6 +55,7 @@ void reduce_vector_run(
 
     Clustering::ReduceVectorParcol<uint32_t> reducevector;
     reducevector.prepare(context);
+    reducevector.set_host_finish(host_finish);
     boost::compute::wait_list wait_list;
 
     auto& dp = measurement.add_datapoint();
@@ -220,6 +226,89 @@ TEST(ReduceVectorParcol, FurySize) {
                 ));
 }
 
+TEST(ReduceVectorParcol, HostFinish) {
+
+    auto const& data = dgen.def_size(4, 2048 * 32);
+    std::vector<uint32_t> test_output;
+    std::vector<uint32_t> verify_output;
+    Measurement::Measurement measurement;
+
+    reduce_vector_run(
+            clenv->context,
+            clenv->queue,
+            data,
+            test_output,
+            measurement,
+            true
+            );
+    reduce_vector_verify(data, verify_output);
+
+    EXPECT_TRUE(std::equal(
+                test_output.begin(),
+                test_output.end(),
+                verify_output.begin()
+                ));
+}
+
+TEST(ReduceVectorParcol, Scaling) {
+
+    for (size_t rows : {4, 20, 256}) {
+        for (size_t copies = 64; copies <= 65536; copies *= 2) {
+            auto const& data = dgen.def_size(rows, copies);
+            std::vector<uint32_t> test_output;
+            std::vector<uint32_t> verify_output;
+            Measurement::Measurement measurement;
+
+            reduce_vector_run(
+                    clenv->context,
+                    clenv->queue,
+                    data,
+                    test_output,
+                    measurement
+                    );
+            reduce_vector_verify(data, verify_output);
+
+            EXPECT_TRUE(std::equal(
+                        test_output.begin(),
+                        test_output.end(),
+                        verify_output.begin()
+                        ))
+                << "rows " << rows << " copies " << copies;
+
+            Clustering::BenchmarkHarness harness(5, 1);
+            harness.run([&](bool) {
+                Measurement::Measurement run_measurement;
+                reduce_vector_run(
+                        clenv->context,
+                        clenv->queue,
+                        data,
+                        test_output,
+                        run_measurement
+                        );
+
+                uint64_t time = 0;
+                auto times = run_measurement.get_execution_times_by_name(
+                        std::regex("ReduceVectorParcol"));
+                for (auto const& t : times) {
+                    time += std::get<1>(t);
+                }
+                return time;
+            });
+
+            std::cout
+                << "rows " << rows
+                << " copies " << copies
+                << " passes "
+                << Clustering::ReduceVectorParcol<uint32_t>::num_passes(
+                        copies, rows)
+                << " ";
+            Clustering::BenchmarkHarness::print(
+                    std::cout, harness.statistics(), "ns");
+            std::cout << std::endl;
+        }
+    }
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   clenv = new CLEnvironment;
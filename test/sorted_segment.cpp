@@ -0,0 +1,181 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <centroid_update_factory.hpp>
+#include <centroid_update_configuration.hpp>
+#include <measurement/measurement.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+#include <boost/compute/container/vector.hpp>
+#include <boost/compute/algorithm/copy.hpp>
+
+namespace bc = boost::compute;
+
+size_t const num_points = 1 << 18;
+size_t const num_features = 4;
+
+// Compares sorted_segment against a host reference and cluster_merge
+template <typename LabelT>
+class SortedSegmentTest : public ::testing::Test {
+protected:
+    // Points in [0, 1) with skewed cluster masses. Every third cluster
+    // is empty, and the last clusters of large k get no points either.
+    void generate(size_t num_clusters) {
+        points.resize(num_points * num_features);
+        labels.resize(num_points);
+        masses.assign(num_clusters, 0);
+
+        std::default_random_engine rgen;
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        for (auto& x : points) {
+            x = uniform(rgen);
+        }
+        for (auto& l : labels) {
+            float u = uniform(rgen);
+            size_t c = std::min(
+                    (size_t) (u * u * u * num_clusters),
+                    num_clusters - 1);
+            if (num_clusters > 1 && c % 3 == 2) {
+                c -= 1;
+            }
+            l = (LabelT) c;
+            masses[c] += 1;
+        }
+
+        sums.assign(num_clusters * num_features, 0.0);
+        for (size_t p = 0; p < num_points; ++p) {
+            for (size_t f = 0; f < num_features; ++f) {
+                sums[f * num_clusters + labels[p]] +=
+                    points[f * num_points + p];
+            }
+        }
+    }
+
+    std::vector<float> run(std::string strategy, size_t num_clusters) {
+        bc::command_queue queue(
+                clenv->context,
+                clenv->device,
+                bc::command_queue::enable_profiling);
+
+        Clustering::CentroidUpdateConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = strategy;
+        config.global_size[0] = 1024;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = 64;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = 1;
+
+        Measurement::Measurement measurement;
+        Clustering::CentroidUpdateFactory<float, LabelT, uint32_t, true>
+            factory;
+        auto centroid_update = factory.create(
+                clenv->context,
+                config,
+                measurement);
+
+        bc::vector<float> d_points(points.begin(), points.end(), queue);
+        bc::vector<float> d_centroids(
+                num_clusters * num_features, 0.0f, queue);
+        bc::vector<LabelT> d_labels(labels.begin(), labels.end(), queue);
+        bc::vector<uint32_t> d_masses(masses.begin(), masses.end(), queue);
+
+        bc::wait_list wait_list;
+        centroid_update(
+                queue,
+                num_features,
+                num_points,
+                num_clusters,
+                d_points.begin(),
+                d_points.end(),
+                d_centroids.begin(),
+                d_centroids.end(),
+                d_labels.begin(),
+                d_labels.end(),
+                d_masses.begin(),
+                d_masses.end(),
+                measurement.add_datapoint(),
+                wait_list).wait();
+
+        std::vector<float> centroids(num_clusters * num_features);
+        bc::copy(
+                d_centroids.begin(),
+                d_centroids.end(),
+                centroids.begin(),
+                queue);
+
+        return centroids;
+    }
+
+    void compare(size_t num_clusters) {
+        SCOPED_TRACE(num_clusters);
+
+        generate(num_clusters);
+        std::vector<float> segment = run("sorted_segment", num_clusters);
+        std::vector<float> merge = run("cluster_merge", num_clusters);
+
+        ASSERT_EQ(sums.size(), segment.size());
+        for (size_t i = 0; i < sums.size(); ++i) {
+            size_t const c = i % num_clusters;
+            if (masses[c] == 0) {
+                EXPECT_EQ(0.0f, segment[i]) << "empty cluster " << c;
+            }
+            EXPECT_NEAR(segment[i], sums[i], sums[i] * 1e-5 + 1e-3)
+                << "cluster " << c;
+            EXPECT_NEAR(segment[i], merge[i], sums[i] * 1e-5 + 1e-3)
+                << "cluster " << c;
+        }
+    }
+
+    std::vector<float> points;
+    std::vector<LabelT> labels;
+    std::vector<uint32_t> masses;
+    std::vector<double> sums;
+};
+
+using LabelTypes = ::testing::Types<uint32_t, uint16_t, uint8_t>;
+TYPED_TEST_CASE(SortedSegmentTest, LabelTypes);
+
+TYPED_TEST(SortedSegmentTest, SmallK) {
+    for (size_t k : {1, 2, 5, 16}) {
+        this->compare(k);
+    }
+}
+
+TYPED_TEST(SortedSegmentTest, LargeK) {
+    // Up to the largest k of the label type
+    size_t const max_k = std::min(
+            (size_t) 1000,
+            (size_t) std::numeric_limits<TypeParam>::max() + 1);
+    for (size_t k : {(size_t) 64, (size_t) 255, max_k}) {
+        this->compare(std::min(k, max_k));
+    }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,211 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <kmeans_single_stage.hpp>
+#include <kmeans_three_stage.hpp>
+#include <fused_configuration.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "opencl_setup.hpp"
+
+#include <boost/compute/core.hpp>
+
+size_t const num_features = 4;
+size_t const num_clusters = 8;
+size_t const num_batch_points = 1 << 14;
+size_t const num_batches = 4;
+
+class Streaming : public ::testing::Test {
+protected:
+    using Kmeans = Clustering::KmeansSingleStage<float, uint32_t, uint32_t, true>;
+
+    void SetUp() override {
+        // Well separated blobs, point p belongs to blob p % k. The first k
+        // points of the first batch therefore seed one centroid per blob.
+        std::default_random_engine rgen;
+        std::uniform_real_distribution<float> noise(-5.0f, 5.0f);
+
+        batches.resize(num_batches);
+        for (auto& batch : batches) {
+            batch.resize(num_batch_points * num_features);
+            for (size_t f = 0; f < num_features; ++f) {
+                for (size_t p = 0; p < num_batch_points; ++p) {
+                    float center = (float) ((p % num_clusters) * 100
+                            + f * 10);
+                    batch[f * num_batch_points + p] = center + noise(rgen);
+                }
+            }
+        }
+    }
+
+    void set_up_kmeans(Kmeans& kmeans, double decay) {
+        Clustering::FusedConfiguration config;
+        config.platform = 0;
+        config.device = 0;
+        config.strategy = "cluster_merge";
+        config.global_size[0] = 8192;
+        config.global_size[1] = 1;
+        config.global_size[2] = 1;
+        config.local_size[0] = 64;
+        config.local_size[1] = 1;
+        config.local_size[2] = 1;
+        config.vector_length = 1;
+        config.point_format = "float";
+
+        kmeans.set_context(clenv->context);
+        kmeans.set_queue(boost::compute::command_queue(
+                    clenv->context,
+                    clenv->device));
+        kmeans.set_fused(config);
+        kmeans.set_features(num_features);
+        kmeans.set_clusters(num_clusters);
+        kmeans.set_decay(decay);
+    }
+
+    // Mini-batch k-means on the host with the same decayed weighting as
+    // KmeansSingleStage::ingest
+    void reference_ingest(std::vector<float> const& batch) {
+        if (reference_centroids.empty()) {
+            reference_centroids.resize(num_clusters * num_features);
+            reference_weights.assign(num_clusters, 0.0);
+            for (size_t f = 0; f < num_features; ++f) {
+                for (size_t c = 0; c < num_clusters; ++c) {
+                    reference_centroids[f * num_clusters + c] =
+                        batch[f * num_batch_points + c];
+                }
+            }
+        }
+
+        std::vector<double> sums(num_clusters * num_features, 0.0);
+        std::vector<uint32_t> masses(num_clusters, 0);
+        for (size_t p = 0; p < num_batch_points; ++p) {
+            float min_dist = std::numeric_limits<float>::max();
+            size_t label = 0;
+            for (size_t c = 0; c < num_clusters; ++c) {
+                float dist = 0.0f;
+                for (size_t f = 0; f < num_features; ++f) {
+                    float d = batch[f * num_batch_points + p]
+                        - reference_centroids[f * num_clusters + c];
+                    dist = std::fma(d, d, dist);
+                }
+                if (dist < min_dist) {
+                    min_dist = dist;
+                    label = c;
+                }
+            }
+            masses[label] += 1;
+            for (size_t f = 0; f < num_features; ++f) {
+                sums[f * num_clusters + label] +=
+                    batch[f * num_batch_points + p];
+            }
+        }
+
+        for (size_t c = 0; c < num_clusters; ++c) {
+            double old_weight = decay * reference_weights[c];
+            double weight = old_weight + masses[c];
+            if (weight > 0.0) {
+                for (size_t f = 0; f < num_features; ++f) {
+                    size_t index = f * num_clusters + c;
+                    reference_centroids[index] = (float) (
+                            (old_weight * reference_centroids[index]
+                             + sums[index])
+                            / weight);
+                }
+            }
+            reference_weights[c] = weight;
+        }
+    }
+
+    void run_streaming(double d) {
+        decay = d;
+        reference_centroids.clear();
+
+        Kmeans kmeans;
+        set_up_kmeans(kmeans, decay);
+
+        for (auto const& batch : batches) {
+            kmeans.ingest(batch.data(), num_batch_points);
+            reference_ingest(batch);
+
+            auto centroids = kmeans.snapshot_centroids();
+            ASSERT_EQ(centroids.size(), reference_centroids.size());
+            for (size_t i = 0; i < centroids.size(); ++i) {
+                EXPECT_NEAR(centroids[i], reference_centroids[i], 1e-2);
+            }
+
+            auto const& masses = kmeans.get_cluster_masses();
+            for (size_t c = 0; c < num_clusters; ++c) {
+                EXPECT_EQ(
+                        masses[c],
+                        (uint32_t) (reference_weights[c] + 0.5));
+            }
+        }
+    }
+
+    std::vector<std::vector<float>> batches;
+    std::vector<float> reference_centroids;
+    std::vector<double> reference_weights;
+    double decay;
+};
+
+TEST_F(Streaming, IngestBatches) {
+    this->run_streaming(1.0);
+}
+
+TEST_F(Streaming, IngestBatchesWithDecay) {
+    this->run_streaming(0.5);
+}
+
+TEST_F(Streaming, SnapshotBeforeIngest) {
+    Kmeans kmeans;
+    EXPECT_TRUE(kmeans.snapshot_centroids().empty());
+}
+
+TEST_F(Streaming, FirstBatchSmallerThanClusters) {
+    Kmeans kmeans;
+    set_up_kmeans(kmeans, 1.0);
+    EXPECT_THROW(
+            kmeans.ingest(batches[0].data(), num_clusters - 1),
+            std::invalid_argument);
+}
+
+TEST_F(Streaming, BatchWithOtherFeatures) {
+    Kmeans kmeans;
+    set_up_kmeans(kmeans, 1.0);
+    kmeans.ingest(batches[0].data(), num_batch_points);
+
+    kmeans.set_features(num_features / 2);
+    EXPECT_THROW(
+            kmeans.ingest(batches[1].data(), 2 * num_batch_points),
+            std::invalid_argument);
+}
+
+TEST_F(Streaming, UnsupportedPipeline) {
+    Clustering::KmeansThreeStage<float, uint32_t, uint32_t, true> kmeans;
+    kmeans.set_features(num_features);
+    kmeans.set_clusters(num_clusters);
+    EXPECT_THROW(
+            kmeans.ingest(batches[0].data(), num_batch_points),
+            std::invalid_argument);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  clenv = new CLEnvironment;
+  ::testing::AddGlobalTestEnvironment(clenv);
+  return RUN_ALL_TESTS();
+}
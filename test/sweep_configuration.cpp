@@ -0,0 +1,109 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <sweep_configuration.hpp>
+#include <configuration_parser.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using Clustering::SweepAxis;
+using Clustering::SweepConfiguration;
+
+TEST(SweepConfiguration, ParseAxis)
+{
+    SweepAxis axis = SweepConfiguration::parse_axis(
+            "kmeans.labeling.vector_length 1 2 4");
+
+    EXPECT_EQ("kmeans.labeling.vector_length", axis.option);
+    ASSERT_EQ(3u, axis.values.size());
+    EXPECT_EQ("1", axis.values[0]);
+    EXPECT_EQ("4", axis.values[2]);
+
+    EXPECT_THROW(
+            SweepConfiguration::parse_axis("kmeans.clusters"),
+            std::invalid_argument);
+}
+
+TEST(SweepConfiguration, CrossProduct)
+{
+    SweepConfiguration sweep;
+    EXPECT_EQ(1u, sweep.size());
+    EXPECT_TRUE(sweep.point(0).empty());
+
+    sweep.add_axis("kmeans.clusters 4 8 16");
+    sweep.add_axis("kmeans.types.point float double");
+    ASSERT_EQ(6u, sweep.size());
+
+    // Last option varies fastest
+    auto first = sweep.point(0);
+    ASSERT_EQ(2u, first.size());
+    EXPECT_EQ("kmeans.clusters", first[0].first);
+    EXPECT_EQ("4", first[0].second);
+    EXPECT_EQ("float", first[1].second);
+
+    auto second = sweep.point(1);
+    EXPECT_EQ("4", second[0].second);
+    EXPECT_EQ("double", second[1].second);
+
+    auto last = sweep.point(5);
+    EXPECT_EQ("16", last[0].second);
+    EXPECT_EQ("double", last[1].second);
+
+    EXPECT_THROW(sweep.point(6), std::out_of_range);
+}
+
+TEST(SweepConfiguration, OverrideOptions)
+{
+    std::string file = "sweep_configuration_test.conf";
+    {
+        std::ofstream conf(file);
+        conf
+            << "[kmeans]\n"
+            << "clusters = 4\n"
+            << "pipeline = three_stage\n"
+            << "[kmeans.labeling]\n"
+            << "global_size = 1024\n"
+            << "[sweep]\n"
+            << "data = a.bin\n"
+            << "data = b.bin\n"
+            << "vary = kmeans.clusters 8 16\n"
+            << "vary = kmeans.labeling.global_size 2048 4096\n";
+    }
+
+    Clustering::ConfigurationParser config;
+    config.parse_file(file);
+    std::remove(file.c_str());
+
+    auto sweep = config.get_sweep_configuration();
+    ASSERT_EQ(2u, sweep.data_files().size());
+    EXPECT_EQ("b.bin", sweep.data_files()[1]);
+    EXPECT_EQ(4u, sweep.size());
+
+    Clustering::ConfigurationParser point(config);
+    for (auto const& option : sweep.point(3)) {
+        point.set_option(option.first, option.second);
+    }
+
+    EXPECT_EQ(16u, point.get_kmeans_configuration().clusters);
+    EXPECT_EQ("three_stage", point.get_kmeans_configuration().pipeline);
+    EXPECT_EQ(4096u, point.get_labeling_configuration().global_size[0]);
+
+    // The base configuration is unchanged
+    EXPECT_EQ(4u, config.get_kmeans_configuration().clusters);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,100 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#include <tuning_table.hpp>
+#include <fused_configuration.hpp>
+
+#include <limits>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+using Clustering::TuningRule;
+using Clustering::TuningTable;
+
+TEST(TuningTable, ParseRule)
+{
+    TuningRule rule = TuningTable::parse_rule(
+            "GeForce_GTX_1080 2-16 8 cluster_merge 32768 32 4");
+
+    EXPECT_EQ("GeForce_GTX_1080", rule.device);
+    EXPECT_EQ(2u, rule.min_features);
+    EXPECT_EQ(16u, rule.max_features);
+    EXPECT_EQ(8u, rule.min_clusters);
+    EXPECT_EQ(8u, rule.max_clusters);
+    EXPECT_EQ("cluster_merge", rule.strategy);
+    EXPECT_EQ(32768u, rule.global_size);
+    EXPECT_EQ(32u, rule.local_size);
+    EXPECT_EQ(4u, rule.vector_length);
+
+    rule = TuningTable::parse_rule("* 17- 1- feature_sum 4096 64 1");
+    EXPECT_EQ(17u, rule.min_features);
+    EXPECT_EQ(std::numeric_limits<size_t>::max(), rule.max_features);
+}
+
+TEST(TuningTable, ParseErrors)
+{
+    EXPECT_THROW(
+            TuningTable::parse_rule("* 2-16 1- cluster_merge 32768 32"),
+            std::invalid_argument);
+    EXPECT_THROW(
+            TuningTable::parse_rule("* 16-2 1- cluster_merge 32768 32 4"),
+            std::invalid_argument);
+    EXPECT_THROW(
+            TuningTable::parse_rule("* a-b 1- cluster_merge 32768 32 4"),
+            std::invalid_argument);
+}
+
+TEST(TuningTable, FirstMatchWins)
+{
+    TuningTable table;
+    table.add("GeForce_GTX_1080 2-16 1- cluster_merge 32768 32 4");
+    table.add("* 1-16 1- feature_sum 16384 64 2");
+    table.add("* 17- 1- feature_sum 8192 128 1");
+
+    TuningRule const* rule = table.find("GeForce GTX 1080", 4, 10);
+    ASSERT_NE(nullptr, rule);
+    EXPECT_EQ("cluster_merge", rule->strategy);
+
+    rule = table.find("Intel(R) Core(TM) i7-6700K CPU", 4, 10);
+    ASSERT_NE(nullptr, rule);
+    EXPECT_EQ(16384u, rule->global_size);
+
+    rule = table.find("GeForce GTX 1080", 1024, 10);
+    ASSERT_NE(nullptr, rule);
+    EXPECT_EQ(128u, rule->local_size);
+}
+
+TEST(TuningTable, Select)
+{
+    TuningTable table;
+    table.add("* 2-16 2-8 cluster_merge 32768 32 4");
+
+    Clustering::FusedConfiguration base;
+    base.strategy = "feature_sum";
+    base.global_size[0] = 1024;
+    base.local_size[0] = 64;
+    base.vector_length = 1;
+
+    auto selected = table.select(base, "Any", 4, 4);
+    EXPECT_EQ("cluster_merge", selected.strategy);
+    EXPECT_EQ(32768u, selected.global_size[0]);
+    EXPECT_EQ(32u, selected.local_size[0]);
+    EXPECT_EQ(4u, selected.vector_length);
+
+    // No match keeps the base configuration
+    auto unchanged = table.select(base, "Any", 4, 100);
+    EXPECT_EQ("feature_sum", unchanged.strategy);
+    EXPECT_EQ(1024u, unchanged.global_size[0]);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
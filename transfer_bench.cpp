@@ -7,6 +7,7 @@
  * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
  */
 
+#include <benchmark_harness.hpp>
 #include <measurement/measurement.hpp>
 #include <simple_buffer_cache.hpp>
 #include <single_device_scheduler.hpp>
@@ -39,6 +40,45 @@ __kernel void zero(__global int * const restrict buffer, uint size)
 }
 )ENDSTR";
 
+// Device memory bandwidth and peak performance for the roofline
+constexpr char peak_source[] =
+R"ENDSTR(
+__kernel void peak_copy(
+        __global float4 const * const restrict src,
+        __global float4 * const restrict dst,
+        uint size)
+{
+    for (uint i = get_global_id(0); i < size; i += get_global_size(0)) {
+        dst[i] = src[i];
+    }
+}
+
+// Four independent chains of mad on float4, i.e. 32 FLOPs per iteration
+__kernel void peak_flops(
+        __global float * const restrict out,
+        float const a,
+        float const b)
+{
+    float4 x = (float4) (get_global_id(0));
+    float4 y = x + 1.0f;
+    float4 z = x + 2.0f;
+    float4 w = x + 3.0f;
+
+    for (uint i = 0; i < PEAK_ITERATIONS; ++i) {
+        x = mad(x, a, b);
+        y = mad(y, a, b);
+        z = mad(z, a, b);
+        w = mad(w, a, b);
+    }
+
+    float4 r = x + y + z + w;
+    out[get_global_id(0)] = r.s0 + r.s1 + r.s2 + r.s3;
+}
+)ENDSTR";
+
+uint32_t const peak_iterations = 4096;
+uint32_t const peak_flops_per_iteration = 32;
+
 class TransferBench {
 public:
     TransferBench(
@@ -93,13 +133,17 @@ public:
         this->destroy_scheduler();
     }
 
-    std::vector<std::tuple<size_t, uint64_t>> transfer_to_device_only(
+    // Statistics of the mean transfer time of each run in nanoseconds
+    std::vector<std::tuple<size_t, Clustering::SampleStatistics>>
+    transfer_to_device_only(
             uint32_t repeat,
-            std::vector<size_t> buffer_sizes
+            std::vector<size_t> buffer_sizes,
+            Clustering::BenchmarkHarness harness
             ) {
 
         uint32_t object_id = 0;
-        std::vector<std::tuple<size_t, uint64_t>> transfer_time;
+        std::vector<std::tuple<size_t, Clustering::SampleStatistics>>
+            transfer_time;
 
         long page_size = ::sysconf(_SC_PAGESIZE);
         assert(page_size != -1);
@@ -155,44 +199,47 @@ public:
                 throw_away += idata[i];
             }
 
-            std::future<std::deque<bc::event>> fevents;
-            Measurement::Measurement measurement;
-
-            object_id = new_scheduler(
-                    bs,
-                    data,
-                    transfer_size
-                    );
+            harness.run([&](bool) {
+                std::future<std::deque<bc::event>> fevents;
+                Measurement::Measurement measurement;
 
-            assert(true ==
-                    scheduler->enqueue(
-                        zero_f,
-                        object_id,
+                object_id = new_scheduler(
                         bs,
-                        fevents,
-                        measurement.add_datapoint()
-                        ));
+                        data,
+                        transfer_size
+                        );
 
-            assert(true ==
-                    scheduler->run());
+                assert(true ==
+                        scheduler->enqueue(
+                            zero_f,
+                            object_id,
+                            bs,
+                            fevents,
+                            measurement.add_datapoint()
+                            ));
 
-            fevents.wait();
-            auto events = fevents.get();
+                assert(true ==
+                        scheduler->run());
 
-            auto times = measurement
-                .get_execution_times_by_name<std::chrono::nanoseconds>(
-                    std::regex("^BufferCache.*")
-                    );
+                fevents.wait();
+                auto events = fevents.get();
 
-            for (auto& tuple : times) {
-                std::string s;
-                uint64_t t;
-                std::tie (s, t) = tuple;
+                auto times = measurement
+                    .get_execution_times_by_name<std::chrono::nanoseconds>(
+                        std::regex("^BufferCache.*")
+                        );
 
-                transfer_time.emplace_back(bs, t);
-            }
+                uint64_t total = 0;
+                for (auto& tuple : times) {
+                    total += std::get<1>(tuple);
+                }
+
+                destroy_scheduler();
+
+                return (times.empty()) ? 0 : total / times.size();
+            });
 
-            destroy_scheduler();
+            transfer_time.emplace_back(bs, harness.statistics());
 
             for (void *map : maps) {
                 assert(0 == ::munmap(map, DATA_SIZE));
@@ -208,6 +255,63 @@ public:
     void transfer_to_device_and_back() {
     }
 
+    // Median time in ns to copy buffer_size bytes between device buffers
+    Clustering::SampleStatistics peak_bandwidth(
+            size_t buffer_size,
+            Clustering::BenchmarkHarness harness
+            ) {
+
+        bc::kernel kernel = peak_program().create_kernel("peak_copy");
+        size_t const num_vectors = buffer_size / sizeof(cl_float4);
+        bc::buffer src(queue_i.get_context(), buffer_size);
+        bc::buffer dst(queue_i.get_context(), buffer_size);
+        kernel.set_args(src, dst, (cl_uint) num_vectors);
+
+        harness.run([&](bool) {
+            bc::event event = queue_i.enqueue_1d_range_kernel(
+                    kernel,
+                    0,
+                    peak_global_size(),
+                    peak_local_size());
+            event.wait();
+            return (uint64_t) event.duration<std::chrono::nanoseconds>()
+                .count();
+        });
+
+        return harness.statistics();
+    }
+
+    // Median time in ns of peak_flops_count() floating point operations
+    Clustering::SampleStatistics peak_performance(
+            Clustering::BenchmarkHarness harness
+            ) {
+
+        bc::kernel kernel = peak_program().create_kernel("peak_flops");
+        bc::buffer out(
+                queue_i.get_context(),
+                peak_global_size() * sizeof(cl_float));
+        kernel.set_args(out, 0.999f, 0.001f);
+
+        harness.run([&](bool) {
+            bc::event event = queue_i.enqueue_1d_range_kernel(
+                    kernel,
+                    0,
+                    peak_global_size(),
+                    peak_local_size());
+            event.wait();
+            return (uint64_t) event.duration<std::chrono::nanoseconds>()
+                .count();
+        });
+
+        return harness.statistics();
+    }
+
+    uint64_t peak_flops_count() {
+        return (uint64_t) peak_global_size()
+            * peak_iterations
+            * peak_flops_per_iteration;
+    }
+
 private:
     uint32_t new_scheduler(size_t buffer_size, void *data_ptr, size_t data_size) {
         scheduler = std::make_shared<Clustering::SingleDeviceScheduler>();
@@ -236,6 +340,25 @@ private:
         return object_id;
     }
 
+    bc::program peak_program() {
+        return bc::program::build_with_source(
+                peak_source,
+                queue_i.get_context(),
+                "-DPEAK_ITERATIONS=" + std::to_string(peak_iterations)
+                );
+    }
+
+    size_t peak_local_size() {
+        return std::min(
+                (size_t) 256,
+                device_i.max_work_group_size());
+    }
+
+    // Enough work groups to fill every compute unit several times
+    size_t peak_global_size() {
+        return device_i.compute_units() * peak_local_size() * 16;
+    }
+
     void destroy_scheduler() {
         scheduler.reset();
         buffer_cache.reset();
@@ -258,7 +381,12 @@ public:
         global_size(1024),
         local_size(64),
         max_buffer_size(256ull << 20),
-        repeat(10)
+        repeat(10),
+        peak(false),
+        runs(1),
+        warmup_runs(0),
+        max_runs(0),
+        ci_width(0.0)
     {
         this->platform = 0;
         this->device = 0;
@@ -277,6 +405,11 @@ public:
             ("device", po::value<uint32_t>(), "OpenCL Device ID")
             ("max-size", po::value<size_t>(), "Maximum transfer buffer size in Megabytes; Default: 256MB")
             ("repeat", po::value<uint32_t>(), "Number of transfers to make; Default: 10")
+            ("peak", "Measure device memory bandwidth and peak performance for the roofline instead")
+            ("runs", po::value<size_t>(), "Minimum number of runs per buffer size; Default: 1")
+            ("warmup", po::value<size_t>(), "Number of discarded warmup runs; Default: 0")
+            ("max-runs", po::value<size_t>(), "Maximum number of runs per buffer size; Default: runs")
+            ("ci-width", po::value<double>(), "Target width of the median's 95% confidence interval relative to the median; Default: 0 (off)")
             // ("global_size", po::value<size_t>(), "Kernel Global Size; Default: 1024")
             // ("local_size", po::value<size_t>(), "Kernel Local Size; Default: 64")
             ;
@@ -311,6 +444,26 @@ public:
             this->repeat = vm["repeat"].as<uint32_t>();
         }
 
+        if (vm.count("peak")) {
+            this->peak = true;
+        }
+
+        if (vm.count("runs")) {
+            this->runs = vm["runs"].as<size_t>();
+        }
+
+        if (vm.count("warmup")) {
+            this->warmup_runs = vm["warmup"].as<size_t>();
+        }
+
+        if (vm.count("max-runs")) {
+            this->max_runs = vm["max-runs"].as<size_t>();
+        }
+
+        if (vm.count("ci-width")) {
+            this->ci_width = vm["ci-width"].as<double>();
+        }
+
         if (vm.count("global_size")) {
             this->global_size = vm["global_size"].as<size_t>();
         }
@@ -328,6 +481,11 @@ public:
     size_t local_size;
     size_t max_buffer_size;
     uint32_t repeat;
+    bool peak;
+    size_t runs;
+    size_t warmup_runs;
+    size_t max_runs;
+    double ci_width;
 };
 
 int main(int argc, char **argv) {
@@ -368,25 +526,71 @@ int main(int argc, char **argv) {
             config.global_size,
             config.local_size
             );
+    Clustering::BenchmarkHarness harness(
+            config.runs,
+            config.warmup_runs,
+            config.max_runs,
+            config.ci_width);
+
+    if (config.peak) {
+        size_t copy_size = std::min(
+                (size_t) config.max_buffer_size,
+                (size_t) device.get_info<cl_ulong>(CL_DEVICE_MAX_MEM_ALLOC_SIZE));
+        auto copy_time = tb.peak_bandwidth(copy_size, harness);
+        auto flops_time = tb.peak_performance(harness);
+
+        // Bytes and FLOPs per nanosecond are GB/s and GFLOP/s
+        double bandwidth = 2.0 * copy_size / copy_time.median;
+        double performance = tb.peak_flops_count() / flops_time.median;
+
+        std::cout << "Copy " << copy_size << " bytes, ";
+        Clustering::BenchmarkHarness::print(std::cout, copy_time, "ns");
+        std::cout << std::endl << "Peak FLOPs, ";
+        Clustering::BenchmarkHarness::print(std::cout, flops_time, "ns");
+        std::cout
+            << std::endl
+            << std::endl
+            << "[benchmark]" << '\n'
+            << "peak_bandwidth = " << bandwidth << '\n'
+            << "peak_performance = " << performance << '\n'
+            << std::flush;
+
+        return 0;
+    }
+
     tb.setup();
-    auto transfer_time = tb.transfer_to_device_only(config.repeat, buffer_sizes);
+    auto transfer_time = tb.transfer_to_device_only(
+            config.repeat,
+            buffer_sizes,
+            harness);
     tb.teardown();
 
     std::cout
         << "Buffer_Size_(bytes)\ttransfer_to_device_(ns)"
+        << "\tp95_(ns)\tCI_low_(ns)\tCI_high_(ns)\tRuns\tOutliers"
         << std::endl
         ;
 
     for (auto& tuple : transfer_time) {
         size_t size;
-        uint64_t nanos;
-        std::tie (size, nanos) = tuple;
+        Clustering::SampleStatistics stats;
+        std::tie (size, stats) = tuple;
 
         std::cout
             << std::setw(10)
             << size
             << '\t'
-            << nanos
+            << stats.median
+            << '\t'
+            << stats.p95
+            << '\t'
+            << stats.median_ci_low
+            << '\t'
+            << stats.median_ci_high
+            << '\t'
+            << stats.count
+            << '\t'
+            << stats.outliers
             << '\n'
             ;
     }
@@ -0,0 +1,141 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef TUNED_STRATEGY_HPP
+#define TUNED_STRATEGY_HPP
+
+#include "tuning_table.hpp"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <boost/compute/core.hpp>
+
+namespace Clustering {
+
+/*
+ * Strategy that is selected from a tuning table on first use
+ *
+ * The data shape is only known when the pipeline runs. The rule matching
+ * the queue's device, num_features and num_clusters is applied to the base
+ * configuration and the resulting strategy is built with create. Pipelines
+ * call prepare before they start timing, so that building is not timed;
+ * calls with a shape that was not prepared build the strategy on first
+ * use. Built strategies are kept for later calls with the same device and
+ * shape. Copies share the built strategies.
+ */
+template <typename Function, typename Config>
+class TunedStrategy {
+public:
+    using CreateFunction = std::function<Function(Config)>;
+
+    TunedStrategy(
+            Config config,
+            TuningTable tuning,
+            CreateFunction create
+            ) :
+        config(config),
+        tuning(tuning),
+        create(create),
+        strategies(std::make_shared<StrategyMap>())
+    {}
+
+    /*
+     * Select and build the strategy for the data shape
+     */
+    Function& prepare(
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_clusters
+            )
+    {
+        std::string device_name = queue.get_device().name();
+        auto key = std::make_tuple(device_name, num_features, num_clusters);
+
+        auto it = strategies->find(key);
+        if (it == strategies->end()) {
+            Config selected = tuning.select(
+                    config,
+                    device_name,
+                    num_features,
+                    num_clusters);
+            it = strategies->emplace(key, create(selected)).first;
+        }
+
+        return it->second;
+    }
+
+    /*
+     * Prepare f if it is a TunedStrategy, otherwise it is already built
+     */
+    static void prepare(
+            Function& f,
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_clusters
+            )
+    {
+        TunedStrategy* tuned = f.template target<TunedStrategy>();
+        if (tuned) {
+            tuned->prepare(queue, num_features, num_clusters);
+        }
+    }
+
+    /*
+     * Call visit with each strategy that f built, or with f itself if it
+     * is not a TunedStrategy
+     */
+    template <typename Visitor>
+    static void for_each(Function& f, Visitor visit) {
+        TunedStrategy* tuned = f.template target<TunedStrategy>();
+        if (tuned) {
+            for (auto& strategy : *tuned->strategies) {
+                visit(strategy.second);
+            }
+        }
+        else {
+            visit(f);
+        }
+    }
+
+    template <typename ... Args>
+    boost::compute::event operator() (
+            boost::compute::command_queue queue,
+            size_t num_features,
+            size_t num_points,
+            size_t num_clusters,
+            Args&& ... args
+            )
+    {
+        return prepare(queue, num_features, num_clusters)(
+                queue,
+                num_features,
+                num_points,
+                num_clusters,
+                std::forward<Args>(args)...);
+    }
+
+private:
+    using StrategyMap = std::map<
+        std::tuple<std::string, size_t, size_t>,
+        Function>;
+
+    Config config;
+    TuningTable tuning;
+    CreateFunction create;
+    std::shared_ptr<StrategyMap> strategies;
+};
+
+}
+
+#endif /* TUNED_STRATEGY_HPP */
@@ -0,0 +1,188 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Copyright (c) 2018, Lutz, Clemens <lutzcle@cml.li>
+ */
+
+#ifndef TUNING_TABLE_HPP
+#define TUNING_TABLE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Clustering {
+
+/*
+ * Kernel configuration for a range of data shapes on a device
+ *
+ * Ranges are inclusive. A device of "*" matches all devices, otherwise the
+ * rule matches all devices whose name contains the device string.
+ * Underscores in the device string match spaces in the device name.
+ */
+struct TuningRule {
+    std::string device;
+    size_t min_features;
+    size_t max_features;
+    size_t min_clusters;
+    size_t max_clusters;
+    std::string strategy;
+    size_t global_size;
+    size_t local_size;
+    size_t vector_length;
+};
+
+/*
+ * Ordered list of tuning rules, the first matching rule wins
+ *
+ * Rules are written in the configuration file as
+ *   tuning = <device> <features> <clusters> <strategy> <global_size>
+ *            <local_size> <vector_length>
+ * where <features> and <clusters> are either a single number or an
+ * inclusive range "min-max", and an open end "min-" matches all larger
+ * values. Example:
+ *   tuning = GTX_1080 2-16 1-64 cluster_merge 32768 32 4
+ *   tuning = * 17- 1- feature_sum 32768 64 1
+ */
+class TuningTable {
+public:
+    void add(TuningRule const& rule) {
+        rules_.push_back(rule);
+    }
+
+    void add(std::string const& rule) {
+        rules_.push_back(parse_rule(rule));
+    }
+
+    bool empty() const {
+        return rules_.empty();
+    }
+
+    size_t size() const {
+        return rules_.size();
+    }
+
+    std::vector<TuningRule> const& rules() const {
+        return rules_;
+    }
+
+    TuningRule const* find(
+            std::string const& device_name,
+            size_t num_features,
+            size_t num_clusters) const
+    {
+        for (auto const& rule : rules_) {
+            if (
+                    match_device(rule.device, device_name)
+                    && num_features >= rule.min_features
+                    && num_features <= rule.max_features
+                    && num_clusters >= rule.min_clusters
+                    && num_clusters <= rule.max_clusters
+               )
+            {
+                return &rule;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /*
+     * Returns config with the first matching rule applied
+     *
+     * config is returned unchanged if no rule matches.
+     */
+    template <typename Config>
+    Config select(
+            Config config,
+            std::string const& device_name,
+            size_t num_features,
+            size_t num_clusters) const
+    {
+        TuningRule const* rule = find(device_name, num_features, num_clusters);
+
+        if (rule) {
+            config.strategy = rule->strategy;
+            config.global_size[0] = rule->global_size;
+            config.local_size[0] = rule->local_size;
+            config.vector_length = rule->vector_length;
+        }
+
+        return config;
+    }
+
+    static TuningRule parse_rule(std::string const& line) {
+        std::istringstream fields(line);
+        std::string features, clusters;
+        TuningRule rule;
+
+        fields
+            >> rule.device
+            >> features
+            >> clusters
+            >> rule.strategy
+            >> rule.global_size
+            >> rule.local_size
+            >> rule.vector_length;
+
+        if (fields.fail()) {
+            throw std::invalid_argument(
+                    "Malformed tuning rule \"" + line + "\"");
+        }
+
+        parse_range(features, rule.min_features, rule.max_features);
+        parse_range(clusters, rule.min_clusters, rule.max_clusters);
+
+        return rule;
+    }
+
+private:
+    static void parse_range(std::string const& range, size_t& min, size_t& max) {
+        size_t dash = range.find('-');
+
+        try {
+            if (dash == std::string::npos) {
+                min = std::stoul(range);
+                max = min;
+            }
+            else {
+                min = std::stoul(range.substr(0, dash));
+                max = (dash + 1 == range.size())
+                    ? std::numeric_limits<size_t>::max()
+                    : std::stoul(range.substr(dash + 1))
+                    ;
+            }
+        }
+        catch (std::logic_error const&) {
+            throw std::invalid_argument(
+                    "Malformed tuning range \"" + range + "\"");
+        }
+
+        if (min > max) {
+            throw std::invalid_argument(
+                    "Empty tuning range \"" + range + "\"");
+        }
+    }
+
+    static bool match_device(std::string device, std::string const& name) {
+        if (device == "*") {
+            return true;
+        }
+
+        std::replace(device.begin(), device.end(), '_', ' ');
+        return name.find(device) != std::string::npos;
+    }
+
+    std::vector<TuningRule> rules_;
+};
+
+}
+
+#endif /* TUNING_TABLE_HPP */